@@ -0,0 +1,575 @@
+//----------------------------------------------------------------------------
+//
+// Batch mode for dumpstk.
+//
+// The debugger engine supports a single session per process, so
+// batch mode runs a pool of child dumpstk processes that each
+// open one dump with their own IDebugClient.  A child writes a
+// single JSON record for its dump, which the parent annotates
+// with the worker and wall-clock time and writes out as one line.
+//
+// Every child is given the same symbol and image paths so
+// symbols downloaded by one worker into the downstream store
+// are found there by all of the others.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include <dbgeng.h>
+
+#include "dumpstk.hpp"
+
+// A child's record is at most a few dozen frames.
+#define MAX_RECORD 65536
+
+struct BatchWorker
+{
+    HANDLE Process;
+    HANDLE Output;
+    ULONG Dump;
+    double Start;
+};
+
+PSTR* g_BatchDumps;
+ULONG g_NumBatchDumps;
+ULONG g_MaxBatchDumps;
+
+CHAR g_SelfPath[MAX_PATH];
+CHAR g_Record[MAX_RECORD + 1];
+
+double
+GetTimerMs(void)
+{
+    static LARGE_INTEGER s_Freq;
+    LARGE_INTEGER Now;
+
+    if (!s_Freq.QuadPart)
+    {
+        QueryPerformanceFrequency(&s_Freq);
+    }
+
+    QueryPerformanceCounter(&Now);
+    return (double)Now.QuadPart * 1000.0 / (double)s_Freq.QuadPart;
+}
+
+void
+OutputJsonString(_In_ FILE* File, _In_ PCSTR String)
+{
+    fputc('"', File);
+
+    while (*String)
+    {
+        UCHAR Ch = (UCHAR)*String++;
+
+        if (Ch == '"' || Ch == '\\')
+        {
+            fputc('\\', File);
+            fputc(Ch, File);
+        }
+        else if (Ch < ' ')
+        {
+            fprintf(File, "\\u%04x", Ch);
+        }
+        else
+        {
+            fputc(Ch, File);
+        }
+    }
+
+    fputc('"', File);
+}
+
+//----------------------------------------------------------------------------
+//
+// Dump list.
+//
+//----------------------------------------------------------------------------
+
+void
+AddBatchDump(_In_ PCSTR File)
+{
+    if (g_NumBatchDumps == g_MaxBatchDumps)
+    {
+        ULONG NewMax = g_MaxBatchDumps ? g_MaxBatchDumps * 2 : 256;
+        PSTR* NewDumps;
+
+        NewDumps = (PSTR*)realloc(g_BatchDumps, NewMax * sizeof(*NewDumps));
+        if (NewDumps == NULL)
+        {
+            Exit(1, "Unable to allocate dump list\n");
+        }
+
+        g_BatchDumps = NewDumps;
+        g_MaxBatchDumps = NewMax;
+    }
+
+    if ((g_BatchDumps[g_NumBatchDumps] = _strdup(File)) == NULL)
+    {
+        Exit(1, "Unable to allocate dump list\n");
+    }
+
+    g_NumBatchDumps++;
+}
+
+void
+FindBatchDumps(void)
+{
+    DWORD Attr;
+
+    if ((Attr = GetFileAttributesA(g_BatchInput)) == INVALID_FILE_ATTRIBUTES)
+    {
+        Exit(1, "Unable to find '%s', %u\n", g_BatchInput, GetLastError());
+    }
+
+    if (Attr & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        CHAR Path[MAX_PATH];
+        WIN32_FIND_DATAA Find;
+        HANDLE FindHandle;
+
+        // Pick up .dmp, .mdmp, .hdmp and so on.
+        if (_snprintf_s(Path, _countof(Path), _TRUNCATE,
+                        "%s\\*.*dmp", g_BatchInput) < 0)
+        {
+            Exit(1, "Directory name too long\n");
+        }
+
+        FindHandle = FindFirstFileA(Path, &Find);
+        if (FindHandle != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                if (Find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    continue;
+                }
+
+                if (_snprintf_s(Path, _countof(Path), _TRUNCATE, "%s\\%s",
+                                g_BatchInput, Find.cFileName) < 0)
+                {
+                    Exit(1, "Dump file name too long\n");
+                }
+
+                AddBatchDump(Path);
+            }
+            while (FindNextFileA(FindHandle, &Find));
+
+            FindClose(FindHandle);
+        }
+    }
+    else
+    {
+        FILE* List;
+        CHAR Line[MAX_PATH + 2];
+
+        // A list file has one dump per line.  Blank lines
+        // and lines starting with '#' are ignored.
+        if (fopen_s(&List, g_BatchInput, "r") != 0)
+        {
+            Exit(1, "Unable to open '%s'\n", g_BatchInput);
+        }
+
+        while (fgets(Line, sizeof(Line), List) != NULL)
+        {
+            PSTR Start = Line;
+            PSTR End = Line + strlen(Line);
+
+            while (*Start == ' ' || *Start == '\t')
+            {
+                Start++;
+            }
+            while (End > Start &&
+                   (End[-1] == '\n' || End[-1] == '\r' ||
+                    End[-1] == ' ' || End[-1] == '\t'))
+            {
+                End--;
+            }
+            *End = 0;
+
+            if (*Start && *Start != '#')
+            {
+                AddBatchDump(Start);
+            }
+        }
+
+        fclose(List);
+    }
+
+    if (!g_NumBatchDumps)
+    {
+        Exit(1, "No dump files found in '%s'\n", g_BatchInput);
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Worker pool.
+//
+//----------------------------------------------------------------------------
+
+void
+AppendArg(_Inout_updates_z_(Chars) PSTR CmdLine,
+          _In_ size_t Chars,
+          _In_ PCSTR Arg,
+          _In_ bool Quote)
+{
+    size_t Used = strlen(CmdLine);
+
+    if (Used + strlen(Arg) + 4 > Chars)
+    {
+        Exit(1, "Command line too long for '%s'\n", Arg);
+    }
+
+    if (Used)
+    {
+        strcat_s(CmdLine, Chars, " ");
+    }
+    if (Quote)
+    {
+        strcat_s(CmdLine, Chars, "\"");
+    }
+    strcat_s(CmdLine, Chars, Arg);
+    if (Quote)
+    {
+        strcat_s(CmdLine, Chars, "\"");
+    }
+}
+
+HRESULT
+StartWorker(_Inout_ BatchWorker* Worker,
+            _In_ ULONG Dump)
+{
+    CHAR CmdLine[4 * MAX_PATH + 1024];
+    STARTUPINFOA StartInfo;
+    PROCESS_INFORMATION ProcInfo;
+    BOOL Created;
+
+    CmdLine[0] = 0;
+    AppendArg(CmdLine, _countof(CmdLine), g_SelfPath, true);
+    AppendArg(CmdLine, _countof(CmdLine), "-json", false);
+    AppendArg(CmdLine, _countof(CmdLine), "-z", false);
+    AppendArg(CmdLine, _countof(CmdLine), g_BatchDumps[Dump], true);
+    if (g_SymbolPath != NULL)
+    {
+        AppendArg(CmdLine, _countof(CmdLine), "-y", false);
+        AppendArg(CmdLine, _countof(CmdLine), g_SymbolPath, true);
+    }
+    if (g_ImagePath != NULL)
+    {
+        AppendArg(CmdLine, _countof(CmdLine), "-i", false);
+        AppendArg(CmdLine, _countof(CmdLine), g_ImagePath, true);
+    }
+
+    // Reuse the worker's record file.
+    SetFilePointer(Worker->Output, 0, NULL, FILE_BEGIN);
+    SetEndOfFile(Worker->Output);
+
+    ZeroMemory(&StartInfo, sizeof(StartInfo));
+    StartInfo.cb = sizeof(StartInfo);
+    StartInfo.dwFlags = STARTF_USESTDHANDLES;
+    StartInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    StartInfo.hStdOutput = Worker->Output;
+    StartInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    // Only this worker's record file should be inherited,
+    // not the files of the other running workers.
+    SetHandleInformation(Worker->Output, HANDLE_FLAG_INHERIT,
+                         HANDLE_FLAG_INHERIT);
+
+    Worker->Start = GetTimerMs();
+    Created = CreateProcessA(NULL, CmdLine, NULL, NULL, TRUE, 0,
+                             NULL, NULL, &StartInfo, &ProcInfo);
+
+    SetHandleInformation(Worker->Output, HANDLE_FLAG_INHERIT, 0);
+
+    if (!Created)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(ProcInfo.hThread);
+    Worker->Process = ProcInfo.hProcess;
+    Worker->Dump = Dump;
+    return S_OK;
+}
+
+void
+WriteErrorRecord(_In_opt_ FILE* Out,
+                 _In_ ULONG Dump,
+                 _In_ ULONG Error,
+                 _In_ ULONG WorkerIndex,
+                 _In_ double WallMs)
+{
+    if (Out == NULL)
+    {
+        return;
+    }
+
+    fputs("{\"dump\":", Out);
+    OutputJsonString(Out, g_BatchDumps[Dump]);
+    fprintf(Out, ",\"status\":\"error\",\"error\":\"0x%X\","
+            "\"worker\":%u,\"wall_ms\":%.1f}\n",
+            Error, WorkerIndex, WallMs);
+    fflush(Out);
+}
+
+bool
+FinishWorker(_Inout_ BatchWorker* Worker,
+             _In_ ULONG WorkerIndex,
+             _In_opt_ FILE* Out)
+{
+    double WallMs = GetTimerMs() - Worker->Start;
+    DWORD ExitCode;
+    DWORD Size;
+    DWORD Done;
+
+    if (!GetExitCodeProcess(Worker->Process, &ExitCode))
+    {
+        ExitCode = GetLastError();
+    }
+
+    CloseHandle(Worker->Process);
+    Worker->Process = NULL;
+
+    //
+    // A successful child leaves exactly one JSON object
+    // in its record file.  Anything else is reported as
+    // a failure with the child's exit code.
+    //
+
+    Size = GetFileSize(Worker->Output, NULL);
+    if (ExitCode != 0 ||
+        Size == 0 ||
+        Size > MAX_RECORD ||
+        SetFilePointer(Worker->Output, 0, NULL,
+                       FILE_BEGIN) == INVALID_SET_FILE_POINTER ||
+        !ReadFile(Worker->Output, g_Record, Size, &Done, NULL) ||
+        Done != Size)
+    {
+        WriteErrorRecord(Out, Worker->Dump,
+                         ExitCode ? ExitCode : E_FAIL,
+                         WorkerIndex, WallMs);
+        return false;
+    }
+
+    while (Done > 0 &&
+           (g_Record[Done - 1] == '\n' || g_Record[Done - 1] == '\r'))
+    {
+        Done--;
+    }
+    if (Done < 2 || g_Record[0] != '{' || g_Record[Done - 1] != '}')
+    {
+        WriteErrorRecord(Out, Worker->Dump, E_FAIL, WorkerIndex, WallMs);
+        return false;
+    }
+
+    if (Out != NULL)
+    {
+        // Splice the parent's fields onto the child's record.
+        g_Record[Done - 1] = 0;
+        fprintf(Out, "%s,\"worker\":%u,\"wall_ms\":%.1f}\n",
+                g_Record, WorkerIndex, WallMs);
+        fflush(Out);
+    }
+
+    return true;
+}
+
+void
+RunBatchPass(_In_ ULONG Workers,
+             _In_opt_ FILE* Out,
+             _Out_ double* Seconds,
+             _Out_ PULONG Failed)
+{
+    BatchWorker Pool[MAXIMUM_WAIT_OBJECTS];
+    HANDLE Waits[MAXIMUM_WAIT_OBJECTS];
+    ULONG WaitWorker[MAXIMUM_WAIT_OBJECTS];
+    CHAR TempDir[MAX_PATH];
+    CHAR TempFile[MAX_PATH];
+    ULONG Next = 0;
+    double Start;
+    HRESULT Status;
+
+    *Failed = 0;
+
+    if (!GetTempPathA(_countof(TempDir), TempDir))
+    {
+        Exit(1, "GetTempPath failed, %u\n", GetLastError());
+    }
+
+    // Children write their records to temporary files rather
+    // than pipes so the parent never has to drain output
+    // while it waits for workers to finish.
+    for (ULONG i = 0; i < Workers; i++)
+    {
+        Pool[i].Process = NULL;
+
+        if (!GetTempFileNameA(TempDir, "dsk", 0, TempFile))
+        {
+            Exit(1, "GetTempFileName failed, %u\n", GetLastError());
+        }
+
+        Pool[i].Output = CreateFileA(TempFile, GENERIC_READ | GENERIC_WRITE,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                     NULL, CREATE_ALWAYS,
+                                     FILE_ATTRIBUTE_TEMPORARY |
+                                     FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (Pool[i].Output == INVALID_HANDLE_VALUE)
+        {
+            Exit(1, "Unable to create '%s', %u\n",
+                 TempFile, GetLastError());
+        }
+    }
+
+    Start = GetTimerMs();
+
+    for (;;)
+    {
+        ULONG Active = 0;
+        DWORD Wait;
+
+        // Keep every idle worker busy.
+        for (ULONG i = 0; i < Workers; i++)
+        {
+            while (Pool[i].Process == NULL &&
+                   Next < g_NumBatchDumps)
+            {
+                if (FAILED(Status = StartWorker(&Pool[i], Next)))
+                {
+                    WriteErrorRecord(Out, Next, Status, i, 0);
+                    (*Failed)++;
+                }
+
+                Next++;
+            }
+
+            if (Pool[i].Process != NULL)
+            {
+                Waits[Active] = Pool[i].Process;
+                WaitWorker[Active] = i;
+                Active++;
+            }
+        }
+
+        if (!Active)
+        {
+            break;
+        }
+
+        Wait = WaitForMultipleObjects(Active, Waits, FALSE, INFINITE);
+        if (Wait >= WAIT_OBJECT_0 + Active)
+        {
+            Exit(1, "WaitForMultipleObjects failed, %u\n", GetLastError());
+        }
+
+        Wait -= WAIT_OBJECT_0;
+        if (!FinishWorker(&Pool[WaitWorker[Wait]], WaitWorker[Wait], Out))
+        {
+            (*Failed)++;
+        }
+    }
+
+    *Seconds = (GetTimerMs() - Start) / 1000.0;
+
+    for (ULONG i = 0; i < Workers; i++)
+    {
+        CloseHandle(Pool[i].Output);
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Batch driver.
+//
+//----------------------------------------------------------------------------
+
+void
+RunBatch(void)
+{
+    ULONG MaxWorkers;
+    double Seconds;
+    ULONG Failed;
+
+    FindBatchDumps();
+
+    if (!GetModuleFileNameA(NULL, g_SelfPath, _countof(g_SelfPath)))
+    {
+        Exit(1, "GetModuleFileName failed, %u\n", GetLastError());
+    }
+
+    MaxWorkers = g_BatchWorkers;
+    if (!MaxWorkers)
+    {
+        SYSTEM_INFO SysInfo;
+
+        GetSystemInfo(&SysInfo);
+        MaxWorkers = SysInfo.dwNumberOfProcessors;
+    }
+    if (MaxWorkers > MAXIMUM_WAIT_OBJECTS)
+    {
+        MaxWorkers = MAXIMUM_WAIT_OBJECTS;
+    }
+    if (MaxWorkers > g_NumBatchDumps)
+    {
+        MaxWorkers = g_NumBatchDumps;
+    }
+
+    if (g_BatchBench)
+    {
+        //
+        // Run the whole batch once to fill the symbol store
+        // so that download time doesn't favor later passes,
+        // then time the batch with 1, 2, 4... workers.
+        //
+
+        printf("%u dumps, warming up with %u workers\n",
+               g_NumBatchDumps, MaxWorkers);
+        RunBatchPass(MaxWorkers, NULL, &Seconds, &Failed);
+
+        printf("\n%8s %10s %12s %8s\n",
+               "Workers", "Seconds", "Dumps/min", "Failed");
+
+        for (ULONG Workers = 1; ; Workers *= 2)
+        {
+            if (Workers > MaxWorkers)
+            {
+                Workers = MaxWorkers;
+            }
+
+            RunBatchPass(Workers, NULL, &Seconds, &Failed);
+            printf("%8u %10.2f %12.1f %8u\n", Workers, Seconds,
+                   Seconds > 0 ? g_NumBatchDumps * 60.0 / Seconds : 0.0,
+                   Failed);
+
+            if (Workers == MaxWorkers)
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        FILE* Out = stdout;
+
+        if (g_BatchOutput != NULL &&
+            fopen_s(&Out, g_BatchOutput, "w") != 0)
+        {
+            Exit(1, "Unable to create '%s'\n", g_BatchOutput);
+        }
+
+        RunBatchPass(MaxWorkers, Out, &Seconds, &Failed);
+
+        if (Out != stdout)
+        {
+            fclose(Out);
+        }
+
+        fprintf(stderr, "%u dumps, %u failed, %.2f s with %u workers, "
+                "%.1f dumps/min\n",
+                g_NumBatchDumps, Failed, Seconds, MaxWorkers,
+                Seconds > 0 ? g_NumBatchDumps * 60.0 / Seconds : 0.0);
+    }
+}
@@ -0,0 +1,33 @@
+//----------------------------------------------------------------------------
+//
+// Definitions shared between the dumpstk driver and its batch mode.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __DUMPSTK_HPP__
+#define __DUMPSTK_HPP__
+
+extern PSTR g_DumpFile;
+extern PSTR g_ImagePath;
+extern PSTR g_SymbolPath;
+
+extern PSTR g_BatchInput;
+extern PSTR g_BatchOutput;
+extern ULONG g_BatchWorkers;
+extern bool g_BatchBench;
+
+void
+Exit(int Code, _In_ _Printf_format_string_ PCSTR Format, ...);
+
+//
+// batch.cpp.
+//
+
+double
+GetTimerMs(void);
+void
+OutputJsonString(_In_ FILE* File, _In_ PCSTR String);
+void
+RunBatch(void);
+
+#endif // #ifndef __DUMPSTK_HPP__
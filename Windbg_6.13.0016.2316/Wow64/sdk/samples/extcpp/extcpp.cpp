@@ -9,6 +9,7 @@
 //----------------------------------------------------------------------------
 
 #include <engextcpp.hpp>
+#include <strsafe.h>
 
 //----------------------------------------------------------------------------
 //
@@ -21,10 +22,24 @@
 //
 //----------------------------------------------------------------------------
 
+struct SweepFields;
+
 class EXT_CLASS : public ExtExtension
 {
 public:
     EXT_COMMAND_METHOD(ummods);
+    EXT_COMMAND_METHOD(readbench);
+    EXT_COMMAND_METHOD(strstress);
+    EXT_COMMAND_METHOD(procsweep);
+
+    double TimeReads(_In_ ULONG64 Offset,
+                     _In_ ULONG Count);
+    ULONG CheckStrings(_In_ ULONG Thread,
+                       _In_ ULONG Count);
+    static DWORD WINAPI StringWorker(_In_ PVOID Param);
+    double TimeSweep(_In_ ExtRemoteListSnapshot& Snapshot,
+                     _In_ SweepFields* Fields,
+                     _In_ ULONG Threads);
 };
 
 // EXT_DECLARE_GLOBALS must be used to instantiate
@@ -114,3 +129,467 @@ EXT_COMMAND(ummods,
         Out("Loader list entry at %p\n", LdrList2.GetNodeOffset());
     }
 }
+
+//----------------------------------------------------------------------------
+//
+// readbench extension command.
+//
+// This command measures how many primitive remote data
+// reads per second the framework can do, first checking
+// for a user interrupt on every read and then with the
+// framework's default rate-limited interrupt polling.
+//
+// Reads mostly hit the framework's read cache so the
+// cost of the interrupt check is not hidden by memory
+// access.
+//
+//----------------------------------------------------------------------------
+
+double
+EXT_CLASS::TimeReads(_In_ ULONG64 Offset,
+                     _In_ ULONG Count)
+{
+    LARGE_INTEGER Freq, Start, End;
+
+    QueryPerformanceFrequency(&Freq);
+    QueryPerformanceCounter(&Start);
+    
+    for (ULONG i = 0; i < Count; i++)
+    {
+        ExtRemoteData Data(Offset + (i & 0xff) * sizeof(ULONG),
+                           sizeof(ULONG));
+        Data.GetUlong();
+    }
+
+    QueryPerformanceCounter(&End);
+
+    double Secs = (double)(End.QuadPart - Start.QuadPart) /
+        (double)Freq.QuadPart;
+    return Secs > 0 ? Count / Secs : 0;
+}
+
+EXT_COMMAND(readbench,
+            "Measure primitive remote data reads per second",
+            "{count;ed,d=100000;count;Number of reads per pass}"
+            "{;e,r;addr;Address of at least 1KB of readable memory}")
+{
+    ULONG64 Offset = GetUnnamedArgU64(0);
+    ULONG Count = (ULONG)GetArgU64("count");
+    ULONG OldOps = m_InterruptPollOps;
+    bool OldCache = IsReadCacheEnabled();
+
+    double Every, Polled;
+
+    EnableReadCache(true);
+
+    try
+    {
+        m_InterruptPollOps = 1;
+        Every = TimeReads(Offset, Count);
+        m_InterruptPollOps = OldOps;
+        Polled = TimeReads(Offset, Count);
+    }
+    catch(...)
+    {
+        m_InterruptPollOps = OldOps;
+        EnableReadCache(OldCache);
+        throw;
+    }
+
+    EnableReadCache(OldCache);
+
+    Out("Interrupt check per read:    %12.0f reads/sec\n", Every);
+    Out("Interrupt check every %5u: %12.0f reads/sec\n",
+        m_InterruptPollOps, Polled);
+}
+
+//----------------------------------------------------------------------------
+//
+// strstress extension command.
+//
+// This command exercises the per-thread string arenas
+// behind PrintCircleString from several threads at once.
+// Each thread formats batches of strings, checks that
+// every string in the batch is still intact and then
+// releases the batch with ResetThreadStrings.  A final
+// pass on the command thread formats far more than an
+// arena holds to show that it wraps instead of growing.
+//
+//----------------------------------------------------------------------------
+
+struct StringWork
+{
+    ULONG Thread;
+    ULONG Count;
+    ULONG Errors;
+};
+
+ULONG
+EXT_CLASS::CheckStrings(_In_ ULONG Thread,
+                        _In_ ULONG Count)
+{
+    static const ULONG s_Batch = 1000;
+    PSTR Strs[s_Batch];
+    char Expect[64];
+    ULONG Errors = 0;
+
+    for (ULONG Done = 0; Done < Count; Done += s_Batch)
+    {
+        ULONG i;
+        
+        for (i = 0; i < s_Batch; i++)
+        {
+            Strs[i] = PrintCircleString("%s-%u-%I64x", "str",
+                                        Thread, (ULONG64)Done + i);
+        }
+        for (i = 0; i < s_Batch; i++)
+        {
+            StringCbPrintfA(Expect, sizeof(Expect), "%s-%u-%I64x",
+                            "str", Thread, (ULONG64)Done + i);
+            if (strcmp(Strs[i], Expect))
+            {
+                Errors++;
+            }
+        }
+
+        ResetThreadStrings();
+    }
+
+    return Errors;
+}
+
+DWORD WINAPI
+EXT_CLASS::StringWorker(_In_ PVOID Param)
+{
+    StringWork* Work = (StringWork*)Param;
+
+    try
+    {
+        Work->Errors = g_ExtInstance.
+            CheckStrings(Work->Thread, Work->Count);
+    }
+    catch(...)
+    {
+        Work->Errors = Work->Count;
+    }
+    return 0;
+}
+
+EXT_COMMAND(strstress,
+            "Stress the per-thread temporary string arenas",
+            "{threads;ed,d=4;threads;Number of worker threads}"
+            "{count;ed,d=100000;count;Strings formatted per thread}")
+{
+    static const ULONG s_MaxThreads = 64;
+    ULONG Threads = (ULONG)GetArgU64("threads");
+    ULONG Count = (ULONG)GetArgU64("count");
+    StringWork Work[s_MaxThreads];
+    HANDLE Handles[s_MaxThreads];
+    ULONG Started = 0;
+    ULONG Errors = 0;
+    ULONG i;
+
+    if (Threads < 1 || Threads > s_MaxThreads)
+    {
+        ThrowInvalidArg("threads must be between 1 and %u", s_MaxThreads);
+    }
+
+    for (i = 0; i < Threads; i++)
+    {
+        Work[i].Thread = i + 1;
+        Work[i].Count = Count;
+        Work[i].Errors = 0;
+        Handles[Started] = CreateThread(NULL, 0, StringWorker,
+                                        &Work[i], 0, NULL);
+        if (!Handles[Started])
+        {
+            break;
+        }
+        Started++;
+    }
+
+    // The command thread takes a share as well.
+    Errors += CheckStrings(0, Count);
+
+    WaitForMultipleObjects(Started, Handles, TRUE, INFINITE);
+    for (i = 0; i < Started; i++)
+    {
+        CloseHandle(Handles[i]);
+        Errors += Work[i].Errors;
+    }
+
+    //
+    // Format over ten megabytes without resetting.
+    // Early strings are recycled but the latest one
+    // must still be intact.
+    //
+
+    PSTR Last = NULL;
+    char Expect[64];
+    
+    for (i = 0; i < 256 * 1024; i++)
+    {
+        Last = PrintCircleString("%s-%u-%I64x%32s", "wrap",
+                                 i, (ULONG64)i, "");
+    }
+    StringCbPrintfA(Expect, sizeof(Expect), "%s-%u-%I64x%32s",
+                    "wrap", i - 1, (ULONG64)(i - 1), "");
+    if (strcmp(Last, Expect))
+    {
+        Errors++;
+    }
+    
+    Out("%u threads, %u strings each, %u errors\n",
+        Started + 1, Count, Errors);
+}
+
+//----------------------------------------------------------------------------
+//
+// procsweep extension command.
+//
+// This command sweeps the kernel process list in the
+// style of !process 0 with ExtRemoteListSnapshot.  The
+// list is captured on the engine thread and each process
+// is then decoded on a worker pool, following pointers
+// through the snapshot's captured memory to the process
+// token, its user SID and the handle table.  Results are
+// printed in list order.
+//
+// With /b the decode is timed with one thread and with
+// the requested number of threads, each from a fresh
+// capture so that both include the rounds that capture
+// the memory the decoders ask for.
+//
+//----------------------------------------------------------------------------
+
+struct SweepFields
+{
+    ULONG UniqueProcessId;
+    ULONG ImageFileName;
+    ULONG ActiveThreads;
+    ULONG Token;
+    ULONG ObjectTable;
+    ULONG TokenSessionId;
+    ULONG TokenUserAndGroups;
+    ULONG HandleCount;
+    ULONG64 FastRefMask;
+    ULONG PtrSize;
+    bool HasActiveThreads;
+    bool HasHandleCount;
+};
+
+struct SweepResult
+{
+    ULONG64 Pid;
+    ULONG Threads;
+    LONG Handles;
+    ULONG SessionId;
+    char Image[16];
+    char User[192];
+};
+
+static ULONG64
+NodePointer(_In_ SweepFields* Fields,
+            _In_ const UCHAR* NodeData,
+            _In_ ULONG Offset)
+{
+    // Sign-extended as ExtRemoteData::GetPtr does.
+    return Fields->PtrSize == 8 ?
+        *(ULONG64 UNALIGNED*)(NodeData + Offset) :
+        (ULONG64)(LONG64)*(LONG UNALIGNED*)(NodeData + Offset);
+}
+
+static HRESULT WINAPI
+DecodeProcess(_In_ ExtRemoteListSnapshot* Snapshot,
+              _In_opt_ PVOID Context,
+              _In_ ULONG Index,
+              _In_ ULONG64 Node,
+              _In_reads_bytes_(NodeBytes) const UCHAR* NodeData,
+              _In_ ULONG NodeBytes,
+              _Out_writes_bytes_(ResultBytes) PVOID Result,
+              _In_ ULONG ResultBytes)
+{
+    SweepFields* Fields = (SweepFields*)Context;
+    SweepResult* Res = (SweepResult*)Result;
+
+    UNREFERENCED_PARAMETER(Index);
+    UNREFERENCED_PARAMETER(Node);
+    UNREFERENCED_PARAMETER(NodeBytes);
+    UNREFERENCED_PARAMETER(ResultBytes);
+
+    //
+    // Fields in the process itself come from the node data,
+    // anything else is read through the snapshot.
+    //
+    
+    Res->Pid = NodePointer(Fields, NodeData, Fields->UniqueProcessId);
+    memcpy(Res->Image, NodeData + Fields->ImageFileName,
+           sizeof(Res->Image) - 1);
+    if (Fields->HasActiveThreads)
+    {
+        Res->Threads = *(ULONG UNALIGNED*)
+            (NodeData + Fields->ActiveThreads);
+    }
+
+    Res->Handles = -1;
+    if (Fields->HasHandleCount)
+    {
+        ULONG64 Table = NodePointer(Fields, NodeData, Fields->ObjectTable);
+        if (Table)
+        {
+            Snapshot->ReadMemory(Table + Fields->HandleCount,
+                                 &Res->Handles, sizeof(Res->Handles));
+        }
+    }
+
+    ULONG64 Token = NodePointer(Fields, NodeData, Fields->Token) &
+        Fields->FastRefMask;
+    if (!Token)
+    {
+        StringCbCopyA(Res->User, sizeof(Res->User), "<no token>");
+        return S_OK;
+    }
+
+    Snapshot->ReadMemory(Token + Fields->TokenSessionId,
+                         &Res->SessionId, sizeof(Res->SessionId));
+
+    //
+    // The user is the first entry of UserAndGroups.  SID
+    // formatting is the kind of per-node work that benefits
+    // from running on the pool.
+    //
+    
+    ULONG64 Groups = Snapshot->ReadPointer(Token +
+                                           Fields->TokenUserAndGroups);
+    ULONG64 SidAddr = Snapshot->ReadPointer(Groups);
+    UCHAR Sid[8 + 15 * sizeof(ULONG)];
+    
+    Snapshot->ReadMemory(SidAddr, Sid, 8);
+    if (Sid[1] > 15)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_SID);
+    }
+    Snapshot->ReadMemory(SidAddr + 8, Sid + 8, Sid[1] * sizeof(ULONG));
+
+    ULONG64 Authority = 0;
+    for (ULONG i = 2; i < 8; i++)
+    {
+        Authority = (Authority << 8) | Sid[i];
+    }
+    
+    StringCbPrintfA(Res->User, sizeof(Res->User), "S-%u-%I64u",
+                    Sid[0], Authority);
+    for (ULONG i = 0; i < Sid[1]; i++)
+    {
+        size_t Used = strlen(Res->User);
+        
+        StringCbPrintfA(Res->User + Used, sizeof(Res->User) - Used,
+                        "-%u", ((ULONG UNALIGNED*)(Sid + 8))[i]);
+    }
+
+    return S_OK;
+}
+
+double
+EXT_CLASS::TimeSweep(_In_ ExtRemoteListSnapshot& Snapshot,
+                     _In_ SweepFields* Fields,
+                     _In_ ULONG Threads)
+{
+    LARGE_INTEGER Freq, Start, End;
+
+    // Start from a fresh capture so that each timing
+    // includes capturing the memory decoders follow.
+    ExtNtOsInformation::CaptureKernelProcessList(Snapshot);
+    
+    QueryPerformanceFrequency(&Freq);
+    QueryPerformanceCounter(&Start);
+    
+    Snapshot.Decode(DecodeProcess, Fields, sizeof(SweepResult), Threads);
+
+    QueryPerformanceCounter(&End);
+    
+    return (double)(End.QuadPart - Start.QuadPart) /
+        (double)Freq.QuadPart;
+}
+
+EXT_COMMAND(procsweep,
+            "Decode every kernel process in parallel",
+            "{t;ed,d=0;threads;Decode threads, zero for one per processor}"
+            "{b;b;;Time one decode thread against the thread count}")
+{
+    ULONG Threads = (ULONG)GetArgU64("t");
+    SweepFields Fields;
+    ExtRemoteListSnapshot Snapshot;
+
+    RequireKernelMode();
+
+    ZeroMemory(&Fields, sizeof(Fields));
+    Fields.UniqueProcessId =
+        ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "UniqueProcessId");
+    Fields.ImageFileName =
+        ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "ImageFileName");
+    Fields.Token =
+        ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "Token");
+    Fields.ObjectTable =
+        ExtRemoteTyped::GetTypeFieldOffset("nt!_EPROCESS", "ObjectTable");
+    Fields.TokenSessionId =
+        ExtRemoteTyped::GetTypeFieldOffset("nt!_TOKEN", "SessionId");
+    Fields.TokenUserAndGroups =
+        ExtRemoteTyped::GetTypeFieldOffset("nt!_TOKEN", "UserAndGroups");
+    // The token reference count lives in the low bits.
+    Fields.FastRefMask = m_PtrSize == 8 ? ~(ULONG64)0xf : ~(ULONG64)7;
+    Fields.PtrSize = m_PtrSize;
+
+    // Not every kernel has these.
+    try
+    {
+        Fields.ActiveThreads = ExtRemoteTyped::
+            GetTypeFieldOffset("nt!_EPROCESS", "ActiveThreads");
+        Fields.HasActiveThreads = true;
+    }
+    catch(ExtException)
+    {
+    }
+    try
+    {
+        Fields.HandleCount = ExtRemoteTyped::
+            GetTypeFieldOffset("nt!_HANDLE_TABLE", "HandleCount");
+        Fields.HasHandleCount = true;
+    }
+    catch(ExtException)
+    {
+    }
+
+    if (HasArg("b"))
+    {
+        double Single = TimeSweep(Snapshot, &Fields, 1);
+        double Multi = TimeSweep(Snapshot, &Fields, Threads);
+
+        Out("%u processes\n", Snapshot.GetCount());
+        Out("1 decode thread:  %10.3f ms\n", Single * 1000);
+        Out("%s decode threads: %10.3f ms  (%.2fx)\n",
+            Threads ? PrintCircleString("%u", Threads) : "All",
+            Multi * 1000, Multi > 0 ? Single / Multi : 0);
+        return;
+    }
+
+    ExtNtOsInformation::CaptureKernelProcessList(Snapshot);
+    Snapshot.Decode(DecodeProcess, &Fields, sizeof(SweepResult), Threads);
+
+    for (ULONG i = 0; i < Snapshot.GetCount(); i++)
+    {
+        SweepResult* Res = (SweepResult*)Snapshot.GetResult(i);
+        HRESULT Status = Snapshot.GetResultStatus(i);
+        
+        if (FAILED(Status))
+        {
+            Out("%p  <unable to decode, %08x>\n",
+                Snapshot.GetNodeOffset(i), Status);
+            continue;
+        }
+        
+        Out("%p %6I64u %4u %6d %2u %-15s %s\n",
+            Snapshot.GetNodeOffset(i), Res->Pid, Res->Threads,
+            Res->Handles, Res->SessionId, Res->Image, Res->User);
+    }
+}
@@ -0,0 +1,238 @@
+//----------------------------------------------------------------------------
+//
+// Minidump format definitions for the portable minidump reader.
+//
+// On Windows the definitions come straight from dbghelp.h.  Elsewhere
+// this header mirrors the subset of dbghelp.h MINIDUMP_* structures
+// that the reader uses, with the same names, layout and 4-byte packing,
+// so that the reader source is the same on every host.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __MDMPCOMPAT_H__
+#define __MDMPCOMPAT_H__
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <dbghelp.h>
+
+#if defined(_MSC_VER) && _MSC_VER < 1800
+#define strtoull _strtoui64
+#endif
+
+#else // #ifdef _WIN32
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+//
+// SAL annotations have no meaning outside of the Microsoft compiler.
+//
+
+#ifndef _In_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _In_reads_(Size)
+#define _In_reads_bytes_(Size)
+#define _Out_writes_(Size)
+#define _Out_writes_bytes_(Size)
+#define _Out_writes_to_(Size, Count)
+#endif
+
+#define __cdecl
+
+//
+// Basic Windows types with their Windows sizes.
+//
+
+typedef uint8_t UCHAR, *PUCHAR;
+typedef uint16_t USHORT;
+typedef uint16_t WCHAR;
+typedef int32_t LONG;
+typedef uint32_t ULONG, *PULONG;
+typedef uint32_t ULONG32, *PULONG32;
+typedef uint32_t DWORD;
+typedef int64_t LONG64;
+typedef uint64_t ULONG64, *PULONG64;
+typedef void* PVOID;
+typedef const char* PCSTR;
+typedef char* PSTR;
+typedef int32_t HRESULT;
+
+#define S_OK            ((HRESULT)0)
+#define S_FALSE         ((HRESULT)1)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+#define E_NOINTERFACE   ((HRESULT)0x80004002)
+
+#define SUCCEEDED(Status) ((HRESULT)(Status) >= 0)
+#define FAILED(Status) ((HRESULT)(Status) < 0)
+
+#define ERROR_FILE_CORRUPT      1392L
+#define ERROR_READ_FAULT        30L
+#define ERROR_ARITHMETIC_OVERFLOW 534L
+
+#define HRESULT_FROM_WIN32(Error) \
+    ((HRESULT)(Error) <= 0 ? (HRESULT)(Error) : \
+     (HRESULT)(((Error) & 0x0000FFFF) | 0x80070000))
+
+#define EXCEPTION_MAXIMUM_PARAMETERS 15
+
+typedef struct tagVS_FIXEDFILEINFO
+{
+    DWORD dwSignature;
+    DWORD dwStrucVersion;
+    DWORD dwFileVersionMS;
+    DWORD dwFileVersionLS;
+    DWORD dwProductVersionMS;
+    DWORD dwProductVersionLS;
+    DWORD dwFileFlagsMask;
+    DWORD dwFileFlags;
+    DWORD dwFileOS;
+    DWORD dwFileType;
+    DWORD dwFileSubtype;
+    DWORD dwFileDateMS;
+    DWORD dwFileDateLS;
+} VS_FIXEDFILEINFO;
+
+//
+// Minidump structures, as in dbghelp.h.  Container
+// structures with trailing variable-length arrays are
+// not mirrored; the reader addresses their elements
+// directly.
+//
+
+#pragma pack(push, 4)
+
+#define MINIDUMP_SIGNATURE (0x504d444d) // 'PMDM'
+#define MINIDUMP_VERSION   (42899)
+typedef DWORD RVA;
+typedef ULONG64 RVA64;
+
+typedef struct _MINIDUMP_LOCATION_DESCRIPTOR {
+    ULONG32 DataSize;
+    RVA Rva;
+} MINIDUMP_LOCATION_DESCRIPTOR;
+
+typedef struct _MINIDUMP_LOCATION_DESCRIPTOR64 {
+    ULONG64 DataSize;
+    RVA64 Rva;
+} MINIDUMP_LOCATION_DESCRIPTOR64;
+
+typedef struct _MINIDUMP_MEMORY_DESCRIPTOR {
+    ULONG64 StartOfMemoryRange;
+    MINIDUMP_LOCATION_DESCRIPTOR Memory;
+} MINIDUMP_MEMORY_DESCRIPTOR, *PMINIDUMP_MEMORY_DESCRIPTOR;
+
+typedef struct _MINIDUMP_MEMORY_DESCRIPTOR64 {
+    ULONG64 StartOfMemoryRange;
+    ULONG64 DataSize;
+} MINIDUMP_MEMORY_DESCRIPTOR64, *PMINIDUMP_MEMORY_DESCRIPTOR64;
+
+typedef struct _MINIDUMP_HEADER {
+    ULONG32 Signature;
+    ULONG32 Version;
+    ULONG32 NumberOfStreams;
+    RVA StreamDirectoryRva;
+    ULONG32 CheckSum;
+    ULONG32 TimeDateStamp;
+    ULONG64 Flags;
+} MINIDUMP_HEADER, *PMINIDUMP_HEADER;
+
+typedef struct _MINIDUMP_DIRECTORY {
+    ULONG32 StreamType;
+    MINIDUMP_LOCATION_DESCRIPTOR Location;
+} MINIDUMP_DIRECTORY, *PMINIDUMP_DIRECTORY;
+
+typedef enum _MINIDUMP_STREAM_TYPE {
+
+    UnusedStream                = 0,
+    ReservedStream0             = 1,
+    ReservedStream1             = 2,
+    ThreadListStream            = 3,
+    ModuleListStream            = 4,
+    MemoryListStream            = 5,
+    ExceptionStream             = 6,
+    SystemInfoStream            = 7,
+    ThreadExListStream          = 8,
+    Memory64ListStream          = 9,
+    CommentStreamA              = 10,
+    CommentStreamW              = 11,
+    HandleDataStream            = 12,
+    FunctionTableStream         = 13,
+    UnloadedModuleListStream    = 14,
+    MiscInfoStream              = 15,
+    MemoryInfoListStream        = 16,
+    ThreadInfoListStream        = 17,
+    HandleOperationListStream   = 18,
+    TokenStream                 = 19,
+    JavaScriptDataStream        = 20,
+
+    LastReservedStream          = 0xffff
+
+} MINIDUMP_STREAM_TYPE;
+
+typedef struct _MINIDUMP_THREAD {
+    ULONG32 ThreadId;
+    ULONG32 SuspendCount;
+    ULONG32 PriorityClass;
+    ULONG32 Priority;
+    ULONG64 Teb;
+    MINIDUMP_MEMORY_DESCRIPTOR Stack;
+    MINIDUMP_LOCATION_DESCRIPTOR ThreadContext;
+} MINIDUMP_THREAD, *PMINIDUMP_THREAD;
+
+typedef struct _MINIDUMP_EXCEPTION  {
+    ULONG32 ExceptionCode;
+    ULONG32 ExceptionFlags;
+    ULONG64 ExceptionRecord;
+    ULONG64 ExceptionAddress;
+    ULONG32 NumberParameters;
+    ULONG32 __unusedAlignment;
+    ULONG64 ExceptionInformation [ EXCEPTION_MAXIMUM_PARAMETERS ];
+} MINIDUMP_EXCEPTION, *PMINIDUMP_EXCEPTION;
+
+typedef struct MINIDUMP_EXCEPTION_STREAM {
+    ULONG32 ThreadId;
+    ULONG32  __alignment;
+    MINIDUMP_EXCEPTION ExceptionRecord;
+    MINIDUMP_LOCATION_DESCRIPTOR ThreadContext;
+} MINIDUMP_EXCEPTION_STREAM, *PMINIDUMP_EXCEPTION_STREAM;
+
+typedef struct _MINIDUMP_MODULE {
+    ULONG64 BaseOfImage;
+    ULONG32 SizeOfImage;
+    ULONG32 CheckSum;
+    ULONG32 TimeDateStamp;
+    RVA ModuleNameRva;
+    VS_FIXEDFILEINFO VersionInfo;
+    MINIDUMP_LOCATION_DESCRIPTOR CvRecord;
+    MINIDUMP_LOCATION_DESCRIPTOR MiscRecord;
+    ULONG64 Reserved0;
+    ULONG64 Reserved1;
+} MINIDUMP_MODULE, *PMINIDUMP_MODULE;
+
+#pragma pack(pop)
+
+#endif // #ifdef _WIN32
+
+//
+// The dbghelp.h sizes are part of the file format so
+// make sure the mirrored definitions agree with them.
+//
+
+typedef char MdmpCheckHeaderSize[sizeof(MINIDUMP_HEADER) == 32 ? 1 : -1];
+typedef char MdmpCheckDirectorySize[sizeof(MINIDUMP_DIRECTORY) == 12 ? 1 : -1];
+typedef char MdmpCheckThreadSize[sizeof(MINIDUMP_THREAD) == 48 ? 1 : -1];
+typedef char MdmpCheckModuleSize[sizeof(MINIDUMP_MODULE) == 108 ? 1 : -1];
+typedef char MdmpCheckMemorySize[sizeof(MINIDUMP_MEMORY_DESCRIPTOR) == 16 ? 1 : -1];
+typedef char MdmpCheckMemory64Size[sizeof(MINIDUMP_MEMORY_DESCRIPTOR64) == 16 ? 1 : -1];
+typedef char MdmpCheckExceptionSize[sizeof(MINIDUMP_EXCEPTION_STREAM) == 168 ? 1 : -1];
+
+#endif // #ifndef __MDMPCOMPAT_H__
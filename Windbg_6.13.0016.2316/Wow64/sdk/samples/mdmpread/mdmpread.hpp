@@ -0,0 +1,216 @@
+//----------------------------------------------------------------------------
+//
+// Portable memory-mapped minidump reader.
+//
+// The reader maps a dump file read-only and hands out views that
+// point directly into the mapping, so even multi-gigabyte full
+// memory dumps are never copied.  Saved memory ranges are indexed
+// when the dump is opened; other streams are only examined the
+// first time they are requested.
+//
+// All views remain valid until the reader is closed.  Everything
+// read from the file is bounds-checked against the file size.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __MDMPREAD_HPP__
+#define __MDMPREAD_HPP__
+
+#include "mdmpcompat.h"
+
+//----------------------------------------------------------------------------
+//
+// A counted view of an array of elements within a mapped dump.
+//
+//----------------------------------------------------------------------------
+
+template<typename _T>
+struct MdmpView
+{
+    const _T* Data;
+    ULONG64 Count;
+
+    const _T& operator[](_In_ ULONG64 Index) const
+    {
+        return Data[Index];
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+// A range of virtual memory saved in the dump, from either
+// the MemoryListStream or the Memory64ListStream.
+//
+//----------------------------------------------------------------------------
+
+struct MdmpMemoryRange
+{
+    ULONG64 Start;
+    ULONG64 Size;
+    ULONG64 FileOffset;
+};
+
+#define MDMP_NO_RANGE 0xffffffff
+
+class MdmpReader
+{
+public:
+    MdmpReader(void);
+    ~MdmpReader(void);
+
+    // Maps the file, checks the header and builds the
+    // memory range index.  Other streams are not
+    // examined until they're needed.
+    HRESULT Open(_In_ PCSTR FileName);
+    void Close(void);
+
+    bool IsOpen(void)
+    {
+        return m_Base != NULL;
+    }
+    ULONG64 GetFileSize(void)
+    {
+        return m_Size;
+    }
+    const MINIDUMP_HEADER* GetHeader(void)
+    {
+        return (const MINIDUMP_HEADER*)m_Base;
+    }
+
+    //
+    // Raw file access.  Returns a pointer to Bytes bytes
+    // at the given file offset or NULL if the range
+    // is not within the file.
+    //
+
+    const UCHAR* GetFileData(_In_ ULONG64 Offset,
+                             _In_ ULONG64 Bytes)
+    {
+        if (Offset > m_Size ||
+            Bytes > m_Size - Offset)
+        {
+            return NULL;
+        }
+
+        return m_Base + Offset;
+    }
+    const UCHAR* GetLocation(_In_ const MINIDUMP_LOCATION_DESCRIPTOR* Location)
+    {
+        return GetFileData(Location->Rva, Location->DataSize);
+    }
+
+    //
+    // Streams.  These return S_FALSE and an empty view
+    // if the dump does not contain the stream.
+    //
+
+    HRESULT GetStream(_In_ ULONG32 StreamType,
+                      _Out_ const UCHAR** Data,
+                      _Out_ PULONG32 Bytes);
+    HRESULT GetThreads(_Out_ MdmpView<MINIDUMP_THREAD>* Threads);
+    HRESULT GetModules(_Out_ MdmpView<MINIDUMP_MODULE>* Modules);
+    HRESULT GetException(_Out_ const MINIDUMP_EXCEPTION_STREAM** Exception);
+    HRESULT GetMemoryList(_Out_ MdmpView<MINIDUMP_MEMORY_DESCRIPTOR>* Ranges);
+    HRESULT GetMemory64List(_Out_ MdmpView<MINIDUMP_MEMORY_DESCRIPTOR64>* Ranges,
+                            _Out_ PULONG64 BaseRva);
+
+    // Returns a view of a MINIDUMP_STRING, Chars is
+    // the number of WCHARs without a terminator.
+    HRESULT GetString(_In_ RVA Rva,
+                      _Out_ const WCHAR** String,
+                      _Out_ PULONG32 Chars);
+
+    //
+    // Virtual memory access.
+    //
+    // All saved ranges from the MemoryListStream and
+    // Memory64ListStream are kept in an index sorted by
+    // start address, so lookups are a binary search over
+    // a flat array of starts.
+    //
+
+    ULONG32 GetNumMemoryRanges(void)
+    {
+        return m_NumRanges;
+    }
+    void GetMemoryRange(_In_ ULONG32 Index,
+                        _Out_ MdmpMemoryRange* Range)
+    {
+        Range->Start = m_RangeStart[Index];
+        Range->Size = m_RangeSize[Index];
+        Range->FileOffset = m_RangeOffset[Index];
+    }
+
+    // Returns the index of the saved range containing
+    // Address or MDMP_NO_RANGE.
+    ULONG32 FindMemoryRangeIndex(_In_ ULONG64 Address);
+    // Resolves many addresses in one call, which is
+    // fastest when the addresses are sorted.
+    // Indices receives range indices or MDMP_NO_RANGE.
+    // Returns the number of addresses that were found.
+    ULONG32 FindMemoryRanges(_In_ ULONG32 Count,
+                             _In_reads_(Count) const ULONG64* Addresses,
+                             _Out_writes_(Count) PULONG32 Indices);
+
+    // Finds the saved range containing Address.  Returns
+    // S_FALSE if the address is not in the dump.
+    HRESULT FindMemoryRange(_In_ ULONG64 Address,
+                            _Out_ MdmpMemoryRange* Range);
+    // Returns a pointer to the dump data for Address along with
+    // the number of contiguous bytes available there, which
+    // may be less than requested.
+    HRESULT GetVirtualView(_In_ ULONG64 Address,
+                           _In_ ULONG64 Bytes,
+                           _Out_ const UCHAR** Data,
+                           _Out_ PULONG64 Avail);
+    // Copies memory that may span several saved ranges.
+    HRESULT ReadVirtual(_In_ ULONG64 Address,
+                        _Out_writes_bytes_(Bytes) PVOID Buffer,
+                        _In_ ULONG32 Bytes,
+                        _Out_opt_ PULONG32 Done);
+
+protected:
+    HRESULT ParseDirectory(void);
+    HRESULT BuildRangeIndex(void);
+    void FreeRangeIndex(void);
+    ULONG32 SearchRanges(_In_ ULONG64 Address,
+                         _In_ ULONG32 Low,
+                         _In_ ULONG32 High);
+    HRESULT GetList(_In_ ULONG32 StreamType,
+                    _In_ ULONG32 HeaderBytes,
+                    _In_ ULONG32 EltBytes,
+                    _Out_ const UCHAR** Elts,
+                    _Out_ PULONG64 Count);
+
+    const UCHAR* m_Base;
+    ULONG64 m_Size;
+
+#ifdef _WIN32
+    HANDLE m_File;
+    HANDLE m_Mapping;
+#else
+    int m_File;
+#endif
+
+    // Directory state, filled in on first use.
+    // Stream types below s_MaxIndexedStream are
+    // indexed directly, others are searched for.
+    static const ULONG32 s_MaxIndexedStream = 32;
+
+    bool m_DirectoryParsed;
+    HRESULT m_DirectoryStatus;
+    const MINIDUMP_DIRECTORY* m_Directory;
+    ULONG32 m_NumStreams;
+    ULONG32 m_StreamIndex[s_MaxIndexedStream];
+
+    // Memory range index, as parallel arrays
+    // sorted by start address.
+    ULONG32 m_NumRanges;
+    PULONG64 m_RangeStart;
+    PULONG64 m_RangeSize;
+    PULONG64 m_RangeOffset;
+    // Last range found, as accesses tend to be clustered.
+    ULONG32 m_LastRange;
+};
+
+#endif // #ifndef __MDMPREAD_HPP__
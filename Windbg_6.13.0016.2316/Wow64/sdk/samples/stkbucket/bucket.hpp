@@ -0,0 +1,97 @@
+//----------------------------------------------------------------------------
+//
+// Stack signature bucketing.
+//
+// Stacks are normalized by dropping every frame that the
+// triage rules ignore, keeping the top meaningful frames as
+// module!symbol without offsets.  The normalized signature is
+// hashed and counted in a hash table that is split into
+// independently locked shards, so many threads can add stacks
+// at once with little contention.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __BUCKET_HPP__
+#define __BUCKET_HPP__
+
+#include "triage.hpp"
+
+#define BUCKET_MAX_FRAMES 32
+#define BUCKET_MAX_SIGNATURE 2048
+
+// Separates frames within a signature.
+#define BUCKET_FRAME_SEPARATOR ' '
+
+struct StackBucket
+{
+    ULONG64 Hash;
+    ULONG64 Count;
+    // Rule of the first meaningful frame or TRIAGE_NO_RULE.
+    ULONG32 FollowUpRule;
+    ULONG32 Frames;
+    PCSTR Signature;
+};
+
+class StackBucketer
+{
+public:
+    StackBucketer(void);
+    ~StackBucketer(void);
+
+    // Rules may be NULL, in which case no frames are
+    // ignored.  TopFrames is the number of meaningful
+    // frames that make up a signature.
+    HRESULT Initialize(_In_opt_ TriageRules* Rules,
+                       _In_ ULONG32 TopFrames);
+    void Clear(void);
+
+    //
+    // Normalizes a stack, given as frame strings with the
+    // top of the stack first, and counts it in its bucket.
+    // May be called from any number of threads at once.
+    //
+    HRESULT AddStack(_In_ ULONG32 NumFrames,
+                     _In_reads_(NumFrames) const PCSTR* Frames,
+                     _In_ ULONG64 Count);
+
+    // Builds the signature for a stack without counting it.
+    // Signature must hold BUCKET_MAX_SIGNATURE characters.
+    ULONG64 GetSignature(_In_ ULONG32 NumFrames,
+                         _In_reads_(NumFrames) const PCSTR* Frames,
+                         _Out_writes_z_(BUCKET_MAX_SIGNATURE) PSTR Signature,
+                         _Out_ PULONG32 SignatureChars,
+                         _Out_ PULONG32 SignatureFrames,
+                         _Out_ PULONG32 FollowUpRule);
+
+    ULONG64 GetNumStacks(void);
+    ULONG32 GetNumBuckets(void);
+
+    //
+    // Returns every bucket sorted by decreasing count.  The
+    // array must be released with free() and the buckets
+    // themselves remain owned by the bucketer.
+    //
+    HRESULT GetRankedBuckets(_Out_ StackBucket*** Buckets,
+                             _Out_ PULONG32 NumBuckets);
+
+protected:
+    struct BucketShard
+    {
+        TRG_LOCK Lock;
+        StackBucket** Table;
+        ULONG32 TableSize;
+        ULONG32 Used;
+        ULONG64 Stacks;
+    };
+
+    HRESULT GrowShard(_Inout_ BucketShard* Shard);
+
+    static const ULONG32 s_NumShards = 64;
+
+    TriageRules* m_Rules;
+    ULONG32 m_TopFrames;
+    bool m_Initialized;
+    BucketShard m_Shards[s_NumShards];
+};
+
+#endif // #ifndef __BUCKET_HPP__
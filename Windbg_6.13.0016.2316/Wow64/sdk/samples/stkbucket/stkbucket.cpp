@@ -0,0 +1,929 @@
+//----------------------------------------------------------------------------
+//
+// Command-line driver for stack signature bucketing.
+//
+// Reads stacks, either the JSON records written by dumpstk -batch
+// or plain text stacks separated by blank lines, buckets them
+// using the triage.ini rules and prints a table of buckets ranked
+// by the number of stacks in each.  Can also generate synthetic
+// stacks to benchmark bucketing throughput, and synthetic frames
+// to compare compiled rule matching with sequential matching.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "bucket.hpp"
+
+struct InputStack
+{
+    ULONG32 FirstFrame;
+    ULONG32 NumFrames;
+};
+
+PCSTR g_RulesFile;
+ULONG32 g_TopFrames = 5;
+ULONG32 g_Threads;
+ULONG32 g_ShowBuckets = 25;
+ULONG64 g_BenchStacks;
+ULONG64 g_MatchFrames;
+PSTR* g_InputFiles;
+int g_NumInputFiles;
+
+PCSTR* g_Frames;
+ULONG32 g_NumFrames;
+ULONG32 g_MaxFrames;
+
+InputStack* g_Stacks;
+ULONG32 g_NumStacks;
+ULONG32 g_MaxStacks;
+
+TriageRules g_Rules;
+StackBucketer g_Bucketer;
+
+void
+Exit(int Code, _In_ PCSTR Format, ...)
+{
+    // Output an error message if given.
+    if (Format != NULL)
+    {
+        va_list Args;
+
+        va_start(Args, Format);
+        vfprintf(stderr, Format, Args);
+        va_end(Args);
+    }
+
+    exit(Code);
+}
+
+// Small deterministic generator so that benchmark
+// runs are repeatable.
+ULONG64
+NextRandom(_Inout_ PULONG64 State)
+{
+    *State = *State * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *State >> 17;
+}
+
+void
+ParseCommandLine(int Argc, _In_reads_(Argc) PSTR* Argv)
+{
+    while (--Argc > 0)
+    {
+        Argv++;
+        if (!strcmp(Argv[0], "-r"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_RulesFile = Argv[0];
+            }
+            else
+            {
+                Exit(1, "-r missing argument\n");
+            }
+        }
+        else if (!strcmp(Argv[0], "-n") ||
+                 !strcmp(Argv[0], "-t") ||
+                 !strcmp(Argv[0], "-top"))
+        {
+            PCSTR Option = Argv[0];
+            ULONG Value;
+
+            Argv++;
+            Argc--;
+            if (Argc <= 0)
+            {
+                Exit(1, "%s missing argument\n", Option);
+            }
+
+            Value = strtoul(Argv[0], NULL, 0);
+            if (!Value)
+            {
+                Exit(1, "%s illegal argument\n", Option);
+            }
+
+            if (Option[1] == 'n')
+            {
+                if (Value > BUCKET_MAX_FRAMES)
+                {
+                    Exit(1, "-n can be at most %u\n", BUCKET_MAX_FRAMES);
+                }
+                g_TopFrames = Value;
+            }
+            else if (Option[2])
+            {
+                g_ShowBuckets = Value;
+            }
+            else
+            {
+                g_Threads = Value;
+            }
+        }
+        else if (!strcmp(Argv[0], "-bench"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_BenchStacks = strtoull(Argv[0], NULL, 0);
+            }
+            if (Argc <= 0 || !g_BenchStacks || g_BenchStacks >= 0x80000000)
+            {
+                Exit(1, "-bench needs a stack count\n");
+            }
+        }
+        else if (!strcmp(Argv[0], "-matchbench"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_MatchFrames = strtoull(Argv[0], NULL, 0);
+            }
+            if (Argc <= 0 || !g_MatchFrames)
+            {
+                Exit(1, "-matchbench needs a frame count\n");
+            }
+        }
+        else if (Argv[0][0] == '-')
+        {
+            Exit(1, "Unknown command line argument '%s'\n", Argv[0]);
+        }
+        else
+        {
+            // Everything after the options is input.
+            g_InputFiles = Argv;
+            g_NumInputFiles = Argc;
+            break;
+        }
+    }
+
+    if (!g_NumInputFiles && !g_BenchStacks && !g_MatchFrames)
+    {
+        Exit(1, "Usage: stkbucket [-r triage.ini] [-n frames] [-t threads] "
+             "[-top buckets] [-bench stacks] [-matchbench frames] "
+             "[stack files...]\n");
+    }
+
+    if (!g_Threads)
+    {
+        g_Threads = TrgGetProcessorCount();
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Input.
+//
+// Frame strings point into the loaded file buffers, which
+// are kept for the life of the process.
+//
+//----------------------------------------------------------------------------
+
+void
+AddFrame(_In_ PCSTR Frame)
+{
+    if (g_NumFrames == g_MaxFrames)
+    {
+        ULONG32 NewMax = g_MaxFrames ? g_MaxFrames * 2 : 65536;
+        PCSTR* NewFrames;
+
+        NewFrames = (PCSTR*)realloc(g_Frames, NewMax * sizeof(*NewFrames));
+        if (NewFrames == NULL)
+        {
+            Exit(1, "Unable to allocate frames\n");
+        }
+
+        g_Frames = NewFrames;
+        g_MaxFrames = NewMax;
+    }
+
+    g_Frames[g_NumFrames++] = Frame;
+}
+
+void
+EndStack(_In_ ULONG32 FirstFrame)
+{
+    if (g_NumFrames == FirstFrame)
+    {
+        return;
+    }
+
+    if (g_NumStacks == g_MaxStacks)
+    {
+        ULONG32 NewMax = g_MaxStacks ? g_MaxStacks * 2 : 4096;
+        InputStack* NewStacks;
+
+        NewStacks = (InputStack*)realloc(g_Stacks, NewMax * sizeof(*NewStacks));
+        if (NewStacks == NULL)
+        {
+            Exit(1, "Unable to allocate stacks\n");
+        }
+
+        g_Stacks = NewStacks;
+        g_MaxStacks = NewMax;
+    }
+
+    g_Stacks[g_NumStacks].FirstFrame = FirstFrame;
+    g_Stacks[g_NumStacks].NumFrames = g_NumFrames - FirstFrame;
+    g_NumStacks++;
+}
+
+PSTR
+LoadFile(_In_ PCSTR FileName)
+{
+    FILE* File;
+    PSTR Buffer;
+    size_t Size = 0;
+    size_t Max = 1 << 20;
+    size_t Read;
+
+    File = fopen(FileName, "rb");
+    if (File == NULL)
+    {
+        Exit(1, "Unable to open '%s'\n", FileName);
+    }
+
+    Buffer = (PSTR)malloc(Max + 1);
+    while (Buffer != NULL &&
+           (Read = fread(Buffer + Size, 1, Max - Size, File)) > 0)
+    {
+        Size += Read;
+        if (Size == Max)
+        {
+            PSTR NewBuffer = (PSTR)realloc(Buffer, Max * 2 + 1);
+
+            if (NewBuffer == NULL)
+            {
+                free(Buffer);
+            }
+            Buffer = NewBuffer;
+            Max *= 2;
+        }
+    }
+
+    fclose(File);
+
+    if (Buffer == NULL)
+    {
+        Exit(1, "Unable to read '%s'\n", FileName);
+    }
+
+    Buffer[Size] = 0;
+    return Buffer;
+}
+
+// Decodes a JSON string in place and returns the character
+// after the closing quote.
+PSTR
+ParseJsonString(_Inout_ PSTR String)
+{
+    PSTR Out = String;
+    PSTR In = String + 1;
+
+    while (*In && *In != '"')
+    {
+        if (*In == '\\' && In[1])
+        {
+            In++;
+            switch (*In)
+            {
+            case 'n':
+                *Out++ = '\n';
+                break;
+            case 't':
+                *Out++ = '\t';
+                break;
+            case 'u':
+                // Frames are ASCII, so anything escaped
+                // this way is replaced.
+                *Out++ = '?';
+                for (int i = 0; i < 4 && In[1]; i++)
+                {
+                    In++;
+                }
+                break;
+            default:
+                *Out++ = *In;
+                break;
+            }
+            In++;
+        }
+        else
+        {
+            *Out++ = *In++;
+        }
+    }
+
+    *Out = 0;
+    return *In ? In + 1 : In;
+}
+
+// Parses one dumpstk -json record.
+void
+ParseJsonStack(_Inout_ PSTR Line)
+{
+    ULONG32 FirstFrame = g_NumFrames;
+    PSTR Scan;
+
+    if (strstr(Line, "\"status\":\"ok\"") == NULL ||
+        (Scan = strstr(Line, "\"frames\":[")) == NULL)
+    {
+        return;
+    }
+
+    while ((Scan = strstr(Scan, "\"sym\":")) != NULL)
+    {
+        Scan += 6;
+        if (*Scan == '"')
+        {
+            PSTR Frame = Scan;
+
+            Scan = ParseJsonString(Scan);
+            AddFrame(Frame);
+        }
+        else
+        {
+            AddFrame("unknown");
+        }
+    }
+
+    EndStack(FirstFrame);
+}
+
+void
+LoadStacks(_In_ PCSTR FileName)
+{
+    PSTR Line = LoadFile(FileName);
+    ULONG32 FirstFrame = g_NumFrames;
+
+    while (*Line)
+    {
+        PSTR End = Line;
+        PSTR Token;
+        PSTR Frame;
+
+        while (*End && *End != '\n')
+        {
+            End++;
+        }
+        if (*End)
+        {
+            *End++ = 0;
+        }
+
+        while (*Line == ' ' || *Line == '\t')
+        {
+            Line++;
+        }
+
+        if (*Line == '{')
+        {
+            EndStack(FirstFrame);
+            ParseJsonStack(Line);
+            FirstFrame = g_NumFrames;
+        }
+        else if (!*Line || *Line == '\r')
+        {
+            // A blank line ends a text stack.
+            EndStack(FirstFrame);
+            FirstFrame = g_NumFrames;
+        }
+        else if (*Line != '#' && strncmp(Line, "Child", 5) != 0)
+        {
+            //
+            // Text stacks may be bare frames or debugger stack
+            // output, so use the first module!symbol token on
+            // the line, or the last token if there is none.
+            //
+
+            Frame = NULL;
+            Token = Line;
+            while (*Token && *Token != '\r')
+            {
+                PSTR TokenEnd = Token;
+
+                while (*TokenEnd && *TokenEnd != ' ' &&
+                       *TokenEnd != '\t' && *TokenEnd != '\r')
+                {
+                    TokenEnd++;
+                }
+
+                Frame = Token;
+                if (memchr(Token, '!', TokenEnd - Token) != NULL)
+                {
+                    break;
+                }
+
+                Token = TokenEnd;
+                while (*Token == ' ' || *Token == '\t')
+                {
+                    Token++;
+                }
+            }
+
+            if (Frame != NULL)
+            {
+                AddFrame(Frame);
+            }
+        }
+
+        Line = End;
+    }
+
+    EndStack(FirstFrame);
+}
+
+//----------------------------------------------------------------------------
+//
+// Synthetic stacks for benchmarking.
+//
+// Each stack has a few frames that triage.ini ignores on top
+// of a run of application frames.  The application frames are
+// drawn from a skewed distribution so that a handful of
+// buckets are hot and there is a long tail.
+//
+//----------------------------------------------------------------------------
+
+PCSTR g_NoiseFrames[] =
+{
+    "nt!KiBugCheckDispatch+0x69",
+    "nt!KeBugCheckEx+0x1d",
+    "nt!_KiTrap0E+0x2d3",
+    "hal!HalpClockInterrupt+0xaa",
+    "app!_chkstk+0x27",
+    "ntdll!_CxxThrowException+0x42",
+    "nt!memcpy+0x33",
+};
+
+void
+GenerateStacks(void)
+{
+    ULONG64 Random = 1;
+    PSTR Names;
+    ULONG32 NumNames = 4096;
+    const ULONG32 NameChars = 48;
+
+    // Build a pool of distinct application frames.
+    Names = (PSTR)malloc(NumNames * NameChars);
+    if (Names == NULL)
+    {
+        Exit(1, "Unable to allocate frame names\n");
+    }
+
+    for (ULONG32 i = 0; i < NumNames; i++)
+    {
+        snprintf(Names + i * NameChars, NameChars, "%s%u!Function%u+0x%x",
+                 (i & 3) ? "lib" : "App", i % 37, i,
+                 (ULONG32)(i * 13 % 0x400));
+    }
+
+    for (ULONG64 i = 0; i < g_BenchStacks; i++)
+    {
+        ULONG32 FirstFrame = g_NumFrames;
+        ULONG32 Noise = (ULONG32)(NextRandom(&Random) % 4);
+        ULONG64 Pick;
+        ULONG32 Base;
+
+        for (ULONG32 j = 0; j < Noise; j++)
+        {
+            AddFrame(g_NoiseFrames[NextRandom(&Random) %
+                                   (sizeof(g_NoiseFrames) /
+                                    sizeof(g_NoiseFrames[0]))]);
+        }
+
+        // Squaring a uniform value skews toward
+        // low bucket numbers.
+        Pick = NextRandom(&Random) % 1024;
+        Base = (ULONG32)(Pick * Pick / 1024) * 4;
+
+        for (ULONG32 j = 0; j < 12; j++)
+        {
+            AddFrame(Names + ((Base + j * 97) % NumNames) * NameChars);
+        }
+
+        EndStack(FirstFrame);
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Bucketing.
+//
+//----------------------------------------------------------------------------
+
+struct BucketWork
+{
+    ULONG32 Threads;
+    HRESULT Status;
+};
+
+void
+BucketThread(_In_ PVOID Context,
+             _In_ ULONG32 Index)
+{
+    BucketWork* Work = (BucketWork*)Context;
+    ULONG32 Start = (ULONG32)((ULONG64)g_NumStacks * Index / Work->Threads);
+    ULONG32 End = (ULONG32)((ULONG64)g_NumStacks * (Index + 1) /
+                            Work->Threads);
+    HRESULT Status;
+
+    for (ULONG32 i = Start; i < End; i++)
+    {
+        if ((Status = g_Bucketer.AddStack(g_Stacks[i].NumFrames,
+                                          &g_Frames[g_Stacks[i].FirstFrame],
+                                          1)) != S_OK)
+        {
+            Work->Status = Status;
+            return;
+        }
+    }
+}
+
+double
+BucketStacks(_In_ ULONG32 Threads)
+{
+    HRESULT Status;
+    BucketWork Work;
+    double Start;
+
+    if ((Status = g_Bucketer.Initialize(g_RulesFile != NULL ?
+                                        &g_Rules : NULL,
+                                        g_TopFrames)) != S_OK)
+    {
+        Exit(1, "Unable to initialize bucketing, 0x%X\n", Status);
+    }
+
+    Work.Threads = Threads;
+    Work.Status = S_OK;
+
+    Start = TrgGetSeconds();
+
+    if ((Status = TrgRunThreads(Threads, BucketThread, &Work)) != S_OK ||
+        (Status = Work.Status) != S_OK)
+    {
+        Exit(1, "Bucketing failed, 0x%X\n", Status);
+    }
+
+    return TrgGetSeconds() - Start;
+}
+
+void
+PrintBuckets(void)
+{
+    HRESULT Status;
+    StackBucket** Buckets;
+    ULONG32 NumBuckets;
+    ULONG64 Total = g_Bucketer.GetNumStacks();
+
+    if ((Status = g_Bucketer.GetRankedBuckets(&Buckets, &NumBuckets)) != S_OK)
+    {
+        Exit(1, "Unable to rank buckets, 0x%X\n", Status);
+    }
+
+    printf("%llu stacks in %u buckets, top %u frames\n\n",
+           (unsigned long long)Total, NumBuckets, g_TopFrames);
+    printf("%5s %10s %7s  %-20s %s\n",
+           "Rank", "Count", "Share", "Follow-up", "Signature");
+
+    for (ULONG32 i = 0; i < NumBuckets && i < g_ShowBuckets; i++)
+    {
+        PCSTR FollowUp = "-";
+
+        if (Buckets[i]->FollowUpRule != TRIAGE_NO_RULE)
+        {
+            FollowUp = g_Rules.GetRule(Buckets[i]->FollowUpRule)->Action;
+        }
+
+        printf("%5u %10llu %6.2f%%  %-20s %s\n", i + 1,
+               (unsigned long long)Buckets[i]->Count,
+               Total ? Buckets[i]->Count * 100.0 / Total : 0.0,
+               FollowUp,
+               Buckets[i]->Signature[0] ?
+               Buckets[i]->Signature : "<no meaningful frames>");
+    }
+
+    free(Buckets);
+}
+
+void
+Benchmark(void)
+{
+    printf("\n%8s %10s %16s %10s\n",
+           "Threads", "Seconds", "Stacks/min", "Buckets");
+
+    for (ULONG32 Threads = 1; ; Threads *= 2)
+    {
+        double Elapsed;
+
+        if (Threads > g_Threads)
+        {
+            Threads = g_Threads;
+        }
+
+        Elapsed = BucketStacks(Threads);
+        if (Elapsed <= 0)
+        {
+            Elapsed = 1e-9;
+        }
+
+        printf("%8u %10.3f %16.0f %10u\n", Threads, Elapsed,
+               g_NumStacks * 60.0 / Elapsed, g_Bucketer.GetNumBuckets());
+
+        if (Threads == g_Threads)
+        {
+            break;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Rule matching benchmark.
+//
+// Matches synthetic frames with both the compiled and the
+// sequential matcher, checks that they agree and reports
+// frames per second for each.  The test is then repeated
+// after adding thousands of extra rules to show how each
+// matcher scales with the size of the rule set.
+//
+//----------------------------------------------------------------------------
+
+#define MATCH_NAME_CHARS 96
+#define MATCH_MAX_POOL (1 << 20)
+#define MATCH_EXTRA_RULES 10000
+#define MATCH_MAX_SEQUENTIAL_LARGE 100000
+
+// Copies a pattern, turning its wildcards into literal
+// text so that the result matches the pattern.
+PSTR
+InstantiatePattern(_Out_ PSTR Out,
+                   _In_ PSTR End,
+                   _In_ PCSTR Pattern)
+{
+    while (*Pattern && Out < End - 4)
+    {
+        if (*Pattern == '*')
+        {
+            memcpy(Out, "Abc", 3);
+            Out += 3;
+        }
+        else if (*Pattern == '?')
+        {
+            *Out++ = 'x';
+        }
+        else
+        {
+            *Out++ = *Pattern;
+        }
+        Pattern++;
+    }
+
+    return Out;
+}
+
+void
+RunMatchPass(_In_ ULONG32 PoolSize,
+             _In_reads_(PoolSize) const TriageFrame* Pool,
+             _In_ ULONG64 SequentialFrames)
+{
+    ULONG32 Mask = PoolSize - 1;
+    ULONG64 Mismatches = 0;
+    double Start;
+    double Compiled;
+    double Sequential;
+
+    Start = TrgGetSeconds();
+    for (ULONG64 i = 0; i < g_MatchFrames; i++)
+    {
+        g_Rules.MatchFrameCompiled(&Pool[i & Mask]);
+    }
+    Compiled = TrgGetSeconds() - Start;
+
+    Start = TrgGetSeconds();
+    for (ULONG64 i = 0; i < SequentialFrames; i++)
+    {
+        g_Rules.MatchFrameSequential(&Pool[i & Mask]);
+    }
+    Sequential = TrgGetSeconds() - Start;
+
+    // Both matchers must pick the same rule.
+    for (ULONG32 i = 0; i < PoolSize && i < SequentialFrames; i++)
+    {
+        if (g_Rules.MatchFrameCompiled(&Pool[i]) !=
+            g_Rules.MatchFrameSequential(&Pool[i]))
+        {
+            Mismatches++;
+        }
+    }
+
+    if (Compiled <= 0)
+    {
+        Compiled = 1e-9;
+    }
+    if (Sequential <= 0)
+    {
+        Sequential = 1e-9;
+    }
+
+    printf("%8u rules: sequential %12.0f frames/s (%llu frames), "
+           "compiled %12.0f frames/s (%llu frames), %.1fx\n",
+           g_Rules.GetNumRules(),
+           SequentialFrames / Sequential,
+           (unsigned long long)SequentialFrames,
+           g_MatchFrames / Compiled,
+           (unsigned long long)g_MatchFrames,
+           (g_MatchFrames / Compiled) / (SequentialFrames / Sequential));
+    if (Mismatches)
+    {
+        printf("%llu frames matched differently\n",
+               (unsigned long long)Mismatches);
+    }
+}
+
+void
+MatchBenchmark(void)
+{
+    HRESULT Status;
+    ULONG64 Random = 1;
+    ULONG32 PoolSize = 1;
+    PSTR Names;
+    TriageFrame* Pool;
+    CHAR Pattern[64];
+    CHAR Action[16];
+
+    // The pool size is a power of two so the
+    // timed loops can simply mask the index.
+    while (PoolSize < g_MatchFrames && PoolSize < MATCH_MAX_POOL)
+    {
+        PoolSize *= 2;
+    }
+
+    Names = (PSTR)malloc((size_t)PoolSize * MATCH_NAME_CHARS);
+    Pool = (TriageFrame*)malloc(PoolSize * sizeof(*Pool));
+    if (Names == NULL || Pool == NULL)
+    {
+        Exit(1, "Unable to allocate frames\n");
+    }
+
+    //
+    // Half of the frames are built from the rules so that
+    // they match, the rest are ordinary application frames
+    // and kernel frames that only the broad rules match.
+    //
+
+    for (ULONG32 i = 0; i < PoolSize; i++)
+    {
+        PSTR Name = Names + (size_t)i * MATCH_NAME_CHARS;
+        PSTR End = Name + MATCH_NAME_CHARS;
+        ULONG32 Kind = (ULONG32)(NextRandom(&Random) % 4);
+
+        if (Kind < 2 && g_Rules.GetNumRules())
+        {
+            const TriageRule* Rule =
+                g_Rules.GetRule((ULONG32)(NextRandom(&Random) %
+                                          g_Rules.GetNumRules()));
+            PSTR Out = InstantiatePattern(Name, End, Rule->Module);
+
+            if (Rule->Symbol != NULL)
+            {
+                *Out++ = '!';
+                Out = InstantiatePattern(Out, End, Rule->Symbol);
+            }
+            snprintf(Out, End - Out, "+0x%x",
+                     (ULONG32)(NextRandom(&Random) % 0x1000));
+        }
+        else if (Kind == 2)
+        {
+            snprintf(Name, MATCH_NAME_CHARS, "nt!Function%u+0x%x",
+                     (ULONG32)(NextRandom(&Random) % 5000),
+                     (ULONG32)(NextRandom(&Random) % 0x1000));
+        }
+        else
+        {
+            snprintf(Name, MATCH_NAME_CHARS, "lib%u!Function%u+0x%x",
+                     (ULONG32)(NextRandom(&Random) % 200),
+                     (ULONG32)(NextRandom(&Random) % 5000),
+                     (ULONG32)(NextRandom(&Random) % 0x1000));
+        }
+
+        TriageParseFrame(Name, &Pool[i]);
+    }
+
+    if ((Status = g_Rules.Compile()) != S_OK)
+    {
+        Exit(1, "Unable to compile rules, 0x%X\n", Status);
+    }
+
+    printf("\nMatching %llu frames from a pool of %u\n\n",
+           (unsigned long long)g_MatchFrames, PoolSize);
+    RunMatchPass(PoolSize, Pool, g_MatchFrames);
+
+    //
+    // Grow the rule set with exact, prefix and wildcard
+    // module rules and time the matchers again.  The
+    // sequential matcher only gets a sample of frames.
+    //
+
+    for (ULONG32 i = 0; i < MATCH_EXTRA_RULES; i++)
+    {
+        switch (i % 3)
+        {
+        case 0:
+            snprintf(Pattern, sizeof(Pattern), "extra%u!Function%u", i, i);
+            break;
+        case 1:
+            snprintf(Pattern, sizeof(Pattern), "extra%u!Handler%u*", i, i);
+            break;
+        default:
+            snprintf(Pattern, sizeof(Pattern), "extra%u*!Dispatch%u", i, i);
+            break;
+        }
+        snprintf(Action, sizeof(Action), "Extra%u", i % 10);
+
+        if ((Status = g_Rules.AddRule(Pattern, Action, 0)) != S_OK)
+        {
+            Exit(1, "Unable to add rule, 0x%X\n", Status);
+        }
+    }
+
+    if ((Status = g_Rules.Compile()) != S_OK)
+    {
+        Exit(1, "Unable to compile rules, 0x%X\n", Status);
+    }
+
+    RunMatchPass(PoolSize, Pool,
+                 g_MatchFrames < MATCH_MAX_SEQUENTIAL_LARGE ?
+                 g_MatchFrames : MATCH_MAX_SEQUENTIAL_LARGE);
+
+    free(Pool);
+    free(Names);
+}
+
+int __cdecl
+main(int Argc, _In_reads_(Argc) PSTR* Argv)
+{
+    HRESULT Status;
+
+    ParseCommandLine(Argc, Argv);
+
+    if (g_RulesFile != NULL &&
+        (Status = g_Rules.Load(g_RulesFile)) != S_OK)
+    {
+        Exit(1, "Unable to load '%s', 0x%X\n", g_RulesFile, Status);
+    }
+
+    if (g_MatchFrames)
+    {
+        MatchBenchmark();
+
+        if (!g_NumInputFiles && !g_BenchStacks)
+        {
+            Exit(0, NULL);
+        }
+
+        // Drop the extra benchmark rules.
+        g_Rules.Clear();
+        if (g_RulesFile != NULL &&
+            (Status = g_Rules.Load(g_RulesFile)) != S_OK)
+        {
+            Exit(1, "Unable to load '%s', 0x%X\n", g_RulesFile, Status);
+        }
+    }
+
+    for (int i = 0; i < g_NumInputFiles; i++)
+    {
+        LoadStacks(g_InputFiles[i]);
+    }
+
+    if (g_BenchStacks)
+    {
+        GenerateStacks();
+    }
+
+    if (!g_NumStacks)
+    {
+        Exit(1, "No stacks found\n");
+    }
+
+    if (g_BenchStacks)
+    {
+        Benchmark();
+    }
+    else
+    {
+        BucketStacks(g_Threads);
+    }
+
+    printf("\n");
+    PrintBuckets();
+
+    Exit(0, NULL);
+    return 0;
+}
@@ -0,0 +1,671 @@
+//----------------------------------------------------------------------------
+//
+// triage.ini follow-up rules.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "triage.hpp"
+
+static inline CHAR
+LowerChar(_In_ CHAR Ch)
+{
+    return (Ch >= 'A' && Ch <= 'Z') ? (CHAR)(Ch - 'A' + 'a') : Ch;
+}
+
+bool
+TriageParseFrame(_In_ PCSTR Text,
+                 _Out_ TriageFrame* Frame)
+{
+    PCSTR Bang;
+    PCSTR End;
+
+    while (*Text == ' ' || *Text == '\t')
+    {
+        Text++;
+    }
+
+    // The frame ends at the first blank, which also drops
+    // any trailing source line information.
+    End = Text;
+    while (*End && *End != ' ' && *End != '\t' &&
+           *End != '\r' && *End != '\n')
+    {
+        End++;
+    }
+
+    Bang = Text;
+    while (Bang < End && *Bang != '!')
+    {
+        Bang++;
+    }
+
+    if (Bang < End)
+    {
+        PCSTR Plus = Bang + 1;
+
+        while (Plus < End && *Plus != '+')
+        {
+            Plus++;
+        }
+
+        Frame->Module = Text;
+        Frame->ModuleChars = (ULONG32)(Bang - Text);
+        Frame->Symbol = Bang + 1;
+        Frame->SymbolChars = (ULONG32)(Plus - (Bang + 1));
+    }
+    else
+    {
+        PCSTR Plus = Text;
+
+        while (Plus < End && *Plus != '+')
+        {
+            Plus++;
+        }
+
+        Frame->Module = Text;
+        Frame->ModuleChars = (ULONG32)(Plus - Text);
+        Frame->Symbol = End;
+        Frame->SymbolChars = 0;
+    }
+
+    return Frame->ModuleChars > 0 || Frame->SymbolChars > 0;
+}
+
+bool
+TriageGlobMatch(_In_ PCSTR Pattern,
+                _In_reads_(Chars) PCSTR Text,
+                _In_ ULONG32 Chars)
+{
+    PCSTR StarPattern = NULL;
+    ULONG32 StarText = 0;
+    ULONG32 Pos = 0;
+
+    //
+    // Greedy match that backtracks only to the most
+    // recent '*', which is sufficient for globs.
+    //
+
+    for (;;)
+    {
+        if (*Pattern == '*')
+        {
+            StarPattern = ++Pattern;
+            StarText = Pos;
+            continue;
+        }
+
+        if (Pos == Chars)
+        {
+            if (!*Pattern)
+            {
+                return true;
+            }
+        }
+        else if (*Pattern &&
+                 (*Pattern == '?' ||
+                  LowerChar(*Pattern) == LowerChar(Text[Pos])))
+        {
+            Pattern++;
+            Pos++;
+            continue;
+        }
+
+        if (StarPattern == NULL || StarText == Chars)
+        {
+            return false;
+        }
+
+        Pattern = StarPattern;
+        Pos = ++StarText;
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// TriageRules.
+//
+//----------------------------------------------------------------------------
+
+TriageRules::TriageRules(void)
+{
+    m_Rules = NULL;
+    m_NumRules = 0;
+    m_MaxRules = 0;
+
+    m_Compiled = false;
+    m_NodeEntries = NULL;
+    m_NumNodes = 0;
+    m_Entries = NULL;
+    m_NumEntries = 0;
+    m_Edges = NULL;
+    m_EdgeShift = 0;
+}
+
+TriageRules::~TriageRules(void)
+{
+    Clear();
+}
+
+void
+TriageRules::Clear(void)
+{
+    FreeCompiled();
+
+    for (ULONG32 i = 0; i < m_NumRules; i++)
+    {
+        // The module string owns the rule's storage.
+        free((PVOID)m_Rules[i].Module);
+    }
+
+    free(m_Rules);
+    m_Rules = NULL;
+    m_NumRules = 0;
+    m_MaxRules = 0;
+}
+
+HRESULT
+TriageRules::AddRule(_In_ PCSTR Pattern,
+                     _In_ PCSTR Action,
+                     _In_ ULONG32 Line)
+{
+    size_t PatternChars = strlen(Pattern);
+    size_t ActionChars = strlen(Action);
+    TriageRule* Rule;
+    PSTR Store;
+    PSTR Bang;
+
+    if (!PatternChars || !ActionChars)
+    {
+        return E_INVALIDARG;
+    }
+
+    FreeCompiled();
+
+    if (m_NumRules == m_MaxRules)
+    {
+        ULONG32 NewMax = m_MaxRules ? m_MaxRules * 2 : 64;
+        TriageRule* NewRules;
+
+        NewRules = (TriageRule*)realloc(m_Rules, NewMax * sizeof(*NewRules));
+        if (NewRules == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        m_Rules = NewRules;
+        m_MaxRules = NewMax;
+    }
+
+    // Module, symbol and action share one allocation.
+    Store = (PSTR)malloc(PatternChars + ActionChars + 2);
+    if (Store == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    memcpy(Store, Pattern, PatternChars + 1);
+    memcpy(Store + PatternChars + 1, Action, ActionChars + 1);
+
+    Rule = &m_Rules[m_NumRules];
+    Rule->Module = Store;
+    Rule->Action = Store + PatternChars + 1;
+    Rule->Line = Line;
+
+    Bang = strchr(Store, '!');
+    if (Bang != NULL)
+    {
+        *Bang = 0;
+        Rule->Symbol = Bang + 1;
+    }
+    else
+    {
+        Rule->Symbol = NULL;
+    }
+
+    //
+    // Specificity is the number of literal characters, with
+    // any rule naming a symbol ranked above module-only rules.
+    //
+
+    Rule->Specificity = 0;
+    for (PCSTR Scan = Pattern; *Scan; Scan++)
+    {
+        if (*Scan != '!' && *Scan != '*' && *Scan != '?')
+        {
+            Rule->Specificity++;
+        }
+    }
+    if (Rule->Symbol != NULL)
+    {
+        Rule->Specificity += 0x10000;
+    }
+
+    Rule->Ignore =
+        (Action[0] == 'i' || Action[0] == 'I') &&
+        (Action[1] == 'g' || Action[1] == 'G') &&
+        (Action[2] == 'n' || Action[2] == 'N') &&
+        (Action[3] == 'o' || Action[3] == 'O') &&
+        (Action[4] == 'r' || Action[4] == 'R') &&
+        (Action[5] == 'e' || Action[5] == 'E') &&
+        !Action[6];
+
+    m_NumRules++;
+    return S_OK;
+}
+
+HRESULT
+TriageRules::Load(_In_ PCSTR FileName)
+{
+    HRESULT Status;
+    FILE* File;
+    CHAR Line[1024];
+    ULONG32 LineNum = 0;
+
+    File = fopen(FileName, "r");
+    if (File == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
+    }
+
+    while (fgets(Line, sizeof(Line), File) != NULL)
+    {
+        PSTR Start = Line;
+        PSTR End;
+        PSTR Equals;
+
+        LineNum++;
+
+        while (*Start == ' ' || *Start == '\t')
+        {
+            Start++;
+        }
+        End = Start + strlen(Start);
+        while (End > Start &&
+               (End[-1] == '\n' || End[-1] == '\r' ||
+                End[-1] == ' ' || End[-1] == '\t'))
+        {
+            End--;
+        }
+        *End = 0;
+
+        if (!*Start || *Start == ';')
+        {
+            continue;
+        }
+
+        Equals = strchr(Start, '=');
+        if (Equals == NULL)
+        {
+            fclose(File);
+            return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+        }
+        *Equals = 0;
+
+        if ((Status = AddRule(Start, Equals + 1, LineNum)) != S_OK)
+        {
+            fclose(File);
+            return Status;
+        }
+    }
+
+    fclose(File);
+    return Compile();
+}
+
+ULONG32
+TriageRules::MatchFrameSequential(_In_ const TriageFrame* Frame)
+{
+    ULONG32 Best = TRIAGE_NO_RULE;
+
+    for (ULONG32 i = 0; i < m_NumRules; i++)
+    {
+        TriageRule* Rule = &m_Rules[i];
+
+        if (!Precedes(i, Best) ||
+            !TriageGlobMatch(Rule->Module, Frame->Module,
+                             Frame->ModuleChars) ||
+            (Rule->Symbol != NULL &&
+             !TriageGlobMatch(Rule->Symbol, Frame->Symbol,
+                              Frame->SymbolChars)))
+        {
+            continue;
+        }
+
+        Best = i;
+    }
+
+    return Best;
+}
+
+//----------------------------------------------------------------------------
+//
+// Compiled matcher.
+//
+//----------------------------------------------------------------------------
+
+#define EDGE_HASH_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+void
+TriageRules::FreeCompiled(void)
+{
+    free(m_NodeEntries);
+    m_NodeEntries = NULL;
+    free(m_Entries);
+    m_Entries = NULL;
+    free(m_Edges);
+    m_Edges = NULL;
+    m_NumNodes = 0;
+    m_NumEntries = 0;
+    m_EdgeShift = 0;
+    m_Compiled = false;
+}
+
+ULONG32
+TriageRules::FindChild(_In_ ULONG32 Node,
+                       _In_ CHAR Ch)
+{
+    ULONG64 Key = ((ULONG64)Node << 8) | (UCHAR)LowerChar(Ch);
+    ULONG32 Mask = (1U << (64 - m_EdgeShift)) - 1;
+    ULONG32 Slot = (ULONG32)((Key * EDGE_HASH_MULTIPLIER) >> m_EdgeShift);
+
+    // Keys are offset by one so that zero marks a free slot.
+    Key++;
+    while (m_Edges[Slot].Key)
+    {
+        if (m_Edges[Slot].Key == Key)
+        {
+            return m_Edges[Slot].Child;
+        }
+
+        Slot = (Slot + 1) & Mask;
+    }
+
+    return TRIAGE_NO_RULE;
+}
+
+ULONG32
+TriageRules::InsertPrefix(_In_ ULONG32 Node,
+                          _In_ PCSTR Pattern,
+                          _Out_ PCSTR* Tail)
+{
+    ULONG32 Mask = (1U << (64 - m_EdgeShift)) - 1;
+
+    while (*Pattern && *Pattern != '*' && *Pattern != '?')
+    {
+        ULONG64 Key = ((ULONG64)Node << 8) | (UCHAR)LowerChar(*Pattern);
+        ULONG32 Slot = (ULONG32)((Key * EDGE_HASH_MULTIPLIER) >> m_EdgeShift);
+
+        Key++;
+        while (m_Edges[Slot].Key && m_Edges[Slot].Key != Key)
+        {
+            Slot = (Slot + 1) & Mask;
+        }
+
+        if (!m_Edges[Slot].Key)
+        {
+            m_Edges[Slot].Key = Key;
+            m_Edges[Slot].Child = m_NumNodes;
+            m_NodeEntries[m_NumNodes++] = TRIAGE_NO_RULE;
+        }
+
+        Node = m_Edges[Slot].Child;
+        Pattern++;
+    }
+
+    *Tail = Pattern;
+    return Node;
+}
+
+ULONG32
+TriageRules::AddEntry(_In_ ULONG32 Node,
+                      _In_ PCSTR Tail,
+                      _In_ ULONG32 Rule)
+{
+    MatchEntry* Entry = &m_Entries[m_NumEntries];
+
+    Entry->Tail = Tail;
+    if (!*Tail)
+    {
+        Entry->Kind = MatchExact;
+    }
+    else if (Tail[0] == '*' && !Tail[1])
+    {
+        Entry->Kind = MatchAny;
+    }
+    else
+    {
+        Entry->Kind = MatchGlob;
+    }
+    Entry->Rule = Rule;
+    Entry->SymbolRoot = TRIAGE_NO_RULE;
+
+    // Entries are appended so each node's list stays
+    // in rule order.
+    Entry->Next = TRIAGE_NO_RULE;
+    if (m_NodeEntries[Node] == TRIAGE_NO_RULE)
+    {
+        m_NodeEntries[Node] = m_NumEntries;
+    }
+    else
+    {
+        ULONG32 Last = m_NodeEntries[Node];
+
+        while (m_Entries[Last].Next != TRIAGE_NO_RULE)
+        {
+            Last = m_Entries[Last].Next;
+        }
+        m_Entries[Last].Next = m_NumEntries;
+    }
+
+    return m_NumEntries++;
+}
+
+HRESULT
+TriageRules::Compile(void)
+{
+    ULONG32 MaxNodes = 1;
+    ULONG32 EdgeSlots;
+
+    FreeCompiled();
+
+    //
+    // Every literal character can add at most one node and
+    // one edge, and each distinct module pattern adds a
+    // symbol root, so the tables are sized once up front.
+    //
+
+    for (ULONG32 i = 0; i < m_NumRules; i++)
+    {
+        MaxNodes += (ULONG32)strlen(m_Rules[i].Module) + 1;
+        if (m_Rules[i].Symbol != NULL)
+        {
+            MaxNodes += (ULONG32)strlen(m_Rules[i].Symbol);
+        }
+    }
+
+    m_EdgeShift = 64 - 4;
+    EdgeSlots = 16;
+    while (EdgeSlots < MaxNodes * 2)
+    {
+        EdgeSlots *= 2;
+        m_EdgeShift--;
+    }
+
+    m_NodeEntries = (PULONG32)malloc(MaxNodes * sizeof(*m_NodeEntries));
+    m_Entries = (MatchEntry*)malloc((m_NumRules * 2 + 1) * sizeof(*m_Entries));
+    m_Edges = (MatchEdge*)calloc(EdgeSlots, sizeof(*m_Edges));
+    if (m_NodeEntries == NULL ||
+        m_Entries == NULL ||
+        m_Edges == NULL)
+    {
+        FreeCompiled();
+        return E_OUTOFMEMORY;
+    }
+
+    // Node zero is the module trie root.
+    m_NodeEntries[0] = TRIAGE_NO_RULE;
+    m_NumNodes = 1;
+
+    for (ULONG32 i = 0; i < m_NumRules; i++)
+    {
+        TriageRule* Rule = &m_Rules[i];
+        ULONG32 Node;
+        ULONG32 Module;
+        PCSTR Tail;
+
+        //
+        // Rules with the same module pattern share one
+        // module entry and so one symbol trie.
+        //
+
+        Node = InsertPrefix(0, Rule->Module, &Tail);
+
+        for (Module = m_NodeEntries[Node];
+             Module != TRIAGE_NO_RULE;
+             Module = m_Entries[Module].Next)
+        {
+            PCSTR Other = m_Entries[Module].Tail;
+            PCSTR Mine = Tail;
+
+            while (*Other && LowerChar(*Other) == LowerChar(*Mine))
+            {
+                Other++;
+                Mine++;
+            }
+            if (!*Other && !*Mine)
+            {
+                break;
+            }
+        }
+
+        if (Module == TRIAGE_NO_RULE)
+        {
+            Module = AddEntry(Node, Tail, TRIAGE_NO_RULE);
+        }
+
+        if (Rule->Symbol == NULL)
+        {
+            if (m_Entries[Module].Rule == TRIAGE_NO_RULE ||
+                Precedes(i, m_Entries[Module].Rule))
+            {
+                m_Entries[Module].Rule = i;
+            }
+            continue;
+        }
+
+        if (m_Entries[Module].SymbolRoot == TRIAGE_NO_RULE)
+        {
+            m_Entries[Module].SymbolRoot = m_NumNodes;
+            m_NodeEntries[m_NumNodes++] = TRIAGE_NO_RULE;
+        }
+
+        Node = InsertPrefix(m_Entries[Module].SymbolRoot,
+                            Rule->Symbol, &Tail);
+        AddEntry(Node, Tail, i);
+    }
+
+    m_Compiled = true;
+    return S_OK;
+}
+
+bool
+TriageRules::MatchTail(_In_ const MatchEntry* Entry,
+                       _In_reads_(Chars) PCSTR Text,
+                       _In_ ULONG32 Chars)
+{
+    switch (Entry->Kind)
+    {
+    case MatchExact:
+        return Chars == 0;
+    case MatchAny:
+        return true;
+    default:
+        return TriageGlobMatch(Entry->Tail, Text, Chars);
+    }
+}
+
+ULONG32
+TriageRules::MatchSymbol(_In_ ULONG32 Root,
+                         _In_ const TriageFrame* Frame,
+                         _In_ ULONG32 Best)
+{
+    ULONG32 Node = Root;
+    ULONG32 Depth = 0;
+
+    for (;;)
+    {
+        for (ULONG32 Index = m_NodeEntries[Node];
+             Index != TRIAGE_NO_RULE;
+             Index = m_Entries[Index].Next)
+        {
+            MatchEntry* Entry = &m_Entries[Index];
+
+            if (Precedes(Entry->Rule, Best) &&
+                MatchTail(Entry, Frame->Symbol + Depth,
+                          Frame->SymbolChars - Depth))
+            {
+                Best = Entry->Rule;
+            }
+        }
+
+        if (Depth == Frame->SymbolChars ||
+            (Node = FindChild(Node, Frame->Symbol[Depth])) == TRIAGE_NO_RULE)
+        {
+            return Best;
+        }
+
+        Depth++;
+    }
+}
+
+ULONG32
+TriageRules::MatchFrameCompiled(_In_ const TriageFrame* Frame)
+{
+    ULONG32 Best = TRIAGE_NO_RULE;
+    ULONG32 Node = 0;
+    ULONG32 Depth = 0;
+
+    //
+    // Walk the module name through the module trie.  Every
+    // node passed is a literal prefix of the module, so only
+    // the entries there need their wildcard tails checked.
+    //
+
+    for (;;)
+    {
+        for (ULONG32 Index = m_NodeEntries[Node];
+             Index != TRIAGE_NO_RULE;
+             Index = m_Entries[Index].Next)
+        {
+            MatchEntry* Entry = &m_Entries[Index];
+
+            if (!MatchTail(Entry, Frame->Module + Depth,
+                           Frame->ModuleChars - Depth))
+            {
+                continue;
+            }
+
+            if (Entry->Rule != TRIAGE_NO_RULE &&
+                Precedes(Entry->Rule, Best))
+            {
+                Best = Entry->Rule;
+            }
+            if (Entry->SymbolRoot != TRIAGE_NO_RULE)
+            {
+                Best = MatchSymbol(Entry->SymbolRoot, Frame, Best);
+            }
+        }
+
+        if (Depth == Frame->ModuleChars ||
+            (Node = FindChild(Node, Frame->Module[Depth])) == TRIAGE_NO_RULE)
+        {
+            return Best;
+        }
+
+        Depth++;
+    }
+}
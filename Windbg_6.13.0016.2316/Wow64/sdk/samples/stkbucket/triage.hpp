@@ -0,0 +1,206 @@
+//----------------------------------------------------------------------------
+//
+// triage.ini follow-up rules.
+//
+// Each line of triage.ini has the form
+//
+//     module!symbol=action
+//
+// where module and symbol may contain '*' and '?' wildcards and
+// the symbol part may be omitted to match a whole module.  An
+// action of "ignore" means that the frame is skipped when
+// looking for the frame responsible for a failure.
+//
+// Rules are matched case-insensitively.  When several rules match
+// a frame the most specific one wins: rules with a symbol beat
+// module-only rules, then the rule with the most non-wildcard
+// characters wins, and remaining ties go to the rule that comes
+// first in the file.  This lets "nt!ExFreePool=Pool_corruption"
+// take precedence over "nt!*=MachineOwner".
+//
+// Matching every frame against every rule in turn gets slow as
+// rule sets grow, so the rules are compiled into a trie keyed by
+// the literal prefix of the module pattern and then by the literal
+// prefix of the symbol pattern.  A lookup walks the frame's module
+// and symbol once and only examines rules whose prefixes match,
+// so its cost does not depend on the number of rules.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __TRIAGE_HPP__
+#define __TRIAGE_HPP__
+
+#include "trgcompat.h"
+
+#define TRIAGE_NO_RULE 0xffffffff
+
+//----------------------------------------------------------------------------
+//
+// A frame split into its module and symbol parts.  The
+// parts point into the caller's string and are not
+// terminated.
+//
+//----------------------------------------------------------------------------
+
+struct TriageFrame
+{
+    PCSTR Module;
+    ULONG32 ModuleChars;
+    PCSTR Symbol;
+    ULONG32 SymbolChars;
+};
+
+// Splits "module!symbol+0x12" into its parts.  Frames
+// without a symbol, such as "module+0x1234", have an
+// empty symbol.  Returns false for an empty frame.
+bool
+TriageParseFrame(_In_ PCSTR Text,
+                 _Out_ TriageFrame* Frame);
+
+// Case-insensitive match of a '*'/'?' pattern against
+// a counted string.
+bool
+TriageGlobMatch(_In_ PCSTR Pattern,
+                _In_reads_(Chars) PCSTR Text,
+                _In_ ULONG32 Chars);
+
+//----------------------------------------------------------------------------
+//
+// Rule set.
+//
+//----------------------------------------------------------------------------
+
+struct TriageRule
+{
+    PCSTR Module;
+    // NULL for module-only rules.
+    PCSTR Symbol;
+    PCSTR Action;
+    ULONG32 Line;
+    // Larger is more specific.
+    ULONG32 Specificity;
+    bool Ignore;
+};
+
+class TriageRules
+{
+public:
+    TriageRules(void);
+    ~TriageRules(void);
+
+    // Adds the rules from a triage.ini-format file and
+    // compiles the rule set.  Lines starting with ';'
+    // are comments.
+    HRESULT Load(_In_ PCSTR FileName);
+    // Adds a single "module!symbol" pattern.  Frames are
+    // matched sequentially until Compile is called again.
+    HRESULT AddRule(_In_ PCSTR Pattern,
+                    _In_ PCSTR Action,
+                    _In_ ULONG32 Line);
+    HRESULT Compile(void);
+    void Clear(void);
+
+    ULONG32 GetNumRules(void)
+    {
+        return m_NumRules;
+    }
+    const TriageRule* GetRule(_In_ ULONG32 Index)
+    {
+        return &m_Rules[Index];
+    }
+
+    // Returns the index of the winning rule for
+    // a frame or TRIAGE_NO_RULE.
+    ULONG32 MatchFrame(_In_ const TriageFrame* Frame)
+    {
+        return m_Compiled ?
+            MatchFrameCompiled(Frame) : MatchFrameSequential(Frame);
+    }
+    // Reference matcher that tries every rule in turn.
+    ULONG32 MatchFrameSequential(_In_ const TriageFrame* Frame);
+    ULONG32 MatchFrameCompiled(_In_ const TriageFrame* Frame);
+
+    bool IsIgnored(_In_ const TriageFrame* Frame)
+    {
+        ULONG32 Rule = MatchFrame(Frame);
+        return Rule != TRIAGE_NO_RULE && m_Rules[Rule].Ignore;
+    }
+
+    // True if rule Index takes precedence over rule Than.
+    bool Precedes(_In_ ULONG32 Index,
+                  _In_ ULONG32 Than)
+    {
+        if (Than == TRIAGE_NO_RULE)
+        {
+            return true;
+        }
+        if (m_Rules[Index].Specificity != m_Rules[Than].Specificity)
+        {
+            return m_Rules[Index].Specificity > m_Rules[Than].Specificity;
+        }
+        return Index < Than;
+    }
+
+protected:
+    //
+    // Compiled matcher.  Trie nodes are numbered and their
+    // edges live in one hash table keyed by node and lowered
+    // character.  Each node lists the entries whose pattern's
+    // literal prefix ends there.  A module entry holds the
+    // module-only rule for its pattern and the root of a
+    // symbol trie; a symbol entry holds a single rule.
+    //
+
+    enum
+    {
+        MatchExact,
+        MatchAny,
+        MatchGlob,
+    };
+
+    struct MatchEntry
+    {
+        // Pattern text after the literal prefix.
+        PCSTR Tail;
+        ULONG32 Kind;
+        ULONG32 Rule;
+        ULONG32 SymbolRoot;
+        ULONG32 Next;
+    };
+
+    struct MatchEdge
+    {
+        ULONG64 Key;
+        ULONG32 Child;
+    };
+
+    void FreeCompiled(void);
+    ULONG32 InsertPrefix(_In_ ULONG32 Node,
+                         _In_ PCSTR Pattern,
+                         _Out_ PCSTR* Tail);
+    ULONG32 AddEntry(_In_ ULONG32 Node,
+                     _In_ PCSTR Tail,
+                     _In_ ULONG32 Rule);
+    ULONG32 FindChild(_In_ ULONG32 Node,
+                      _In_ CHAR Ch);
+    bool MatchTail(_In_ const MatchEntry* Entry,
+                   _In_reads_(Chars) PCSTR Text,
+                   _In_ ULONG32 Chars);
+    ULONG32 MatchSymbol(_In_ ULONG32 Root,
+                        _In_ const TriageFrame* Frame,
+                        _In_ ULONG32 Best);
+
+    TriageRule* m_Rules;
+    ULONG32 m_NumRules;
+    ULONG32 m_MaxRules;
+
+    bool m_Compiled;
+    PULONG32 m_NodeEntries;
+    ULONG32 m_NumNodes;
+    MatchEntry* m_Entries;
+    ULONG32 m_NumEntries;
+    MatchEdge* m_Edges;
+    ULONG32 m_EdgeShift;
+};
+
+#endif // #ifndef __TRIAGE_HPP__
@@ -0,0 +1,151 @@
+//----------------------------------------------------------------------------
+//
+// Precompiled GUID name index.
+//
+// Names interface and provider GUIDs from the triage databases:
+//
+//     interface_map!{<GUID>}=<Name>     (guids.ini)
+//     interface_type!<Name>={<GUID>}    (guids.ini)
+//     <GUID>    <Name>                  (guid.txt)
+//
+// guids.ini also lists the interfaces each module registers as
+// <module>={<GUID>} lines.  Those do not name a GUID and are skipped.
+//
+// The names are kept in an open-addressed table keyed by the full
+// 128-bit GUID, at most half full so that a lookup usually touches
+// a single slot.  As with the pool tag index the table and its
+// strings form one image that can be saved and memory-mapped.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __GUIDINDEX_HPP__
+#define __GUIDINDEX_HPP__
+
+#include "mapfile.hpp"
+
+#define GUID_INDEX_SIGNATURE 0x58444947 // 'GIDX'
+#define GUID_INDEX_VERSION 1
+
+enum
+{
+    GUID_KIND_INTERFACE = 1,
+    GUID_KIND_TYPE,
+    GUID_KIND_PROVIDER,
+};
+
+//
+// Image layout.  All offsets are from the start of the image.
+//
+
+struct GuidIndexHeader
+{
+    ULONG32 Signature;
+    ULONG32 Version;
+    ULONG32 TotalBytes;
+    ULONG32 NumEntries;
+    // Power of two.
+    ULONG32 NumSlots;
+    ULONG32 SlotsOffset;
+    ULONG32 StringsOffset;
+    ULONG32 StringBytes;
+};
+
+struct GuidIndexSlot
+{
+    // The GUID's sixteen bytes as two little-endian halves.
+    ULONG64 Low;
+    ULONG64 High;
+    // Zero for an empty slot.
+    ULONG32 Name;
+    ULONG32 Kind;
+};
+
+// Parses a GUID with or without braces.  Returns the
+// number of characters used or zero if there is no GUID.
+ULONG32
+ParseGuid(_In_ PCSTR Text,
+          _Out_ GUID* Guid);
+
+class GuidIndex
+{
+public:
+    GuidIndex(void);
+    ~GuidIndex(void);
+
+    //
+    // Building.  Files are merged as pool tag files are: within a
+    // file the first name for a GUID wins and later files override
+    // earlier ones.
+    //
+
+    HRESULT AddGuidFile(_In_ PCSTR FileName);
+    HRESULT AddGuid(_In_ const GUID* Guid,
+                    _In_ ULONG32 Kind,
+                    _In_ PCSTR Name);
+    HRESULT Build(void);
+    HRESULT Save(_In_ PCSTR FileName);
+
+    // Maps a saved image.
+    HRESULT Open(_In_ PCSTR FileName);
+    void Close(void);
+
+    bool IsReady(void)
+    {
+        return m_Header != NULL;
+    }
+    ULONG32 GetNumGuids(void)
+    {
+        return m_Header != NULL ? m_Header->NumEntries : 0;
+    }
+    ULONG32 GetImageBytes(void)
+    {
+        return m_Header != NULL ? m_Header->TotalBytes : 0;
+    }
+
+    //
+    // Lookups.  Names are NULL for unknown GUIDs.
+    //
+
+    PCSTR Lookup(_In_ const GUID* Guid,
+                 _Out_opt_ PULONG32 Kind);
+
+    // Looks up an array of GUIDs and returns how many were
+    // found.  The slots for a group of GUIDs are computed
+    // before any is read so the memory reads overlap.
+    ULONG32 LookupGuids(_In_ ULONG32 Count,
+                        _In_reads_(Count) const GUID* Guids,
+                        _Out_writes_(Count) PCSTR* Names);
+
+protected:
+    struct GuidDef
+    {
+        ULONG64 Low;
+        ULONG64 High;
+        ULONG32 Kind;
+        ULONG32 File;
+        PSTR Name;
+    };
+
+    HRESULT AddDef(_In_ ULONG64 Low,
+                   _In_ ULONG64 High,
+                   _In_ ULONG32 Kind,
+                   _In_ PCSTR Name);
+    void FreeDefs(void);
+    HRESULT SetImage(_In_reads_bytes_(Bytes) const UCHAR* Image,
+                     _In_ ULONG64 Bytes);
+
+    // GUIDs added so far, only used while building.
+    GuidDef* m_Defs;
+    ULONG32 m_NumDefs;
+    ULONG32 m_DefSlots;
+    ULONG32 m_CurFile;
+
+    // The current image, either built in memory or mapped.
+    UCHAR* m_Built;
+    MappedFile m_Mapped;
+    const GuidIndexHeader* m_Header;
+    const GuidIndexSlot* m_Slots;
+    PCSTR m_Strings;
+};
+
+#endif // #ifndef __GUIDINDEX_HPP__
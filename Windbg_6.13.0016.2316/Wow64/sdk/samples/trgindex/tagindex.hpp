@@ -0,0 +1,165 @@
+//----------------------------------------------------------------------------
+//
+// Precompiled pool tag index.
+//
+// pooltag.txt lines have the form
+//
+//     <Tag> - <binary> - <Description>
+//
+// where the binary may be omitted and the tag may use '?' for
+// any character and a trailing '*' for any remaining characters.
+// The text files are parsed once into an image that holds a
+// perfect hash of the tags along with their descriptions.
+// The image can be saved next to pooltag.txt and
+// memory-mapped later, so lookups never touch the text.
+//
+// Each wildcard shape becomes a byte mask over the four tag
+// characters.  An entry is keyed by the masked tag plus its mask,
+// and a lookup probes once per distinct mask, most specific
+// first, so exact tags win over wildcard ones.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __TAGINDEX_HPP__
+#define __TAGINDEX_HPP__
+
+#include "mapfile.hpp"
+
+// The high tag bit marks protected pool and
+// is not part of the tag name.
+#define POOL_TAG_PROTECTED 0x80000000
+
+#define TAG_INDEX_SIGNATURE 0x58495450 // 'PTIX'
+#define TAG_INDEX_VERSION 1
+#define TAG_INDEX_MAX_MASKS 16
+
+//
+// Image layout.  All offsets are from the start of the image.
+//
+
+struct TagIndexHeader
+{
+    ULONG32 Signature;
+    ULONG32 Version;
+    ULONG32 TotalBytes;
+    ULONG32 NumEntries;
+    // Power of two.
+    ULONG32 NumSlots;
+    ULONG32 NumBuckets;
+    ULONG32 NumMasks;
+    ULONG32 SeedsOffset;
+    ULONG32 SlotsOffset;
+    ULONG32 StringsOffset;
+    ULONG32 StringBytes;
+    // Most specific mask first.
+    ULONG32 Masks[TAG_INDEX_MAX_MASKS];
+};
+
+struct TagIndexSlot
+{
+    ULONG32 Key;
+    // Zero for an empty slot.
+    ULONG32 Mask;
+    ULONG32 Binary;
+    ULONG32 Description;
+};
+
+class PoolTagIndex
+{
+public:
+    PoolTagIndex(void);
+    ~PoolTagIndex(void);
+
+    //
+    // Building.  Text files are merged in the order they are
+    // added: within a file the first line for a tag wins and
+    // a later file, such as a vendor's local tag list,
+    // overrides tags from earlier files.
+    //
+
+    HRESULT AddTagFile(_In_ PCSTR FileName);
+    HRESULT AddTag(_In_ PCSTR Tag,
+                   _In_ PCSTR Binary,
+                   _In_ PCSTR Description);
+    // Builds the image from the added tags and
+    // makes it the current index.
+    HRESULT Build(void);
+    HRESULT Save(_In_ PCSTR FileName);
+
+    // Maps a saved image.
+    HRESULT Open(_In_ PCSTR FileName);
+    void Close(void);
+
+    bool IsReady(void)
+    {
+        return m_Header != NULL;
+    }
+    ULONG32 GetNumTags(void)
+    {
+        return m_Header != NULL ? m_Header->NumEntries : 0;
+    }
+    ULONG32 GetImageBytes(void)
+    {
+        return m_Header != NULL ? m_Header->TotalBytes : 0;
+    }
+
+    //
+    // Lookups.
+    //
+
+    bool Lookup(_In_ ULONG PoolTag,
+                _Out_ PCSTR* Binary,
+                _Out_ PCSTR* Description);
+
+    // Fills in the same information as kext's
+    // GetPoolTagDescription.
+    HRESULT GetTagDescription(_In_ ULONG PoolTag,
+                              _Out_ PDEBUG_POOLTAG_DESCRIPTION Description);
+
+    // Fills PoolTagDescription for an array of pool records and
+    // returns the number of records whose tag was found.  Runs
+    // of the same tag, common in pool summaries, reuse the
+    // previous description.
+    ULONG32 FillPoolData(_In_ ULONG32 Count,
+                         _Inout_updates_(Count) PDEBUG_POOL_DATA PoolData);
+
+protected:
+    struct TagDef
+    {
+        ULONG32 Key;
+        ULONG32 Mask;
+        ULONG32 File;
+        PSTR Binary;
+        PSTR Description;
+    };
+
+    HRESULT ParseTag(_In_ PCSTR Tag,
+                     _Out_ PULONG32 Key,
+                     _Out_ PULONG32 Mask);
+    HRESULT AddDef(_In_ ULONG32 Key,
+                   _In_ ULONG32 Mask,
+                   _In_ PCSTR Binary,
+                   _In_ PCSTR Description);
+    void FreeDefs(void);
+    HRESULT SetImage(_In_reads_bytes_(Bytes) const UCHAR* Image,
+                     _In_ ULONG64 Bytes);
+    void FreeImage(void);
+    PCSTR GetString(_In_ ULONG32 Offset);
+
+    // Tags added so far, in a simple open-addressed table
+    // that is only used while building.
+    TagDef* m_Defs;
+    ULONG32 m_NumDefs;
+    ULONG32 m_DefSlots;
+    ULONG32 m_CurFile;
+
+    // The current image, either built in memory or mapped.
+    UCHAR* m_Built;
+    MappedFile m_Mapped;
+    const TagIndexHeader* m_Header;
+    const ULONG32* m_Seeds;
+    const TagIndexSlot* m_Slots;
+    PCSTR m_Strings;
+};
+
+#endif // #ifndef __TAGINDEX_HPP__
@@ -18,6 +18,20 @@
 
 #define IsSpace(_Char) isspace((UCHAR)(_Char))
 
+// Older compilers have no va_copy, but there va_list
+// is a simple pointer that can be assigned.
+#ifndef va_copy
+#define va_copy(_Dst, _Src) ((_Dst) = (_Src))
+#endif
+
+// Symbol tags from cvconst.h, which is not always available.
+enum
+{
+    ExtSymTagUDT = 11,
+    ExtSymTagPointerType = 14,
+    ExtSymTagArrayType = 15,
+};
+
 PEXT_DLL_MAIN g_ExtDllMain;
 
 WINDBG_EXTENSION_APIS64 ExtensionApis;
@@ -188,6 +202,7 @@ ExtCommandDesc::ExtCommandDesc(_In_ PCSTR Name,
                                _In_opt_ PCSTR Args)
 {
     m_Name = Name;
+    m_NameHash = HashName(Name);
     m_Method = Method;
     m_Desc = Desc;
     m_ArgDescStr = Args;
@@ -195,31 +210,13 @@ ExtCommandDesc::ExtCommandDesc(_In_ PCSTR Name,
     ClearArgs();
 
     //
-    // Add into command list sorted by name.
+    // Push onto the command list.  Sorting every insertion
+    // is quadratic for extensions with many commands so
+    // the list is sorted once when it is transferred.
     //
 
-    ExtCommandDesc* Cur, *Prev;
-
-    Prev = NULL;
-    for (Cur = s_Commands; Cur; Cur = Cur->m_Next)
-    {
-        if (strcmp(Name, Cur->m_Name) < 0)
-        {
-            break;
-        }
-
-        Prev = Cur;
-    }
-
-    if (Prev)
-    {
-        Prev->m_Next = this;
-    }
-    else
-    {
-        s_Commands = this;
-    }
-    m_Next = Cur;
+    m_Next = s_Commands;
+    s_Commands = this;
 
     if (strlen(Name) > s_LongestCommandName)
     {
@@ -245,6 +242,7 @@ ExtCommandDesc::ClearArgs(void)
     m_NumArgs = 0;
     m_NumUnnamedArgs = 0;
     m_Args = NULL;
+    ZeroMemory(m_ArgTable, sizeof(m_ArgTable));
 }
 
 void WINAPI
@@ -793,6 +791,30 @@ ExtCommandDesc::ParseArgDesc(void)
         }
         memcpy(m_Args, Args, m_NumArgs * sizeof(m_Args[0]));
     }
+
+    //
+    // Index the named arguments so that lookups by
+    // name don't have to compare against every argument.
+    // Earlier arguments are inserted first so they win
+    // for duplicate names, as with a linear search.
+    //
+    
+    for (ULONG i = 0; i < m_NumArgs; i++)
+    {
+        if (!m_Args[i].Name)
+        {
+            continue;
+        }
+
+        m_Args[i].NameHash = HashName(m_Args[i].Name);
+        
+        ULONG Slot = m_Args[i].NameHash & (s_ArgTableSize - 1);
+        while (m_ArgTable[Slot])
+        {
+            Slot = (Slot + 1) & (s_ArgTableSize - 1);
+        }
+        m_ArgTable[Slot] = (UCHAR)(i + 1);
+    }
     
     m_ArgsInitialized = true;
 }
@@ -819,14 +841,19 @@ ExtCommandDesc::ExInitialize(_In_ ExtExtension* Ext)
 ExtCommandDesc::ArgDesc* WINAPI
 ExtCommandDesc::FindArg(_In_ PCSTR Name)
 {
-    ArgDesc* Check = m_Args;
-    for (ULONG i = 0; i < m_NumArgs; i++, Check++)
+    ULONG Hash = HashName(Name);
+    ULONG Slot = Hash & (s_ArgTableSize - 1);
+    
+    while (m_ArgTable[Slot])
     {
-        if (Check->Name &&
+        ArgDesc* Check = &m_Args[m_ArgTable[Slot] - 1];
+        
+        if (Check->NameHash == Hash &&
             !strcmp(Name, Check->Name))
         {
             return Check;
         }
+        Slot = (Slot + 1) & (s_ArgTableSize - 1);
     }
     return NULL;
 }
@@ -846,12 +873,86 @@ ExtCommandDesc::FindUnnamedArg(_In_ ULONG Index)
     return NULL;
 }
 
+ULONG WINAPI
+ExtCommandDesc::HashName(_In_ PCSTR Name)
+{
+    // FNV-1a.
+    ULONG Hash = 2166136261;
+    
+    while (*Name)
+    {
+        Hash = (Hash ^ (UCHAR)*Name++) * 16777619;
+    }
+    return Hash;
+}
+
+// Stable merge sort of a command list by name.
+static ExtCommandDesc*
+SortCommandList(_In_opt_ ExtCommandDesc* List,
+                _In_ ULONG Count)
+{
+    if (Count < 2)
+    {
+        if (List)
+        {
+            List->m_Next = NULL;
+        }
+        return List;
+    }
+
+    ULONG FirstCount = Count / 2;
+    ExtCommandDesc* Second = List;
+
+    for (ULONG i = 0; i < FirstCount; i++)
+    {
+        Second = Second->m_Next;
+    }
+
+    ExtCommandDesc* First = SortCommandList(List, FirstCount);
+    Second = SortCommandList(Second, Count - FirstCount);
+
+    ExtCommandDesc* Head = NULL;
+    ExtCommandDesc** Tail = &Head;
+    
+    while (First && Second)
+    {
+        if (strcmp(Second->m_Name, First->m_Name) < 0)
+        {
+            *Tail = Second;
+            Second = Second->m_Next;
+        }
+        else
+        {
+            *Tail = First;
+            First = First->m_Next;
+        }
+        Tail = &(*Tail)->m_Next;
+    }
+    *Tail = First ? First : Second;
+
+    return Head;
+}
+
 void WINAPI
 ExtCommandDesc::Transfer(_Out_ ExtCommandDesc** Commands,
                          _Out_ PULONG LongestName)
 {
-    *Commands = s_Commands;
-    s_Commands = NULL;
+    ExtCommandDesc* Ordered = NULL;
+    ULONG Count = 0;
+
+    // Descs were pushed in reverse registration order, so
+    // put them back before the stable sort so that same-named
+    // descs keep the order they had when sorted on insertion.
+    while (s_Commands)
+    {
+        ExtCommandDesc* Desc = s_Commands;
+        s_Commands = Desc->m_Next;
+        Desc->m_Next = Ordered;
+        Ordered = Desc;
+        Count++;
+    }
+
+    *Commands = SortCommandList(Ordered, Count);
     *LongestName = ExtCommandDesc::s_LongestCommandName;
     s_LongestCommandName = 0;
 }
@@ -863,9 +964,9 @@ ExtCommandDesc::Transfer(_Out_ ExtCommandDesc** Commands,
 //----------------------------------------------------------------------------
 
 HMODULE ExtExtension::s_Module;
-char ExtExtension::s_String[2000];
-char ExtExtension::s_CircleStringBuffer[2000];
-char* ExtExtension::s_CircleString = s_CircleStringBuffer;
+DWORD ExtExtension::s_StringTls = TLS_OUT_OF_INDEXES;
+ExtExtension::StringArena* ExtExtension::s_StringArenas;
+CRITICAL_SECTION ExtExtension::s_StringLock;
 
 WINAPI
 ExtExtension::ExtExtension(void)
@@ -903,6 +1004,9 @@ ExtExtension::ExtExtension(void)
 
     m_KnownStructs = NULL;
     m_ProvidedValues = NULL;
+    m_FastLiteralArgs = true;
+    m_InterruptPollOps = 256;
+    m_InterruptPollMs = 50;
     
     m_ExInitialized = false;
     m_OutMask = DEBUG_OUTPUT_NORMAL;
@@ -910,8 +1014,23 @@ ExtExtension::ExtExtension(void)
     m_LeftIndent = 0;
     m_AllowWrap = true;
     m_TestWrap = 0;
+    m_OutWrapBufferChars = 0;
+    m_OutWrapDml = false;
+    m_OutWrapBufferMask = 0;
+    m_OutWrapBufferDml = false;
 
+    m_LiteralRadix = DEBUG_ANY_ID;
+    m_LiteralSyntax = DEBUG_ANY_ID;
     m_CurCommand = NULL;
+    m_Commands = NULL;
+    m_LongestCommandName = 0;
+    m_CommandTable = NULL;
+    m_CommandTableMask = 0;
+    m_InterruptPollCountdown = 0;
+    m_InterruptPollTick = 0;
+    m_KnownStructTable = NULL;
+    m_KnownStructTableMask = 0;
+    m_KnownStructTableSource = NULL;
     
     m_AppendBuffer = NULL;
     m_AppendBufferChars = 0;
@@ -919,6 +1038,26 @@ ExtExtension::ExtExtension(void)
 
     m_DbgHelp = NULL;
     m_SymMatchStringA = NULL;
+
+    m_ReadCache = NULL;
+    m_ReadCacheData = NULL;
+    m_ReadCacheFill = NULL;
+    m_ReadCacheUse = 0;
+    m_ReadCacheKeep = false;
+    m_ReadCachePhysical = false;
+    m_ReadCacheChecked = false;
+    m_ReadCacheProcess = 0;
+    m_ReadCacheHits = 0;
+    m_ReadCacheMisses = 0;
+
+    m_TypeCache = NULL;
+    m_TypeCacheMask = 0;
+    m_TypeCacheUsed = 0;
+    m_TypeCacheCookie = 0;
+    m_TypeCacheProcess = 0;
+    m_TypeCacheChecked = false;
+    m_TypeCacheHits = 0;
+    m_TypeCacheMisses = 0;
 }
 
 HRESULT WINAPI
@@ -938,12 +1077,22 @@ ExtExtension::BaseInitialize(_In_ HMODULE ExtDllModule,
     // extension class data.
     ExtCommandDesc::Transfer(&m_Commands,
                              &m_LongestCommandName);
+    if ((Status = BuildCommandTable()) != S_OK)
+    {
+        return Status;
+    }
     
     if ((Status = Initialize()) != S_OK)
     {
         return Status;
     }
 
+    // Initialize is where m_KnownStructs is set up.
+    if ((Status = BuildKnownStructTable()) != S_OK)
+    {
+        return Status;
+    }
+
     *Version = DEBUG_EXTENSION_VERSION(m_ExtMajorVersion,
                                        m_ExtMinorVersion);
     *Flags = m_ExtInitFlags;
@@ -965,6 +1114,25 @@ ExtExtension::Uninitialize(void)
         m_DbgHelp = NULL;
         m_SymMatchStringA = NULL;
     }
+
+    EnableReadCache(false);
+
+    FlushTypeCache();
+    free(m_TypeCache);
+    m_TypeCache = NULL;
+    m_TypeCacheMask = 0;
+    m_TypeCacheCookie = 0;
+
+    free(m_CommandTable);
+    m_CommandTable = NULL;
+    m_CommandTableMask = 0;
+
+    m_OutWrapBuffer.Delete();
+    
+    free(m_KnownStructTable);
+    m_KnownStructTable = NULL;
+    m_KnownStructTableMask = 0;
+    m_KnownStructTableSource = NULL;
 }
 
 void
@@ -1001,6 +1169,7 @@ ExtExtension::Out(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->OutputVaList(m_OutMask, Format, Args);
     va_end(Args);
@@ -1012,6 +1181,7 @@ ExtExtension::Warn(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->OutputVaList(DEBUG_OUTPUT_WARNING, Format, Args);
     va_end(Args);
@@ -1023,6 +1193,7 @@ ExtExtension::Err(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->OutputVaList(DEBUG_OUTPUT_ERROR, Format, Args);
     va_end(Args);
@@ -1034,6 +1205,7 @@ ExtExtension::Verb(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->OutputVaList(DEBUG_OUTPUT_VERBOSE, Format, Args);
     va_end(Args);
@@ -1045,6 +1217,7 @@ ExtExtension::Out(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->OutputVaListWide(m_OutMask, Format, Args);
     va_end(Args);
@@ -1056,6 +1229,7 @@ ExtExtension::Warn(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->OutputVaListWide(DEBUG_OUTPUT_WARNING, Format, Args);
     va_end(Args);
@@ -1067,6 +1241,7 @@ ExtExtension::Err(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->OutputVaListWide(DEBUG_OUTPUT_ERROR, Format, Args);
     va_end(Args);
@@ -1078,6 +1253,7 @@ ExtExtension::Verb(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->OutputVaListWide(DEBUG_OUTPUT_VERBOSE, Format, Args);
     va_end(Args);
@@ -1089,6 +1265,7 @@ ExtExtension::Dml(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->ControlledOutputVaList(DEBUG_OUTCTL_AMBIENT_DML,
                                       m_OutMask, Format, Args);
@@ -1101,6 +1278,7 @@ ExtExtension::DmlWarn(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->ControlledOutputVaList(DEBUG_OUTCTL_AMBIENT_DML,
                                       DEBUG_OUTPUT_WARNING, Format, Args);
@@ -1113,6 +1291,7 @@ ExtExtension::DmlErr(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->ControlledOutputVaList(DEBUG_OUTCTL_AMBIENT_DML,
                                       DEBUG_OUTPUT_ERROR, Format, Args);
@@ -1125,6 +1304,7 @@ ExtExtension::DmlVerb(_In_ PCSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control->ControlledOutputVaList(DEBUG_OUTCTL_AMBIENT_DML,
                                       DEBUG_OUTPUT_VERBOSE, Format, Args);
@@ -1137,6 +1317,7 @@ ExtExtension::Dml(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->ControlledOutputVaListWide(DEBUG_OUTCTL_AMBIENT_DML,
                                            m_OutMask,
@@ -1151,6 +1332,7 @@ ExtExtension::DmlWarn(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->ControlledOutputVaListWide(DEBUG_OUTCTL_AMBIENT_DML,
                                            DEBUG_OUTPUT_WARNING,
@@ -1165,6 +1347,7 @@ ExtExtension::DmlErr(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->ControlledOutputVaListWide(DEBUG_OUTCTL_AMBIENT_DML,
                                            DEBUG_OUTPUT_ERROR,
@@ -1179,6 +1362,7 @@ ExtExtension::DmlVerb(_In_ PCWSTR Format,
 {
     va_list Args;
 
+    FlushOutWrap();
     va_start(Args, Format);
     m_Control4->ControlledOutputVaListWide(DEBUG_OUTCTL_AMBIENT_DML,
                                            DEBUG_OUTPUT_VERBOSE,
@@ -1187,12 +1371,175 @@ ExtExtension::DmlVerb(_In_ PCWSTR Format,
     va_end(Args);
 }
 
+// Markup takes no output columns.
+static PCSTR
+SkipDmlTag(_In_ PCSTR Scan)
+{
+    while (*Scan && *Scan != '>')
+    {
+        Scan++;
+    }
+    return *Scan ? Scan + 1 : Scan;
+}
+
+// An entity such as &lt; takes one column.  A lone
+// ampersand is treated as a plain character.
+static PCSTR
+SkipDmlEntity(_In_ PCSTR Scan)
+{
+    PCSTR End = Scan + 1;
+    
+    while (*End && *End != ';' && *End != ' ' && *End != '<' &&
+           *End != '\n')
+    {
+        End++;
+    }
+    return *End == ';' ? End + 1 : Scan + 1;
+}
+
+static ULONG
+DmlColumns(_In_ PCSTR Scan)
+{
+    ULONG Columns = 0;
+
+    while (*Scan)
+    {
+        if (*Scan == '<')
+        {
+            Scan = SkipDmlTag(Scan);
+            continue;
+        }
+
+        Columns++;
+        Scan = *Scan == '&' ? SkipDmlEntity(Scan) : Scan + 1;
+    }
+    return Columns;
+}
+
+void WINAPI
+ExtExtension::OutWrapText(_In_reads_(Chars) PCSTR Text,
+                          _In_ ULONG Chars)
+{
+    if (!Chars)
+    {
+        return;
+    }
+    
+    if (!m_OutWrapBufferChars)
+    {
+        if (m_OutWrapDml)
+        {
+            m_Control->ControlledOutput(DEBUG_OUTCTL_AMBIENT_DML, m_OutMask,
+                                        "%.*s", (int)Chars, Text);
+        }
+        else
+        {
+            m_Control->Output(m_OutMask, "%.*s", (int)Chars, Text);
+        }
+        return;
+    }
+
+    // Pending text must go out with the mask
+    // and markup mode it was written with.
+    if (m_OutWrapBuffer.GetEltsUsed() &&
+        (m_OutWrapBufferMask != m_OutMask ||
+         m_OutWrapBufferDml != m_OutWrapDml))
+    {
+        FlushOutWrapBuffer();
+    }
+    m_OutWrapBufferMask = m_OutMask;
+    m_OutWrapBufferDml = m_OutWrapDml;
+
+    ULONG Used = m_OutWrapBuffer.GetEltsUsed();
+    
+    m_OutWrapBuffer.RequireRounded(Used + Chars, s_OutWrapOutputChars);
+    memcpy(m_OutWrapBuffer.GetRawBuffer() + Used, Text, Chars);
+    m_OutWrapBuffer.SetEltsUsed(Used + Chars);
+
+    if (Used + Chars >= m_OutWrapBufferChars)
+    {
+        FlushOutWrapBuffer();
+    }
+}
+
+void WINAPI
+ExtExtension::FlushOutWrapBuffer(void)
+{
+    ULONG Chars = m_OutWrapBuffer.GetEltsUsed();
+    ULONG Alloc = m_OutWrapBuffer.GetEltsAlloc();
+    bool Owned = m_OutWrapBuffer.GetOwned();
+    ULONG OutCtl = m_OutWrapBufferDml ?
+        DEBUG_OUTCTL_AMBIENT_DML : DEBUG_OUTCTL_AMBIENT_TEXT;
+
+    //
+    // Detach the text before output so that if the engine
+    // calls back in and more wrapped output is buffered
+    // it goes into a new buffer instead of overwriting
+    // the text being sent.
+    //
+    
+    PSTR Buffer = m_OutWrapBuffer.Relinquish();
+    PCSTR Text = Buffer;
+
+    while (Chars > 0)
+    {
+        ULONG Piece = Chars;
+
+        // Break pieces at line ends so that
+        // no markup is split between calls.
+        if (Piece > s_OutWrapOutputChars)
+        {
+            Piece = s_OutWrapOutputChars;
+            while (Piece > 0 && Text[Piece - 1] != '\n')
+            {
+                Piece--;
+            }
+            if (!Piece)
+            {
+                Piece = s_OutWrapOutputChars;
+            }
+        }
+
+        m_Control->ControlledOutput(OutCtl, m_OutWrapBufferMask,
+                                    "%.*s", (int)Piece, Text);
+        Text += Piece;
+        Chars -= Piece;
+    }
+
+    // Reuse the storage unless a new buffer was started.
+    if (!m_OutWrapBuffer.GetRawBuffer())
+    {
+        m_OutWrapBuffer.Set(Buffer, Alloc, Owned, 0);
+    }
+    else if (Owned)
+    {
+        delete [] Buffer;
+    }
+}
+
 void WINAPI
 ExtExtension::WrapLine(void)
 {
-    if (m_LeftIndent)
+    if (m_OutWrapBufferChars)
     {
-        m_Control->Output(m_OutMask, "\n%*c", m_LeftIndent, ' ');
+        static const char s_Spaces[] = "                                ";
+        ULONG Indent = m_LeftIndent;
+        
+        OutWrapText("\n", 1);
+        while (Indent > 0)
+        {
+            ULONG Chars = Indent < sizeof(s_Spaces) - 1 ?
+                Indent : sizeof(s_Spaces) - 1;
+            OutWrapText(s_Spaces, Chars);
+            Indent -= Chars;
+        }
+    }
+    else if (m_LeftIndent)
+    {
+        m_Control->ControlledOutput(m_OutWrapDml ?
+                                    DEBUG_OUTCTL_AMBIENT_DML :
+                                    DEBUG_OUTCTL_AMBIENT_TEXT,
+                                    m_OutMask, "\n%*c", m_LeftIndent, ' ');
     }
     else
     {
@@ -1206,7 +1553,14 @@ ExtExtension::OutWrapStr(_In_ PCSTR String)
 {
     if (m_TestWrap)
     {
-        m_TestWrapChars += strlen(String);
+        if (m_OutWrapDml)
+        {
+            m_TestWrapChars += DmlColumns(String);
+        }
+        else
+        {
+            m_TestWrapChars += strlen(String);
+        }
         return;
     }
     
@@ -1225,13 +1579,28 @@ ExtExtension::OutWrapStr(_In_ PCSTR String)
                 !LastSpace ||
                 m_CurChar < m_OutputWidth))
         {
+            if (m_OutWrapDml &&
+                *Scan == '<')
+            {
+                Scan = SkipDmlTag(Scan);
+                continue;
+            }
+            
             if (*Scan == ' ')
             {
                 LastSpace = Scan;
             }
             
             m_CurChar++;
-            Scan++;
+            if (m_OutWrapDml &&
+                *Scan == '&')
+            {
+                Scan = SkipDmlEntity(Scan);
+            }
+            else
+            {
+                Scan++;
+            }
         }
 
         if (m_AllowWrap &&
@@ -1244,7 +1613,7 @@ ExtExtension::OutWrapStr(_In_ PCSTR String)
             Scan = LastSpace;
         }
 
-        m_Control->Output(m_OutMask, "%.*s", (int)(Scan - String), String);
+        OutWrapText(String, (ULONG)(Scan - String));
 
         if (!*Scan)
         {
@@ -1268,8 +1637,7 @@ void WINAPIV
 ExtExtension::OutWrapVa(_In_ PCSTR Format,
                         _In_ va_list Args)
 {
-    StringCbVPrintf(s_String, sizeof(s_String), Format, Args);
-    OutWrapStr(s_String);
+    OutWrapStr(PrintScratchStringVa(Format, Args));
 }
 
 void WINAPIV
@@ -1283,99 +1651,382 @@ ExtExtension::OutWrap(_In_ PCSTR Format,
     va_end(Args);
 }
 
-PSTR WINAPI
-ExtExtension::RequestCircleString(_In_ ULONG Chars)
+bool WINAPI
+ExtExtension::InitializeThreadStrings(void)
 {
-    if (Chars > EXT_DIMA(s_CircleStringBuffer))
+    s_StringTls = TlsAlloc();
+    if (s_StringTls == TLS_OUT_OF_INDEXES)
     {
-        ThrowInvalidArg("Circle string buffer overflow, %u chars", Chars);
+        return false;
     }
+    InitializeCriticalSection(&s_StringLock);
+    return true;
+}
 
-    if ((ULONG_PTR)(s_CircleString - s_CircleStringBuffer) >
-        EXT_DIMA(s_CircleStringBuffer) - Chars)
+void WINAPI
+ExtExtension::UninitializeThreadStrings(void)
+{
+    if (s_StringTls == TLS_OUT_OF_INDEXES)
     {
-        // String is too long to fit in the remainder, wrap around.
-        s_CircleString = s_CircleStringBuffer;
+        return;
     }
 
-    PSTR Str = s_CircleString;
-    s_CircleString += Chars;
-    return Str;
-}
-
-PSTR WINAPI
-ExtExtension::CopyCircleString(_In_ PCSTR Str)
-{
-    PSTR Buf;
-    ULONG Chars;
+    // Threads that have not been notified of the
+    // unload still have arenas, free them all.
+    while (s_StringArenas)
+    {
+        FreeThreadStrings(s_StringArenas);
+    }
     
-    Chars = strlen(Str) + 1;
-    Buf = RequestCircleString(Chars);
-    memcpy(Buf, Str, Chars * sizeof(*Str));
-    return Buf;
+    DeleteCriticalSection(&s_StringLock);
+    TlsFree(s_StringTls);
+    s_StringTls = TLS_OUT_OF_INDEXES;
 }
 
-PSTR WINAPI
-ExtExtension::PrintCircleStringVa(_In_ PCSTR Format,
-                                  _In_ va_list Args)
+ExtExtension::StringArena* WINAPI
+ExtExtension::GetThreadStrings(_In_ bool Create)
 {
-    StringCbVPrintf(s_String, sizeof(s_String), Format, Args);
-    return CopyCircleString(s_String);
-}
+    StringArena* Arena;
 
-PSTR WINAPIV
-ExtExtension::PrintCircleString(_In_ PCSTR Format,
-                                ...)
-{
-    PSTR Str;
-    va_list Args;
+    if (s_StringTls == TLS_OUT_OF_INDEXES)
+    {
+        return NULL;
+    }
+    
+    Arena = (StringArena*)TlsGetValue(s_StringTls);
+    if (Arena || !Create)
+    {
+        return Arena;
+    }
 
-    va_start(Args, Format);
-    Str = PrintCircleStringVa(Format, Args);
-    va_end(Args);
-    return Str;
-}
+    Arena = (StringArena*)malloc(sizeof(*Arena));
+    if (!Arena)
+    {
+        return NULL;
+    }
+    ZeroMemory(Arena, sizeof(*Arena));
     
-void WINAPI
-ExtExtension::SetAppendBuffer(_In_reads_(BufferChars) PSTR Buffer,
-                              _In_ ULONG BufferChars)
-{
-    m_AppendBuffer = Buffer;
-    m_AppendBufferChars = BufferChars;
-    m_AppendAt = Buffer;
+    if (!TlsSetValue(s_StringTls, Arena))
+    {
+        free(Arena);
+        return NULL;
+    }
+    
+    EnterCriticalSection(&s_StringLock);
+    Arena->Next = s_StringArenas;
+    if (s_StringArenas)
+    {
+        s_StringArenas->Prev = Arena;
+    }
+    s_StringArenas = Arena;
+    LeaveCriticalSection(&s_StringLock);
+    
+    return Arena;
 }
 
 void WINAPI
-ExtExtension::AppendBufferString(_In_ PCSTR Str)
+ExtExtension::FreeThreadStrings(_In_ StringArena* Arena)
 {
-    ULONG Chars;
-    
-    Chars = strlen(Str) + 1;
-    if (Chars > m_AppendBufferChars ||
-        (ULONG_PTR)(m_AppendAt - m_AppendBuffer) > m_AppendBufferChars - Chars)
+    EnterCriticalSection(&s_StringLock);
+    if (Arena->Prev)
     {
-        ThrowStatus(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW),
-                    "Append string overflowed");
+        Arena->Prev->Next = Arena->Next;
+    }
+    else
+    {
+        s_StringArenas = Arena->Next;
     }
+    if (Arena->Next)
+    {
+        Arena->Next->Prev = Arena->Prev;
+    }
+    LeaveCriticalSection(&s_StringLock);
 
-    memcpy(m_AppendAt, Str, Chars * sizeof(*Str));
-    // Position next append where it will overwrite the terminator
-    // to continue the existing string.
-    m_AppendAt += Chars - 1;
+    while (Arena->Blocks)
+    {
+        StringBlock* Block = Arena->Blocks;
+        Arena->Blocks = Block->Next;
+        free(Block);
+    }
+    free(Arena->Scratch);
+    free(Arena);
 }
 
-void WINAPI
-ExtExtension::AppendStringVa(_In_ PCSTR Format,
-                             _In_ va_list Args)
+PSTR WINAPI
+ExtExtension::AllocThreadString(_In_ StringArena* Arena,
+                                _In_ ULONG Chars)
 {
-    if (m_AppendBuffer >= s_String &&
-        m_AppendBuffer <= s_String + (EXT_DIMA(s_String) - 1))
+    if (Chars > Arena->Left)
     {
-        ThrowInvalidArg("Append string buffer cannot use s_String");
+        StringBlock* Block = NULL;
+        ULONG BlockChars = s_StringBlockChars;
+
+        if (Chars > BlockChars)
+        {
+            BlockChars = Chars;
+        }
+
+        // Requests are limited to keep the size
+        // calculation from overflowing.
+        if (BlockChars > 0x7fffffff)
+        {
+            return NULL;
+        }
+
+        //
+        // Once the arena reaches its limit the oldest
+        // blocks are taken off the end of the list, reusing
+        // one if it's big enough and freeing the others.
+        //
+        
+        while (Arena->Blocks &&
+               (ULONG64)Arena->Chars + BlockChars > s_StringArenaMaxChars)
+        {
+            StringBlock** Link = &Arena->Blocks;
+            StringBlock* Oldest;
+
+            while ((*Link)->Next)
+            {
+                Link = &(*Link)->Next;
+            }
+            Oldest = *Link;
+            *Link = NULL;
+            Arena->Chars -= Oldest->Chars;
+            
+            if (Oldest->Chars >= BlockChars)
+            {
+                Block = Oldest;
+                BlockChars = Block->Chars;
+                break;
+            }
+            free(Oldest);
+        }
+        
+        if (!Block)
+        {
+            Block = (StringBlock*)malloc(sizeof(*Block) +
+                                         BlockChars * sizeof(CHAR));
+            if (!Block)
+            {
+                // The current block may have been freed.
+                Arena->Cur = NULL;
+                Arena->Left = 0;
+                return NULL;
+            }
+            Block->Chars = BlockChars;
+        }
+
+        Arena->Chars += BlockChars;
+        Block->Next = Arena->Blocks;
+        Arena->Blocks = Block;
+        Arena->Cur = (PSTR)(Block + 1);
+        Arena->Left = BlockChars;
+    }
+
+    PSTR Str = Arena->Cur;
+    Arena->Cur += Chars;
+    Arena->Left -= Chars;
+    return Str;
+}
+
+void WINAPI
+ExtExtension::ClearThreadStrings(_In_ StringArena* Arena)
+{
+    StringBlock* Block = Arena->Blocks;
+
+    if (!Block)
+    {
+        return;
+    }
+
+    // Keep the oldest block, which is normally a
+    // standard-sized one, and release the rest.
+    while (Block->Next)
+    {
+        Arena->Blocks = Block->Next;
+        free(Block);
+        Block = Arena->Blocks;
+    }
+
+    Arena->Cur = (PSTR)(Block + 1);
+    Arena->Left = Block->Chars;
+    Arena->Chars = Block->Chars;
+}
+
+PSTR WINAPI
+ExtExtension::FormatThreadStringVa(_In_ PCSTR Format,
+                                   _In_ va_list Args)
+{
+    StringArena* Arena = GetThreadStrings(true);
+    if (!Arena)
+    {
+        return NULL;
+    }
+    
+    // Args is used twice so measure with a copy.
+    va_list Measure;
+    
+    va_copy(Measure, Args);
+    int Len = _vscprintf(Format, Measure);
+    va_end(Measure);
+    if (Len < 0)
+    {
+        return NULL;
+    }
+
+    PSTR Str = AllocThreadString(Arena, (ULONG)Len + 1);
+    if (Str)
+    {
+        StringCchVPrintfA(Str, (ULONG)Len + 1, Format, Args);
+    }
+    return Str;
+}
+
+PSTR WINAPI
+ExtExtension::PrintScratchStringVa(_In_ PCSTR Format,
+                                   _In_ va_list Args)
+{
+    StringArena* Arena = GetThreadStrings(true);
+    if (!Arena)
+    {
+        ThrowOutOfMemory();
+    }
+    
+    va_list Measure;
+    
+    va_copy(Measure, Args);
+    int Len = _vscprintf(Format, Measure);
+    va_end(Measure);
+    if (Len < 0)
+    {
+        ThrowInvalidArg("Unable to format '%s'", Format);
+    }
+
+    if ((ULONG)Len + 1 > Arena->ScratchChars)
+    {
+        ULONG Chars = s_StringBlockChars;
+
+        if ((ULONG)Len + 1 > Chars)
+        {
+            Chars = (ULONG)Len + 1;
+        }
+        
+        PSTR Scratch = (PSTR)realloc(Arena->Scratch,
+                                     Chars * sizeof(CHAR));
+        if (!Scratch)
+        {
+            ThrowOutOfMemory();
+        }
+        Arena->Scratch = Scratch;
+        Arena->ScratchChars = Chars;
+    }
+
+    StringCchVPrintfA(Arena->Scratch, Arena->ScratchChars, Format, Args);
+    return Arena->Scratch;
+}
+
+PSTR WINAPI
+ExtExtension::RequestCircleString(_In_ ULONG Chars)
+{
+    StringArena* Arena = GetThreadStrings(true);
+    PSTR Str = Arena ? AllocThreadString(Arena, Chars) : NULL;
+    if (!Str)
+    {
+        ThrowOutOfMemory();
+    }
+    return Str;
+}
+
+void WINAPI
+ExtExtension::ResetThreadStrings(void)
+{
+    StringArena* Arena = GetThreadStrings(false);
+    if (Arena)
+    {
+        ClearThreadStrings(Arena);
+    }
+}
+
+PSTR WINAPI
+ExtExtension::CopyCircleString(_In_ PCSTR Str)
+{
+    PSTR Buf;
+    ULONG Chars;
+    
+    Chars = (ULONG)strlen(Str) + 1;
+    Buf = RequestCircleString(Chars);
+    memcpy(Buf, Str, Chars * sizeof(*Str));
+    return Buf;
+}
+
+PSTR WINAPI
+ExtExtension::PrintCircleStringVa(_In_ PCSTR Format,
+                                  _In_ va_list Args)
+{
+    PSTR Str = FormatThreadStringVa(Format, Args);
+    if (!Str)
+    {
+        ThrowOutOfMemory();
+    }
+    return Str;
+}
+
+PSTR WINAPIV
+ExtExtension::PrintCircleString(_In_ PCSTR Format,
+                                ...)
+{
+    PSTR Str;
+    va_list Args;
+
+    va_start(Args, Format);
+    Str = PrintCircleStringVa(Format, Args);
+    va_end(Args);
+    return Str;
+}
+    
+void WINAPI
+ExtExtension::SetAppendBuffer(_In_reads_(BufferChars) PSTR Buffer,
+                              _In_ ULONG BufferChars)
+{
+    m_AppendBuffer = Buffer;
+    m_AppendBufferChars = BufferChars;
+    m_AppendAt = Buffer;
+}
+
+void WINAPI
+ExtExtension::AppendBufferString(_In_ PCSTR Str)
+{
+    ULONG Chars;
+    
+    Chars = strlen(Str) + 1;
+    if (Chars > m_AppendBufferChars ||
+        (ULONG_PTR)(m_AppendAt - m_AppendBuffer) > m_AppendBufferChars - Chars)
+    {
+        ThrowStatus(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW),
+                    "Append string overflowed");
+    }
+
+    memcpy(m_AppendAt, Str, Chars * sizeof(*Str));
+    // Position next append where it will overwrite the terminator
+    // to continue the existing string.
+    m_AppendAt += Chars - 1;
+}
+
+void WINAPI
+ExtExtension::AppendStringVa(_In_ PCSTR Format,
+                             _In_ va_list Args)
+{
+    StringArena* Arena = GetThreadStrings(false);
+    if (Arena &&
+        Arena->Scratch &&
+        m_AppendBuffer >= Arena->Scratch &&
+        m_AppendBuffer <= Arena->Scratch + (Arena->ScratchChars - 1))
+    {
+        ThrowInvalidArg("Append string buffer cannot use "
+                        "the scratch string");
     }
     
-    StringCbVPrintf(s_String, sizeof(s_String), Format, Args);
-    AppendBufferString(s_String);
+    AppendBufferString(PrintScratchStringVa(Format, Args));
 }
 
 void WINAPIV
@@ -1618,2838 +2269,4827 @@ ExtExtension::AddCachedSymbolInfo(_In_ PDEBUG_CACHED_SYMBOL_INFO Info,
     return false;
 }
 
-void WINAPI
-ExtExtension::FindSymMatchStringA(void)
+ULONG WINAPI
+ExtExtension::FindTypeId(_In_ PCSTR Type,
+                         _Out_ PULONG64 ModBase)
 {
-    m_DbgHelp = LoadLibraryExA("dbghelp.dll", NULL, 0);
-    if (!m_DbgHelp)
+    HRESULT Status;
+    TypeCacheEntry* Entry;
+    ULONG TypeId;
+
+    Entry = FindTypeCache(s_TypeCacheTypeName, 0, 0, Type);
+    if (Entry)
     {
-        ThrowLastError("Unable to load dbghelp.dll");
+        *ModBase = Entry->ValModBase;
+        return Entry->ValTypeId;
+    }
+    
+    if ((Status = m_Symbols->
+         GetSymbolTypeId(Type, 
+                         &TypeId,
+                         ModBase)) != S_OK)
+    {
+        ThrowStatus(Status, "Unable to get type ID of '%s'",
+                    Type);
     }
 
-    m_SymMatchStringA = (PFN_SymMatchStringA)
-        GetProcAddress(m_DbgHelp, "SymMatchStringA");
-    if (!m_SymMatchStringA)
+    Entry = AddTypeCache(s_TypeCacheTypeName, 0, 0, Type);
+    if (Entry)
     {
-        HRESULT Status = HRESULT_FROM_WIN32(GetLastError());
-        FreeLibrary(m_DbgHelp);
-        m_DbgHelp = NULL;
-        ThrowStatus(Status, "Unable to find SymMatchStringA in dbghelp.dll");
+        Entry->ValModBase = *ModBase;
+        Entry->ValTypeId = TypeId;
     }
+    
+    return TypeId;
 }
 
-bool WINAPI
-ExtExtension::GetOffsetSymbol(_In_ ULONG64 Offs,
-                              _Inout_ ExtBuffer<char>* Name,
-                              _Out_opt_ PULONG64 Displacement,
-                              _In_ bool AddDisp) throw(...)
+void WINAPI
+ExtExtension::FlushTypeCache(void)
 {
-    HRESULT Status;
-    ULONG Need;
-    ULONG64 LocalDisp;
-
-    for (UINT i = 0; i < 2; i++)
+    if (!m_TypeCacheUsed)
     {
-        Status = m_Symbols->GetNameByOffset(Offs,
-                                            Name->GetRawBuffer(),
-                                            Name->GetEltsAlloc(),
-                                            &Need,
-                                            &LocalDisp);
-        if (Status == E_NOINTERFACE)
-        {
-            return false;
-        }
-        else if (Status == S_OK &&
-                 Name->GetRawBuffer())
-        {
-            Name->SetEltsUsed(Need);
-            if (Displacement)
-            {
-                *Displacement = LocalDisp;
-            }
-            if (AddDisp)
-            {
-                const ULONG DispChars = 19;
-                
-                Name->Require(Need, DispChars);
-                StringCchPrintf(Name->GetBuffer() + (Need - 1),
-                                DispChars,
-                                "+0x%I64x",
-                                LocalDisp);
-            }
-            return true;
-        }
-        else if (FAILED(Status))
-        {
-            ThrowStatus(Status,
-                        "Failed during symbol resolution for 0x%p",
-                        Offs);
-        }
-
-        Name->Require(Need);
+        return;
     }
-
-    ThrowStatus(E_FAIL, "Invalid loop when resolving 0x%p");
+    
+    for (ULONG i = 0; i <= m_TypeCacheMask; i++)
+    {
+        free(m_TypeCache[i].Name);
+    }
+    ZeroMemory(m_TypeCache,
+               (m_TypeCacheMask + 1) * sizeof(*m_TypeCache));
+    m_TypeCacheUsed = 0;
 }
 
-ULONG WINAPI
-ExtExtension::FindFirstModule(_In_ PCSTR Pattern,
-                              _Inout_opt_ ExtBuffer<char>* Name,
-                              _In_ ULONG StartIndex) throw(...)
+ULONG64 WINAPI
+ExtExtension::GetProcessCacheKey(void)
 {
-    HRESULT Status;
-    ULONG Need;
-    ExtDeclBuffer<char, 100> LocalName;
+    ULONG64 Key;
+    ULONG SysId;
 
-    for (;;)
+    //
+    // The implicit process follows .process and friends,
+    // so prefer it.  Otherwise fall back on the current
+    // process's system ID, tagged so that it can't match
+    // a data offset.
+    //
+    
+    if (m_System2.IsSet() &&
+        m_System2->GetImplicitProcessDataOffset(&Key) == S_OK &&
+        Key)
     {
-        Status = m_Symbols->GetModuleNames(StartIndex,
-                                           0,
-                                           NULL,
-                                           0,
-                                           NULL,
-                                           LocalName.GetRawBuffer(),
-                                           LocalName.GetEltsAlloc(),
-                                           &Need,
-                                           NULL,
-                                           0,
-                                           NULL);
-        if (Status == S_OK)
-        {
-            if (!MatchPattern(LocalName, Pattern))
-            {
-                StartIndex++;
-                continue;
-            }
-            
-            if (Name)
-            {
-                LocalName.SetEltsUsed(Need);
-                Name->Copy(&LocalName);
-            }
-            return StartIndex;
-        }
-        else if (Status != S_FALSE)
-        {
-            ThrowStatus(Status,
-                        "Unable to find any module matches for '%s'",
-                        Pattern);
-        }
-
-        LocalName.RequireRounded(Need, 20);
+        return Key;
+    }
+    if (m_System->GetCurrentProcessSystemId(&SysId) == S_OK)
+    {
+        return 0x8000000000000000UI64 | SysId;
     }
+    return 0;
 }
 
 void WINAPI
-ExtExtension::GetModuleImagehlpInfo(_In_ ULONG64 ModBase,
-                                    _Out_ struct _IMAGEHLP_MODULEW64* Info)
+ExtExtension::CheckTypeCache(void)
 {
-    HRESULT Status;
+    DEBUG_CACHED_SYMBOL_INFO Info;
+    
+    if (m_TypeCacheChecked)
+    {
+        return;
+    }
+    m_TypeCacheChecked = true;
 
-    ZeroMemory(Info, sizeof(*Info));
-    Info->SizeOfStruct = sizeof(*Info);
+    //
+    // Type IDs are only meaningful within the module
+    // instances of a single process, so switching
+    // processes discards everything.
+    //
     
-    if ((Status = m_Advanced2->
-         GetSymbolInformation(DEBUG_SYMINFO_IMAGEHLP_MODULEW64,
-                              ModBase,
-                              0,
-                              Info,
-                              Info->SizeOfStruct,
-                              NULL,
-                              NULL,
-                              0,
-                              NULL)) != S_OK)
+    ULONG64 Process = GetProcessCacheKey();
+    
+    if (Process != m_TypeCacheProcess)
     {
-        ThrowStatus(Status, "Unable to retrieve module info");
+        FlushTypeCache();
+        m_TypeCacheProcess = Process;
+    }
+    
+    if (!m_Advanced2.IsSet())
+    {
+        // No way to tell whether symbols have changed
+        // so the cache only lives for a single call.
+        FlushTypeCache();
+        return;
+    }
+    
+    if (m_TypeCacheCookie &&
+        m_Advanced2->Request(DEBUG_REQUEST_GET_CACHED_SYMBOL_INFO,
+                             &m_TypeCacheCookie,
+                             sizeof(m_TypeCacheCookie),
+                             &Info,
+                             sizeof(Info),
+                             NULL) == S_OK)
+    {
+        return;
+    }
+
+    FlushTypeCache();
+
+    ZeroMemory(&Info, sizeof(Info));
+    if (m_Advanced2->Request(DEBUG_REQUEST_ADD_CACHED_SYMBOL_INFO,
+                             &Info,
+                             sizeof(Info),
+                             &m_TypeCacheCookie,
+                             sizeof(m_TypeCacheCookie),
+                             NULL) != S_OK)
+    {
+        m_TypeCacheCookie = 0;
     }
 }
 
-bool WINAPI
-ExtExtension::ModuleHasGlobalSymbols(_In_ ULONG64 ModBase)
+static ULONG
+HashTypeCacheKey(_In_ ULONG Kind,
+                 _In_ ULONG64 ModBase,
+                 _In_ ULONG TypeId,
+                 _In_ PCSTR Name)
 {
-    IMAGEHLP_MODULEW64 Info;
+    ULONG Hash = ExtCommandDesc::HashName(Name);
 
-    GetModuleImagehlpInfo(ModBase, &Info);
-    return Info.GlobalSymbols != FALSE;
+    Hash ^= (ULONG)(ModBase >> 12) * 0x9e3779b1;
+    Hash ^= TypeId * 0x85ebca6b;
+    Hash ^= Kind;
+    return Hash ^ (Hash >> 16);
 }
 
-bool WINAPI
-ExtExtension::ModuleHasTypeInfo(_In_ ULONG64 ModBase)
+ExtExtension::TypeCacheEntry* WINAPI
+ExtExtension::FindTypeCache(_In_ ULONG Kind,
+                            _In_ ULONG64 ModBase,
+                            _In_ ULONG TypeId,
+                            _In_ PCSTR Name)
 {
-    IMAGEHLP_MODULEW64 Info;
+    CheckTypeCache();
     
-    GetModuleImagehlpInfo(ModBase, &Info);
-    return Info.TypeInfo != FALSE;
+    if (!m_TypeCacheUsed)
+    {
+        m_TypeCacheMisses++;
+        return NULL;
+    }
+    
+    ULONG Hash = HashTypeCacheKey(Kind, ModBase, TypeId, Name);
+    ULONG Slot = Hash & m_TypeCacheMask;
+    TypeCacheEntry* Entry;
+    
+    while ((Entry = &m_TypeCache[Slot])->Name)
+    {
+        if (Entry->Hash == Hash &&
+            Entry->Kind == Kind &&
+            Entry->ModBase == ModBase &&
+            Entry->TypeId == TypeId &&
+            !strcmp(Entry->Name, Name))
+        {
+            m_TypeCacheHits++;
+            return Entry;
+        }
+        Slot = (Slot + 1) & m_TypeCacheMask;
+    }
+
+    m_TypeCacheMisses++;
+    return NULL;
 }
 
-ULONG64 WINAPI
-ExtExtension::CallDebuggeeBase(_In_ PCSTR CommandString,
-                               _In_ ULONG TimeoutMilliseconds)
+ExtExtension::TypeCacheEntry* WINAPI
+ExtExtension::AddTypeCache(_In_ ULONG Kind,
+                           _In_ ULONG64 ModBase,
+                           _In_ ULONG TypeId,
+                           _In_ PCSTR Name)
 {
-    HRESULT Status;
-    ExtDeclBuffer<char, 300> Cmd;
-    ExtCaptureOutputA IgnoreOut;
-
-    Cmd.Copy(".call ", 6);
-    Cmd.Append(CommandString, strlen(CommandString) + 1);
+    TypeCacheEntry* Entry;
+    ULONG Slot;
+    
+    //
+    // Grow the table when it would become more than half full.
+    //
 
-    if (FAILED(Status = m_Control->
-               Execute(DEBUG_OUTCTL_IGNORE,
-                       Cmd,
-                       DEBUG_EXECUTE_NOT_LOGGED |
-                       DEBUG_EXECUTE_NO_REPEAT)))
+    if (!m_TypeCache ||
+        m_TypeCacheUsed + 1 > (m_TypeCacheMask + 1) / 2)
     {
-        ThrowStatus(Status, "Unable to execute '%s'", Cmd);
-    }
+        ULONG NewSlots = m_TypeCache ?
+            (m_TypeCacheMask + 1) * 2 : s_TypeCacheInitialSlots;
+        TypeCacheEntry* NewTable = (TypeCacheEntry*)
+            calloc(NewSlots, sizeof(*NewTable));
+        if (!NewTable)
+        {
+            return NULL;
+        }
 
-    // Capture output just so we can throw away the
-    // automatic retval output from .call when execution completes.
-    // This isn't ideal since it won't hide output to
-    // other clients but it's the best we can do.
-    // Eventually .call will get a quiet mode and then
-    // at least the return value output can be hidden.
-    IgnoreOut.Start();
-    
-    if ((Status = m_Control->SetExecutionStatus(DEBUG_STATUS_GO)) == S_OK)
-    {
-        Status = m_Control->WaitForEvent(DEBUG_WAIT_DEFAULT,
-                                         TimeoutMilliseconds);
-    }
+        if (m_TypeCache)
+        {
+            for (ULONG i = 0; i <= m_TypeCacheMask; i++)
+            {
+                if (!m_TypeCache[i].Name)
+                {
+                    continue;
+                }
+                
+                Slot = m_TypeCache[i].Hash & (NewSlots - 1);
+                while (NewTable[Slot].Name)
+                {
+                    Slot = (Slot + 1) & (NewSlots - 1);
+                }
+                NewTable[Slot] = m_TypeCache[i];
+            }
+            free(m_TypeCache);
+        }
 
-    IgnoreOut.Delete();
+        m_TypeCache = NewTable;
+        m_TypeCacheMask = NewSlots - 1;
+    }
 
-    if (FAILED(Status))
+    PSTR NameCopy = _strdup(Name);
+    if (!NameCopy)
     {
-        // Try and revert our .call setup.
-        m_Control->Execute(DEBUG_OUTCTL_IGNORE,
-                           ".call -c",
-                           DEBUG_EXECUTE_NOT_LOGGED |
-                           DEBUG_EXECUTE_NO_REPEAT);
-        
-        ThrowStatus(Status, "Unable to wait for debuggee to run");
+        return NULL;
     }
-    else if (Status != S_OK)
+    
+    ULONG Hash = HashTypeCacheKey(Kind, ModBase, TypeId, Name);
+    
+    Slot = Hash & m_TypeCacheMask;
+    while (m_TypeCache[Slot].Name)
     {
-        // Try and get control back.
-        m_Control->SetInterrupt(DEBUG_INTERRUPT_ACTIVE);
-        
-        ThrowStatus(E_FAIL,
-                    "DANGEROUS FAILURE: "
-                    "Debuggee took longer than %g seconds to run "
-                    "and is still running.\n"
-                    "A break-in request has been made but the debuggee "
-                    "may be dead.\n"
-                    "If the debuggee does come back validate that its "
-                    "state has not be corrupted.",
-                    (double)TimeoutMilliseconds / 1000);
+        Slot = (Slot + 1) & m_TypeCacheMask;
     }
 
-    ULONG64 RetVal;
-    
-    GetExprU64("@$callret", -1, &RetVal);
-    return RetVal;
+    Entry = &m_TypeCache[Slot];
+    ZeroMemory(Entry, sizeof(*Entry));
+    Entry->Kind = Kind;
+    Entry->Hash = Hash;
+    Entry->ModBase = ModBase;
+    Entry->TypeId = TypeId;
+    Entry->Name = NameCopy;
+    m_TypeCacheUsed++;
+    return Entry;
 }
 
-ULONG WINAPI
-ExtExtension::FindRegister(_In_ PCSTR Name,
-                           _Inout_opt_ PULONG IndexCache)
+HRESULT WINAPI
+ExtExtension::EnableReadCache(_In_ bool Enable,
+                              _In_ bool KeepAcrossCalls,
+                              _In_ bool CachePhysical)
 {
-    HRESULT Status;
-    ULONG Index;
-    
-    if (IndexCache != NULL &&
-        *IndexCache != DEBUG_ANY_ID)
+    if (!Enable)
     {
-        return *IndexCache;
+        free(m_ReadCache);
+        m_ReadCache = NULL;
+        free(m_ReadCacheData);
+        m_ReadCacheData = NULL;
+        m_ReadCacheFill = NULL;
+        m_ReadCacheKeep = false;
+        m_ReadCachePhysical = false;
+        return S_OK;
     }
 
-    if ((Status = m_Registers->GetIndexByName(Name,
-                                              &Index)) != S_OK)
+    m_ReadCacheKeep = KeepAcrossCalls;
+    if (m_ReadCache)
     {
-        ThrowStatus(Status, "Unable to find register '%s'", Name);
+        if (m_ReadCachePhysical && !CachePhysical)
+        {
+            FlushReadCache();
+        }
+        m_ReadCachePhysical = CachePhysical;
+        return S_OK;
     }
+    m_ReadCachePhysical = CachePhysical;
 
-    if (IndexCache != NULL)
+    ULONG Blocks = s_ReadCacheSets * s_ReadCacheWays;
+    
+    m_ReadCache = (ReadCacheBlock*)malloc(Blocks * sizeof(*m_ReadCache));
+    m_ReadCacheData = (PUCHAR)malloc((Blocks + 1) * s_ReadCacheBlockSize);
+    if (!m_ReadCache ||
+        !m_ReadCacheData)
     {
-        *IndexCache = Index;
+        EnableReadCache(false);
+        return E_OUTOFMEMORY;
     }
 
-    return Index;
-}
-
-ULONG64 WINAPI
-ExtExtension::GetRegisterU64(_In_ PCSTR Name,
-                             _Inout_opt_ PULONG IndexCache)
-{
-    HRESULT Status;
-    ULONG Index = FindRegister(Name, IndexCache);
-    DEBUG_VALUE RegVal, RegVal64;
-
-    if ((Status = m_Registers->GetValue(Index,
-                                        &RegVal)) != S_OK ||
-        (Status = m_Control->CoerceValue(&RegVal,
-                                         DEBUG_VALUE_INT64,
-                                         &RegVal64)) != S_OK)
+    for (ULONG i = 0; i < Blocks; i++)
     {
-        ThrowStatus(Status, "Unable to get value for '%s'", Name);
+        m_ReadCache[i].Data = m_ReadCacheData + i * s_ReadCacheBlockSize;
     }
-
-    return RegVal64.I64;
+    m_ReadCacheFill = m_ReadCacheData + Blocks * s_ReadCacheBlockSize;
+    
+    FlushReadCache();
+    return S_OK;
 }
 
 void WINAPI
-ExtExtension::SetRegisterU64(_In_ PCSTR Name,
-                             _In_ ULONG64 Val,
-                             _Inout_opt_ PULONG IndexCache)
+ExtExtension::FlushReadCache(void)
 {
-    HRESULT Status;
-    ULONG Index = FindRegister(Name, IndexCache);
-    DEBUG_VALUE RegVal64;
-
-    RegVal64.Type = DEBUG_VALUE_INT64;
-    RegVal64.I64 = Val;
-    if ((Status = m_Registers->SetValue(Index,
-                                        &RegVal64)) != S_OK)
+    if (!m_ReadCache)
     {
-        ThrowStatus(Status, "Unable to set value for '%s'", Name);
+        return;
     }
-}
-
-ULONG WINAPI
-ExtExtension::FindPseudoRegister(_In_ PCSTR Name,
-                                 _Inout_opt_ PULONG IndexCache)
-{
-    HRESULT Status;
-    ULONG Index;
     
-    if (IndexCache != NULL &&
-        *IndexCache != DEBUG_ANY_ID)
+    for (ULONG i = 0; i < s_ReadCacheSets * s_ReadCacheWays; i++)
     {
-        return *IndexCache;
+        m_ReadCache[i].Valid = 0;
+        m_ReadCache[i].LastUse = 0;
     }
+    m_ReadCacheUse = 0;
+    m_ReadCacheChecked = false;
+}
 
-    if ((Status = m_Registers2->GetPseudoIndexByName(Name,
-                                                     &Index)) != S_OK)
+void WINAPI
+ExtExtension::InvalidateReadCache(_In_ bool Physical,
+                                  _In_ ULONG SpaceFlags,
+                                  _In_ ULONG64 Offset,
+                                  _In_ ULONG Bytes)
+{
+    if (!m_ReadCache ||
+        !Bytes)
     {
-        ThrowStatus(Status, "Unable to find pseudo-register '%s'", Name);
+        return;
     }
 
-    if (IndexCache != NULL)
+    ULONG Space = Physical ? (SpaceFlags | 0x80000000) : 0;
+    ULONG64 First = Offset >> s_ReadCacheBlockShift;
+    ULONG64 Last = (Offset + Bytes - 1) >> s_ReadCacheBlockShift;
+
+    // A write spanning the whole cache is unusual enough
+    // that it isn't worth walking it block by block.
+    if (Last - First >= s_ReadCacheSets)
     {
-        *IndexCache = Index;
+        FlushReadCache();
+        return;
     }
+    
+    for (ULONG64 Block = First; Block <= Last; Block++)
+    {
+        ULONG64 Base = Block << s_ReadCacheBlockShift;
+        ReadCacheBlock* Set =
+            &m_ReadCache[(ULONG)(Block % s_ReadCacheSets) * s_ReadCacheWays];
 
-    return Index;
+        for (ULONG Way = 0; Way < s_ReadCacheWays; Way++)
+        {
+            if (Set[Way].Valid &&
+                Set[Way].Base == Base &&
+                Set[Way].Space == Space)
+            {
+                Set[Way].Valid = 0;
+            }
+        }
+    }
 }
 
-ULONG64 WINAPI
-ExtExtension::GetPseudoRegisterU64(_In_ PCSTR Name,
-                                   _Inout_opt_ PULONG IndexCache)
+ExtExtension::ReadCacheBlock* WINAPI
+ExtExtension::GetReadCacheBlock(_In_ ULONG Space,
+                                _In_ ULONG64 Base,
+                                _Out_ HRESULT* Status)
 {
-    HRESULT Status;
-    ULONG Index = FindPseudoRegister(Name, IndexCache);
-    DEBUG_VALUE RegVal, RegVal64;
+    ReadCacheBlock* Set =
+        &m_ReadCache[(ULONG)((Base >> s_ReadCacheBlockShift) %
+                             s_ReadCacheSets) * s_ReadCacheWays];
+    ReadCacheBlock* Victim = &Set[0];
 
-    if ((Status = m_Registers2->GetPseudoValues(DEBUG_REGSRC_DEBUGGEE,
-                                                1,
-                                                &Index,
-                                                0,
-                                                &RegVal)) != S_OK ||
-        (Status = m_Control->CoerceValue(&RegVal,
-                                         DEBUG_VALUE_INT64,
-                                         &RegVal64)) != S_OK)
+    *Status = S_OK;
+    
+    for (ULONG Way = 0; Way < s_ReadCacheWays; Way++)
     {
-        ThrowStatus(Status, "Unable to get value for '%s'", Name);
-    }
+        if (Set[Way].Valid &&
+            Set[Way].Base == Base &&
+            Set[Way].Space == Space)
+        {
+            Set[Way].LastUse = ++m_ReadCacheUse;
+            return &Set[Way];
+        }
 
-    return RegVal64.I64;
-}
+        if (!Set[Way].Valid)
+        {
+            if (Victim->Valid)
+            {
+                Victim = &Set[Way];
+            }
+        }
+        else if (Victim->Valid &&
+                 Set[Way].LastUse < Victim->LastUse)
+        {
+            Victim = &Set[Way];
+        }
+    }
 
-void WINAPI
-ExtExtension::SetPseudoRegisterU64(_In_ PCSTR Name,
-                                   _In_ ULONG64 Val,
-                                   _Inout_opt_ PULONG IndexCache)
-{
-    HRESULT Status;
-    ULONG Index = FindPseudoRegister(Name, IndexCache);
-    DEBUG_VALUE RegVal64;
+    //
+    // Miss, so fill the least-recently-used way.
+    //
 
-    RegVal64.Type = DEBUG_VALUE_INT64;
-    RegVal64.I64 = Val;
-    if ((Status = m_Registers2->SetPseudoValues(DEBUG_REGSRC_DEBUGGEE,
-                                                1,
-                                                &Index,
-                                                0,
-                                                &RegVal64)) != S_OK)
+    ULONG Done = 0;
+    
+    m_ReadCacheMisses++;
+    
+    if (Space & 0x80000000)
     {
-        ThrowStatus(Status, "Unable to set value for '%s'", Name);
+        *Status = m_Data4->
+            ReadPhysical2(Base, Space & ~0x80000000, m_ReadCacheFill,
+                          s_ReadCacheBlockSize, &Done);
     }
-}
-
-PCSTR WINAPI
-ExtExtension::GetUnnamedArgStr(_In_ ULONG Index)
-{
-    if (Index >= m_NumUnnamedArgs)
+    else
     {
-        ThrowInvalidArg("Invalid unnamed argument index %u, only given %u",
-                        Index + 1, m_NumUnnamedArgs);
+        *Status = m_Data->
+            ReadVirtual(Base, m_ReadCacheFill, s_ReadCacheBlockSize, &Done);
     }
-    if (!m_Args[Index].StrVal)
+    if (*Status != S_OK ||
+        !Done)
     {
-        ThrowInvalidArg("Unnamed argument index %u is not a string",
-                        Index + 1);
+        return NULL;
     }
 
-    return m_Args[Index].StrVal;
+    // Swap the new data in, the victim's old data
+    // becomes the spare.
+    PUCHAR Data = Victim->Data;
+    
+    Victim->Data = m_ReadCacheFill;
+    m_ReadCacheFill = Data;
+    Victim->Base = Base;
+    Victim->Space = Space;
+    Victim->Valid = Done;
+    Victim->LastUse = ++m_ReadCacheUse;
+    return Victim;
 }
 
-ULONG64 WINAPI
-ExtExtension::GetUnnamedArgU64(_In_ ULONG Index)
+HRESULT WINAPI
+ExtExtension::ReadCachedBuffer(_In_ bool Physical,
+                               _In_ ULONG SpaceFlags,
+                               _In_ ULONG64 Offset,
+                               _Out_writes_bytes_(Bytes) PVOID Buffer,
+                               _In_ ULONG Bytes,
+                               _Out_ PULONG Done)
 {
-    if (Index >= m_NumUnnamedArgs)
+    HRESULT Status;
+    
+    //
+    // Blocks are only good for the process they were read
+    // in, so check once per call whether it has changed.
+    //
+    
+    if (m_ReadCache &&
+        !m_ReadCacheChecked)
     {
-        ThrowInvalidArg("Invalid unnamed argument index %u, only given %u",
-                        Index + 1, m_NumUnnamedArgs);
+        ULONG64 Process = GetProcessCacheKey();
+
+        if (Process != m_ReadCacheProcess)
+        {
+            FlushReadCache();
+            m_ReadCacheProcess = Process;
+        }
+        m_ReadCacheChecked = true;
     }
-    if (m_Args[Index].StrVal)
+    
+    if (m_ReadCache &&
+        (!Physical || m_ReadCachePhysical) &&
+        Bytes <= s_ReadCacheMaxRequest)
     {
-        ThrowInvalidArg("Unnamed argument index %u is not a number",
-                        Index + 1);
-    }
+        ULONG Space = Physical ? (SpaceFlags | 0x80000000) : 0;
+        ULONG64 Cur = Offset;
+        PUCHAR To = (PUCHAR)Buffer;
+        ULONG Left = Bytes;
+        ULONG64 Misses = m_ReadCacheMisses;
 
-    return m_Args[Index].NumVal;
-}
+        while (Left > 0)
+        {
+            ULONG64 Base = Cur & ~(ULONG64)(s_ReadCacheBlockSize - 1);
+            ULONG BlockOffs = (ULONG)(Cur - Base);
+            ULONG Chunk = s_ReadCacheBlockSize - BlockOffs;
+            ReadCacheBlock* Block;
 
-PCSTR WINAPI
-ExtExtension::GetArgStr(_In_ PCSTR Name,
-                        _In_ bool Required)
-{
-    ArgVal* Arg = FindArg(Name, Required);
-    if (!Arg)
+            if (Chunk > Left)
+            {
+                Chunk = Left;
+            }
+
+            Block = GetReadCacheBlock(Space, Base, &Status);
+
+            // If the block isn't fully readable fall back
+            // to a direct read so that partial reads and
+            // failures are reported exactly as without
+            // the cache.
+            if (!Block ||
+                BlockOffs + Chunk > Block->Valid)
+            {
+                break;
+            }
+
+            memcpy(To, Block->Data + BlockOffs, Chunk);
+            To += Chunk;
+            Cur += Chunk;
+            Left -= Chunk;
+        }
+
+        if (!Left)
+        {
+            if (Misses == m_ReadCacheMisses)
+            {
+                m_ReadCacheHits++;
+            }
+            *Done = Bytes;
+            return S_OK;
+        }
+    }
+    
+    if (Physical)
     {
-        return NULL;
+        Status = m_Data4->
+            ReadPhysical2(Offset, SpaceFlags, Buffer, Bytes, Done);
     }
-    if (!Arg->StrVal)
+    else
     {
-        ThrowInvalidArg("Argument /%s is not a string",
-                        Name);
+        Status = m_Data->
+            ReadVirtual(Offset, Buffer, Bytes, Done);
     }
-    return Arg->StrVal;
+
+    return Status;
 }
 
-ULONG64 WINAPI
-ExtExtension::GetArgU64(_In_ PCSTR Name,
-                        _In_ bool Required)
+void WINAPI
+ExtExtension::FindSymMatchStringA(void)
 {
-    ArgVal* Arg = FindArg(Name, Required);
-    if (!Arg)
+    m_DbgHelp = LoadLibraryExA("dbghelp.dll", NULL, 0);
+    if (!m_DbgHelp)
     {
-        return 0;
+        ThrowLastError("Unable to load dbghelp.dll");
     }
-    if (Arg->StrVal)
+
+    m_SymMatchStringA = (PFN_SymMatchStringA)
+        GetProcAddress(m_DbgHelp, "SymMatchStringA");
+    if (!m_SymMatchStringA)
     {
-        ThrowInvalidArg("Argument /%s is not a number",
-                        Name);
+        HRESULT Status = HRESULT_FROM_WIN32(GetLastError());
+        FreeLibrary(m_DbgHelp);
+        m_DbgHelp = NULL;
+        ThrowStatus(Status, "Unable to find SymMatchStringA in dbghelp.dll");
     }
-    return Arg->NumVal;
 }
 
 bool WINAPI
-ExtExtension::SetUnnamedArg(_In_ ULONG Index,
-                            _In_opt_ PCSTR StrArg,
-                            _In_ ULONG64 NumArg,
-                            _In_ bool OnlyIfUnset)
+ExtExtension::GetOffsetSymbol(_In_ ULONG64 Offs,
+                              _Inout_ ExtBuffer<char>* Name,
+                              _Out_opt_ PULONG64 Displacement,
+                              _In_ bool AddDisp) throw(...)
 {
-    ExtCommandDesc::ArgDesc* Check = m_CurCommand->FindUnnamedArg(Index);
-    if (!Check)
-    {
-        ThrowInvalidArg("Unnamed argument index %u too large", Index);
-    }
+    HRESULT Status;
+    ULONG Need;
+    ULONG64 LocalDisp;
 
-    ArgVal* Val = NULL;
-    
-    if (HasUnnamedArg(Index))
+    for (UINT i = 0; i < 2; i++)
     {
-        if (OnlyIfUnset)
+        Status = m_Symbols->GetNameByOffset(Offs,
+                                            Name->GetRawBuffer(),
+                                            Name->GetEltsAlloc(),
+                                            &Need,
+                                            &LocalDisp);
+        if (Status == E_NOINTERFACE)
         {
             return false;
         }
+        else if (Status == S_OK &&
+                 Name->GetRawBuffer())
+        {
+            Name->SetEltsUsed(Need);
+            if (Displacement)
+            {
+                *Displacement = LocalDisp;
+            }
+            if (AddDisp)
+            {
+                const ULONG DispChars = 19;
+                
+                Name->Require(Need, DispChars);
+                StringCchPrintf(Name->GetBuffer() + (Need - 1),
+                                DispChars,
+                                "+0x%I64x",
+                                LocalDisp);
+            }
+            return true;
+        }
+        else if (FAILED(Status))
+        {
+            ThrowStatus(Status,
+                        "Failed during symbol resolution for 0x%p",
+                        Offs);
+        }
 
-        Val = &m_Args[Index];
+        Name->Require(Need);
     }
 
-    SetRawArgVal(Check, Val, true, StrArg, false, NumArg);
-    return true;
+    ThrowStatus(E_FAIL, "Invalid loop when resolving 0x%p");
 }
 
-bool WINAPI
-ExtExtension::SetArg(_In_ PCSTR Name,
-                     _In_opt_ PCSTR StrArg,
-                     _In_ ULONG64 NumArg,
-                     _In_ bool OnlyIfUnset)
+ULONG WINAPI
+ExtExtension::FindFirstModule(_In_ PCSTR Pattern,
+                              _Inout_opt_ ExtBuffer<char>* Name,
+                              _In_ ULONG StartIndex) throw(...)
 {
-    ExtCommandDesc::ArgDesc* Check = m_CurCommand->FindArg(Name);
-    if (!Check)
-    {
-        ThrowInvalidArg("No argument named '%s'", Name);
-    }
-
-    ArgVal* Val = FindArg(Name, false);
+    HRESULT Status;
+    ULONG Need;
+    ExtDeclBuffer<char, 100> LocalName;
 
-    if (Val)
+    for (;;)
     {
-        if (OnlyIfUnset)
+        Status = m_Symbols->GetModuleNames(StartIndex,
+                                           0,
+                                           NULL,
+                                           0,
+                                           NULL,
+                                           LocalName.GetRawBuffer(),
+                                           LocalName.GetEltsAlloc(),
+                                           &Need,
+                                           NULL,
+                                           0,
+                                           NULL);
+        if (Status == S_OK)
         {
-            return false;
+            if (!MatchPattern(LocalName, Pattern))
+            {
+                StartIndex++;
+                continue;
+            }
+            
+            if (Name)
+            {
+                LocalName.SetEltsUsed(Need);
+                Name->Copy(&LocalName);
+            }
+            return StartIndex;
+        }
+        else if (Status != S_FALSE)
+        {
+            ThrowStatus(Status,
+                        "Unable to find any module matches for '%s'",
+                        Pattern);
         }
-    }
 
-    SetRawArgVal(Check, Val, true, StrArg, false, NumArg);
-    return true;
+        LocalName.RequireRounded(Need, 20);
+    }
 }
 
-PCSTR WINAPI
-ExtExtension::GetExpr64(_In_ PCSTR Str,
-                        _In_ bool Signed,
-                        _In_ ULONG64 Limit,
-                        _Out_ PULONG64 Val)
+void WINAPI
+ExtExtension::GetModuleImagehlpInfo(_In_ ULONG64 ModBase,
+                                    _Out_ struct _IMAGEHLP_MODULEW64* Info)
 {
     HRESULT Status;
-    DEBUG_VALUE FullVal;
-    ULONG EndIdx;
-
-    if ((Status = m_Control->
-         Evaluate(Str, DEBUG_VALUE_INT64, &FullVal, &EndIdx)) != S_OK)
-    {
-        ExtStatusException Ex(Status);
 
-        Ex.PrintMessage(s_String, EXT_DIMA(s_String),
-                        "Unable to evaluate expression '%s'", Str);
-        throw Ex;
-    }
-    if ((!Signed &&
-         FullVal.I64 > Limit) ||
-        (Signed &&
-         ((LONG64)FullVal.I64 < -(LONG64)Limit ||
-          (LONG64)FullVal.I64 > (LONG64)Limit)))
-    {
-        ThrowInvalidArg("Result overflow in expression '%s'", Str);
-    }
-
-    *Val = FullVal.I64;
-    Str += EndIdx;
-
-    while (IsSpace(*Str))
+    ZeroMemory(Info, sizeof(*Info));
+    Info->SizeOfStruct = sizeof(*Info);
+    
+    if ((Status = m_Advanced2->
+         GetSymbolInformation(DEBUG_SYMINFO_IMAGEHLP_MODULEW64,
+                              ModBase,
+                              0,
+                              Info,
+                              Info->SizeOfStruct,
+                              NULL,
+                              NULL,
+                              0,
+                              NULL)) != S_OK)
     {
-        Str++;
+        ThrowStatus(Status, "Unable to retrieve module info");
     }
-
-    return Str;
 }
 
-void WINAPIV
-ExtExtension::ThrowInvalidArg(_In_ PCSTR Format,
-                              ...)
+bool WINAPI
+ExtExtension::ModuleHasGlobalSymbols(_In_ ULONG64 ModBase)
 {
-    ExtInvalidArgumentException Ex("");
-    va_list Args;
+    IMAGEHLP_MODULEW64 Info;
 
-    va_start(Args, Format);
-    Ex.PrintMessageVa(s_String, EXT_DIMA(s_String),
-                      Format, Args);
-    va_end(Args);
-    throw Ex;
+    GetModuleImagehlpInfo(ModBase, &Info);
+    return Info.GlobalSymbols != FALSE;
 }
 
-void WINAPIV
-ExtExtension::ThrowRemote(_In_ HRESULT Status,
-                          _In_ PCSTR Format,
-                          ...)
+bool WINAPI
+ExtExtension::ModuleHasTypeInfo(_In_ ULONG64 ModBase)
 {
-    ExtRemoteException Ex(Status, "");
-    va_list Args;
-
-    va_start(Args, Format);
-    Ex.PrintMessageVa(s_String, EXT_DIMA(s_String),
-                      Format, Args);
-    va_end(Args);
-    throw Ex;
+    IMAGEHLP_MODULEW64 Info;
+    
+    GetModuleImagehlpInfo(ModBase, &Info);
+    return Info.TypeInfo != FALSE;
 }
 
-void WINAPIV
-ExtExtension::ThrowStatus(_In_ HRESULT Status,
-                          _In_ PCSTR Format,
-                          ...)
+ULONG64 WINAPI
+ExtExtension::CallDebuggeeBase(_In_ PCSTR CommandString,
+                               _In_ ULONG TimeoutMilliseconds)
 {
-    ExtStatusException Ex(Status);
-    va_list Args;
+    HRESULT Status;
+    ExtDeclBuffer<char, 300> Cmd;
+    ExtCaptureOutputA IgnoreOut;
 
-    va_start(Args, Format);
-    Ex.PrintMessageVa(s_String, EXT_DIMA(s_String),
-                      Format, Args);
-    va_end(Args);
-    throw Ex;
-}
+    Cmd.Copy(".call ", 6);
+    Cmd.Append(CommandString, strlen(CommandString) + 1);
 
-void WINAPI
-ExtExtension::ExInitialize(void)
-{
-    if (m_ExInitialized)
+    // The debuggee is going to run.
+    FlushReadCache();
+
+    if (FAILED(Status = m_Control->
+               Execute(DEBUG_OUTCTL_IGNORE,
+                       Cmd,
+                       DEBUG_EXECUTE_NOT_LOGGED |
+                       DEBUG_EXECUTE_NO_REPEAT)))
     {
-        return;
+        ThrowStatus(Status, "Unable to execute '%s'", Cmd);
     }
 
-    m_ExInitialized = true;
+    // Capture output just so we can throw away the
+    // automatic retval output from .call when execution completes.
+    // This isn't ideal since it won't hide output to
+    // other clients but it's the best we can do.
+    // Eventually .call will get a quiet mode and then
+    // at least the return value output can be hidden.
+    IgnoreOut.Start();
+    
+    if ((Status = m_Control->SetExecutionStatus(DEBUG_STATUS_GO)) == S_OK)
+    {
+        Status = m_Control->WaitForEvent(DEBUG_WAIT_DEFAULT,
+                                         TimeoutMilliseconds);
+    }
 
-    //
-    // Special initialization pass that
-    // is done when output can be produced
-    // and exceptions thrown.
-    // This pass allows verbose feedback on
-    // errors, as opposed to the DLL-load Initialize().
-    //
+    IgnoreOut.Delete();
+
+    if (FAILED(Status))
+    {
+        // Try and revert our .call setup.
+        m_Control->Execute(DEBUG_OUTCTL_IGNORE,
+                           ".call -c",
+                           DEBUG_EXECUTE_NOT_LOGGED |
+                           DEBUG_EXECUTE_NO_REPEAT);
+        
+        ThrowStatus(Status, "Unable to wait for debuggee to run");
+    }
+    else if (Status != S_OK)
+    {
+        // Try and get control back.
+        m_Control->SetInterrupt(DEBUG_INTERRUPT_ACTIVE);
+        
+        ThrowStatus(E_FAIL,
+                    "DANGEROUS FAILURE: "
+                    "Debuggee took longer than %g seconds to run "
+                    "and is still running.\n"
+                    "A break-in request has been made but the debuggee "
+                    "may be dead.\n"
+                    "If the debuggee does come back validate that its "
+                    "state has not be corrupted.",
+                    (double)TimeoutMilliseconds / 1000);
+    }
+
+    ULONG64 RetVal;
+    
+    GetExprU64("@$callret", -1, &RetVal);
+    return RetVal;
 }
 
-HRESULT WINAPI
-ExtExtension::QueryMachineInfo(void)
+ULONG WINAPI
+ExtExtension::FindRegister(_In_ PCSTR Name,
+                           _Inout_opt_ PULONG IndexCache)
 {
     HRESULT Status;
-
-    if ((Status = m_Control->
-         GetEffectiveProcessorType(&m_Machine)) != S_OK ||
-        (Status = m_Control->
-         GetPageSize(&m_PageSize)) != S_OK ||
-        // IsPointer64Bit check must be last as Status
-        // is used to compute the pointer size below.
-        FAILED(Status = m_Control->
-               IsPointer64Bit()))
+    ULONG Index;
+    
+    if (IndexCache != NULL &&
+        *IndexCache != DEBUG_ANY_ID)
     {
-        return Status;
+        return *IndexCache;
     }
-    if (Status == S_OK)
+
+    if ((Status = m_Registers->GetIndexByName(Name,
+                                              &Index)) != S_OK)
     {
-        m_PtrSize = 8;
-        m_OffsetMask = 0xffffffffffffffffUI64;
+        ThrowStatus(Status, "Unable to find register '%s'", Name);
     }
-    else
+
+    if (IndexCache != NULL)
     {
-        m_PtrSize = 4;
-        m_OffsetMask = 0xffffffffUI64;
+        *IndexCache = Index;
     }
 
-    m_ExtRetIndex = DEBUG_ANY_ID;
-    for (ULONG i = 0; i < EXT_DIMA(m_TempRegIndex); i++)
+    return Index;
+}
+
+ULONG64 WINAPI
+ExtExtension::GetRegisterU64(_In_ PCSTR Name,
+                             _Inout_opt_ PULONG IndexCache)
+{
+    HRESULT Status;
+    ULONG Index = FindRegister(Name, IndexCache);
+    DEBUG_VALUE RegVal, RegVal64;
+
+    if ((Status = m_Registers->GetValue(Index,
+                                        &RegVal)) != S_OK ||
+        (Status = m_Control->CoerceValue(&RegVal,
+                                         DEBUG_VALUE_INT64,
+                                         &RegVal64)) != S_OK)
     {
-        m_TempRegIndex[i] = DEBUG_ANY_ID;
+        ThrowStatus(Status, "Unable to get value for '%s'", Name);
     }
-    
-    return S_OK;
+
+    return RegVal64.I64;
 }
 
-#define REQ_IF(_If, _Member) \
-    if ((Status = Start->QueryInterface(__uuidof(_If), \
-                                        (PVOID*)&_Member)) != S_OK) \
-    { \
-        goto Exit; \
-    }
-#define OPT_IF(_If, _Member) \
-    if ((Status = Start->QueryInterface(__uuidof(_If), \
-                                        (PVOID*)&_Member)) != S_OK) \
-    { \
-        _Member.Set(NULL); \
+void WINAPI
+ExtExtension::SetRegisterU64(_In_ PCSTR Name,
+                             _In_ ULONG64 Val,
+                             _Inout_opt_ PULONG IndexCache)
+{
+    HRESULT Status;
+    ULONG Index = FindRegister(Name, IndexCache);
+    DEBUG_VALUE RegVal64;
+
+    RegVal64.Type = DEBUG_VALUE_INT64;
+    RegVal64.I64 = Val;
+    if ((Status = m_Registers->SetValue(Index,
+                                        &RegVal64)) != S_OK)
+    {
+        ThrowStatus(Status, "Unable to set value for '%s'", Name);
     }
+}
 
-HRESULT WINAPI
-ExtExtension::Query(_In_ PDEBUG_CLIENT Start)
+ULONG WINAPI
+ExtExtension::FindPseudoRegister(_In_ PCSTR Name,
+                                 _Inout_opt_ PULONG IndexCache)
 {
     HRESULT Status;
+    ULONG Index;
+    
+    if (IndexCache != NULL &&
+        *IndexCache != DEBUG_ANY_ID)
+    {
+        return *IndexCache;
+    }
 
-    // We don't support nested queries.
-    if (*&m_Advanced != NULL)
+    if ((Status = m_Registers2->GetPseudoIndexByName(Name,
+                                                     &Index)) != S_OK)
     {
-        return E_UNEXPECTED;
+        ThrowStatus(Status, "Unable to find pseudo-register '%s'", Name);
     }
 
-    m_ArgCopy = NULL;
-    
-    REQ_IF(IDebugAdvanced, m_Advanced);
-    REQ_IF(IDebugClient, m_Client);
-    REQ_IF(IDebugControl, m_Control);
-    REQ_IF(IDebugDataSpaces, m_Data);
-    REQ_IF(IDebugRegisters, m_Registers);
-    REQ_IF(IDebugSymbols, m_Symbols);
-    REQ_IF(IDebugSystemObjects, m_System);
-    
-    OPT_IF(IDebugAdvanced2, m_Advanced2);
-    OPT_IF(IDebugAdvanced3, m_Advanced3);
-    OPT_IF(IDebugClient2, m_Client2);
-    OPT_IF(IDebugClient3, m_Client3);
-    OPT_IF(IDebugClient4, m_Client4);
-    OPT_IF(IDebugClient5, m_Client5);
-    OPT_IF(IDebugControl2, m_Control2);
-    OPT_IF(IDebugControl3, m_Control3);
-    OPT_IF(IDebugControl4, m_Control4);
-    OPT_IF(IDebugControl5, m_Control5);
-    OPT_IF(IDebugControl6, m_Control6);
-    OPT_IF(IDebugDataSpaces2, m_Data2);
-    OPT_IF(IDebugDataSpaces3, m_Data3);
-    OPT_IF(IDebugDataSpaces4, m_Data4);
-    OPT_IF(IDebugRegisters2, m_Registers2);
-    OPT_IF(IDebugSymbols2, m_Symbols2);
-    OPT_IF(IDebugSymbols3, m_Symbols3);
-    OPT_IF(IDebugSystemObjects2, m_System2);
-    OPT_IF(IDebugSystemObjects3, m_System3);
-    OPT_IF(IDebugSystemObjects4, m_System4);
-
-    // If this isn't a dump target GetDumpFormatFlags
-    // will fail, so just zero the flags.  People
-    // checking should check the class and qualifier
-    // first so having them zeroed is not a problem.
-    if (!m_Control2.IsSet() ||
-        m_Control2->GetDumpFormatFlags(&m_DumpFormatFlags) != S_OK)
+    if (IndexCache != NULL)
     {
-        m_DumpFormatFlags = 0;
+        *IndexCache = Index;
     }
-    
-    if ((Status = m_Control->
-         GetDebuggeeType(&m_DebuggeeClass,
-                         &m_DebuggeeQual)) != S_OK ||
-        (Status = m_Client->
-         GetOutputWidth(&m_OutputWidth)) != S_OK ||
-        (Status = m_Control->
-         GetActualProcessorType(&m_ActualMachine)) != S_OK ||
-        (Status = QueryMachineInfo()) != S_OK)
+
+    return Index;
+}
+
+ULONG64 WINAPI
+ExtExtension::GetPseudoRegisterU64(_In_ PCSTR Name,
+                                   _Inout_opt_ PULONG IndexCache)
+{
+    HRESULT Status;
+    ULONG Index = FindPseudoRegister(Name, IndexCache);
+    DEBUG_VALUE RegVal, RegVal64;
+
+    if ((Status = m_Registers2->GetPseudoValues(DEBUG_REGSRC_DEBUGGEE,
+                                                1,
+                                                &Index,
+                                                0,
+                                                &RegVal)) != S_OK ||
+        (Status = m_Control->CoerceValue(&RegVal,
+                                         DEBUG_VALUE_INT64,
+                                         &RegVal64)) != S_OK)
     {
-        goto Exit;
+        ThrowStatus(Status, "Unable to get value for '%s'", Name);
     }
 
-    // User targets may fail a processor count request.
-    if (m_Control->GetNumberProcessors(&m_NumProcessors) != S_OK)
+    return RegVal64.I64;
+}
+
+void WINAPI
+ExtExtension::SetPseudoRegisterU64(_In_ PCSTR Name,
+                                   _In_ ULONG64 Val,
+                                   _Inout_opt_ PULONG IndexCache)
+{
+    HRESULT Status;
+    ULONG Index = FindPseudoRegister(Name, IndexCache);
+    DEBUG_VALUE RegVal64;
+
+    RegVal64.Type = DEBUG_VALUE_INT64;
+    RegVal64.I64 = Val;
+    if ((Status = m_Registers2->SetPseudoValues(DEBUG_REGSRC_DEBUGGEE,
+                                                1,
+                                                &Index,
+                                                0,
+                                                &RegVal64)) != S_OK)
     {
-        m_NumProcessors = 0;
+        ThrowStatus(Status, "Unable to set value for '%s'", Name);
     }
-        
-    ExtensionApis.nSize = sizeof(ExtensionApis);
-    Status = m_Control->GetWindbgExtensionApis64(&ExtensionApis);
-    if (Status == RPC_E_CALL_REJECTED)
+}
+
+PCSTR WINAPI
+ExtExtension::GetUnnamedArgStr(_In_ ULONG Index)
+{
+    if (Index >= m_NumUnnamedArgs)
     {
-        // GetWindbgExtensionApis64 is not remotable,
-        // and this particular failure means we
-        // are running remotely.  Go on without any
-        // wdbgexts support.
-        ZeroMemory(&ExtensionApis, sizeof(ExtensionApis));
-        m_IsRemote = true;
-        Status = S_OK;
+        ThrowInvalidArg("Invalid unnamed argument index %u, only given %u",
+                        Index + 1, m_NumUnnamedArgs);
     }
-    else
+    if (!m_Args[Index].StrVal)
     {
-        m_IsRemote = false;
+        ThrowInvalidArg("Unnamed argument index %u is not a string",
+                        Index + 1);
     }
 
-    RefreshOutputCallbackFlags();
+    return m_Args[Index].StrVal;
+}
 
- Exit:
-    if (Status != S_OK)
+ULONG64 WINAPI
+ExtExtension::GetUnnamedArgU64(_In_ ULONG Index)
+{
+    if (Index >= m_NumUnnamedArgs)
     {
-        if (*&m_Control != NULL)
-        {
-            m_Control->Output(DEBUG_OUTPUT_ERROR,
-                              "ERROR: Unable to query interfaces, 0x%08x\n",
-                              Status);
-        }
-        Release();
+        ThrowInvalidArg("Invalid unnamed argument index %u, only given %u",
+                        Index + 1, m_NumUnnamedArgs);
     }
-    return Status;
+    if (m_Args[Index].StrVal)
+    {
+        ThrowInvalidArg("Unnamed argument index %u is not a number",
+                        Index + 1);
+    }
+
+    return m_Args[Index].NumVal;
 }
 
-void WINAPI
-ExtExtension::Release(void)
+PCSTR WINAPI
+ExtExtension::GetArgStr(_In_ PCSTR Name,
+                        _In_ bool Required)
 {
-    EXT_RELEASE(m_Advanced);
-    EXT_RELEASE(m_Client);
-    EXT_RELEASE(m_Control);
-    EXT_RELEASE(m_Data);
-    EXT_RELEASE(m_Registers);
-    EXT_RELEASE(m_Symbols);
-    EXT_RELEASE(m_System);
-    EXT_RELEASE(m_Advanced2);
-    EXT_RELEASE(m_Advanced3);
-    EXT_RELEASE(m_Client2);
-    EXT_RELEASE(m_Client3);
-    EXT_RELEASE(m_Client4);
-    EXT_RELEASE(m_Client5);
-    EXT_RELEASE(m_Control2);
-    EXT_RELEASE(m_Control3);
-    EXT_RELEASE(m_Control4);
-    EXT_RELEASE(m_Control5);
-    EXT_RELEASE(m_Control6);
-    EXT_RELEASE(m_Data2);
-    EXT_RELEASE(m_Data3);
-    EXT_RELEASE(m_Data4);
-    EXT_RELEASE(m_Registers2);
-    EXT_RELEASE(m_Symbols2);
-    EXT_RELEASE(m_Symbols3);
-    EXT_RELEASE(m_System2);
-    EXT_RELEASE(m_System3);
-    EXT_RELEASE(m_System4);
-    ZeroMemory(&ExtensionApis, sizeof(ExtensionApis));
-    free(m_ArgCopy);
-    m_ArgCopy = NULL;
-    m_CurCommand = NULL;
+    ArgVal* Arg = FindArg(Name, Required);
+    if (!Arg)
+    {
+        return NULL;
+    }
+    if (!Arg->StrVal)
+    {
+        ThrowInvalidArg("Argument /%s is not a string",
+                        Name);
+    }
+    return Arg->StrVal;
 }
 
-HRESULT WINAPI
-ExtExtension::CallExtCodeCEH(_In_opt_ ExtCommandDesc* Desc,
-                             _In_opt_ PCSTR Args,
-                             _In_opt_ ExtRawMethod RawMethod,
-                             _In_opt_ ExtRawFunction RawFunction,
-                             _In_opt_ PVOID Context,
-                             _In_opt_ PCSTR RawName)
+ULONG64 WINAPI
+ExtExtension::GetArgU64(_In_ PCSTR Name,
+                        _In_ bool Required)
 {
-    HRESULT Status;
-    PCSTR PreName;
-    PCSTR Name;
-
-    PreName = "";
-
-    if (RawName)
+    ArgVal* Arg = FindArg(Name, Required);
+    if (!Arg)
     {
-        Name = RawName;
+        return 0;
     }
-    else if (Desc)
+    if (Arg->StrVal)
     {
-        PreName = "!";
-        Name = Desc->m_Name;
+        ThrowInvalidArg("Argument /%s is not a number",
+                        Name);
     }
-    else
+    return Arg->NumVal;
+}
+
+bool WINAPI
+ExtExtension::SetUnnamedArg(_In_ ULONG Index,
+                            _In_opt_ PCSTR StrArg,
+                            _In_ ULONG64 NumArg,
+                            _In_ bool OnlyIfUnset)
+{
+    ExtCommandDesc::ArgDesc* Check = m_CurCommand->FindUnnamedArg(Index);
+    if (!Check)
     {
-        Name = NULL;
+        ThrowInvalidArg("Unnamed argument index %u too large", Index);
     }
+
+    ArgVal* Val = NULL;
     
-    try
+    if (HasUnnamedArg(Index))
     {
-        ExInitialize();
-
-        if (Desc)
+        if (OnlyIfUnset)
         {
-            Desc->ExInitialize(this);
-            ParseArgs(Desc, Args);
+            return false;
         }
-        
-        m_CallStatus = S_OK;
-        // Release NULLs this out.
-        m_CurCommand = Desc;
 
-        if (RawFunction)
-        {
-            Status = RawFunction(Context);
-        }
-        else if (RawMethod)
-        {
-            Status = (this->*RawMethod)(Context);
-        }
-        else if (Desc)
-        {
-            (this->*Desc->m_Method)();
-            Status = m_CallStatus;
-        }
-        else
-        {
-            // This should never happen.
-            Status = E_INVALIDARG;
-        }
+        Val = &m_Args[Index];
     }
-    catch(ExtInterruptException Ex)
+
+    SetRawArgVal(Check, Val, true, StrArg, false, NumArg);
+    return true;
+}
+
+bool WINAPI
+ExtExtension::SetArg(_In_ PCSTR Name,
+                     _In_opt_ PCSTR StrArg,
+                     _In_ ULONG64 NumArg,
+                     _In_ bool OnlyIfUnset)
+{
+    ExtCommandDesc::ArgDesc* Check = m_CurCommand->FindArg(Name);
+    if (!Check)
     {
-        if (Name)
-        {
-            m_Control->Output(DEBUG_OUTPUT_ERROR, "%s%s: %s.\n",
-                              PreName, Name, Ex.GetMessage());
-        }
-        Status = Ex.GetStatus();
+        ThrowInvalidArg("No argument named '%s'", Name);
     }
-    catch(ExtException Ex)
+
+    ArgVal* Val = FindArg(Name, false);
+
+    if (Val)
     {
-        if (Name &&
-            Ex.GetMessage())
-        {
-            if (FAILED(Ex.GetStatus()))
-            {
-                m_Control->
-                    Output(DEBUG_OUTPUT_ERROR,
-                           "ERROR: %s%s: extension exception "
-                           "0x%08x.\n    \"%s\"\n",
-                           PreName, Name,
-                           Ex.GetStatus(), Ex.GetMessage());
-            }
-            else
-            {
-                m_Control->Output(DEBUG_OUTPUT_NORMAL, "%s%s: %s\n",
-                                  PreName, Name, Ex.GetMessage());
-            }
-        }
-        else if (Name &&
-                 Ex.GetStatus() != DEBUG_EXTENSION_CONTINUE_SEARCH &&
-                 Ex.GetStatus() != DEBUG_EXTENSION_RELOAD_EXTENSION &&
-                 FAILED(Ex.GetStatus()))
+        if (OnlyIfUnset)
         {
-            m_Control->
-                Output(DEBUG_OUTPUT_ERROR,
-                       "ERROR: %s%s: extension exception 0x%08x.\n",
-                       PreName, Name, Ex.GetStatus());
+            return false;
         }
-        
-        Status = Ex.GetStatus();
     }
 
-    return Status;
+    SetRawArgVal(Check, Val, true, StrArg, false, NumArg);
+    return true;
 }
 
-HRESULT WINAPI
-ExtExtension::CallExtCodeSEH(_In_opt_ ExtCommandDesc* Desc,
-                             _In_ PDEBUG_CLIENT Client,
-                             _In_opt_ PCSTR Args,
-                             _In_opt_ ExtRawMethod RawMethod,
-                             _In_opt_ ExtRawFunction RawFunction,
-                             _In_opt_ PVOID Context,
-                             _In_opt_ PCSTR RawName)
+PCSTR WINAPI
+ExtExtension::GetExpr64(_In_ PCSTR Str,
+                        _In_ bool Signed,
+                        _In_ ULONG64 Limit,
+                        _Out_ PULONG64 Val)
 {
-    HRESULT Status = Query(Client);
-    if (Status != S_OK)
+    HRESULT Status;
+    DEBUG_VALUE FullVal;
+    ULONG EndIdx;
+
+    if ((Status = m_Control->
+         Evaluate(Str, DEBUG_VALUE_INT64, &FullVal, &EndIdx)) != S_OK)
     {
-        return Status;
+        ThrowStatus(Status, "Unable to evaluate expression '%s'", Str);
     }
-
-    // Use a hard SEH try/finally to guarantee that
-    // Release always occurs.
-    __try
+    if ((!Signed &&
+         FullVal.I64 > Limit) ||
+        (Signed &&
+         ((LONG64)FullVal.I64 < -(LONG64)Limit ||
+          (LONG64)FullVal.I64 > (LONG64)Limit)))
     {
-        Status = CallExtCodeCEH(Desc, Args,
-                                RawMethod, RawFunction, Context, RawName);
+        ThrowInvalidArg("Result overflow in expression '%s'", Str);
     }
-    __finally
+
+    *Val = FullVal.I64;
+    Str += EndIdx;
+
+    while (IsSpace(*Str))
     {
-        Release();
+        Str++;
     }
 
-    return Status;
+    return Str;
 }
 
-HRESULT WINAPI
-ExtExtension::CallKnownStructMethod(_In_ ExtKnownStruct* Struct,
-                                    _In_ ULONG Flags,
-                                    _In_ ULONG64 Offset,
-                                    _Out_writes_(*BufferChars) PSTR Buffer,
-                                    _Inout_ PULONG BufferChars)
+void WINAPIV
+ExtExtension::ThrowInvalidArg(_In_ PCSTR Format,
+                              ...)
 {
-    HRESULT Status;
-    
-    try
+    ExtInvalidArgumentException Ex("");
+    va_list Args;
+    PSTR Message;
+
+    // The status matters more than the message so
+    // a formatting failure just leaves it empty.
+    va_start(Args, Format);
+    Message = FormatThreadStringVa(Format, Args);
+    va_end(Args);
+    if (Message)
     {
-        ExInitialize();
-        SetAppendBuffer(Buffer, *BufferChars);
-        
-        m_CallStatus = S_OK;
+        Ex.SetMessage(Message);
+    }
+    throw Ex;
+}
 
-        (this->*Struct->Method)(Struct->TypeName, Flags, Offset);
+void WINAPIV
+ExtExtension::ThrowRemote(_In_ HRESULT Status,
+                          _In_ PCSTR Format,
+                          ...)
+{
+    ExtRemoteException Ex(Status, "");
+    va_list Args;
+    PSTR Message;
 
-        Status = m_CallStatus;
+    va_start(Args, Format);
+    Message = FormatThreadStringVa(Format, Args);
+    va_end(Args);
+    if (Message)
+    {
+        Ex.SetMessage(Message);
     }
-    catch(ExtException Ex)
+    throw Ex;
+}
+
+void WINAPIV
+ExtExtension::ThrowStatus(_In_ HRESULT Status,
+                          _In_ PCSTR Format,
+                          ...)
+{
+    ExtStatusException Ex(Status);
+    va_list Args;
+    PSTR Message;
+
+    va_start(Args, Format);
+    Message = FormatThreadStringVa(Format, Args);
+    va_end(Args);
+    if (Message)
     {
-        Status = Ex.GetStatus();
+        Ex.SetMessage(Message);
     }
+    throw Ex;
+}
 
-    return Status;
+void WINAPI
+ExtExtension::ExInitialize(void)
+{
+    if (m_ExInitialized)
+    {
+        return;
+    }
+
+    m_ExInitialized = true;
+
+    //
+    // Special initialization pass that
+    // is done when output can be produced
+    // and exceptions thrown.
+    // This pass allows verbose feedback on
+    // errors, as opposed to the DLL-load Initialize().
+    //
 }
 
 HRESULT WINAPI
-ExtExtension::CallKnownStruct(_In_ PDEBUG_CLIENT Client,
-                              _In_ ExtKnownStruct* Struct,
-                              _In_ ULONG Flags,
-                              _In_ ULONG64 Offset,
-                              _Out_writes_(*BufferChars) PSTR Buffer,
-                              _Inout_ PULONG BufferChars)
+ExtExtension::BuildCommandTable(void)
 {
-    HRESULT Status = Query(Client);
-    if (Status != S_OK)
+    ExtCommandDesc* Desc;
+    ULONG Count = 0;
+    ULONG Slots = 16;
+
+    free(m_CommandTable);
+    m_CommandTable = NULL;
+    m_CommandTableMask = 0;
+    
+    for (Desc = m_Commands; Desc; Desc = Desc->m_Next)
     {
-        return Status;
+        Count++;
+    }
+    while (Slots < Count * 2)
+    {
+        Slots *= 2;
     }
 
-    // Use a hard SEH try/finally to guarantee that
-    // Release always occurs.
-    __try
+    m_CommandTable = (ExtCommandDesc**)calloc(Slots, sizeof(*m_CommandTable));
+    if (!m_CommandTable)
     {
-        Status = CallKnownStructMethod(Struct, Flags, Offset,
-                                       Buffer, BufferChars);
+        return E_OUTOFMEMORY;
     }
-    __finally
+    m_CommandTableMask = Slots - 1;
+
+    for (Desc = m_Commands; Desc; Desc = Desc->m_Next)
     {
-        Release();
+        ULONG Slot = Desc->m_NameHash & m_CommandTableMask;
+        
+        while (m_CommandTable[Slot])
+        {
+            // The list is sorted so the first of any
+            // duplicate names is the one help shows.
+            if (!strcmp(m_CommandTable[Slot]->m_Name, Desc->m_Name))
+            {
+                break;
+            }
+            Slot = (Slot + 1) & m_CommandTableMask;
+        }
+        if (!m_CommandTable[Slot])
+        {
+            m_CommandTable[Slot] = Desc;
+        }
     }
 
-    return Status;
+    return S_OK;
 }
 
 HRESULT WINAPI
-ExtExtension::HandleKnownStruct(_In_ PDEBUG_CLIENT Client,
-                                _In_ ULONG Flags,
-                                _In_ ULONG64 Offset,
-                                _In_opt_ PCSTR TypeName,
-                                _Out_writes_opt_(*BufferChars) PSTR Buffer,
-                                _Inout_opt_ PULONG BufferChars)
+ExtExtension::BuildKnownStructTable(void)
 {
-    HRESULT Status;
-    ExtKnownStruct* Struct = m_KnownStructs;
+    ExtKnownStruct* Struct;
+    ULONG Count = 0;
+    ULONG Slots = 16;
+
+    free(m_KnownStructTable);
+    m_KnownStructTable = NULL;
+    m_KnownStructTableMask = 0;
+    m_KnownStructTableSource = m_KnownStructs;
+
+    if (!m_KnownStructs)
+    {
+        return S_OK;
+    }
     
-    if (Flags == DEBUG_KNOWN_STRUCT_GET_NAMES &&
-        Buffer != NULL &&
-        *BufferChars > 0)
+    for (Struct = m_KnownStructs; Struct->TypeName; Struct++)
     {
-        ULONG CharsNeeded;
-        
-        //
-        // Return names of known structs packed in
-        // the output buffer.
-        //
+        Count++;
+    }
+    while (Slots < Count * 2)
+    {
+        Slots *= 2;
+    }
 
-        // Save a character for the double terminator.
-        (*BufferChars)--;
-        CharsNeeded = 1;
+    m_KnownStructTable = (ExtKnownStruct**)
+        calloc(Slots, sizeof(*m_KnownStructTable));
+    if (!m_KnownStructTable)
+    {
+        m_KnownStructTableSource = NULL;
+        return E_OUTOFMEMORY;
+    }
+    m_KnownStructTableMask = Slots - 1;
 
-        Status = S_OK;
-        while (Struct && Struct->TypeName)
+    for (Struct = m_KnownStructs; Struct->TypeName; Struct++)
+    {
+        ULONG Slot = ExtCommandDesc::HashName(Struct->TypeName) &
+            m_KnownStructTableMask;
+        
+        while (m_KnownStructTable[Slot])
         {
-            ULONG Chars = strlen(Struct->TypeName) + 1;
-            CharsNeeded += Chars;
-            
-            if (Status != S_OK || *BufferChars < Chars)
-            {
-                Status = S_FALSE;
-            }
-            else
+            // The first of any duplicate names wins,
+            // as with the old array scan.
+            if (!strcmp(m_KnownStructTable[Slot]->TypeName,
+                        Struct->TypeName))
             {
-                memcpy(Buffer, Struct->TypeName, Chars * sizeof(*Buffer));
-                Buffer += Chars;
-                (*BufferChars) -= Chars;
+                break;
             }
-            
-            Struct++;
+            Slot = (Slot + 1) & m_KnownStructTableMask;
+        }
+        if (!m_KnownStructTable[Slot])
+        {
+            m_KnownStructTable[Slot] = Struct;
         }
-
-        *Buffer = 0;
-        *BufferChars = CharsNeeded;
     }
-    else if (Flags == DEBUG_KNOWN_STRUCT_GET_SINGLE_LINE_OUTPUT &&
-             Buffer != NULL &&
-             BufferChars > 0)
-    {
-        //
-        // Dispatch request to method.
-        //
 
-        Status = E_NOINTERFACE;
-        while (Struct && Struct->TypeName)
-        {
-            if (!strcmp(TypeName, Struct->TypeName))
-            {
-                Status = CallKnownStruct(Client, Struct, Flags, Offset,
-                                         Buffer, BufferChars);
-                break;
-            }
+    return S_OK;
+}
 
-            Struct++;
-        }
+ExtKnownStruct* WINAPI
+ExtExtension::FindKnownStruct(_In_opt_ PCSTR TypeName)
+{
+    if (!TypeName)
+    {
+        return NULL;
     }
-    else if (Flags == DEBUG_KNOWN_STRUCT_SUPPRESS_TYPE_NAME)
+    
+    if (m_KnownStructTableSource != m_KnownStructs &&
+        BuildKnownStructTable() != S_OK)
     {
-        //
-        // Determine if formatting method suppresses the type name.
-        //
+        return NULL;
+    }
+    if (!m_KnownStructTable)
+    {
+        return NULL;
+    }
 
-        Status = E_NOINTERFACE;
-        while (Struct && Struct->TypeName)
-        {
-            if (!strcmp(TypeName, Struct->TypeName))
-            {
-                Status = Struct->SuppressesTypeName ? S_OK : S_FALSE;
-                break;
-            }
+    ULONG Slot = ExtCommandDesc::HashName(TypeName) &
+        m_KnownStructTableMask;
+    ExtKnownStruct* Struct;
 
-            Struct++;
-        }
-    }
-    else
+    while ((Struct = m_KnownStructTable[Slot]) != NULL)
     {
-        Status = E_INVALIDARG;
+        if (!strcmp(Struct->TypeName, TypeName))
+        {
+            return Struct;
+        }
+        Slot = (Slot + 1) & m_KnownStructTableMask;
     }
 
-    return Status;
+    return NULL;
 }
 
-HRESULT WINAPI
-ExtExtension::HandleQueryValueNames(_In_ PDEBUG_CLIENT Client,
-                                    _In_ ULONG Flags,
-                                    _Out_writes_(BufferChars) PWSTR Buffer,
-                                    _In_ ULONG BufferChars,
-                                    _Out_ PULONG BufferNeeded)
+ExtCommandDesc* WINAPI
+ExtExtension::FindCommand(_In_ PCSTR Name)
 {
-    HRESULT Status;
-
-    UNREFERENCED_PARAMETER(Client);
-    UNREFERENCED_PARAMETER(Flags);
-
-    if (Buffer == NULL ||
-        BufferChars < 1)
+    if (!m_CommandTable)
     {
-        return E_INVALIDARG;
+        return NULL;
     }
-    
-    ExtProvidedValue* ExtVal = m_ProvidedValues;
-    ULONG CharsNeeded;
-        
-    //
-    // Return names of values packed in
-    // the output buffer.
-    //
 
-    // Save a character for the double terminator.
-    BufferChars--;
-    CharsNeeded = 1;
+    ULONG Hash = ExtCommandDesc::HashName(Name);
+    ULONG Slot = Hash & m_CommandTableMask;
+    ExtCommandDesc* Desc;
 
-    Status = S_OK;
-    while (ExtVal && ExtVal->ValueName)
+    while ((Desc = m_CommandTable[Slot]) != NULL)
     {
-        ULONG Chars = wcslen(ExtVal->ValueName) + 1;
-        CharsNeeded += Chars;
-            
-        if (Status != S_OK || BufferChars < Chars)
-        {
-            Status = S_FALSE;
-        }
-        else
+        if (Desc->m_NameHash == Hash &&
+            !strcmp(Desc->m_Name, Name))
         {
-            memcpy(Buffer, ExtVal->ValueName, Chars * sizeof(*Buffer));
-            Buffer += Chars;
-            BufferChars -= Chars;
+            return Desc;
         }
-            
-        ExtVal++;
+        Slot = (Slot + 1) & m_CommandTableMask;
     }
 
-    *Buffer = 0;
-    *BufferNeeded = CharsNeeded;
-
-    return Status;
+    return NULL;
 }
 
 HRESULT WINAPI
-ExtExtension::CallProvideValueMethod(_In_ ExtProvidedValue* ExtVal,
-                                     _In_ ULONG Flags,
-                                     _Out_ PULONG64 Value,
-                                     _Out_ PULONG64 TypeModBase,
-                                     _Out_ PULONG TypeId,
-                                     _Out_ PULONG TypeFlags)
+ExtExtension::CallCommandName(_In_ PDEBUG_CLIENT Client,
+                              _In_ PCSTR Name,
+                              _In_opt_ PCSTR Args)
 {
-    HRESULT Status;
-    
-    try
-    {
-        ExInitialize();
-        
-        m_CallStatus = S_OK;
-
-        (this->*ExtVal->Method)(Flags, ExtVal->ValueName,
-                                Value, TypeModBase, TypeId, TypeFlags);
+    ExtCommandDesc* Desc = FindCommand(Name);
 
-        Status = m_CallStatus;
-    }
-    catch(ExtException Ex)
+    // Explicit descs have no method to call.
+    if (!Desc ||
+        !Desc->m_Method)
     {
-        Status = Ex.GetStatus();
+        return E_NOINTERFACE;
     }
 
-    return Status;
+    return CallCommand(Desc, Client, Args);
 }
 
 HRESULT WINAPI
-ExtExtension::HandleProvideValue(_In_ PDEBUG_CLIENT Client,
-                                 _In_ ULONG Flags,
-                                 _In_ PCWSTR Name,
-                                 _Out_ PULONG64 Value,
-                                 _Out_ PULONG64 TypeModBase,
-                                 _Out_ PULONG TypeId,
-                                 _Out_ PULONG TypeFlags)
+ExtExtension::QueryMachineInfo(void)
 {
-    HRESULT Status = Query(Client);
-    if (Status != S_OK)
-    {
-        return Status;
-    }
+    HRESULT Status;
 
-    // Use a hard SEH try/finally to guarantee that
-    // Release always occurs.
-    __try
+    if ((Status = m_Control->
+         GetEffectiveProcessorType(&m_Machine)) != S_OK ||
+        (Status = m_Control->
+         GetPageSize(&m_PageSize)) != S_OK ||
+        // IsPointer64Bit check must be last as Status
+        // is used to compute the pointer size below.
+        FAILED(Status = m_Control->
+               IsPointer64Bit()))
     {
-        ExtProvidedValue* ExtVal = m_ProvidedValues;
-        while (ExtVal && ExtVal->ValueName)
-        {
-            if (wcscmp(Name, ExtVal->ValueName) == 0)
-            {
-                break;
-            }
-
-            ExtVal++;
-        }
-        if (!ExtVal)
-        {
-            Status = E_UNEXPECTED;
-        }
-        else
-        {
-            Status = CallProvideValueMethod(ExtVal, Flags,
-                                            Value, TypeModBase,
-                                            TypeId, TypeFlags);
-        }
+        return Status;
     }
-    __finally
+    if (Status == S_OK)
     {
-        Release();
+        m_PtrSize = 8;
+        m_OffsetMask = 0xffffffffffffffffUI64;
     }
-
-    return Status;
-}
-
-ExtExtension::ArgVal* WINAPI
-ExtExtension::FindArg(_In_ PCSTR Name,
-                      _In_ bool Required)
-{
-    ULONG i;
-
-    for (i = m_FirstNamedArg; i < m_FirstNamedArg + m_NumNamedArgs; i++)
+    else
     {
-        if (!strcmp(Name, m_Args[i].Name))
-        {
-            return &m_Args[i];
-        }
+        m_PtrSize = 4;
+        m_OffsetMask = 0xffffffffUI64;
     }
 
-    if (Required)
+    m_ExtRetIndex = DEBUG_ANY_ID;
+    for (ULONG i = 0; i < EXT_DIMA(m_TempRegIndex); i++)
     {
-        ThrowInvalidArg("No argument /%s was provided", Name);
+        m_TempRegIndex[i] = DEBUG_ANY_ID;
     }
     
-    return NULL;
+    return S_OK;
 }
 
-PCSTR WINAPI
-ExtExtension::SetRawArgVal(_In_ ExtCommandDesc::ArgDesc* Check,
-                           _In_opt_ ArgVal* Val,
-                           _In_ bool ExplicitVal,
-                           _In_opt_ PCSTR StrVal,
-                           _In_ bool StrWritable,
-                           _In_ ULONG64 NumVal)
+#define REQ_IF(_If, _Member) \
+    if ((Status = Start->QueryInterface(__uuidof(_If), \
+                                        (PVOID*)&_Member)) != S_OK) \
+    { \
+        goto Exit; \
+    }
+#define OPT_IF(_If, _Member) \
+    if ((Status = Start->QueryInterface(__uuidof(_If), \
+                                        (PVOID*)&_Member)) != S_OK) \
+    { \
+        _Member.Set(NULL); \
+    }
+
+HRESULT WINAPI
+ExtExtension::Query(_In_ PDEBUG_CLIENT Start)
 {
-    if (!Val)
-    {
-        if (Check->Name)
-        {
-            if (m_NumNamedArgs + m_FirstNamedArg >= EXT_DIMA(m_Args))
-            {
-                ThrowInvalidArg("Argument overflow on '%s'",
-                                Check->Name);
-            }
+    HRESULT Status;
 
-            Val = &m_Args[m_NumNamedArgs + m_FirstNamedArg];
-            m_NumArgs++;
-            m_NumNamedArgs++;
-        }
-        else
-        {
-            Val = &m_Args[m_NumUnnamedArgs];
-            m_NumArgs++;
-            m_NumUnnamedArgs++;
-        }
+    // We don't support nested queries.
+    if (*&m_Advanced != NULL)
+    {
+        return E_UNEXPECTED;
     }
 
-    Check->Present = true;
-    Val->Name = Check->Name;
-    Val->StrVal = NULL;
-    Val->NumVal = 0;
+    m_ArgCopy = NULL;
 
-    if (Check->Boolean)
+    if (!m_ReadCacheKeep)
     {
-        return StrVal;
+        FlushReadCache();
     }
+    m_ReadCacheChecked = false;
 
-    if (StrVal)
-    {
-        while (IsSpace(*StrVal))
-        {
-            StrVal++;
-        }
-        if (!*StrVal &&
-            !ExplicitVal)
-        {
-            ThrowInvalidArg("Missing value for argument '%s'",
-                            Check->Name);
-        }
+    // Symbols may have changed since the last call.
+    m_TypeCacheChecked = false;
 
-        if (Check->String)
-        {
-            Val->StrVal = StrVal;
-            if (Check->StringRemainder)
-            {
-                StrVal += strlen(StrVal);
-            }
-            else
+    // Check for an interrupt on the first primitive.
+    m_InterruptPollCountdown = 0;
+
+    // Strings from the previous call on this
+    // thread are no longer in use.
+    ResetThreadStrings();
+    
+    REQ_IF(IDebugAdvanced, m_Advanced);
+    REQ_IF(IDebugClient, m_Client);
+    REQ_IF(IDebugControl, m_Control);
+    REQ_IF(IDebugDataSpaces, m_Data);
+    REQ_IF(IDebugRegisters, m_Registers);
+    REQ_IF(IDebugSymbols, m_Symbols);
+    REQ_IF(IDebugSystemObjects, m_System);
+    
+    OPT_IF(IDebugAdvanced2, m_Advanced2);
+    OPT_IF(IDebugAdvanced3, m_Advanced3);
+    OPT_IF(IDebugClient2, m_Client2);
+    OPT_IF(IDebugClient3, m_Client3);
+    OPT_IF(IDebugClient4, m_Client4);
+    OPT_IF(IDebugClient5, m_Client5);
+    OPT_IF(IDebugControl2, m_Control2);
+    OPT_IF(IDebugControl3, m_Control3);
+    OPT_IF(IDebugControl4, m_Control4);
+    OPT_IF(IDebugControl5, m_Control5);
+    OPT_IF(IDebugControl6, m_Control6);
+    OPT_IF(IDebugDataSpaces2, m_Data2);
+    OPT_IF(IDebugDataSpaces3, m_Data3);
+    OPT_IF(IDebugDataSpaces4, m_Data4);
+    OPT_IF(IDebugRegisters2, m_Registers2);
+    OPT_IF(IDebugSymbols2, m_Symbols2);
+    OPT_IF(IDebugSymbols3, m_Symbols3);
+    OPT_IF(IDebugSystemObjects2, m_System2);
+    OPT_IF(IDebugSystemObjects3, m_System3);
+    OPT_IF(IDebugSystemObjects4, m_System4);
+
+    // If this isn't a dump target GetDumpFormatFlags
+    // will fail, so just zero the flags.  People
+    // checking should check the class and qualifier
+    // first so having them zeroed is not a problem.
+    if (!m_Control2.IsSet() ||
+        m_Control2->GetDumpFormatFlags(&m_DumpFormatFlags) != S_OK)
+    {
+        m_DumpFormatFlags = 0;
+    }
+    
+    if ((Status = m_Control->
+         GetDebuggeeType(&m_DebuggeeClass,
+                         &m_DebuggeeQual)) != S_OK ||
+        (Status = m_Client->
+         GetOutputWidth(&m_OutputWidth)) != S_OK ||
+        (Status = m_Control->
+         GetActualProcessorType(&m_ActualMachine)) != S_OK ||
+        (Status = QueryMachineInfo()) != S_OK)
+    {
+        goto Exit;
+    }
+
+    // User targets may fail a processor count request.
+    if (m_Control->GetNumberProcessors(&m_NumProcessors) != S_OK)
+    {
+        m_NumProcessors = 0;
+    }
+        
+    ExtensionApis.nSize = sizeof(ExtensionApis);
+    Status = m_Control->GetWindbgExtensionApis64(&ExtensionApis);
+    if (Status == RPC_E_CALL_REJECTED)
+    {
+        // GetWindbgExtensionApis64 is not remotable,
+        // and this particular failure means we
+        // are running remotely.  Go on without any
+        // wdbgexts support.
+        ZeroMemory(&ExtensionApis, sizeof(ExtensionApis));
+        m_IsRemote = true;
+        Status = S_OK;
+    }
+    else
+    {
+        m_IsRemote = false;
+    }
+
+    RefreshOutputCallbackFlags();
+
+ Exit:
+    if (Status != S_OK)
+    {
+        if (*&m_Control != NULL)
+        {
+            m_Control->Output(DEBUG_OUTPUT_ERROR,
+                              "ERROR: Unable to query interfaces, 0x%08x\n",
+                              Status);
+        }
+        Release();
+    }
+    return Status;
+}
+
+void WINAPI
+ExtExtension::Release(void)
+{
+    // Anything still buffered belongs to this call.
+    if (m_Control.IsSet())
+    {
+        FlushOutWrap();
+    }
+    
+    EXT_RELEASE(m_Advanced);
+    EXT_RELEASE(m_Client);
+    EXT_RELEASE(m_Control);
+    EXT_RELEASE(m_Data);
+    EXT_RELEASE(m_Registers);
+    EXT_RELEASE(m_Symbols);
+    EXT_RELEASE(m_System);
+    EXT_RELEASE(m_Advanced2);
+    EXT_RELEASE(m_Advanced3);
+    EXT_RELEASE(m_Client2);
+    EXT_RELEASE(m_Client3);
+    EXT_RELEASE(m_Client4);
+    EXT_RELEASE(m_Client5);
+    EXT_RELEASE(m_Control2);
+    EXT_RELEASE(m_Control3);
+    EXT_RELEASE(m_Control4);
+    EXT_RELEASE(m_Control5);
+    EXT_RELEASE(m_Control6);
+    EXT_RELEASE(m_Data2);
+    EXT_RELEASE(m_Data3);
+    EXT_RELEASE(m_Data4);
+    EXT_RELEASE(m_Registers2);
+    EXT_RELEASE(m_Symbols2);
+    EXT_RELEASE(m_Symbols3);
+    EXT_RELEASE(m_System2);
+    EXT_RELEASE(m_System3);
+    EXT_RELEASE(m_System4);
+    ZeroMemory(&ExtensionApis, sizeof(ExtensionApis));
+    free(m_ArgCopy);
+    m_ArgCopy = NULL;
+    m_CurCommand = NULL;
+}
+
+HRESULT WINAPI
+ExtExtension::CallExtCodeCEH(_In_opt_ ExtCommandDesc* Desc,
+                             _In_opt_ PCSTR Args,
+                             _In_opt_ ExtRawMethod RawMethod,
+                             _In_opt_ ExtRawFunction RawFunction,
+                             _In_opt_ PVOID Context,
+                             _In_opt_ PCSTR RawName)
+{
+    HRESULT Status;
+    PCSTR PreName;
+    PCSTR Name;
+
+    PreName = "";
+
+    if (RawName)
+    {
+        Name = RawName;
+    }
+    else if (Desc)
+    {
+        PreName = "!";
+        Name = Desc->m_Name;
+    }
+    else
+    {
+        Name = NULL;
+    }
+    
+    try
+    {
+        ExInitialize();
+
+        if (Desc)
+        {
+            Desc->ExInitialize(this);
+            ParseArgs(Desc, Args);
+        }
+        
+        m_CallStatus = S_OK;
+        // Release NULLs this out.
+        m_CurCommand = Desc;
+
+        if (RawFunction)
+        {
+            Status = RawFunction(Context);
+        }
+        else if (RawMethod)
+        {
+            Status = (this->*RawMethod)(Context);
+        }
+        else if (Desc)
+        {
+            (this->*Desc->m_Method)();
+            Status = m_CallStatus;
+        }
+        else
+        {
+            // This should never happen.
+            Status = E_INVALIDARG;
+        }
+    }
+    catch(ExtInterruptException Ex)
+    {
+        if (Name)
+        {
+            m_Control->Output(DEBUG_OUTPUT_ERROR, "%s%s: %s.\n",
+                              PreName, Name, Ex.GetMessage());
+        }
+        Status = Ex.GetStatus();
+    }
+    catch(ExtException Ex)
+    {
+        if (Name &&
+            Ex.GetMessage())
+        {
+            if (FAILED(Ex.GetStatus()))
+            {
+                m_Control->
+                    Output(DEBUG_OUTPUT_ERROR,
+                           "ERROR: %s%s: extension exception "
+                           "0x%08x.\n    \"%s\"\n",
+                           PreName, Name,
+                           Ex.GetStatus(), Ex.GetMessage());
+            }
+            else
+            {
+                m_Control->Output(DEBUG_OUTPUT_NORMAL, "%s%s: %s\n",
+                                  PreName, Name, Ex.GetMessage());
+            }
+        }
+        else if (Name &&
+                 Ex.GetStatus() != DEBUG_EXTENSION_CONTINUE_SEARCH &&
+                 Ex.GetStatus() != DEBUG_EXTENSION_RELOAD_EXTENSION &&
+                 FAILED(Ex.GetStatus()))
+        {
+            m_Control->
+                Output(DEBUG_OUTPUT_ERROR,
+                       "ERROR: %s%s: extension exception 0x%08x.\n",
+                       PreName, Name, Ex.GetStatus());
+        }
+        
+        Status = Ex.GetStatus();
+    }
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::CallExtCodeSEH(_In_opt_ ExtCommandDesc* Desc,
+                             _In_ PDEBUG_CLIENT Client,
+                             _In_opt_ PCSTR Args,
+                             _In_opt_ ExtRawMethod RawMethod,
+                             _In_opt_ ExtRawFunction RawFunction,
+                             _In_opt_ PVOID Context,
+                             _In_opt_ PCSTR RawName)
+{
+    HRESULT Status = Query(Client);
+    if (Status != S_OK)
+    {
+        return Status;
+    }
+
+    // Use a hard SEH try/finally to guarantee that
+    // Release always occurs.
+    __try
+    {
+        Status = CallExtCodeCEH(Desc, Args,
+                                RawMethod, RawFunction, Context, RawName);
+    }
+    __finally
+    {
+        Release();
+    }
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::CallKnownStructMethod(_In_ ExtKnownStruct* Struct,
+                                    _In_ ULONG Flags,
+                                    _In_ ULONG64 Offset,
+                                    _Out_writes_(*BufferChars) PSTR Buffer,
+                                    _Inout_ PULONG BufferChars)
+{
+    HRESULT Status;
+    
+    try
+    {
+        ExInitialize();
+        SetAppendBuffer(Buffer, *BufferChars);
+        
+        m_CallStatus = S_OK;
+
+        (this->*Struct->Method)(Struct->TypeName, Flags, Offset);
+
+        Status = m_CallStatus;
+    }
+    catch(ExtException Ex)
+    {
+        Status = Ex.GetStatus();
+    }
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::CallKnownStruct(_In_ PDEBUG_CLIENT Client,
+                              _In_ ExtKnownStruct* Struct,
+                              _In_ ULONG Flags,
+                              _In_ ULONG64 Offset,
+                              _Out_writes_(*BufferChars) PSTR Buffer,
+                              _Inout_ PULONG BufferChars)
+{
+    HRESULT Status = Query(Client);
+    if (Status != S_OK)
+    {
+        return Status;
+    }
+
+    // Use a hard SEH try/finally to guarantee that
+    // Release always occurs.
+    __try
+    {
+        Status = CallKnownStructMethod(Struct, Flags, Offset,
+                                       Buffer, BufferChars);
+    }
+    __finally
+    {
+        Release();
+    }
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::HandleKnownStruct(_In_ PDEBUG_CLIENT Client,
+                                _In_ ULONG Flags,
+                                _In_ ULONG64 Offset,
+                                _In_opt_ PCSTR TypeName,
+                                _Out_writes_opt_(*BufferChars) PSTR Buffer,
+                                _Inout_opt_ PULONG BufferChars)
+{
+    HRESULT Status;
+    ExtKnownStruct* Struct = m_KnownStructs;
+    
+    if (Flags == DEBUG_KNOWN_STRUCT_GET_NAMES &&
+        Buffer != NULL &&
+        *BufferChars > 0)
+    {
+        ULONG CharsNeeded;
+        
+        //
+        // Return names of known structs packed in
+        // the output buffer.
+        //
+
+        // Save a character for the double terminator.
+        (*BufferChars)--;
+        CharsNeeded = 1;
+
+        Status = S_OK;
+        while (Struct && Struct->TypeName)
+        {
+            ULONG Chars = strlen(Struct->TypeName) + 1;
+            CharsNeeded += Chars;
+            
+            if (Status != S_OK || *BufferChars < Chars)
+            {
+                Status = S_FALSE;
+            }
+            else
+            {
+                memcpy(Buffer, Struct->TypeName, Chars * sizeof(*Buffer));
+                Buffer += Chars;
+                (*BufferChars) -= Chars;
+            }
+            
+            Struct++;
+        }
+
+        *Buffer = 0;
+        *BufferChars = CharsNeeded;
+    }
+    else if (Flags == DEBUG_KNOWN_STRUCT_GET_SINGLE_LINE_OUTPUT &&
+             Buffer != NULL &&
+             BufferChars > 0)
+    {
+        //
+        // Dispatch request to method.
+        //
+
+        Struct = FindKnownStruct(TypeName);
+        if (Struct)
+        {
+            Status = CallKnownStruct(Client, Struct, Flags, Offset,
+                                     Buffer, BufferChars);
+        }
+        else
+        {
+            Status = E_NOINTERFACE;
+        }
+    }
+    else if (Flags == DEBUG_KNOWN_STRUCT_SUPPRESS_TYPE_NAME)
+    {
+        //
+        // Determine if formatting method suppresses the type name.
+        //
+
+        Struct = FindKnownStruct(TypeName);
+        if (Struct)
+        {
+            Status = Struct->SuppressesTypeName ? S_OK : S_FALSE;
+        }
+        else
+        {
+            Status = E_NOINTERFACE;
+        }
+    }
+    else
+    {
+        Status = E_INVALIDARG;
+    }
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::HandleQueryValueNames(_In_ PDEBUG_CLIENT Client,
+                                    _In_ ULONG Flags,
+                                    _Out_writes_(BufferChars) PWSTR Buffer,
+                                    _In_ ULONG BufferChars,
+                                    _Out_ PULONG BufferNeeded)
+{
+    HRESULT Status;
+
+    UNREFERENCED_PARAMETER(Client);
+    UNREFERENCED_PARAMETER(Flags);
+
+    if (Buffer == NULL ||
+        BufferChars < 1)
+    {
+        return E_INVALIDARG;
+    }
+    
+    ExtProvidedValue* ExtVal = m_ProvidedValues;
+    ULONG CharsNeeded;
+        
+    //
+    // Return names of values packed in
+    // the output buffer.
+    //
+
+    // Save a character for the double terminator.
+    BufferChars--;
+    CharsNeeded = 1;
+
+    Status = S_OK;
+    while (ExtVal && ExtVal->ValueName)
+    {
+        ULONG Chars = wcslen(ExtVal->ValueName) + 1;
+        CharsNeeded += Chars;
+            
+        if (Status != S_OK || BufferChars < Chars)
+        {
+            Status = S_FALSE;
+        }
+        else
+        {
+            memcpy(Buffer, ExtVal->ValueName, Chars * sizeof(*Buffer));
+            Buffer += Chars;
+            BufferChars -= Chars;
+        }
+            
+        ExtVal++;
+    }
+
+    *Buffer = 0;
+    *BufferNeeded = CharsNeeded;
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::CallProvideValueMethod(_In_ ExtProvidedValue* ExtVal,
+                                     _In_ ULONG Flags,
+                                     _Out_ PULONG64 Value,
+                                     _Out_ PULONG64 TypeModBase,
+                                     _Out_ PULONG TypeId,
+                                     _Out_ PULONG TypeFlags)
+{
+    HRESULT Status;
+    
+    try
+    {
+        ExInitialize();
+        
+        m_CallStatus = S_OK;
+
+        (this->*ExtVal->Method)(Flags, ExtVal->ValueName,
+                                Value, TypeModBase, TypeId, TypeFlags);
+
+        Status = m_CallStatus;
+    }
+    catch(ExtException Ex)
+    {
+        Status = Ex.GetStatus();
+    }
+
+    return Status;
+}
+
+HRESULT WINAPI
+ExtExtension::HandleProvideValue(_In_ PDEBUG_CLIENT Client,
+                                 _In_ ULONG Flags,
+                                 _In_ PCWSTR Name,
+                                 _Out_ PULONG64 Value,
+                                 _Out_ PULONG64 TypeModBase,
+                                 _Out_ PULONG TypeId,
+                                 _Out_ PULONG TypeFlags)
+{
+    HRESULT Status = Query(Client);
+    if (Status != S_OK)
+    {
+        return Status;
+    }
+
+    // Use a hard SEH try/finally to guarantee that
+    // Release always occurs.
+    __try
+    {
+        ExtProvidedValue* ExtVal = m_ProvidedValues;
+        while (ExtVal && ExtVal->ValueName)
+        {
+            if (wcscmp(Name, ExtVal->ValueName) == 0)
+            {
+                break;
+            }
+
+            ExtVal++;
+        }
+        if (!ExtVal)
+        {
+            Status = E_UNEXPECTED;
+        }
+        else
+        {
+            Status = CallProvideValueMethod(ExtVal, Flags,
+                                            Value, TypeModBase,
+                                            TypeId, TypeFlags);
+        }
+    }
+    __finally
+    {
+        Release();
+    }
+
+    return Status;
+}
+
+ExtExtension::ArgVal* WINAPI
+ExtExtension::FindArg(_In_ PCSTR Name,
+                      _In_ bool Required)
+{
+    if (m_CurCommand)
+    {
+        // The command's argument descriptions are hashed
+        // and remember where their values are.
+        ExtCommandDesc::ArgDesc* Check = m_CurCommand->FindArg(Name);
+        if (Check &&
+            Check->Present)
+        {
+            return &m_Args[Check->ValIndex];
+        }
+    }
+    else
+    {
+        ULONG i;
+        
+        for (i = m_FirstNamedArg;
+             i < m_FirstNamedArg + m_NumNamedArgs;
+             i++)
+        {
+            if (!strcmp(Name, m_Args[i].Name))
+            {
+                return &m_Args[i];
+            }
+        }
+    }
+
+    if (Required)
+    {
+        ThrowInvalidArg("No argument /%s was provided", Name);
+    }
+    
+    return NULL;
+}
+
+PCSTR WINAPI
+ExtExtension::SetRawArgVal(_In_ ExtCommandDesc::ArgDesc* Check,
+                           _In_opt_ ArgVal* Val,
+                           _In_ bool ExplicitVal,
+                           _In_opt_ PCSTR StrVal,
+                           _In_ bool StrWritable,
+                           _In_ ULONG64 NumVal)
+{
+    if (!Val)
+    {
+        if (Check->Name)
+        {
+            if (m_NumNamedArgs + m_FirstNamedArg >= EXT_DIMA(m_Args))
+            {
+                ThrowInvalidArg("Argument overflow on '%s'",
+                                Check->Name);
+            }
+
+            Val = &m_Args[m_NumNamedArgs + m_FirstNamedArg];
+            m_NumArgs++;
+            m_NumNamedArgs++;
+        }
+        else
+        {
+            Val = &m_Args[m_NumUnnamedArgs];
+            m_NumArgs++;
+            m_NumUnnamedArgs++;
+        }
+    }
+
+    Check->Present = true;
+    Check->ValIndex = (ULONG)(Val - m_Args);
+    Val->Name = Check->Name;
+    Val->StrVal = NULL;
+    Val->NumVal = 0;
+
+    if (Check->Boolean)
+    {
+        return StrVal;
+    }
+
+    if (StrVal)
+    {
+        while (IsSpace(*StrVal))
+        {
+            StrVal++;
+        }
+        if (!*StrVal &&
+            !ExplicitVal)
+        {
+            ThrowInvalidArg("Missing value for argument '%s'",
+                            Check->Name);
+        }
+
+        if (Check->String)
+        {
+            Val->StrVal = StrVal;
+            if (Check->StringRemainder)
+            {
+                StrVal += strlen(StrVal);
+            }
+            else
+            {
+                while (*StrVal && !IsSpace(*StrVal))
+                {
+                    StrVal++;
+                }
+            }
+        }
+        else if (Check->Expression)
+        {
+            PSTR StrEnd = NULL;
+            char StrEndChar = 0;
+            
+            if (Check->ExpressionDelimited)
+            {
+                StrEnd = (PSTR)StrVal;
+                while (*StrEnd && !IsSpace(*StrEnd))
+                {
+                    StrEnd++;
+                }
+                if (IsSpace(*StrEnd))
+                {
+                    //
+                    // We found some trailing text so we need
+                    // to force a terminator to delimit the
+                    // expression.  We can only do this if
+                    // we make a copy of the string or have
+                    // a writable string.  As any case where a
+                    // non-writable string is passed in involves
+                    // a caller setting an argument explicitly they
+                    // can provide a properly-terminated expression,
+                    // so don't support copying.
+                    //
+                    
+                    if (!StrWritable)
+                    {
+                        ThrowInvalidArg("Delimited expressions can "
+                                        "only be parsed from extension "
+                                        "command arguments");
+                    }
+
+                    StrEndChar = *StrEnd;
+                    *StrEnd = 0;
+                }
+                else
+                {
+                    // No trailing text so no need to force
+                    // termination.
+                    StrEnd = NULL;
+                }
+            }
+
+            ULONG64 Limit = 0xffffffffffffffffUI64 >>
+                (64 - Check->ExpressionBits);
+            PCSTR LiteralEnd;
+            
+            if (Check->ExpressionEvaluator == NULL &&
+                ParseLiteralArg(StrVal, Check->ExpressionRadix,
+                                &LiteralEnd, &Val->NumVal))
+            {
+                if ((!Check->ExpressionSigned &&
+                     Val->NumVal > Limit) ||
+                    (Check->ExpressionSigned &&
+                     ((LONG64)Val->NumVal < -(LONG64)Limit ||
+                      (LONG64)Val->NumVal > (LONG64)Limit)))
+                {
+                    ThrowInvalidArg("Result overflow in expression '%s'",
+                                    StrVal);
+                }
+                StrVal = LiteralEnd;
+            }
+            else
+            {
+                ExtRadixHolder HoldRadix;
+            
+                if (Check->ExpressionRadix != 0)
+                {
+                    HoldRadix.Refresh();
+                    EXT_STATUS(m_Control->
+                               SetRadix(Check->ExpressionRadix));
+                }
+
+                if (Check->ExpressionEvaluator != NULL)
+                {
+                    StrVal = PrintCircleString("@@%s(%s)",
+                                               Check->ExpressionEvaluator,
+                                               StrVal);
+                }
+            
+                StrVal = GetExpr64(StrVal,
+                                   Check->ExpressionSigned != 0,
+                                   Limit,
+                                   &Val->NumVal);
+            }
+
+            if (StrEnd)
+            {
+                *StrEnd = StrEndChar;
+            }
+        }
+    }
+    else if (Check->String)
+    {
+        ThrowInvalidArg("Missing value for argument '%s'",
+                        Check->Name);
+    }
+    else
+    {
+        Val->NumVal = NumVal;
+    }
+
+    return StrVal;
+}
+
+bool WINAPI
+ExtExtension::ParseLiteralArg(_In_ PCSTR Str,
+                              _In_ ULONG Radix,
+                              _Out_ PCSTR* End,
+                              _Out_ PULONG64 Val)
+{
+    if (!m_FastLiteralArgs)
+    {
+        return false;
+    }
+
+    //
+    // Only forms whose value is the same under any
+    // evaluation are handled: 0x-prefixed hex always,
+    // and with MASM syntax 0n decimal and unprefixed
+    // numbers in the current radix, where MASM gives
+    // numbers precedence over symbols.  Anything else
+    // goes to the engine.
+    //
+
+    if (m_LiteralSyntax == DEBUG_ANY_ID)
+    {
+        if (!m_Control3.IsSet() ||
+            m_Control3->GetExpressionSyntax(&m_LiteralSyntax) != S_OK)
+        {
+            // Unknown, so only allow 0x.
+            m_LiteralSyntax = DEBUG_EXPR_CPLUSPLUS;
+        }
+    }
+
+    bool Masm = m_LiteralSyntax == DEBUG_EXPR_MASM;
+    PCSTR Scan = Str;
+    ULONG Base;
+    
+    if (Scan[0] == '0' &&
+        (Scan[1] == 'x' || Scan[1] == 'X'))
+    {
+        Base = 16;
+        Scan += 2;
+    }
+    else if (!Masm)
+    {
+        return false;
+    }
+    else if (Scan[0] == '0' &&
+             (Scan[1] == 'n' || Scan[1] == 'N'))
+    {
+        Base = 10;
+        Scan += 2;
+    }
+    else
+    {
+        if (!Radix)
+        {
+            if (m_LiteralRadix == DEBUG_ANY_ID &&
+                m_Control->GetRadix(&m_LiteralRadix) != S_OK)
+            {
+                m_LiteralRadix = 0;
+            }
+            Radix = m_LiteralRadix;
+        }
+        if (Radix != 8 && Radix != 10 && Radix != 16)
+        {
+            return false;
+        }
+        Base = Radix;
+    }
+
+    ULONG64 Value = 0;
+    ULONG Digits = 0;
+    
+    for (;; Scan++)
+    {
+        ULONG Digit;
+        
+        if (*Scan >= '0' && *Scan <= '9')
+        {
+            Digit = *Scan - '0';
+        }
+        else if (*Scan >= 'a' && *Scan <= 'f')
+        {
+            Digit = *Scan - 'a' + 10;
+        }
+        else if (*Scan >= 'A' && *Scan <= 'F')
+        {
+            Digit = *Scan - 'A' + 10;
+        }
+        else if (*Scan == '`' && Masm && Digits)
+        {
+            // MASM allows ` to separate 64-bit halves.
+            continue;
+        }
+        else
+        {
+            break;
+        }
+
+        if (Digit >= Base ||
+            Value > (0xffffffffffffffffUI64 - Digit) / Base)
+        {
+            return false;
+        }
+        Value = Value * Base + Digit;
+        Digits++;
+    }
+
+    if (!Digits ||
+        Scan[-1] == '`')
+    {
+        return false;
+    }
+
+    //
+    // The literal must be the whole expression.  Only
+    // trailing whitespace is allowed; any other text,
+    // even another argument, is left to the engine so
+    // that it decides where the expression ends.
+    //
+    
+    PCSTR Next = Scan;
+    while (IsSpace(*Next))
+    {
+        Next++;
+    }
+    if (*Next)
+    {
+        return false;
+    }
+
+    // The engine sign-extends 32-bit values for
+    // 32-bit targets.
+    if (m_PtrSize != 8 &&
+        Value >= 0x80000000 &&
+        Value <= 0xffffffff)
+    {
+        return false;
+    }
+
+    *End = Next;
+    *Val = Value;
+    return true;
+}
+
+void WINAPI
+ExtExtension::ParseArgs(_In_ ExtCommandDesc* Desc,
+                        _In_opt_ PCSTR Args)
+{
+    if (!Args)
+    {
+        Args = "";
+    }
+
+    m_RawArgStr = Args;
+    m_NumArgs = 0;
+    m_NumNamedArgs = 0;
+    m_NumUnnamedArgs = 0;
+    m_FirstNamedArg = Desc->m_NumUnnamedArgs;
+    m_LiteralRadix = DEBUG_ANY_ID;
+    m_LiteralSyntax = DEBUG_ANY_ID;
+
+    ULONG i;
+    ExtCommandDesc::ArgDesc* Check;
+
+    // Custom parsers can still set arguments so
+    // presence is always reset.
+    Check = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+    {
+        Check->Present = false;
+    }
+
+    //
+    // First make a copy of the argument string as
+    // we will need to chop it up when parsing.
+    // Release() automatically cleans this up.
+    //
+
+    m_ArgCopy = _strdup(Args);
+    if (!m_ArgCopy)
+    {
+        ThrowOutOfMemory();
+    }
+
+    if (Desc->m_CustomArgParsing)
+    {
+        return;
+    }
+    
+    PSTR Scan = m_ArgCopy;
+    bool ImplicitNamedArg = false;
+
+    for (;;)
+    {
+        while (IsSpace(*Scan))
+        {
+            ImplicitNamedArg = false;
+            Scan++;
+        }
+        if (!*Scan)
+        {
+            break;
+        }
+
+        if (ImplicitNamedArg ||
+            strchr(Desc->m_OptionChars, *Scan) != NULL)
+        {
+            //
+            // Named argument.  Collect name and
+            // see if this is a valid argument.
+            //
+
+            if (!ImplicitNamedArg)
+            {
+                Scan++;
+
+                // If /? is given at any point immediately
+                // go help for the command and exit.
+                if (*Scan == '?' &&
+                    (!*(Scan + 1) || IsSpace(*(Scan + 1))))
+                {
+                    HelpCommand(Desc);
+                    throw ExtStatusException(S_OK);
+                }
+            }
+            
+            PSTR Start = Scan++;
+            while (*Scan && !IsSpace(*Scan))
+            {
+                Scan++;
+            }
+            char Save = *Scan;
+            *Scan = 0;
+
+            //
+            // First check for a full name match.
+            //
+
+            if (!ImplicitNamedArg)
+            {
+                Check = Desc->FindArg(Start);
+                i = Check ?
+                    (ULONG)(Check - Desc->m_Args) : Desc->m_NumArgs;
+            }
+            else
+            {
+                i = Desc->m_NumArgs;
+            }
+            if (i >= Desc->m_NumArgs)
+            {
+                //
+                // Didn't find it with a full name match,
+                // so check for a single-character match.
+                // This is only allowed for single-character
+                // boolean options.
+                //
+
+                ImplicitNamedArg = false;
+
+                Check = Desc->m_Args;
+                for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+                {
+                    if (!Check->Name ||
+                        !Check->Boolean)
+                    {
+                        continue;
+                    }
+                
+                    if (*Start == Check->Name[0] &&
+                        !Check->Name[1])
+                    {
+                        // Multiple single-character options
+                        // can be combined with a single slash,
+                        // so the next character should be
+                        // checked as a named option.
+                        ImplicitNamedArg = true;
+                        break;
+                    }
+                }
+            }
+            if (i >= Desc->m_NumArgs)
+            {
+                ThrowInvalidArg("Unrecognized argument '%s'",
+                                Start);
+            }
+
+            //
+            // Found the argument.  Validate it.
+            //
+
+            if (Check->Present)
+            {
+                ThrowInvalidArg("Duplicate argument '%s'",
+                                Start);
+            }
+            
+            //
+            // Argument is valid, fix up the scan string
+            // and move to value processing.
+            //
+            
+            *Scan = Save;
+            if (ImplicitNamedArg)
+            {
+                Scan = Start + 1;
+            }
+        }
+        else
+        {
+            //
+            // Unnamed argument.
+            // Find the n'th unnamed argument description
+            // and use it.
+            //
+
+            Check = Desc->FindUnnamedArg(m_NumUnnamedArgs);
+            if (! Check)
+            {
+                ThrowInvalidArg("Extra unnamed argument at '%s'",
+                                Scan);
+            }
+        }
+
+        //
+        // We have an argument description, so
+        // look for any appropriate value.
+        //
+
+        Scan = (PSTR)SetRawArgVal(Check, NULL, false, Scan, true, 0);
+        if (Check->String && *Scan)
+        {
+            *Scan++ = 0;
+        }
+    }
+
+    //
+    // Fill in default values where needed.
+    //
+    
+    Check = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+    {
+        if (!Check->Present &&
+            Check->Default)
+        {
+            SetRawArgVal(Check, NULL, true, Check->Default, false, 0);
+        }
+    }
+
+    //
+    // Verify that all required arguments are present.
+    //
+
+    ULONG NumUnPresent = 0;
+    Check = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+    {
+        if (!Check->Name)
+        {
+            NumUnPresent++;
+        }
+        
+        if (Check->Required &&
+            !Check->Present)
+        {
+            if (Check->Name)
+            {
+                ThrowInvalidArg("Missing required argument '%s'",
+                                Check->Name);
+            }
+            else if (Check->DescShort)
+            {
+                ThrowInvalidArg("Missing required argument '<%s>'",
+                                Check->DescShort);
+            }
+            else
+            {
+                ThrowInvalidArg("Missing unnamed argument %u",
+                                NumUnPresent);
+            }
+        }
+    }
+}
+
+void WINAPI
+ExtExtension::OutCommandArg(_In_ ExtCommandDesc::ArgDesc* Arg,
+                            _In_ bool Separate)
+{
+    if (Arg->Name)
+    {
+        if (Separate)
+        {
+            OutWrapStr("/");
+        }
+        
+        OutWrapStr(Arg->Name);
+
+        if (!Arg->Boolean)
+        {
+            OutWrapStr(" ");
+        }
+    }
+
+    if (!Arg->Boolean)
+    {
+        OutWrap("<%s>", Arg->DescShort);
+    }
+}
+
+void WINAPI
+ExtExtension::HelpCommandArgsSummary(_In_ ExtCommandDesc* Desc)
+{
+    ULONG i;
+    ExtCommandDesc::ArgDesc* Arg;
+    bool Hit;
+
+    if (Desc->m_CustomArgDescShort)
+    {
+        OutWrapStr(Desc->m_CustomArgDescShort);
+        return;
+    }
+    
+    //
+    // In order to try and make things pretty we make
+    // several passes over the arguments.
+    //
+
+    //
+    // Display all optional single-char booleans as a collection.
+    //
+
+    Hit = false;
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (Arg->Boolean && !Arg->Required && !Arg->Name[1])
+        {
+            if (!Hit)
             {
-                while (*StrVal && !IsSpace(*StrVal))
-                {
-                    StrVal++;
-                }
+                OutWrapStr(" [/");
+                Hit = true;
+                AllowWrap(false);
             }
+
+            OutWrapStr(Arg->Name);
         }
-        else if (Check->Expression)
+    }
+    if (Hit)
+    {
+        OutWrapStr("]");
+        AllowWrap(true);
+    }
+    
+    //
+    // Display all optional multi-char booleans.
+    //
+
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (Arg->Boolean && !Arg->Required && Arg->Name[1])
         {
-            PSTR StrEnd = NULL;
-            char StrEndChar = 0;
-            
-            if (Check->ExpressionDelimited)
+            OutWrap(" [/%s]", Arg->Name);
+        }
+    }
+    
+    //
+    // Display all required single-char booleans as a collection.
+    //
+
+    Hit = false;
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (Arg->Boolean && Arg->Required && !Arg->Name[1])
+        {
+            if (!Hit)
             {
-                StrEnd = (PSTR)StrVal;
-                while (*StrEnd && !IsSpace(*StrEnd))
-                {
-                    StrEnd++;
-                }
-                if (IsSpace(*StrEnd))
-                {
-                    //
-                    // We found some trailing text so we need
-                    // to force a terminator to delimit the
-                    // expression.  We can only do this if
-                    // we make a copy of the string or have
-                    // a writable string.  As any case where a
-                    // non-writable string is passed in involves
-                    // a caller setting an argument explicitly they
-                    // can provide a properly-terminated expression,
-                    // so don't support copying.
-                    //
-                    
-                    if (!StrWritable)
-                    {
-                        ThrowInvalidArg("Delimited expressions can "
-                                        "only be parsed from extension "
-                                        "command arguments");
-                    }
+                OutWrapStr(" /");
+                Hit = true;
+                AllowWrap(false);
+            }
 
-                    StrEndChar = *StrEnd;
-                    *StrEnd = 0;
-                }
-                else
-                {
-                    // No trailing text so no need to force
-                    // termination.
-                    StrEnd = NULL;
-                }
+            OutWrapStr(Arg->Name);
+        }
+    }
+    AllowWrap(true);
+
+    //
+    // Display all required multi-char booleans.
+    //
+
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (Arg->Boolean && Arg->Required && Arg->Name[1])
+        {
+            OutWrap(" /%s", Arg->Name);
+        }
+    }
+
+    //
+    // Display all optional named non-booleans.
+    //
+
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (!Arg->Boolean && !Arg->Required && Arg->Name)
+        {
+            TestWrap(true);
+            OutCommandArg(Arg, true);
+            TestWrap(false);
+            if (!DemandWrap(m_TestWrapChars + 3))
+            {
+                OutWrapStr(" ");
+            }
+            OutWrapStr("[");
+            AllowWrap(false);
+            OutCommandArg(Arg, true);
+            OutWrapStr("]");
+            AllowWrap(true);
+        }
+    }
+
+    //
+    // Display all required named non-booleans.
+    //
+
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (!Arg->Boolean && Arg->Required && Arg->Name)
+        {
+            TestWrap(true);
+            OutCommandArg(Arg, true);
+            TestWrap(false);
+            if (!DemandWrap(m_TestWrapChars + 1))
+            {
+                OutWrapStr(" ");
+            }
+            AllowWrap(false);
+            OutCommandArg(Arg, true);
+            AllowWrap(true);
+        }
+    }
+
+    //
+    // Display all unnamed arguments.  As any optional
+    // unnamed argument must be last we can handle both
+    // optional and required in a single pass.
+    //
+
+    Arg = Desc->m_Args;
+    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    {
+        if (!Arg->Boolean && !Arg->Name)
+        {
+            TestWrap(true);
+            OutCommandArg(Arg, true);
+            TestWrap(false);
+            if (!Arg->Required)
+            {
+                m_TestWrapChars += 2;
+            }
+            if (!DemandWrap(m_TestWrapChars + 1))
+            {
+                OutWrapStr(" ");
+            }
+            if (!Arg->Required)
+            {
+                OutWrapStr("[");
+            }
+            AllowWrap(false);
+            OutCommandArg(Arg, true);
+            if (!Arg->Required)
+            {
+                OutWrapStr("]");
             }
+            AllowWrap(true);
+        }
+    }
+}
+
+void WINAPI
+ExtExtension::OutArgDescOptions(_In_ ExtCommandDesc::ArgDesc* Arg)
+{
+    bool First = true;
+    
+    if (Arg->Default &&
+        !Arg->DefaultSilent)
+    {
+        OutWrapStr("defaults to ");
+        OutWrapStr(Arg->Default);
+        First = false;
+    }
 
-            ExtRadixHolder HoldRadix;
+    if (Arg->Expression)
+    {
+        if (Arg->ExpressionSigned)
+        {
+            if (!First)
+            {
+                OutWrapStr(", ");
+            }
+            
+            OutWrapStr("signed");
+            First = false;
+        }
+        if (Arg->ExpressionDelimited)
+        {
+            if (!First)
+            {
+                OutWrapStr(", ");
+            }
+            
+            OutWrapStr("space-delimited");
+            First = false;
+        }
+        if (Arg->ExpressionBits != 64)
+        {
+            if (!First)
+            {
+                OutWrapStr(", ");
+            }
+            
+            OutWrap("%u-bit max", Arg->ExpressionBits);
+            First = false;
+        }
+        if (Arg->ExpressionRadix)
+        {
+            if (!First)
+            {
+                OutWrapStr(", ");
+            }
             
-            if (Check->ExpressionRadix != 0)
+            OutWrap("base %u", Arg->ExpressionRadix);
+            First = false;
+        }
+        if (Arg->ExpressionEvaluator)
+        {
+            if (!First)
             {
-                HoldRadix.Refresh();
-                EXT_STATUS(m_Control->SetRadix(Check->ExpressionRadix));
+                OutWrapStr(", ");
             }
+            
+            OutWrapStr(Arg->ExpressionEvaluator);
+            OutWrapStr(" syntax");
+            First = false;
+        }
+    }
 
-            if (Check->ExpressionEvaluator != NULL)
+    if (Arg->String)
+    {
+        if (Arg->StringRemainder)
+        {
+            if (!First)
             {
-                StrVal = PrintCircleString("@@%s(%s)",
-                                           Check->ExpressionEvaluator,
-                                           StrVal);
+                OutWrapStr(", ");
             }
             
-            StrVal = GetExpr64(StrVal,
-                               Check->ExpressionSigned != 0,
-                               (0xffffffffffffffffUI64 >>
-                                (64 - Check->ExpressionBits)),
-                               &Val->NumVal);
+            OutWrapStr("consumes remainder of input string");
+            First = false;
+        }
+    }
+}
 
-            if (StrEnd)
+void WINAPI
+ExtExtension::HelpCommand(_In_ ExtCommandDesc* Desc)
+{
+    ULONG i;
+
+    Desc->ExInitialize(this);
+    
+    m_CurChar = 0;
+    OutWrap("!%s", Desc->m_Name);
+    m_LeftIndent = m_CurChar + 1;
+    HelpCommandArgsSummary(Desc);
+    m_LeftIndent = 0;
+    OutWrapStr("\n");
+
+    if (Desc->m_CustomArgDescLong)
+    {
+        OutWrapStr("  ");
+        m_LeftIndent = m_CurChar;
+        OutWrapStr(Desc->m_CustomArgDescLong);
+        m_LeftIndent = 0;
+        OutWrapStr("\n");
+    }
+    else
+    {
+        ExtCommandDesc::ArgDesc* Arg = Desc->m_Args;
+        for (i = 0; i < Desc->m_NumArgs; i++)
+        {
+            OutWrapStr("  ");
+            OutCommandArg(Arg, true);
+            
+            if (Arg->DescLong)
             {
-                *StrEnd = StrEndChar;
+                OutWrapStr(" - ");
+                m_LeftIndent = m_CurChar;
+                
+                OutWrapStr(Arg->DescLong);
+
+                if (Arg->NeedsOptionsOutput())
+                {
+                    OutWrapStr(" (");
+                    OutArgDescOptions(Arg);
+                    OutWrapStr(")");
+                }
+            }
+            else if (Arg->NeedsOptionsOutput())
+            {
+                OutWrapStr(" - ");
+                m_LeftIndent = m_CurChar;
+                OutArgDescOptions(Arg);
             }
+            
+            m_LeftIndent = 0;
+            OutWrapStr("\n");
+            Arg++;
         }
     }
-    else if (Check->String)
+    
+    OutWrapStr(Desc->m_Desc);
+    Out("\n");
+}
+
+void WINAPI
+ExtExtension::HelpCommandName(_In_ PCSTR Name)
+{
+    ExtCommandDesc* Desc = FindCommand(Name);
+    if (!Desc)
+    {
+        ThrowInvalidArg("No command named '%s'", Name);
+    }
+
+    HelpCommand(Desc);
+}
+
+void WINAPI
+ExtExtension::HelpAll(void)
+{
+    char ModName[2 * MAX_PATH];
+
+    if (!GetModuleFileName(s_Module, ModName, EXT_DIMA(ModName)))
+    {
+        StringCbCopyA(ModName, sizeof(ModName),
+                      "<Unable to get DLL name>");
+    }
+
+    Out("Commands for %s:\n", ModName);
+    m_CurChar = 0;
+    
+    ExtCommandDesc* Desc = m_Commands;
+    while (Desc)
+    {
+        ULONG NameLen = strlen(Desc->m_Name);
+        OutWrap("  !%s%*c- ",
+                Desc->m_Name,
+                m_LongestCommandName - NameLen + 1, ' ');
+        m_LeftIndent = m_CurChar;
+        OutWrapStr(Desc->m_Desc);
+        m_LeftIndent = 0;
+
+        OutWrapStr("\n");
+
+        Desc = Desc->m_Next;
+    }
+
+    Out("!help <cmd> will give more information for a particular command\n");
+}
+
+EXT_CLASS_COMMAND(ExtExtension,
+                  help,
+                  "Displays information on available extension commands",
+                  "{;s,o;command;Command to get information on}")
+{
+    if (HasUnnamedArg(0))
+    {
+        HelpCommandName(GetUnnamedArgStr(0));
+    }
+    else
+    {
+        HelpAll();
+        SetCallStatus(DEBUG_EXTENSION_CONTINUE_SEARCH);
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Global forwarders for common methods.
+//
+//----------------------------------------------------------------------------
+
+void WINAPIV
+ExtOut(_In_ PCSTR Format, ...)
+{
+    g_Ext.Throw();
+
+    va_list Args;
+
+    va_start(Args, Format);
+    g_Ext->m_Control->
+        OutputVaList(DEBUG_OUTPUT_NORMAL, Format, Args);
+    va_end(Args);
+}
+
+void WINAPIV
+ExtWarn(_In_ PCSTR Format, ...)
+{
+    g_Ext.Throw();
+
+    va_list Args;
+
+    va_start(Args, Format);
+    g_Ext->m_Control->
+        OutputVaList(DEBUG_OUTPUT_WARNING, Format, Args);
+    va_end(Args);
+}
+
+void WINAPIV
+ExtErr(_In_ PCSTR Format, ...)
+{
+    g_Ext.Throw();
+
+    va_list Args;
+
+    va_start(Args, Format);
+    g_Ext->m_Control->
+        OutputVaList(DEBUG_OUTPUT_ERROR, Format, Args);
+    va_end(Args);
+}
+
+void WINAPIV
+ExtVerb(_In_ PCSTR Format, ...)
+{
+    g_Ext.Throw();
+
+    va_list Args;
+
+    va_start(Args, Format);
+    g_Ext->m_Control->
+        OutputVaList(DEBUG_OUTPUT_VERBOSE, Format, Args);
+    va_end(Args);
+}
+
+//----------------------------------------------------------------------------
+//
+// ExtRemoteData.
+//
+//----------------------------------------------------------------------------
+
+void WINAPI
+ExtRemoteData::Set(_In_ const DEBUG_TYPED_DATA* Typed)
+{
+    m_Offset = Typed->Offset;
+    m_ValidOffset = (Typed->Flags & DEBUG_TYPED_DATA_IS_IN_MEMORY) != 0;
+    m_Bytes = Typed->Size;
+    m_Data = Typed->Data;
+    m_ValidData = Typed->Size > 0 && Typed->Size <= sizeof(m_Data);
+}
+
+void WINAPI
+ExtRemoteData::Read(void)
+{
+    g_Ext->PollInterrupt();
+    
+    // Zero data so that unread bytes have a known state.
+    ULONG64 NewData = 0;
+
+#pragma prefast(suppress:__WARNING_REDUNDANTTEST, "valid redundancy")
+    if (m_Bytes > sizeof(m_Data) ||
+        m_Bytes > sizeof(NewData))
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData::Read too large");
+    }
+
+    ReadBuffer(&NewData, m_Bytes);
+    m_Data = NewData;
+    m_ValidData = true;
+}
+
+void WINAPI
+ExtRemoteData::Write(void)
+{
+    g_Ext->PollInterrupt();
+    
+    if (m_Bytes > sizeof(m_Data))
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData::Write too large");
+    }
+    if (!m_ValidData)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData does not have valid data");
+    }
+
+    WriteBuffer(&m_Data, m_Bytes);
+}
+
+ULONG64 WINAPI
+ExtRemoteData::GetData(_In_ ULONG Request)
+{
+    g_Ext->PollInterrupt();
+    
+    if (m_Bytes != Request)
     {
-        ThrowInvalidArg("Missing value for argument '%s'",
-                        Check->Name);
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Invalid ExtRemoteData size");
     }
-    else
+    if (!m_ValidData)
     {
-        Val->NumVal = NumVal;
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData does not have valid data");
     }
 
-    return StrVal;
+    return m_Data;
 }
 
 void WINAPI
-ExtExtension::ParseArgs(_In_ ExtCommandDesc* Desc,
-                        _In_opt_ PCSTR Args)
+ExtRemoteData::SetData(_In_ ULONG64 Data,
+                       _In_ ULONG Request,
+                       _In_ bool NoWrite) throw(...)
 {
-    if (!Args)
+    g_Ext->PollInterrupt();
+    
+    if (m_Bytes != Request)
     {
-        Args = "";
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Invalid ExtRemoteData size");
     }
 
-    m_RawArgStr = Args;
-    m_NumArgs = 0;
-    m_NumNamedArgs = 0;
-    m_NumUnnamedArgs = 0;
-    m_FirstNamedArg = Desc->m_NumUnnamedArgs;
-
-    //
-    // First make a copy of the argument string as
-    // we will need to chop it up when parsing.
-    // Release() automatically cleans this up.
-    //
+    m_Data = Data;
+    m_ValidData = true;
 
-    m_ArgCopy = _strdup(Args);
-    if (!m_ArgCopy)
+    if (!NoWrite)
     {
-        ThrowOutOfMemory();
+        Write();
     }
+}
 
-    if (Desc->m_CustomArgParsing)
+ULONG WINAPI
+ExtRemoteData::ReadBuffer(_Out_writes_bytes_(Bytes) PVOID Buffer,
+                          _In_ ULONG Bytes,
+                          _In_ bool MustReadAll)
+{
+    HRESULT Status;
+    ULONG Done;
+
+    g_Ext->PollInterrupt();
+    
+    if (!Bytes)
     {
-        return;
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Zero-sized ExtRemoteData");
     }
-    
-    PSTR Scan = m_ArgCopy;
-    bool ImplicitNamedArg = false;
-    ULONG i;
-    ExtCommandDesc::ArgDesc* Check;
-    
-    Check = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+    if (!m_ValidOffset)
     {
-        Check->Present = false;
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData does not have a valid address");
     }
 
-    for (;;)
+    Status = g_Ext->ReadCachedBuffer(m_Physical, m_SpaceFlags,
+                                     m_Offset, Buffer, Bytes, &Done);
+    if (Status == S_OK && Done != Bytes && MustReadAll)
     {
-        while (IsSpace(*Scan))
+        Status = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+    }
+    if (Status != S_OK)
+    {
+        if (m_Name)
         {
-            ImplicitNamedArg = false;
-            Scan++;
+            g_Ext->ThrowRemote(Status, "Unable to read %s at %p",
+                               m_Name, m_Offset);
         }
-        if (!*Scan)
+        else
         {
-            break;
+            g_Ext->ThrowRemote(Status, "Unable to read 0x%x bytes at %p",
+                               Bytes, m_Offset);
         }
+    }
 
-        if (ImplicitNamedArg ||
-            strchr(Desc->m_OptionChars, *Scan) != NULL)
-        {
-            //
-            // Named argument.  Collect name and
-            // see if this is a valid argument.
-            //
-
-            if (!ImplicitNamedArg)
-            {
-                Scan++;
-
-                // If /? is given at any point immediately
-                // go help for the command and exit.
-                if (*Scan == '?' &&
-                    (!*(Scan + 1) || IsSpace(*(Scan + 1))))
-                {
-                    HelpCommand(Desc);
-                    throw ExtStatusException(S_OK);
-                }
-            }
-            
-            PSTR Start = Scan++;
-            while (*Scan && !IsSpace(*Scan))
-            {
-                Scan++;
-            }
-            char Save = *Scan;
-            *Scan = 0;
-
-            //
-            // First check for a full name match.
-            //
+    return Done;
+}
 
-            if (!ImplicitNamedArg)
-            {
-                Check = Desc->m_Args;
-                for (i = 0; i < Desc->m_NumArgs; i++, Check++)
-                {
-                    if (!Check->Name)
-                    {
-                        continue;
-                    }
-                
-                    if (!strcmp(Start, Check->Name))
-                    {
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                i = Desc->m_NumArgs;
-            }
-            if (i >= Desc->m_NumArgs)
-            {
-                //
-                // Didn't find it with a full name match,
-                // so check for a single-character match.
-                // This is only allowed for single-character
-                // boolean options.
-                //
+ULONG WINAPI
+ExtRemoteData::WriteBuffer(_In_reads_bytes_(Bytes) PVOID Buffer,
+                           _In_ ULONG Bytes,
+                           _In_ bool MustWriteAll)
+{
+    HRESULT Status;
+    ULONG Done;
 
-                ImplicitNamedArg = false;
+    UNREFERENCED_PARAMETER(Buffer);
 
-                Check = Desc->m_Args;
-                for (i = 0; i < Desc->m_NumArgs; i++, Check++)
-                {
-                    if (!Check->Name ||
-                        !Check->Boolean)
-                    {
-                        continue;
-                    }
-                
-                    if (*Start == Check->Name[0] &&
-                        !Check->Name[1])
-                    {
-                        // Multiple single-character options
-                        // can be combined with a single slash,
-                        // so the next character should be
-                        // checked as a named option.
-                        ImplicitNamedArg = true;
-                        break;
-                    }
-                }
-            }
-            if (i >= Desc->m_NumArgs)
-            {
-                ThrowInvalidArg("Unrecognized argument '%s'",
-                                Start);
-            }
+    g_Ext->PollInterrupt();
 
-            //
-            // Found the argument.  Validate it.
-            //
+    if (!Bytes)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Zero-sized ExtRemoteData");
+    }
+    if (!m_ValidOffset)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData does not have a valid address");
+    }
 
-            if (Check->Present)
-            {
-                ThrowInvalidArg("Duplicate argument '%s'",
-                                Start);
-            }
-            
-            //
-            // Argument is valid, fix up the scan string
-            // and move to value processing.
-            //
-            
-            *Scan = Save;
-            if (ImplicitNamedArg)
-            {
-                Scan = Start + 1;
-            }
+    // Drop cached blocks even on failure as
+    // a partial write may have occurred.
+    g_Ext->InvalidateReadCache(m_Physical, m_SpaceFlags, m_Offset, Bytes);
+    
+    if (m_Physical)
+    {
+        Status = g_Ext->m_Data4->
+            WritePhysical2(m_Offset, m_SpaceFlags, Buffer, Bytes, &Done);
+    }
+    else
+    {
+        Status = g_Ext->m_Data->
+            WriteVirtual(m_Offset, Buffer, Bytes, &Done);
+    }
+    if (Status == S_OK && Done != Bytes && MustWriteAll)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+    }
+    if (Status != S_OK)
+    {
+        if (m_Name)
+        {
+            g_Ext->ThrowRemote(Status, "Unable to write %s at %p",
+                               m_Name, m_Offset);
         }
         else
         {
-            //
-            // Unnamed argument.
-            // Find the n'th unnamed argument description
-            // and use it.
-            //
+            g_Ext->ThrowRemote(Status, "Unable to write 0x%x bytes at %p",
+                               Bytes, m_Offset);
+        }
+    }
+
+    return Done;
+}
+
+PSTR WINAPI
+ExtRemoteData::GetString(_Out_writes_opt_(BufferChars) PSTR Buffer,
+                         _In_ ULONG BufferChars,
+                         _In_ ULONG MaxChars,
+                         _In_ bool MustFit,
+                         _Out_opt_ PULONG NeedChars)
+{
+    HRESULT Status;
+    
+    g_Ext->ThrowInterrupt();
+    
+    if (!m_ValidOffset)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData does not have a valid address");
+    }
+    if (m_Physical)
+    {
+        g_Ext->ThrowRemote(E_NOTIMPL,
+                           "ExtRemoteData cannot read strings "
+                           "from physical memory");
+    }
 
-            Check = Desc->FindUnnamedArg(m_NumUnnamedArgs);
-            if (! Check)
-            {
-                ThrowInvalidArg("Extra unnamed argument at '%s'",
-                                Scan);
-            }
-        }
+    ULONG Need;
+    
+    if (FAILED(Status = g_Ext->m_Data4->
+               ReadMultiByteStringVirtual(m_Offset, MaxChars * sizeof(*Buffer),
+                                          Buffer, BufferChars, &Need)))
+    {
+        g_Ext->ThrowRemote(Status, "Unable to read string at %p",
+                           m_Offset);
+    }
+    if (Status != S_OK && MustFit)
+    {
+        g_Ext->ThrowRemote(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW),
+                           "String at %p overflows buffer, need 0x%x chars",
+                           m_Offset, Need);
+    }
 
-        //
-        // We have an argument description, so
-        // look for any appropriate value.
-        //
+    if (NeedChars)
+    {
+        *NeedChars = Need;
+    }
+    return Buffer;
+}
 
-        Scan = (PSTR)SetRawArgVal(Check, NULL, false, Scan, true, 0);
-        if (Check->String && *Scan)
-        {
-            *Scan++ = 0;
-        }
+PWSTR WINAPI
+ExtRemoteData::GetString(_Out_writes_opt_(BufferChars) PWSTR Buffer,
+                         _In_ ULONG BufferChars,
+                         _In_ ULONG MaxChars,
+                         _In_ bool MustFit,
+                         _Out_opt_ PULONG NeedChars)
+{
+    HRESULT Status;
+    
+    g_Ext->ThrowInterrupt();
+    
+    if (!m_ValidOffset)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteData does not have a valid address");
+    }
+    if (m_Physical)
+    {
+        g_Ext->ThrowRemote(E_NOTIMPL,
+                           "ExtRemoteData cannot read strings "
+                           "from physical memory");
     }
 
-    //
-    // Fill in default values where needed.
-    //
+    ULONG Need;
     
-    Check = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+    if (FAILED(Status = g_Ext->m_Data4->
+               ReadUnicodeStringVirtualWide(m_Offset,
+                                            MaxChars * sizeof(*Buffer),
+                                            Buffer, BufferChars, &Need)))
     {
-        if (!Check->Present &&
-            Check->Default)
-        {
-            SetRawArgVal(Check, NULL, true, Check->Default, false, 0);
-        }
+        g_Ext->ThrowRemote(Status, "Unable to read string at %p",
+                           m_Offset);
+    }
+    if (Status != S_OK && MustFit)
+    {
+        g_Ext->ThrowRemote(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW),
+                           "String at %p overflows buffer, need 0x%x chars",
+                           m_Offset, Need);
     }
 
-    //
-    // Verify that all required arguments are present.
-    //
+    if (NeedChars)
+    {
+        *NeedChars = Need;
+    }
+    return Buffer;
+}
 
-    ULONG NumUnPresent = 0;
-    Check = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Check++)
+PSTR WINAPI
+ExtRemoteData::GetString(_Inout_ ExtBuffer<char>* Buffer,
+                         _In_ ULONG MaxChars)
+{
+    ULONG Need;
+
+    for (ULONG i = 0; i < 2; i++)
     {
-        if (!Check->Name)
-        {
-            NumUnPresent++;
-        }
-        
-        if (Check->Required &&
-            !Check->Present)
+        GetString(Buffer->GetRawBuffer(),
+                  Buffer->GetEltsAlloc(),
+                  MaxChars,
+                  false,
+                  &Need);
+        if (Need <= Buffer->GetEltsAlloc())
         {
-            if (Check->Name)
-            {
-                ThrowInvalidArg("Missing required argument '%s'",
-                                Check->Name);
-            }
-            else if (Check->DescShort)
-            {
-                ThrowInvalidArg("Missing required argument '<%s>'",
-                                Check->DescShort);
-            }
-            else
-            {
-                ThrowInvalidArg("Missing unnamed argument %u",
-                                NumUnPresent);
-            }
+            Buffer->SetEltsUsed(Need);
+            return Buffer->GetBuffer();
         }
+
+        Buffer->Require(Need);
     }
+
+    g_Ext->ThrowRemote(E_INVALIDARG, "Unable to read string at %p",
+                       m_Offset);
 }
 
-void WINAPI
-ExtExtension::OutCommandArg(_In_ ExtCommandDesc::ArgDesc* Arg,
-                            _In_ bool Separate)
+PWSTR WINAPI
+ExtRemoteData::GetString(_Inout_ ExtBuffer<WCHAR>* Buffer,
+                         _In_ ULONG MaxChars)
 {
-    if (Arg->Name)
+    ULONG Need;
+
+    for (ULONG i = 0; i < 2; i++)
     {
-        if (Separate)
+        GetString(Buffer->GetRawBuffer(),
+                  Buffer->GetEltsAlloc(),
+                  MaxChars,
+                  false,
+                  &Need);
+        if (Need <= Buffer->GetEltsAlloc())
         {
-            OutWrapStr("/");
+            Buffer->SetEltsUsed(Need);
+            return Buffer->GetBuffer();
         }
-        
-        OutWrapStr(Arg->Name);
 
-        if (!Arg->Boolean)
-        {
-            OutWrapStr(" ");
-        }
+        Buffer->Require(Need);
     }
 
-    if (!Arg->Boolean)
-    {
-        OutWrap("<%s>", Arg->DescShort);
-    }
+    g_Ext->ThrowRemote(E_INVALIDARG, "Unable to read string at %p",
+                       m_Offset);
 }
 
+//----------------------------------------------------------------------------
+//
+// ExtRemoteTyped.
+//
+//----------------------------------------------------------------------------
+
 void WINAPI
-ExtExtension::HelpCommandArgsSummary(_In_ ExtCommandDesc* Desc)
+ExtRemoteTyped::Copy(_In_ const DEBUG_TYPED_DATA* Source)
 {
-    ULONG i;
-    ExtCommandDesc::ArgDesc* Arg;
-    bool Hit;
+    m_Typed = *Source;
+    ErtIoctl("Copy", EXT_TDOP_COPY, ErtUncheckedIn | ErtOut);
+}
 
-    if (Desc->m_CustomArgDescShort)
+void WINAPI
+ExtRemoteTyped::Set(_In_ PCSTR Expr)
+{
+    EXT_TDOP Op;
+    ULONG Flags = ErtOut;
+    
+    // If we have a valid value let it be used
+    // in the expression if desired.
+    if (m_Release)
     {
-        OutWrapStr(Desc->m_CustomArgDescShort);
-        return;
+        Op = EXT_TDOP_EVALUATE;
+        Flags |= ErtIn;
+    }
+    else
+    {
+        Op = EXT_TDOP_SET_FROM_EXPR;
     }
-    
-    //
-    // In order to try and make things pretty we make
-    // several passes over the arguments.
-    //
 
-    //
-    // Display all optional single-char booleans as a collection.
-    //
+    PSTR Msg = g_Ext->
+        PrintCircleString("Set: unable to evaluate '%s'", Expr);
+    ErtIoctl(Msg, Op, Flags, Expr);
+}
 
-    Hit = false;
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
-    {
-        if (Arg->Boolean && !Arg->Required && !Arg->Name[1])
-        {
-            if (!Hit)
-            {
-                OutWrapStr(" [/");
-                Hit = true;
-                AllowWrap(false);
-            }
+void WINAPI
+ExtRemoteTyped::Set(_In_ PCSTR Expr,
+                    _In_ ULONG64 Offset)
+{
+    m_Typed.Offset = Offset;
+    PSTR Msg = g_Ext->
+        PrintCircleString("Set: unable to evaluate '%s' for 0x%I64x",
+                          Expr, Offset);
+    ErtIoctl(Msg, EXT_TDOP_SET_FROM_U64_EXPR, ErtUncheckedIn | ErtOut, Expr);
+}
+
+void WINAPI
+ExtRemoteTyped::Set(_In_ bool PtrTo,
+                    _In_ ULONG64 TypeModBase,
+                    _In_ ULONG TypeId,
+                    _In_ ULONG64 Offset)
+{
+    HRESULT Status;
+    EXT_TYPED_DATA ExtData;
 
-            OutWrapStr(Arg->Name);
-        }
-    }
-    if (Hit)
+    g_Ext->PollInterrupt();
+
+    ZeroMemory(&ExtData, sizeof(ExtData));
+    ExtData.Operation = PtrTo ?
+        EXT_TDOP_SET_PTR_FROM_TYPE_ID_AND_U64 :
+        EXT_TDOP_SET_FROM_TYPE_ID_AND_U64;
+    if (m_Physical)
     {
-        OutWrapStr("]");
-        AllowWrap(true);
+        ExtData.Flags |= (m_SpaceFlags + 1) << 1;
     }
+    ExtData.InData.ModBase = TypeModBase;
+    ExtData.InData.TypeId = TypeId;
+    ExtData.InData.Offset = Offset;
     
-    //
-    // Display all optional multi-char booleans.
-    //
-
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    Status = g_Ext->m_Advanced2->
+        Request(DEBUG_REQUEST_EXT_TYPED_DATA_ANSI,
+                &ExtData, sizeof(ExtData),
+                &ExtData, sizeof(ExtData),
+                NULL);
+    if (SUCCEEDED(Status))
     {
-        if (Arg->Boolean && !Arg->Required && Arg->Name[1])
-        {
-            OutWrap(" [/%s]", Arg->Name);
-        }
+        Status = ExtData.Status;
     }
-    
-    //
-    // Display all required single-char booleans as a collection.
-    //
 
-    Hit = false;
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    if (FAILED(Status))
     {
-        if (Arg->Boolean && Arg->Required && !Arg->Name[1])
-        {
-            if (!Hit)
-            {
-                OutWrapStr(" /");
-                Hit = true;
-                AllowWrap(false);
-            }
-
-            OutWrapStr(Arg->Name);
-        }
+        g_Ext->ThrowRemote(Status,
+                           "ExtRemoteTyped::Set from type and offset");
     }
-    AllowWrap(true);
 
-    //
-    // Display all required multi-char booleans.
-    //
+    Release();
+    m_Typed = ExtData.OutData;
+    ExtRemoteData::Set(&m_Typed);
+    m_Release = true;
+}
 
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+void WINAPI
+ExtRemoteTyped::Set(_In_ PCSTR Type,
+                    _In_ ULONG64 Offset,
+                    _In_ bool PtrTo,
+                    _Inout_opt_ PULONG64 CacheCookie,
+                    _In_opt_ PCSTR LinkField)
+{
+    HRESULT Status;
+    ULONG64 TypeModBase;
+    ULONG TypeId;
+    
+    if (!CacheCookie)
     {
-        if (Arg->Boolean && Arg->Required && Arg->Name[1])
-        {
-            OutWrap(" /%s", Arg->Name);
-        }
+        TypeId = g_Ext->FindTypeId(Type, &TypeModBase);
     }
-
-    //
-    // Display all optional named non-booleans.
-    //
-
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    else
     {
-        if (!Arg->Boolean && !Arg->Required && Arg->Name)
+        if (LinkField)
         {
-            TestWrap(true);
-            OutCommandArg(Arg, true);
-            TestWrap(false);
-            if (!DemandWrap(m_TestWrapChars + 3))
-            {
-                OutWrapStr(" ");
-            }
-            OutWrapStr("[");
-            AllowWrap(false);
-            OutCommandArg(Arg, true);
-            OutWrapStr("]");
-            AllowWrap(true);
+            // We don't really need the field offset
+            // here but it allows us to use cache
+            // entries that were created for list
+            // usage and so do have it.
+            g_Ext->GetCachedFieldOffset(CacheCookie,
+                                        Type,
+                                        LinkField,
+                                        &TypeModBase,
+                                        &TypeId);
+        }
+        else
+        {
+            TypeId = g_Ext->GetCachedSymbolTypeId(CacheCookie,
+                                                  Type,
+                                                  &TypeModBase);
         }
     }
+        
+    Set(PtrTo, TypeModBase, TypeId, Offset);
+}
 
-    //
-    // Display all required named non-booleans.
-    //
+void WINAPIV
+ExtRemoteTyped::SetPrint(_In_ PCSTR Format,
+                         ...)
+{
+    PSTR Expr;
+    va_list Args;
+    
+    va_start(Args, Format);
+    Expr = g_Ext->PrintCircleStringVa(Format, Args);
+    va_end(Args);
+    Set(Expr);
+}
 
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+ULONG WINAPI
+ExtRemoteTyped::GetFieldOffset(_In_ PCSTR Field) throw(...)
+{
+    ULONG Offset;
+    ExtExtension::TypeCacheEntry* Entry;
+
+    if (m_Release)
     {
-        if (!Arg->Boolean && Arg->Required && Arg->Name)
+        Entry = g_Ext->FindTypeCache(ExtExtension::s_TypeCacheFieldOffset,
+                                     m_Typed.ModBase, m_Typed.TypeId,
+                                     Field);
+        if (Entry)
         {
-            TestWrap(true);
-            OutCommandArg(Arg, true);
-            TestWrap(false);
-            if (!DemandWrap(m_TestWrapChars + 1))
-            {
-                OutWrapStr(" ");
-            }
-            AllowWrap(false);
-            OutCommandArg(Arg, true);
-            AllowWrap(true);
+            return Entry->ValOffset;
         }
     }
+    
+    PSTR Msg = g_Ext->
+        PrintCircleString("GetFieldOffset: no field '%s'",
+                          Field);
+    ErtIoctl(Msg, EXT_TDOP_GET_FIELD_OFFSET, ErtIn, Field, 0, NULL,
+             NULL, 0, &Offset);
 
-    //
-    // Display all unnamed arguments.  As any optional
-    // unnamed argument must be last we can handle both
-    // optional and required in a single pass.
-    //
-
-    Arg = Desc->m_Args;
-    for (i = 0; i < Desc->m_NumArgs; i++, Arg++)
+    Entry = g_Ext->AddTypeCache(ExtExtension::s_TypeCacheFieldOffset,
+                                m_Typed.ModBase, m_Typed.TypeId,
+                                Field);
+    if (Entry)
     {
-        if (!Arg->Boolean && !Arg->Name)
-        {
-            TestWrap(true);
-            OutCommandArg(Arg, true);
-            TestWrap(false);
-            if (!Arg->Required)
-            {
-                m_TestWrapChars += 2;
-            }
-            if (!DemandWrap(m_TestWrapChars + 1))
-            {
-                OutWrapStr(" ");
-            }
-            if (!Arg->Required)
-            {
-                OutWrapStr("[");
-            }
-            AllowWrap(false);
-            OutCommandArg(Arg, true);
-            if (!Arg->Required)
-            {
-                OutWrapStr("]");
-            }
-            AllowWrap(true);
-        }
+        Entry->ValOffset = Offset;
     }
+    
+    return Offset;
 }
 
-void WINAPI
-ExtExtension::OutArgDescOptions(_In_ ExtCommandDesc::ArgDesc* Arg)
+ExtRemoteTyped WINAPI
+ExtRemoteTyped::Field(_In_ PCSTR Field)
 {
-    bool First = true;
-    
-    if (Arg->Default &&
-        !Arg->DefaultSilent)
-    {
-        OutWrapStr("defaults to ");
-        OutWrapStr(Arg->Default);
-        First = false;
-    }
+    ExtRemoteTyped Ret;
+    ExtExtension::TypeCacheEntry* Entry;
 
-    if (Arg->Expression)
+    //
+    // A cached field is created directly from its type
+    // and address, which avoids the engine's field lookup.
+    // This is only valid for a simple field name applied
+    // directly to a structure.  Pointers are dereferenced
+    // by the engine and dotted paths can cross pointers,
+    // so neither has a fixed offset from m_Typed.Offset.
+    //
+    
+    bool Cacheable = m_Release && !m_Physical &&
+        m_Typed.Tag == ExtSymTagUDT &&
+        (m_Typed.Flags & DEBUG_TYPED_DATA_IS_IN_MEMORY) != 0 &&
+        strchr(Field, '.') == NULL &&
+        strchr(Field, '-') == NULL &&
+        strchr(Field, '[') == NULL;
+    
+    if (Cacheable)
     {
-        if (Arg->ExpressionSigned)
-        {
-            if (!First)
-            {
-                OutWrapStr(", ");
-            }
-            
-            OutWrapStr("signed");
-            First = false;
-        }
-        if (Arg->ExpressionDelimited)
-        {
-            if (!First)
-            {
-                OutWrapStr(", ");
-            }
-            
-            OutWrapStr("space-delimited");
-            First = false;
-        }
-        if (Arg->ExpressionBits != 64)
-        {
-            if (!First)
-            {
-                OutWrapStr(", ");
-            }
-            
-            OutWrap("%u-bit max", Arg->ExpressionBits);
-            First = false;
-        }
-        if (Arg->ExpressionRadix)
-        {
-            if (!First)
-            {
-                OutWrapStr(", ");
-            }
-            
-            OutWrap("base %u", Arg->ExpressionRadix);
-            First = false;
-        }
-        if (Arg->ExpressionEvaluator)
+        Entry = g_Ext->FindTypeCache(ExtExtension::s_TypeCacheField,
+                                     m_Typed.ModBase, m_Typed.TypeId,
+                                     Field);
+        if (Entry)
         {
-            if (!First)
-            {
-                OutWrapStr(", ");
-            }
-            
-            OutWrapStr(Arg->ExpressionEvaluator);
-            OutWrapStr(" syntax");
-            First = false;
+            Ret.Set(false, Entry->ValModBase, Entry->ValTypeId,
+                    m_Typed.Offset + Entry->ValOffset);
+            return Ret;
         }
     }
+    
+    PSTR Msg = g_Ext->
+        PrintCircleString("Field: unable to retrieve field '%s' at %I64x",
+                          Field, m_Offset);
+    ErtIoctl(Msg, EXT_TDOP_GET_FIELD, ErtIn | ErtOut, Field, 0, &Ret);
 
-    if (Arg->String)
-    {
-        if (Arg->StringRemainder)
+    //
+    // Only structures, pointers and arrays are cached.
+    // Integer and enum fields can be bitfields, which
+    // can't be recreated from a type ID and byte offset.
+    //
+    
+    if (Cacheable &&
+        (Ret.m_Typed.Tag == ExtSymTagUDT ||
+         Ret.m_Typed.Tag == ExtSymTagPointerType ||
+         Ret.m_Typed.Tag == ExtSymTagArrayType) &&
+        (Ret.m_Typed.Flags & DEBUG_TYPED_DATA_IS_IN_MEMORY) != 0 &&
+        Ret.m_Typed.Offset >= m_Typed.Offset &&
+        Ret.m_Typed.Offset - m_Typed.Offset <= 0xffffffff &&
+        Ret.m_Typed.Offset - m_Typed.Offset == GetFieldOffset(Field))
+    {
+        Entry = g_Ext->AddTypeCache(ExtExtension::s_TypeCacheField,
+                                    m_Typed.ModBase, m_Typed.TypeId,
+                                    Field);
+        if (Entry)
         {
-            if (!First)
-            {
-                OutWrapStr(", ");
-            }
-            
-            OutWrapStr("consumes remainder of input string");
-            First = false;
+            Entry->ValModBase = Ret.m_Typed.ModBase;
+            Entry->ValTypeId = Ret.m_Typed.TypeId;
+            Entry->ValOffset = (ULONG)(Ret.m_Typed.Offset - m_Typed.Offset);
         }
     }
+    
+    return Ret;
 }
 
-void WINAPI
-ExtExtension::HelpCommand(_In_ ExtCommandDesc* Desc)
+ExtRemoteTyped WINAPI
+ExtRemoteTyped::ArrayElement(_In_ LONG64 Index)
 {
-    ULONG i;
+    ExtRemoteTyped Ret;
 
-    Desc->ExInitialize(this);
-    
-    m_CurChar = 0;
-    OutWrap("!%s", Desc->m_Name);
-    m_LeftIndent = m_CurChar + 1;
-    HelpCommandArgsSummary(Desc);
-    m_LeftIndent = 0;
-    OutWrapStr("\n");
+    PSTR Msg = g_Ext->
+        PrintCircleString("ArrayElement: unable to retrieve element %I64d",
+                          Index);
+    ErtIoctl(Msg, EXT_TDOP_GET_ARRAY_ELEMENT,
+             ErtIn | ErtOut, NULL, Index, &Ret);
+    return Ret;
+}
 
-    if (Desc->m_CustomArgDescLong)
-    {
-        OutWrapStr("  ");
-        m_LeftIndent = m_CurChar;
-        OutWrapStr(Desc->m_CustomArgDescLong);
-        m_LeftIndent = 0;
-        OutWrapStr("\n");
-    }
-    else
-    {
-        ExtCommandDesc::ArgDesc* Arg = Desc->m_Args;
-        for (i = 0; i < Desc->m_NumArgs; i++)
-        {
-            OutWrapStr("  ");
-            OutCommandArg(Arg, true);
-            
-            if (Arg->DescLong)
-            {
-                OutWrapStr(" - ");
-                m_LeftIndent = m_CurChar;
-                
-                OutWrapStr(Arg->DescLong);
+ExtRemoteTyped WINAPI
+ExtRemoteTyped::Dereference(void)
+{
+    ExtRemoteTyped Ret;
 
-                if (Arg->NeedsOptionsOutput())
-                {
-                    OutWrapStr(" (");
-                    OutArgDescOptions(Arg);
-                    OutWrapStr(")");
-                }
-            }
-            else if (Arg->NeedsOptionsOutput())
-            {
-                OutWrapStr(" - ");
-                m_LeftIndent = m_CurChar;
-                OutArgDescOptions(Arg);
-            }
-            
-            m_LeftIndent = 0;
-            OutWrapStr("\n");
-            Arg++;
-        }
-    }
+    ErtIoctl("Dereference", EXT_TDOP_GET_DEREFERENCE,
+             ErtIn | ErtOut, NULL, 0, &Ret);
+    return Ret;
+}
+
+ExtRemoteTyped WINAPI
+ExtRemoteTyped::GetPointerTo(void)
+{
+    ExtRemoteTyped Ret;
+
+    ErtIoctl("GetPointerTo", EXT_TDOP_GET_POINTER_TO,
+             ErtIn | ErtOut, NULL, 0, &Ret);
+    return Ret;
+}
+
+ExtRemoteTyped WINAPI
+ExtRemoteTyped::Eval(_In_ PCSTR Expr)
+{
+    ExtRemoteTyped Ret;
     
-    OutWrapStr(Desc->m_Desc);
-    Out("\n");
+    PSTR Msg = g_Ext->
+        PrintCircleString("Eval: unable to evaluate '%s'",
+                          Expr);
+    ErtIoctl(Msg, EXT_TDOP_EVALUATE, ErtIn | ErtOut, Expr, 0, &Ret);
+    return Ret;
 }
 
-void WINAPI
-ExtExtension::HelpCommandName(_In_ PCSTR Name)
+PSTR WINAPI
+ExtRemoteTyped::GetTypeName(void)
 {
-    ExtCommandDesc* Desc = m_Commands;
-    while (Desc)
+    HRESULT Status;
+    ULONG Chars = 512;
+    PSTR Name;
+
+    //
+    // Template type names can be very long so retry
+    // with a larger buffer until the name fits.
+    //
+    
+    for (;;)
     {
-        if (!strcmp(Name, Desc->m_Name))
+        Name = g_Ext->RequestCircleString(Chars);
+        Status = ErtIoctl("GetTypeName", EXT_TDOP_GET_TYPE_NAME,
+                          ErtIn | ErtIgnoreError, NULL, 0, NULL,
+                          Name, Chars);
+        if (Chars < 0x10000 &&
+            (Status == HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) ||
+             Status == HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW) ||
+             (SUCCEEDED(Status) &&
+              strnlen(Name, Chars) >= Chars - 1)))
         {
-            break;
+            Chars *= 2;
+            continue;
+        }
+        if (FAILED(Status))
+        {
+            g_Ext->ThrowRemote(Status, "ExtRemoteTyped::GetTypeName");
         }
 
-        Desc = Desc->m_Next;
+        Name[Chars - 1] = 0;
+        return Name;
     }
-    if (!Desc)
+}
+
+PSTR WINAPI
+ExtRemoteTyped::GetSimpleValue(void)
+{
+    ExtCaptureOutputA Capture;
+
+    Capture.Start();
+
+    OutSimpleValue();
+
+    Capture.Stop();
+    return g_Ext->CopyCircleString(Capture.GetTextNonNull());
+}
+
+ULONG WINAPI
+ExtRemoteTyped::GetTypeFieldOffset(_In_ PCSTR Type,
+                                   _In_ PCSTR Field)
+{
+    HRESULT Status;
+    DEBUG_VALUE Data;
+    PSTR Expr;
+
+    Expr = g_Ext->PrintCircleString("@@c++(#FIELD_OFFSET(%s, %s))",
+                                    Type, Field);
+    if (FAILED(Status = g_Ext->m_Control->
+               Evaluate(Expr, DEBUG_VALUE_INT64, &Data, NULL)))
     {
-        ThrowInvalidArg("No command named '%s'", Name);
+        g_Ext->ThrowRemote(Status,
+                           "Could not find type field %s.%s",
+                           Type, Field);
     }
 
-    HelpCommand(Desc);
+    return (ULONG)Data.I64;
 }
 
-void WINAPI
-ExtExtension::HelpAll(void)
+HRESULT WINAPI
+ExtRemoteTyped::ErtIoctl(_In_ PCSTR Message,
+                         _In_ EXT_TDOP Op,
+                         _In_ ULONG Flags,
+                         _In_opt_ PCSTR InStr,
+                         _In_ ULONG64 In64,
+                         _Out_opt_ ExtRemoteTyped* Ret,
+                         _Out_writes_opt_(StrBufferChars) PSTR StrBuffer,
+                         _In_ ULONG StrBufferChars,
+                         _Out_opt_ PULONG Out32)
 {
-    char ModName[2 * MAX_PATH];
+    HRESULT Status;
+    ExtDeclAlignedBuffer<BYTE, sizeof(EXT_TYPED_DATA) +
+                               10 * sizeof(ULONG64)> DataHolder;
+    EXT_TYPED_DATA* ExtData;
+    ULONG ExtDataBytes;
+    PBYTE ExtraData;
 
-    if (!GetModuleFileName(s_Module, ModName, EXT_DIMA(ModName)))
+    C_ASSERT(EXT_TDF_PHYSICAL_MEMORY == DEBUG_TYPED_DATA_PHYSICAL_MEMORY);
+
+    // Check for a user interrupt, but don't do that
+    // when we're in a cleanup path since we don't
+    // want to prevent orderly shutdown of objects.
+    if (Op != EXT_TDOP_RELEASE)
     {
-        StringCbCopyA(ModName, sizeof(ModName),
-                      "<Unable to get DLL name>");
+        g_Ext->PollInterrupt();
     }
 
-    Out("Commands for %s:\n", ModName);
-    m_CurChar = 0;
+    ExtDataBytes = sizeof(*ExtData) +
+        StrBufferChars * sizeof(*StrBuffer);
+    if (InStr)
+    {
+        ExtDataBytes += (strlen(InStr) + 1) * sizeof(*InStr);
+    }
+
+    ExtData = (EXT_TYPED_DATA*)DataHolder.Get(ExtDataBytes);
+    ExtraData = (PBYTE)(ExtData + 1);
     
-    ExtCommandDesc* Desc = m_Commands;
-    while (Desc)
+    ZeroMemory(ExtData, sizeof(*ExtData));
+    ExtData->Operation = Op;
+    if (m_Physical)
+    {
+        ExtData->Flags |= (m_SpaceFlags + 1) << 1;
+    }
+    if (InStr)
+    {
+        ExtData->InStrIndex = (ULONG)(ExtraData - (PBYTE)ExtData);
+        memcpy(ExtraData, InStr,
+               (strlen(InStr) + 1) * sizeof(*InStr));
+        ExtraData += (strlen(InStr) + 1) * sizeof(*InStr);
+    }
+    ExtData->In64 = In64;
+    if (StrBuffer)
+    {
+        ExtData->StrBufferIndex = (ULONG)(ExtraData - (PBYTE)ExtData);
+        ExtData->StrBufferChars = StrBufferChars;
+        ExtraData += StrBufferChars * sizeof(*StrBuffer);
+    }
+    
+    if ((Flags & (ErtIn | ErtUncheckedIn)) != 0)
+    {
+        if ((Flags & ErtIn) != 0 && !m_Release)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "ExtRemoteTyped::%s", Message);
+        }
+
+        ExtData->InData = m_Typed;
+    }
+
+    Status = g_Ext->m_Advanced2->
+        Request(DEBUG_REQUEST_EXT_TYPED_DATA_ANSI,
+                ExtData, ExtDataBytes,
+                ExtData, ExtDataBytes,
+                NULL);
+    if (SUCCEEDED(Status))
+    {
+        Status = ExtData->Status;
+    }
+
+    if ((Flags & ErtIgnoreError) == 0 &&
+        FAILED(Status))
     {
-        ULONG NameLen = strlen(Desc->m_Name);
-        OutWrap("  !%s%*c- ",
-                Desc->m_Name,
-                m_LongestCommandName - NameLen + 1, ' ');
-        m_LeftIndent = m_CurChar;
-        OutWrapStr(Desc->m_Desc);
-        m_LeftIndent = 0;
+        g_Ext->ThrowRemote(Status,
+                           "ExtRemoteTyped::%s", Message);
+    }
 
-        OutWrapStr("\n");
+    if ((Flags & ErtOut) != 0)
+    {
+        if (!Ret)
+        {
+            Ret = this;
+        }
 
-        Desc = Desc->m_Next;
+        Ret->Release();
+        Ret->m_Typed = ExtData->OutData;
+        Ret->ExtRemoteData::Set(&Ret->m_Typed);
+        Ret->m_Release = true;
     }
 
-    Out("!help <cmd> will give more information for a particular command\n");
-}
-
-EXT_CLASS_COMMAND(ExtExtension,
-                  help,
-                  "Displays information on available extension commands",
-                  "{;s,o;command;Command to get information on}")
-{
-    if (HasUnnamedArg(0))
+    if (StrBuffer)
     {
-        HelpCommandName(GetUnnamedArgStr(0));
+        memcpy(StrBuffer, (PBYTE)ExtData + ExtData->StrBufferIndex,
+               StrBufferChars * sizeof(*StrBuffer));
     }
-    else
+    
+    if (Out32)
     {
-        HelpAll();
-        SetCallStatus(DEBUG_EXTENSION_CONTINUE_SEARCH);
+        *Out32 = ExtData->Out32;
     }
-}
-
-//----------------------------------------------------------------------------
-//
-// Global forwarders for common methods.
-//
-//----------------------------------------------------------------------------
-
-void WINAPIV
-ExtOut(_In_ PCSTR Format, ...)
-{
-    g_Ext.Throw();
-
-    va_list Args;
-
-    va_start(Args, Format);
-    g_Ext->m_Control->
-        OutputVaList(DEBUG_OUTPUT_NORMAL, Format, Args);
-    va_end(Args);
-}
-
-void WINAPIV
-ExtWarn(_In_ PCSTR Format, ...)
-{
-    g_Ext.Throw();
-
-    va_list Args;
-
-    va_start(Args, Format);
-    g_Ext->m_Control->
-        OutputVaList(DEBUG_OUTPUT_WARNING, Format, Args);
-    va_end(Args);
-}
-
-void WINAPIV
-ExtErr(_In_ PCSTR Format, ...)
-{
-    g_Ext.Throw();
-
-    va_list Args;
 
-    va_start(Args, Format);
-    g_Ext->m_Control->
-        OutputVaList(DEBUG_OUTPUT_ERROR, Format, Args);
-    va_end(Args);
+    return Status;
 }
 
-void WINAPIV
-ExtVerb(_In_ PCSTR Format, ...)
+void WINAPI
+ExtRemoteTyped::Clear(void)
 {
-    g_Ext.Throw();
-
-    va_list Args;
-
-    va_start(Args, Format);
-    g_Ext->m_Control->
-        OutputVaList(DEBUG_OUTPUT_VERBOSE, Format, Args);
-    va_end(Args);
+    ZeroMemory(&m_Typed, sizeof(m_Typed));
+    m_Release = false;
+    ExtRemoteData::Clear();
 }
 
 //----------------------------------------------------------------------------
 //
-// ExtRemoteData.
+// ExtRemoteTypedArray.
 //
 //----------------------------------------------------------------------------
 
 void WINAPI
-ExtRemoteData::Set(_In_ const DEBUG_TYPED_DATA* Typed)
+ExtRemoteTypedArray::Read(_In_ ExtRemoteTyped& Array,
+                          _In_ ULONG64 Start,
+                          _In_ ULONG Count,
+                          _In_ bool AllowPartial)
 {
-    m_Offset = Typed->Offset;
-    m_ValidOffset = (Typed->Flags & DEBUG_TYPED_DATA_IS_IN_MEMORY) != 0;
-    m_Bytes = Typed->Size;
-    m_Data = Typed->Data;
-    m_ValidData = Typed->Size > 0 && Typed->Size <= sizeof(m_Data);
+    if (Start > 0x7fffffffffffffffUI64)
+    {
+        g_Ext->ThrowRemote(HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW),
+                           "Array index too large");
+    }
+    
+    // One element lookup gives the element type,
+    // size and address for the whole run.
+    ExtRemoteTyped First = Array.ArrayElement((LONG64)Start);
+
+    if ((First.m_Typed.Flags & DEBUG_TYPED_DATA_IS_IN_MEMORY) == 0)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Array elements are not in memory");
+    }
+    
+    SetType(First.m_Typed.ModBase, First.m_Typed.TypeId,
+            First.m_Typed.Size);
+    m_Offset = First.m_Typed.Offset;
+    m_Physical = Array.m_Physical;
+    m_SpaceFlags = Array.m_SpaceFlags;
+    ReadElements(Count, AllowPartial);
 }
 
 void WINAPI
-ExtRemoteData::Read(void)
+ExtRemoteTypedArray::Read(_In_ PCSTR Type,
+                          _In_ ULONG64 Offset,
+                          _In_ ULONG Count,
+                          _In_ bool AllowPartial)
 {
-    g_Ext->ThrowInterrupt();
-    
-    // Zero data so that unread bytes have a known state.
-    ULONG64 NewData = 0;
+    HRESULT Status;
+    ULONG64 ModBase;
+    ULONG TypeId;
+    ULONG Size;
 
-#pragma prefast(suppress:__WARNING_REDUNDANTTEST, "valid redundancy")
-    if (m_Bytes > sizeof(m_Data) ||
-        m_Bytes > sizeof(NewData))
+    TypeId = g_Ext->FindTypeId(Type, &ModBase);
+    if ((Status = g_Ext->m_Symbols->
+         GetTypeSize(ModBase, TypeId, &Size)) != S_OK)
     {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData::Read too large");
+        g_Ext->ThrowStatus(Status, "Unable to get size of '%s'", Type);
     }
 
-    ReadBuffer(&NewData, m_Bytes);
-    m_Data = NewData;
-    m_ValidData = true;
+    SetType(ModBase, TypeId, Size);
+    m_Offset = Offset;
+    m_Physical = false;
+    m_SpaceFlags = 0;
+    ReadElements(Count, AllowPartial);
 }
 
 void WINAPI
-ExtRemoteData::Write(void)
+ExtRemoteTypedArray::SetType(_In_ ULONG64 ModBase,
+                             _In_ ULONG TypeId,
+                             _In_ ULONG ElementSize)
 {
-    g_Ext->ThrowInterrupt();
-    
-    if (m_Bytes > sizeof(m_Data))
-    {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData::Write too large");
-    }
-    if (!m_ValidData)
+    if (ModBase != m_ModBase ||
+        TypeId != m_TypeId)
     {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData does not have valid data");
+        m_NumFields = 0;
     }
-
-    WriteBuffer(&m_Data, m_Bytes);
+    
+    m_ModBase = ModBase;
+    m_TypeId = TypeId;
+    m_ElementSize = ElementSize;
+    m_Count = 0;
 }
 
-ULONG64 WINAPI
-ExtRemoteData::GetData(_In_ ULONG Request)
+void WINAPI
+ExtRemoteTypedArray::ReadElements(_In_ ULONG Count,
+                                  _In_ bool AllowPartial)
 {
-    g_Ext->ThrowInterrupt();
+    HRESULT Status;
+    ULONG Done;
     
-    if (m_Bytes != Request)
+    if (!m_ElementSize)
     {
         g_Ext->ThrowRemote(E_INVALIDARG,
-                           "Invalid ExtRemoteData size");
+                           "Array element type has no size");
     }
-    if (!m_ValidData)
+    if ((ULONG64)Count * m_ElementSize > s_MaxReadBytes)
     {
         g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData does not have valid data");
+                           "Array read of %u elements is too large",
+                           Count);
     }
 
-    return m_Data;
-}
+    ULONG Bytes = Count * m_ElementSize;
 
-void WINAPI
-ExtRemoteData::SetData(_In_ ULONG64 Data,
-                       _In_ ULONG Request,
-                       _In_ bool NoWrite) throw(...)
-{
     g_Ext->ThrowInterrupt();
     
-    if (m_Bytes != Request)
+    // Nothing needs to be preserved from
+    // a previous read so don't copy on growth.
+    m_Data.Empty();
+    PUCHAR Data = m_Data.Get(Bytes);
+
+    Status = g_Ext->ReadCachedBuffer(m_Physical, m_SpaceFlags, m_Offset,
+                                     Data, Bytes, &Done);
+    if (Status != S_OK)
     {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "Invalid ExtRemoteData size");
+        Done = 0;
     }
-
-    m_Data = Data;
-    m_ValidData = true;
-
-    if (!NoWrite)
+    else if (Done > Bytes)
     {
-        Write();
+        Done = Bytes;
+    }
+    
+    if (Done < Bytes &&
+        !AllowPartial)
+    {
+        g_Ext->ThrowRemote(Status != S_OK ?
+                           Status : HRESULT_FROM_WIN32(ERROR_READ_FAULT),
+                           "Unable to read %u array elements at 0x%I64x",
+                           Count, m_Offset);
     }
+
+    m_Count = Done / m_ElementSize;
 }
 
 ULONG WINAPI
-ExtRemoteData::ReadBuffer(_Out_writes_bytes_(Bytes) PVOID Buffer,
-                          _In_ ULONG Bytes,
-                          _In_ bool MustReadAll)
+ExtRemoteTypedArray::AddField(_In_ PCSTR Field)
 {
-    HRESULT Status;
-    ULONG Done;
-
-    g_Ext->ThrowInterrupt();
-    
-    if (!Bytes)
+    if (!m_ElementSize)
     {
         g_Ext->ThrowRemote(E_INVALIDARG,
-                           "Zero-sized ExtRemoteData");
+                           "ExtRemoteTypedArray has not been read");
     }
-    if (!m_ValidOffset)
+    if (m_NumFields >= s_MaxFields)
     {
         g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData does not have a valid address");
+                           "Too many array fields");
     }
 
-    if (m_Physical)
-    {
-        Status = g_Ext->m_Data4->
-            ReadPhysical2(m_Offset, m_SpaceFlags, Buffer, Bytes, &Done);
-    }
-    else
-    {
-        Status = g_Ext->m_Data->
-            ReadVirtual(m_Offset, Buffer, Bytes, &Done);
-    }
-    if (Status == S_OK && Done != Bytes && MustReadAll)
-    {
-        Status = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+    FieldDesc* Desc = &m_Fields[m_NumFields];
+    ULONG FieldTypeId;
+
+    //
+    // Symbol information alone is enough for most fields.
+    // Otherwise look the field up through a typed object
+    // for the first element.
+    //
+    
+    if (!g_Ext->m_Symbols3.IsSet() ||
+        g_Ext->m_Symbols3->
+        GetFieldTypeAndOffset(m_ModBase, m_TypeId, Field,
+                              &FieldTypeId, &Desc->Offset) != S_OK ||
+        g_Ext->m_Symbols->
+        GetTypeSize(m_ModBase, FieldTypeId, &Desc->Size) != S_OK)
+    {
+        ExtRemoteTyped Elt;
+    
+        Elt.m_Physical = m_Physical;
+        Elt.m_SpaceFlags = m_SpaceFlags;
+        Elt.Set(false, m_ModBase, m_TypeId, m_Offset);
+
+        Desc->Offset = Elt.GetFieldOffset(Field);
+        Desc->Size = Elt.Field(Field).m_Typed.Size;
     }
-    if (Status != S_OK)
+    if (Desc->Offset > m_ElementSize ||
+        Desc->Size > m_ElementSize - Desc->Offset)
     {
-        if (m_Name)
-        {
-            g_Ext->ThrowRemote(Status, "Unable to read %s at %p",
-                               m_Name, m_Offset);
-        }
-        else
-        {
-            g_Ext->ThrowRemote(Status, "Unable to read 0x%x bytes at %p",
-                               Bytes, m_Offset);
-        }
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Field '%s' is outside the array element",
+                           Field);
     }
-
-    return Done;
+    
+    return m_NumFields++;
 }
 
-ULONG WINAPI
-ExtRemoteData::WriteBuffer(_In_reads_bytes_(Bytes) PVOID Buffer,
-                           _In_ ULONG Bytes,
-                           _In_ bool MustWriteAll)
+ExtRemoteTyped WINAPI
+ExtRemoteTypedArray::GetElement(_In_ ULONG Index)
 {
-    HRESULT Status;
-    ULONG Done;
+    ExtRemoteTyped Ret;
 
-    UNREFERENCED_PARAMETER(Buffer);
+    Ret.m_Physical = m_Physical;
+    Ret.m_SpaceFlags = m_SpaceFlags;
+    Ret.Set(false, m_ModBase, m_TypeId, GetElementOffset(Index));
+    return Ret;
+}
 
-    g_Ext->ThrowInterrupt();
+ULONG64 WINAPI
+ExtRemoteTypedArray::GetField(_In_ ULONG Index,
+                              _In_ ULONG Field)
+{
+    PUCHAR Data = GetFieldData(Index, Field);
 
-    if (!Bytes)
-    {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "Zero-sized ExtRemoteData");
-    }
-    if (!m_ValidOffset)
+    switch(m_Fields[Field].Size)
     {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData does not have a valid address");
+    case 1:
+        return *Data;
+    case 2:
+        return *(USHORT UNALIGNED*)Data;
+    case 4:
+        return *(ULONG UNALIGNED*)Data;
+    case 8:
+        return *(ULONG64 UNALIGNED*)Data;
     }
 
-    if (m_Physical)
-    {
-        Status = g_Ext->m_Data4->
-            WritePhysical2(m_Offset, m_SpaceFlags, Buffer, Bytes, &Done);
-    }
-    else
+    g_Ext->ThrowRemote(E_INVALIDARG,
+                       "Array field %u is %u bytes, not an integer",
+                       Field, m_Fields[Field].Size);
+}
+
+void WINAPI
+ExtRemoteTypedArray::ExtractField(_In_ ULONG Field,
+                                  _Out_writes_(m_Count) PULONG64 Values,
+                                  _In_ bool Pointer)
+{
+    CheckField(Field);
+
+    ULONG Size = m_Fields[Field].Size;
+    if (Size != 1 && Size != 2 && Size != 4 && Size != 8)
     {
-        Status = g_Ext->m_Data->
-            WriteVirtual(m_Offset, Buffer, Bytes, &Done);
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "Array field %u is %u bytes, not an integer",
+                           Field, Size);
     }
-    if (Status == S_OK && Done != Bytes && MustWriteAll)
+    
+    if (!m_Count)
     {
-        Status = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+        return;
     }
-    if (Status != S_OK)
+    
+    PUCHAR Data = m_Data.GetBuffer() + m_Fields[Field].Offset;
+    ULONG Stride = m_ElementSize;
+    ULONG i;
+
+    //
+    // Each size gets its own fixed-stride loop
+    // rather than switching per element.
+    //
+    
+    switch(Size)
     {
-        if (m_Name)
+    case 1:
+        for (i = 0; i < m_Count; i++, Data += Stride)
         {
-            g_Ext->ThrowRemote(Status, "Unable to write %s at %p",
-                               m_Name, m_Offset);
+            Values[i] = *Data;
+        }
+        break;
+    case 2:
+        for (i = 0; i < m_Count; i++, Data += Stride)
+        {
+            Values[i] = *(USHORT UNALIGNED*)Data;
+        }
+        break;
+    case 4:
+        if (Pointer)
+        {
+            for (i = 0; i < m_Count; i++, Data += Stride)
+            {
+                Values[i] = (ULONG64)*(LONG UNALIGNED*)Data;
+            }
         }
         else
         {
-            g_Ext->ThrowRemote(Status, "Unable to write 0x%x bytes at %p",
-                               Bytes, m_Offset);
+            for (i = 0; i < m_Count; i++, Data += Stride)
+            {
+                Values[i] = *(ULONG UNALIGNED*)Data;
+            }
+        }
+        break;
+    case 8:
+        for (i = 0; i < m_Count; i++, Data += Stride)
+        {
+            Values[i] = *(ULONG64 UNALIGNED*)Data;
         }
+        break;
     }
-
-    return Done;
 }
 
-PSTR WINAPI
-ExtRemoteData::GetString(_Out_writes_opt_(BufferChars) PSTR Buffer,
-                         _In_ ULONG BufferChars,
-                         _In_ ULONG MaxChars,
-                         _In_ bool MustFit,
-                         _Out_opt_ PULONG NeedChars)
+//----------------------------------------------------------------------------
+//
+// ExtRemoteList.
+//
+//----------------------------------------------------------------------------
+
+// Node data holds raw pointers, so pull out the
+// value the same way ExtRemoteData::Read would.
+static ULONG64
+GetRawNodePtr(_In_ PUCHAR Data)
 {
-    HRESULT Status;
-    
-    g_Ext->ThrowInterrupt();
+    ULONG64 Ptr = 0;
     
-    if (!m_ValidOffset)
-    {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData does not have a valid address");
-    }
-    if (m_Physical)
-    {
-        g_Ext->ThrowRemote(E_NOTIMPL,
-                           "ExtRemoteData cannot read strings "
-                           "from physical memory");
-    }
+    memcpy(&Ptr, Data, g_Ext->m_PtrSize);
+    return Ptr;
+}
 
-    ULONG Need;
-    
-    if (FAILED(Status = g_Ext->m_Data4->
-               ReadMultiByteStringVirtual(m_Offset, MaxChars * sizeof(*Buffer),
-                                          Buffer, BufferChars, &Need)))
+static ULONG64
+SignExtendNodePtr(_In_ ULONG64 Ptr)
+{
+    return g_Ext->m_PtrSize == 8 ? Ptr : (ULONG64)(LONG)Ptr;
+}
+
+void WINAPI
+ExtRemoteList::CopyList(_In_ const ExtRemoteList& Other)
+{
+    m_Head = Other.m_Head;
+    m_LinkOffset = Other.m_LinkOffset;
+    m_Double = Other.m_Double;
+    m_MaxIter = Other.m_MaxIter;
+    m_Node = Other.m_Node;
+    m_CurIter = Other.m_CurIter;
+    m_PrefetchNodeBytes = Other.m_PrefetchNodeBytes;
+    m_PrefetchNodes = Other.m_PrefetchNodes;
+    m_PrefetchData.Delete();
+    m_PrefetchLinks.Delete();
+    ResetPrefetch(Other.m_PrefetchPtrOffset);
+}
+
+void WINAPI
+ExtRemoteList::SetPrefetch(_In_ ULONG NodeBytes,
+                           _In_ ULONG AheadNodes)
+{
+    if (NodeBytes)
     {
-        g_Ext->ThrowRemote(Status, "Unable to read string at %p",
-                           m_Offset);
+        ULONG64 Need = (ULONG64)m_LinkOffset +
+            (m_Double ? 2 : 1) * g_Ext->m_PtrSize;
+        
+        if (NodeBytes < Need)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "List prefetch size does not cover the link");
+        }
+        if (!AheadNodes)
+        {
+            AheadNodes = 1;
+        }
+        if ((ULONG64)NodeBytes * AheadNodes > 0x1000000)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "List prefetch size is too large");
+        }
     }
-    if (Status != S_OK && MustFit)
+    else
     {
-        g_Ext->ThrowRemote(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW),
-                           "String at %p overflows buffer, need 0x%x chars",
-                           m_Offset, Need);
+        AheadNodes = 0;
     }
 
-    if (NeedChars)
-    {
-        *NeedChars = Need;
-    }
-    return Buffer;
+    m_PrefetchNodeBytes = NodeBytes;
+    m_PrefetchNodes = AheadNodes;
+    m_PrefetchData.Delete();
+    m_PrefetchLinks.Delete();
+    ResetPrefetch(m_PrefetchPtrOffset);
 }
 
-PWSTR WINAPI
-ExtRemoteData::GetString(_Out_writes_opt_(BufferChars) PWSTR Buffer,
-                         _In_ ULONG BufferChars,
-                         _In_ ULONG MaxChars,
-                         _In_ bool MustFit,
-                         _Out_opt_ PULONG NeedChars)
+void WINAPI
+ExtRemoteList::FillPrefetch(void)
 {
-    HRESULT Status;
-    
+    ULONG64 Link = m_Node.GetPtr();
+    ULONG Budget = m_PrefetchNodes;
+    PUCHAR Data;
+    PULONG64 Links;
+
     g_Ext->ThrowInterrupt();
     
-    if (!m_ValidOffset)
+    // Never read ahead past the iteration limit.
+    if (m_CurIter < m_MaxIter &&
+        Budget > m_MaxIter - m_CurIter)
     {
-        g_Ext->ThrowRemote(E_INVALIDARG,
-                           "ExtRemoteData does not have a valid address");
+        Budget = m_MaxIter - m_CurIter;
     }
-    if (m_Physical)
+    else if (m_CurIter >= m_MaxIter)
     {
-        g_Ext->ThrowRemote(E_NOTIMPL,
-                           "ExtRemoteData cannot read strings "
-                           "from physical memory");
+        Budget = 1;
     }
 
-    ULONG Need;
+    Data = m_PrefetchData.Get(Budget * m_PrefetchNodeBytes);
+    Links = m_PrefetchLinks.Get(Budget);
+    m_PrefetchUsed = 0;
+    m_PrefetchCur = 0;
     
-    if (FAILED(Status = g_Ext->m_Data4->
-               ReadUnicodeStringVirtualWide(m_Offset,
-                                            MaxChars * sizeof(*Buffer),
-                                            Buffer, BufferChars, &Need)))
-    {
-        g_Ext->ThrowRemote(Status, "Unable to read string at %p",
-                           m_Offset);
+    while (m_PrefetchUsed < Budget &&
+           Link != 0 &&
+           Link != m_Head)
+    {
+        HRESULT Status;
+        ULONG Done;
+        PUCHAR NodeData = Data + m_PrefetchUsed * m_PrefetchNodeBytes;
+
+        Status = g_Ext->ReadCachedBuffer(m_Node.m_Physical,
+                                         m_Node.m_SpaceFlags,
+                                         Link - m_LinkOffset,
+                                         NodeData,
+                                         m_PrefetchNodeBytes,
+                                         &Done);
+        if (Status == S_OK && Done != m_PrefetchNodeBytes)
+        {
+            Status = HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+        }
+        if (Status != S_OK)
+        {
+            // Only the current node is required,
+            // read-ahead just stops.
+            if (!m_PrefetchUsed)
+            {
+                g_Ext->ThrowRemote(Status, "Unable to read list node at %p",
+                                   Link - m_LinkOffset);
+            }
+            break;
+        }
+
+        Links[m_PrefetchUsed++] = Link;
+        Link = SignExtendNodePtr
+            (GetRawNodePtr(NodeData + m_LinkOffset + m_PrefetchPtrOffset));
     }
-    if (Status != S_OK && MustFit)
+}
+
+void WINAPI
+ExtRemoteList::PrefetchStep(void)
+{
+    if (m_PrefetchCur >= m_PrefetchUsed)
     {
-        g_Ext->ThrowRemote(HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW),
-                           "String at %p overflows buffer, need 0x%x chars",
-                           m_Offset, Need);
+        FillPrefetch();
+
+        if (!m_PrefetchUsed)
+        {
+            // No current node, so step exactly as
+            // a non-prefetching walk would.
+            m_Node.Set(m_Node.GetPtr() + m_PrefetchPtrOffset,
+                       g_Ext->m_PtrSize);
+            return;
+        }
     }
 
-    if (NeedChars)
+    ULONG64 Link = m_PrefetchLinks.GetBuffer()[m_PrefetchCur];
+    PUCHAR Data = m_PrefetchData.GetBuffer() +
+        m_PrefetchCur * m_PrefetchNodeBytes;
+
+    // Leave m_Node as if the link had been read directly.
+    m_Node.m_Offset = Link + m_PrefetchPtrOffset;
+    m_Node.m_ValidOffset = true;
+    m_Node.m_Bytes = g_Ext->m_PtrSize;
+    m_Node.m_Data = GetRawNodePtr(Data + m_LinkOffset + m_PrefetchPtrOffset);
+    m_Node.m_ValidData = true;
+
+    if (++m_PrefetchCur >= m_PrefetchUsed)
     {
-        *NeedChars = Need;
+        m_PrefetchUsed = 0;
+        m_PrefetchCur = 0;
     }
-    return Buffer;
 }
 
-PSTR WINAPI
-ExtRemoteData::GetString(_Inout_ ExtBuffer<char>* Buffer,
-                         _In_ ULONG MaxChars)
+PUCHAR WINAPI
+ExtRemoteList::GetNodeData(void)
 {
-    ULONG Need;
-
-    for (ULONG i = 0; i < 2; i++)
+    if (!m_PrefetchNodeBytes)
     {
-        GetString(Buffer->GetRawBuffer(),
-                  Buffer->GetEltsAlloc(),
-                  MaxChars,
-                  false,
-                  &Need);
-        if (Need <= Buffer->GetEltsAlloc())
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "ExtRemoteList is not prefetching");
+    }
+    
+    if (m_PrefetchCur >= m_PrefetchUsed)
+    {
+        FillPrefetch();
+        
+        if (!m_PrefetchUsed)
         {
-            Buffer->SetEltsUsed(Need);
-            return Buffer->GetBuffer();
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "ExtRemoteList has no current node");
         }
-
-        Buffer->Require(Need);
     }
 
-    g_Ext->ThrowRemote(E_INVALIDARG, "Unable to read string at %p",
-                       m_Offset);
+    return m_PrefetchData.GetBuffer() + m_PrefetchCur * m_PrefetchNodeBytes;
 }
 
-PWSTR WINAPI
-ExtRemoteData::GetString(_Inout_ ExtBuffer<WCHAR>* Buffer,
-                         _In_ ULONG MaxChars)
+void WINAPI
+ExtRemoteTypedList::SetTypedPrefetch(_In_ ULONG AheadNodes)
 {
-    ULONG Need;
+    ExtRemoteTyped Ptr;
 
-    for (ULONG i = 0; i < 2; i++)
+    // Resolve the node type the same way GetTypedNodePtr
+    // does, without needing an actual node.
+    if (m_TypeId)
     {
-        GetString(Buffer->GetRawBuffer(),
-                  Buffer->GetEltsAlloc(),
-                  MaxChars,
-                  false,
-                  &Need);
-        if (Need <= Buffer->GetEltsAlloc())
-        {
-            Buffer->SetEltsUsed(Need);
-            return Buffer->GetBuffer();
-        }
-
-        Buffer->Require(Need);
+        Ptr.Set(true, m_TypeModBase, m_TypeId, 0);
+    }
+    else
+    {
+        Ptr.SetPrint("(%s*)0", m_Type);
     }
 
-    g_Ext->ThrowRemote(E_INVALIDARG, "Unable to read string at %p",
-                       m_Offset);
+    ExtRemoteTyped Node = Ptr.Dereference();
+    m_TypeModBase = Node.m_Typed.ModBase;
+    m_TypeId = Node.m_Typed.TypeId;
+    
+    SetPrefetch(Node.GetTypeSize(), AheadNodes);
 }
 
 //----------------------------------------------------------------------------
 //
-// ExtRemoteTyped.
+// ExtRemoteListSnapshot.
 //
 //----------------------------------------------------------------------------
 
 void WINAPI
-ExtRemoteTyped::Copy(_In_ const DEBUG_TYPED_DATA* Source)
-{
-    m_Typed = *Source;
-    ErtIoctl("Copy", EXT_TDOP_COPY, ErtUncheckedIn | ErtOut);
-}
-
-void WINAPI
-ExtRemoteTyped::Set(_In_ PCSTR Expr)
+ExtRemoteListSnapshot::Capture(_In_ ExtRemoteList& List,
+                               _In_ ULONG NodeBytes)
 {
-    EXT_TDOP Op;
-    ULONG Flags = ErtOut;
-    
-    // If we have a valid value let it be used
-    // in the expression if desired.
-    if (m_Release)
+    if (!NodeBytes)
     {
-        Op = EXT_TDOP_EVALUATE;
-        Flags |= ErtIn;
+        NodeBytes = List.m_PrefetchNodeBytes;
+        if (!NodeBytes)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "List snapshot needs a node size");
+        }
     }
-    else
+    if (NodeBytes != List.m_PrefetchNodeBytes)
     {
-        Op = EXT_TDOP_SET_FROM_EXPR;
+        List.SetPrefetch(NodeBytes);
     }
 
-    PSTR Msg = g_Ext->
-        PrintCircleString("Set: unable to evaluate '%s'", Expr);
-    ErtIoctl(Msg, Op, Flags, Expr);
-}
-
-void WINAPI
-ExtRemoteTyped::Set(_In_ PCSTR Expr,
-                    _In_ ULONG64 Offset)
-{
-    m_Typed.Offset = Offset;
-    PSTR Msg = g_Ext->
-        PrintCircleString("Set: unable to evaluate '%s' for 0x%I64x",
-                          Expr, Offset);
-    ErtIoctl(Msg, EXT_TDOP_SET_FROM_U64_EXPR, ErtUncheckedIn | ErtOut, Expr);
-}
+    m_Count = 0;
+    m_NodeBytes = NodeBytes;
+    m_ResultBytes = 0;
+    m_Nodes.Empty();
+    m_Data.Empty();
+    m_Results.Empty();
+    m_Status.Empty();
+    m_Pages.Empty();
+    m_PageData.Empty();
+    m_Missing.Empty();
 
-void WINAPI
-ExtRemoteTyped::Set(_In_ bool PtrTo,
-                    _In_ ULONG64 TypeModBase,
-                    _In_ ULONG TypeId,
-                    _In_ ULONG64 Offset)
-{
-    HRESULT Status;
-    EXT_TYPED_DATA ExtData;
+    //
+    // The walk itself is an ordinary prefetching walk,
+    // the node data is just kept instead of discarded.
+    //
+    
+    for (List.StartHead(); List.HasNode(); List.Next())
+    {
+        if (m_Count >= m_Nodes.GetEltsAlloc())
+        {
+            ULONG Alloc = m_Count ? m_Count * 2 : 64;
 
-    g_Ext->ThrowInterrupt();
+            if ((ULONG64)Alloc * NodeBytes > 0x10000000)
+            {
+                g_Ext->ThrowRemote(E_INVALIDARG,
+                                   "List snapshot is too large");
+            }
+            
+            m_Nodes.Require(Alloc);
+            m_Data.Require(Alloc * NodeBytes);
+        }
 
-    ZeroMemory(&ExtData, sizeof(ExtData));
-    ExtData.Operation = PtrTo ?
-        EXT_TDOP_SET_PTR_FROM_TYPE_ID_AND_U64 :
-        EXT_TDOP_SET_FROM_TYPE_ID_AND_U64;
-    if (m_Physical)
-    {
-        ExtData.Flags |= (m_SpaceFlags + 1) << 1;
+        m_Nodes.GetBuffer()[m_Count] = List.GetNodeOffset();
+        memcpy(m_Data.GetBuffer() + m_Count * NodeBytes,
+               List.GetNodeData(),
+               NodeBytes);
+        m_Count++;
+        m_Nodes.SetEltsUsed(m_Count);
+        m_Data.SetEltsUsed(m_Count * NodeBytes);
     }
-    ExtData.InData.ModBase = TypeModBase;
-    ExtData.InData.TypeId = TypeId;
-    ExtData.InData.Offset = Offset;
+}
+
+bool WINAPI
+ExtRemoteListSnapshot::DecodeChunk(_In_ DecodeState* State)
+{
+    ExtRemoteListSnapshot* Snap = State->Snapshot;
     
-    Status = g_Ext->m_Advanced2->
-        Request(DEBUG_REQUEST_EXT_TYPED_DATA_ANSI,
-                &ExtData, sizeof(ExtData),
-                &ExtData, sizeof(ExtData),
-                NULL);
-    if (SUCCEEDED(Status))
+    if (State->Abort)
     {
-        Status = ExtData.Status;
+        return false;
     }
 
-    if (FAILED(Status))
+    ULONG Chunk = (ULONG)InterlockedIncrement(&State->NextChunk) - 1;
+    if (Chunk >= (State->NumWork + s_DecodeChunk - 1) / s_DecodeChunk)
     {
-        g_Ext->ThrowRemote(Status,
-                           "ExtRemoteTyped::Set from type and offset");
+        return false;
     }
 
-    Release();
-    m_Typed = ExtData.OutData;
-    ExtRemoteData::Set(&m_Typed);
-    m_Release = true;
-}
-
-void WINAPI
-ExtRemoteTyped::Set(_In_ PCSTR Type,
-                    _In_ ULONG64 Offset,
-                    _In_ bool PtrTo,
-                    _Inout_opt_ PULONG64 CacheCookie,
-                    _In_opt_ PCSTR LinkField)
-{
-    HRESULT Status;
-    ULONG64 TypeModBase;
-    ULONG TypeId;
-    
-    if (!CacheCookie)
+    ULONG Work = Chunk * s_DecodeChunk;
+    ULONG End = Work + s_DecodeChunk;
+    if (End > State->NumWork)
     {
-        if ((Status = g_Ext->m_Symbols->
-             GetSymbolTypeId(Type, 
-                             &TypeId,
-                             &TypeModBase)) != S_OK)
-        {
-            g_Ext->ThrowStatus(Status, "Unable to get type ID of '%s'",
-                               Type);
-        }
+        End = State->NumWork;
     }
-    else
+
+    for (; Work < End; Work++)
     {
-        if (LinkField)
+        ULONG Index = State->Work[Work];
+        HRESULT Status;
+        
+        try
         {
-            // We don't really need the field offset
-            // here but it allows us to use cache
-            // entries that were created for list
-            // usage and so do have it.
-            g_Ext->GetCachedFieldOffset(CacheCookie,
-                                        Type,
-                                        LinkField,
-                                        &TypeModBase,
-                                        &TypeId);
+            Status = State->Func(Snap,
+                                 State->Context,
+                                 Index,
+                                 Snap->m_Nodes.GetRawBuffer()[Index],
+                                 Snap->m_Data.GetRawBuffer() +
+                                 (ULONG_PTR)Index * Snap->m_NodeBytes,
+                                 Snap->m_NodeBytes,
+                                 Snap->m_Results.GetRawBuffer() +
+                                 (ULONG_PTR)Index * Snap->m_ResultBytes,
+                                 Snap->m_ResultBytes);
         }
-        else
+        catch(ExtException Ex)
         {
-            TypeId = g_Ext->GetCachedSymbolTypeId(CacheCookie,
-                                                  Type,
-                                                  &TypeModBase);
+            Status = Ex.GetStatus();
         }
+
+        Snap->m_Status.GetRawBuffer()[Index] = Status;
     }
-        
-    Set(PtrTo, TypeModBase, TypeId, Offset);
+
+    return true;
 }
 
-void WINAPIV
-ExtRemoteTyped::SetPrint(_In_ PCSTR Format,
-                         ...)
+DWORD WINAPI
+ExtRemoteListSnapshot::DecodeThread(_In_ LPVOID Param)
 {
-    HRESULT Status;
-    va_list Args;
-    
-    va_start(Args, Format);
-    Status = StringCbVPrintfA(g_Ext->s_String, sizeof(g_Ext->s_String),
-                              Format, Args);
-    va_end(Args);
-    if (Status != S_OK)
+    DecodeState* State = (DecodeState*)Param;
+
+    while (DecodeChunk(State))
     {
-        g_Ext->ThrowRemote(Status,
-                           "ExtRemoteTyped::SetPrint: overflow on '%s'",
-                           Format);
+        // Claim more work.
     }
-    Set(g_Ext->CopyCircleString(g_Ext->s_String));
-}
-
-ULONG WINAPI
-ExtRemoteTyped::GetFieldOffset(_In_ PCSTR Field) throw(...)
-{
-    ULONG Offset;
-    PSTR Msg = g_Ext->
-        PrintCircleString("GetFieldOffset: no field '%s'",
-                          Field);
-    ErtIoctl(Msg, EXT_TDOP_GET_FIELD_OFFSET, ErtIn, Field, 0, NULL,
-             NULL, 0, &Offset);
-    return Offset;
+    return 0;
 }
 
-ExtRemoteTyped WINAPI
-ExtRemoteTyped::Field(_In_ PCSTR Field)
+bool WINAPI
+ExtRemoteListSnapshot::DecodeRound(_In_ DecodeState* State,
+                                   _In_ ULONG Threads)
 {
-    ExtRemoteTyped Ret;
+    ULONG Chunks = (State->NumWork + s_DecodeChunk - 1) / s_DecodeChunk;
+    if (Threads > Chunks)
+    {
+        Threads = Chunks;
+    }
     
-    PSTR Msg = g_Ext->
-        PrintCircleString("Field: unable to retrieve field '%s' at %I64x",
-                          Field, m_Offset);
-    ErtIoctl(Msg, EXT_TDOP_GET_FIELD, ErtIn | ErtOut, Field, 0, &Ret);
-    return Ret;
-}
+    HANDLE Handles[MAXIMUM_WAIT_OBJECTS];
+    ULONG NumHandles = 0;
+    bool Interrupted = false;
 
-ExtRemoteTyped WINAPI
-ExtRemoteTyped::ArrayElement(_In_ LONG64 Index)
-{
-    ExtRemoteTyped Ret;
+    State->NextChunk = 0;
+    State->Abort = 0;
 
-    PSTR Msg = g_Ext->
-        PrintCircleString("ArrayElement: unable to retrieve element %I64d",
-                          Index);
-    ErtIoctl(Msg, EXT_TDOP_GET_ARRAY_ELEMENT,
-             ErtIn | ErtOut, NULL, Index, &Ret);
-    return Ret;
-}
+    // If a thread can't be created the remaining
+    // threads just pick up more of the work.
+    while (NumHandles + 1 < Threads)
+    {
+        Handles[NumHandles] = CreateThread(NULL, 0, DecodeThread, State,
+                                           0, NULL);
+        if (!Handles[NumHandles])
+        {
+            break;
+        }
+        NumHandles++;
+    }
 
-ExtRemoteTyped WINAPI
-ExtRemoteTyped::Dereference(void)
-{
-    ExtRemoteTyped Ret;
+    //
+    // The calling thread works too and is the only
+    // one that can check for a user interrupt.
+    //
+    
+    while (DecodeChunk(State))
+    {
+        if (!Interrupted &&
+            g_Ext->m_Control->GetInterrupt() == S_OK)
+        {
+            InterlockedExchange(&State->Abort, 1);
+            Interrupted = true;
+        }
+    }
 
-    ErtIoctl("Dereference", EXT_TDOP_GET_DEREFERENCE,
-             ErtIn | ErtOut, NULL, 0, &Ret);
-    return Ret;
+    if (NumHandles)
+    {
+        WaitForMultipleObjects(NumHandles, Handles, TRUE, INFINITE);
+        for (ULONG i = 0; i < NumHandles; i++)
+        {
+            CloseHandle(Handles[i]);
+        }
+    }
+
+    return Interrupted;
 }
 
-ExtRemoteTyped WINAPI
-ExtRemoteTyped::GetPointerTo(void)
+void WINAPI
+ExtRemoteListSnapshot::Decode(_In_ ExtNodeDecodeFunction Func,
+                              _In_opt_ PVOID Context,
+                              _In_ ULONG ResultBytes,
+                              _In_ ULONG Threads)
 {
-    ExtRemoteTyped Ret;
+    if ((ULONG64)m_Count * ResultBytes > 0x10000000)
+    {
+        g_Ext->ThrowRemote(E_INVALIDARG,
+                           "List snapshot results are too large");
+    }
 
-    ErtIoctl("GetPointerTo", EXT_TDOP_GET_POINTER_TO,
-             ErtIn | ErtOut, NULL, 0, &Ret);
-    return Ret;
-}
+    m_ResultBytes = ResultBytes;
+    m_PtrSize = g_Ext->m_PtrSize;
+    m_Results.Empty();
+    m_Status.Empty();
+    ZeroMemory(m_Results.Get(m_Count * ResultBytes),
+               m_Count * ResultBytes);
+    HRESULT* Status = m_Status.Get(m_Count);
+    ExtBuffer<ULONG> Work;
+    PULONG WorkIndex = Work.Get(m_Count);
+    for (ULONG i = 0; i < m_Count; i++)
+    {
+        Status[i] = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        WorkIndex[i] = i;
+    }
 
-ExtRemoteTyped WINAPI
-ExtRemoteTyped::Eval(_In_ PCSTR Expr)
-{
-    ExtRemoteTyped Ret;
+    if (!Threads)
+    {
+        SYSTEM_INFO SysInfo;
+
+        GetSystemInfo(&SysInfo);
+        Threads = SysInfo.dwNumberOfProcessors;
+    }
+    if (Threads > MAXIMUM_WAIT_OBJECTS)
+    {
+        Threads = MAXIMUM_WAIT_OBJECTS;
+    }
     
-    PSTR Msg = g_Ext->
-        PrintCircleString("Eval: unable to evaluate '%s'",
-                          Expr);
-    ErtIoctl(Msg, EXT_TDOP_EVALUATE, ErtIn | ErtOut, Expr, 0, &Ret);
-    return Ret;
-}
+    DecodeState State;
 
-PSTR WINAPI
-ExtRemoteTyped::GetTypeName(void)
-{
-    ErtIoctl("GetTypeName", EXT_TDOP_GET_TYPE_NAME, ErtIn, NULL, 0, NULL,
-             g_Ext->s_String, EXT_DIMA(g_Ext->s_String));
-    return g_Ext->CopyCircleString(g_Ext->s_String);
-}
+    State.Snapshot = this;
+    State.Func = Func;
+    State.Context = Context;
+    State.Work = WorkIndex;
+    State.NumWork = m_Count;
+    m_Missing.Empty();
 
-PSTR WINAPI
-ExtRemoteTyped::GetSimpleValue(void)
-{
-    ExtCaptureOutputA Capture;
+    for (ULONG Round = 1; ; Round++)
+    {
+        if (DecodeRound(&State, Threads))
+        {
+            m_Missing.Empty();
+            throw ExtInterruptException();
+        }
 
-    Capture.Start();
+        //
+        // Nodes that read uncaptured memory go again
+        // once the engine thread has captured it.
+        //
+        
+        ULONG NumPending = 0;
+        
+        for (ULONG i = 0; i < State.NumWork; i++)
+        {
+            ULONG Index = State.Work[i];
 
-    OutSimpleValue();
+            if (Status[Index] == E_PENDING)
+            {
+                State.Work[NumPending++] = Index;
+            }
+        }
 
-    Capture.Stop();
-    return g_Ext->CopyCircleString(Capture.GetTextNonNull());
-}
+        if (!NumPending ||
+            Round >= s_MaxDecodeRounds ||
+            !CaptureMissing())
+        {
+            break;
+        }
 
-ULONG WINAPI
-ExtRemoteTyped::GetTypeFieldOffset(_In_ PCSTR Type,
-                                   _In_ PCSTR Field)
-{
-    HRESULT Status;
-    DEBUG_VALUE Data;
-    PSTR Expr;
+        for (ULONG i = 0; i < NumPending; i++)
+        {
+            ULONG Index = State.Work[i];
 
-    Expr = g_Ext->PrintCircleString("@@c++(#FIELD_OFFSET(%s, %s))",
-                                    Type, Field);
-    if (FAILED(Status = g_Ext->m_Control->
-               Evaluate(Expr, DEBUG_VALUE_INT64, &Data, NULL)))
-    {
-        g_Ext->ThrowRemote(Status,
-                           "Could not find type field %s.%s",
-                           Type, Field);
+            ZeroMemory(m_Results.GetRawBuffer() +
+                       (ULONG_PTR)Index * ResultBytes,
+                       ResultBytes);
+            Status[Index] = HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+        State.NumWork = NumPending;
     }
 
-    return (ULONG)Data.I64;
+    m_Missing.Empty();
 }
 
-HRESULT WINAPI
-ExtRemoteTyped::ErtIoctl(_In_ PCSTR Message,
-                         _In_ EXT_TDOP Op,
-                         _In_ ULONG Flags,
-                         _In_opt_ PCSTR InStr,
-                         _In_ ULONG64 In64,
-                         _Out_opt_ ExtRemoteTyped* Ret,
-                         _Out_writes_opt_(StrBufferChars) PSTR StrBuffer,
-                         _In_ ULONG StrBufferChars,
-                         _Out_opt_ PULONG Out32)
+const ExtRemoteListSnapshot::MemoryPage* WINAPI
+ExtRemoteListSnapshot::FindPage(_In_ ULONG64 Base)
 {
-    HRESULT Status;
-    ExtDeclAlignedBuffer<BYTE, sizeof(EXT_TYPED_DATA) +
-                               10 * sizeof(ULONG64)> DataHolder;
-    EXT_TYPED_DATA* ExtData;
-    ULONG ExtDataBytes;
-    PBYTE ExtraData;
+    const MemoryPage* Pages = m_Pages.GetRawBuffer();
+    ULONG Low = 0;
+    ULONG High = m_Pages.GetEltsUsed();
 
-    C_ASSERT(EXT_TDF_PHYSICAL_MEMORY == DEBUG_TYPED_DATA_PHYSICAL_MEMORY);
-
-    // Check for a user interrupt, but don't do that
-    // when we're in a cleanup path since we don't
-    // want to prevent orderly shutdown of objects.
-    if (Op != EXT_TDOP_RELEASE)
+    while (Low < High)
     {
-        g_Ext->ThrowInterrupt();
-    }
+        ULONG Mid = Low + (High - Low) / 2;
 
-    ExtDataBytes = sizeof(*ExtData) +
-        StrBufferChars * sizeof(*StrBuffer);
-    if (InStr)
-    {
-        ExtDataBytes += (strlen(InStr) + 1) * sizeof(*InStr);
+        if (Pages[Mid].Base == Base)
+        {
+            return &Pages[Mid];
+        }
+        else if (Pages[Mid].Base < Base)
+        {
+            Low = Mid + 1;
+        }
+        else
+        {
+            High = Mid;
+        }
     }
 
-    ExtData = (EXT_TYPED_DATA*)DataHolder.Get(ExtDataBytes);
-    ExtraData = (PBYTE)(ExtData + 1);
-    
-    ZeroMemory(ExtData, sizeof(*ExtData));
-    ExtData->Operation = Op;
-    if (m_Physical)
-    {
-        ExtData->Flags |= (m_SpaceFlags + 1) << 1;
-    }
-    if (InStr)
-    {
-        ExtData->InStrIndex = (ULONG)(ExtraData - (PBYTE)ExtData);
-        memcpy(ExtraData, InStr,
-               (strlen(InStr) + 1) * sizeof(*InStr));
-        ExtraData += (strlen(InStr) + 1) * sizeof(*InStr);
+    return NULL;
+}
+
+void WINAPI
+ExtRemoteListSnapshot::AddMissing(_In_ ULONG64 Base)
+{
+    EnterCriticalSection(&m_MissingLock);
+    try
+    {
+        m_Missing.Append(&Base);
     }
-    ExtData->In64 = In64;
-    if (StrBuffer)
+    catch(...)
     {
-        ExtData->StrBufferIndex = (ULONG)(ExtraData - (PBYTE)ExtData);
-        ExtData->StrBufferChars = StrBufferChars;
-        ExtraData += StrBufferChars * sizeof(*StrBuffer);
+        // The node stays pending and the decode
+        // gives up when no pages are captured.
+    }
+    LeaveCriticalSection(&m_MissingLock);
+}
+
+void WINAPI
+ExtRemoteListSnapshot::ReadMemory(_In_ ULONG64 Offset,
+                                  _Out_writes_bytes_(Bytes) PVOID Buffer,
+                                  _In_ ULONG Bytes)
+{
+    PUCHAR To = (PUCHAR)Buffer;
+    bool Pending = false;
+
+    // This can run on any worker so it must not
+    // use g_Ext, including for throwing.
+    if (Bytes > 64 * s_MemoryPageSize)
+    {
+        throw ExtStatusException(E_INVALIDARG,
+                                 "Snapshot memory read is too large");
     }
     
-    if ((Flags & (ErtIn | ErtUncheckedIn)) != 0)
+    while (Bytes > 0)
     {
-        if ((Flags & ErtIn) != 0 && !m_Release)
+        ULONG64 Base = Offset & ~(ULONG64)(s_MemoryPageSize - 1);
+        ULONG PageOffs = (ULONG)(Offset - Base);
+        ULONG Chunk = s_MemoryPageSize - PageOffs;
+        const MemoryPage* Page;
+
+        if (Chunk > Bytes)
         {
-            g_Ext->ThrowRemote(E_INVALIDARG,
-                               "ExtRemoteTyped::%s", Message);
+            Chunk = Bytes;
         }
 
-        ExtData->InData = m_Typed;
+        Page = FindPage(Base);
+        if (!Page)
+        {
+            // Keep going so that every missing page
+            // of the read is captured in one round.
+            AddMissing(Base);
+            Pending = true;
+        }
+        else if (!Pending)
+        {
+            if (PageOffs + Chunk > Page->Valid)
+            {
+                throw ExtStatusException
+                    (HRESULT_FROM_WIN32(ERROR_READ_FAULT),
+                     "Snapshot memory is not readable");
+            }
+            memcpy(To, m_PageData.GetRawBuffer() +
+                   Page->DataOffset + PageOffs, Chunk);
+        }
+
+        To += Chunk;
+        Offset += Chunk;
+        Bytes -= Chunk;
     }
 
-    Status = g_Ext->m_Advanced2->
-        Request(DEBUG_REQUEST_EXT_TYPED_DATA_ANSI,
-                ExtData, ExtDataBytes,
-                ExtData, ExtDataBytes,
-                NULL);
-    if (SUCCEEDED(Status))
+    if (Pending)
     {
-        Status = ExtData->Status;
+        throw ExtStatusException(E_PENDING,
+                                 "Snapshot memory has not been captured");
     }
+}
 
-    if ((Flags & ErtIgnoreError) == 0 &&
-        FAILED(Status))
+static int __cdecl
+CompareULONG64(_In_ const void* Elt1,
+               _In_ const void* Elt2)
+{
+    ULONG64 Val1 = *(const ULONG64*)Elt1;
+    ULONG64 Val2 = *(const ULONG64*)Elt2;
+
+    return Val1 < Val2 ? -1 : (Val1 > Val2 ? 1 : 0);
+}
+
+ULONG WINAPI
+ExtRemoteListSnapshot::CaptureMissing(void)
+{
+    ULONG Count = m_Missing.GetEltsUsed();
+    PULONG64 Missing = m_Missing.GetRawBuffer();
+    ULONG Unique = 0;
+    ULONG i;
+
+    if (!Count)
     {
-        g_Ext->ThrowRemote(Status,
-                           "ExtRemoteTyped::%s", Message);
+        return 0;
     }
 
-    if ((Flags & ErtOut) != 0)
+    qsort(Missing, Count, sizeof(*Missing), CompareULONG64);
+    for (i = 0; i < Count; i++)
     {
-        if (!Ret)
+        if (!i || Missing[i] != Missing[i - 1])
         {
-            Ret = this;
+            Missing[Unique++] = Missing[i];
         }
-
-        Ret->Release();
-        Ret->m_Typed = ExtData->OutData;
-        Ret->ExtRemoteData::Set(&Ret->m_Typed);
-        Ret->m_Release = true;
     }
 
-    if (StrBuffer)
+    ULONG DataUsed = m_PageData.GetEltsUsed();
+    
+    if ((ULONG64)DataUsed + (ULONG64)Unique * s_MemoryPageSize >
+        0x10000000)
     {
-        memcpy(StrBuffer, (PBYTE)ExtData + ExtData->StrBufferIndex,
-               StrBufferChars * sizeof(*StrBuffer));
+        // Give up rather than growing without bound.
+        m_Missing.Empty();
+        return 0;
     }
     
-    if (Out32)
+    m_PageData.Require(DataUsed + Unique * s_MemoryPageSize);
+
+    //
+    // Merge the new pages, which are sorted, with
+    // the existing sorted pages.
+    //
+    
+    ULONG OldCount = m_Pages.GetEltsUsed();
+    ExtBuffer<MemoryPage> Merged;
+    MemoryPage* To = Merged.Get(OldCount + Unique);
+    const MemoryPage* Old = m_Pages.GetRawBuffer();
+    ULONG OldIdx = 0;
+
+    for (i = 0; i < Unique; i++)
     {
-        *Out32 = ExtData->Out32;
-    }
+        ULONG Done = 0;
 
-    return Status;
-}
+        g_Ext->PollInterrupt();
+        
+        if (g_Ext->m_Data->ReadVirtual(Missing[i],
+                                       m_PageData.GetRawBuffer() + DataUsed,
+                                       s_MemoryPageSize,
+                                       &Done) != S_OK)
+        {
+            // Unreadable pages are kept so that
+            // reads of them fail instead of pending.
+            Done = 0;
+        }
 
-void WINAPI
-ExtRemoteTyped::Clear(void)
-{
-    ZeroMemory(&m_Typed, sizeof(m_Typed));
-    m_Release = false;
-    ExtRemoteData::Clear();
+        while (OldIdx < OldCount &&
+               Old[OldIdx].Base < Missing[i])
+        {
+            *To++ = Old[OldIdx++];
+        }
+        
+        To->Base = Missing[i];
+        To->Valid = Done;
+        To->DataOffset = DataUsed;
+        To++;
+        
+        DataUsed += s_MemoryPageSize;
+        m_PageData.SetEltsUsed(DataUsed);
+    }
+    while (OldIdx < OldCount)
+    {
+        *To++ = Old[OldIdx++];
+    }
+
+    m_Pages = Merged;
+    m_Missing.Empty();
+    return Unique;
 }
 
 //----------------------------------------------------------------------------
@@ -4488,6 +7128,10 @@ ExtNtOsInformation::GetKernelLoadedModuleList(void)
                             &s_KernelLoadedModuleBaseInfoCookie,
                             true);
     List.m_MaxIter = 1000;
+    if (g_Ext->IsReadCacheEnabled())
+    {
+        List.SetTypedPrefetch();
+    }
     return List;
 }
     
@@ -4523,6 +7167,10 @@ ExtNtOsInformation::GetKernelProcessList(void)
                             &s_KernelProcessBaseInfoCookie,
                             true);
     List.m_MaxIter = 4000;
+    if (g_Ext->IsReadCacheEnabled())
+    {
+        List.SetTypedPrefetch();
+    }
     return List;
 }
 
@@ -4559,6 +7207,10 @@ ExtNtOsInformation::GetKernelProcessThreadList(_In_ ULONG64 Process)
                             &s_KernelThreadBaseInfoCookie,
                             true);
     List.m_MaxIter = 15000;
+    if (g_Ext->IsReadCacheEnabled())
+    {
+        List.SetTypedPrefetch();
+    }
     return List;
 }
 
@@ -4575,6 +7227,27 @@ ExtNtOsInformation::GetKernelThread(_In_ ULONG64 Offset)
                           "Tcb.ThreadListEntry");
 }
 
+void WINAPI
+ExtNtOsInformation::CaptureKernelProcessList
+    (_Out_ ExtRemoteListSnapshot& Snapshot)
+{
+    ExtRemoteTypedList List = GetKernelProcessList();
+
+    List.SetTypedPrefetch();
+    Snapshot.Capture(List);
+}
+
+void WINAPI
+ExtNtOsInformation::CaptureKernelProcessThreadList
+    (_In_ ULONG64 Process,
+     _Out_ ExtRemoteListSnapshot& Snapshot)
+{
+    ExtRemoteTypedList List = GetKernelProcessThreadList(Process);
+
+    List.SetTypedPrefetch();
+    Snapshot.Capture(List);
+}
+
 ULONG64 WINAPI
 ExtNtOsInformation::GetUserLoadedModuleListHead(_In_ bool NativeOnly)
 {
@@ -4620,6 +7293,10 @@ ExtNtOsInformation::GetUserLoadedModuleList(_In_ bool NativeOnly)
                                 &s_UserOsLoadedModuleBaseInfoCookie,
                                 true);
         List.m_MaxIter = 1000;
+        if (g_Ext->IsReadCacheEnabled())
+        {
+            List.SetTypedPrefetch();
+        }
         return List;
     }
     else
@@ -4632,6 +7309,10 @@ ExtNtOsInformation::GetUserLoadedModuleList(_In_ bool NativeOnly)
                                 &s_UserAltLoadedModuleBaseInfoCookie,
                                 true);
         List.m_MaxIter = 1000;
+        if (g_Ext->IsReadCacheEnabled())
+        {
+            List.SetTypedPrefetch();
+        }
         return List;
     }
 }
@@ -4825,9 +7506,218 @@ ExtNtOsInformation::GetNtDebuggerData(_In_ ULONG DataOffset,
 //
 //----------------------------------------------------------------------------
 
+static ULONG
+HashDefineValue(_In_ ULONG64 Value)
+{
+    Value *= 0x9e3779b97f4a7c15UI64;
+    return (ULONG)(Value >> 32);
+}
+
+ExtDefineMap::MapIndex ExtDefineMap::s_NoIndex;
+
+ExtDefineMap::MapIndex* WINAPI
+ExtDefineMap::GetIndex(void)
+{
+    if (m_Index)
+    {
+        return m_Index != &s_NoIndex ? m_Index : NULL;
+    }
+
+    ULONG NumDefines = 0;
+    ULONG NumBits = 0;
+    ULONG HashSlots = 0;
+    ULONG i;
+    
+    for (ExtDefine* Define = m_Defines; Define->Name; Define++)
+    {
+        for (ULONG64 Bits = Define->Value; Bits; Bits &= Bits - 1)
+        {
+            NumBits++;
+        }
+        NumDefines++;
+    }
+
+    // A short scan is as quick as the index.
+    if (NumDefines < s_IndexMinDefines)
+    {
+        InterlockedCompareExchangePointer((PVOID*)&m_Index,
+                                          &s_NoIndex, NULL);
+        return NULL;
+    }
+    
+    if ((m_Flags & Bitwise) == 0)
+    {
+        HashSlots = 16;
+        while (HashSlots < NumDefines * 2)
+        {
+            HashSlots *= 2;
+        }
+        NumBits = 0;
+    }
+
+    //
+    // Everything goes in one allocation.
+    //
+    
+    MapIndex* Index = (MapIndex*)
+        malloc(sizeof(*Index) + (HashSlots + NumBits) * sizeof(ULONG));
+    if (!Index)
+    {
+        return NULL;
+    }
+
+    ZeroMemory(Index, sizeof(*Index) + HashSlots * sizeof(ULONG));
+    Index->NumDefines = NumDefines;
+    Index->Hash = (PULONG)(Index + 1);
+    Index->HashMask = HashSlots - 1;
+    Index->BitDefines = Index->Hash + HashSlots;
+    Index->ZeroDefine = NumDefines;
+
+    if ((m_Flags & Bitwise) == 0)
+    {
+        for (i = 0; i < NumDefines; i++)
+        {
+            ULONG Slot = HashDefineValue(m_Defines[i].Value) &
+                Index->HashMask;
+            bool Dup = false;
+
+            // The first define with a value wins.
+            while (Index->Hash[Slot])
+            {
+                if (m_Defines[Index->Hash[Slot] - 1].Value ==
+                    m_Defines[i].Value)
+                {
+                    Dup = true;
+                    break;
+                }
+                Slot = (Slot + 1) & Index->HashMask;
+            }
+            if (!Dup)
+            {
+                Index->Hash[Slot] = i + 1;
+            }
+        }
+    }
+    else
+    {
+        ULONG Bit;
+        
+        for (i = 0; i < NumDefines; i++)
+        {
+            if (!m_Defines[i].Value &&
+                Index->ZeroDefine == NumDefines)
+            {
+                Index->ZeroDefine = i;
+            }
+            
+            for (Bit = 0; Bit < 64; Bit++)
+            {
+                if ((m_Defines[i].Value >> Bit) & 1)
+                {
+                    Index->BitStart[Bit + 1]++;
+                }
+            }
+        }
+        for (Bit = 0; Bit < 64; Bit++)
+        {
+            Index->BitStart[Bit + 1] += Index->BitStart[Bit];
+        }
+
+        // Fill in define order using BitStart as cursors,
+        // then shift the starts back.
+        for (i = 0; i < NumDefines; i++)
+        {
+            for (Bit = 0; Bit < 64; Bit++)
+            {
+                if ((m_Defines[i].Value >> Bit) & 1)
+                {
+                    Index->BitDefines[Index->BitStart[Bit]++] = i;
+                }
+            }
+        }
+        for (Bit = 64; Bit > 0; Bit--)
+        {
+            Index->BitStart[Bit] = Index->BitStart[Bit - 1];
+        }
+        Index->BitStart[0] = 0;
+    }
+
+    if (InterlockedCompareExchangePointer((PVOID*)&m_Index,
+                                          Index, NULL) != NULL)
+    {
+        // Another thread got there first.
+        free(Index);
+    }
+    return m_Index;
+}
+
 ExtDefine* WINAPI
 ExtDefineMap::Map(_In_ ULONG64 Value)
 {
+    MapIndex* Index = GetIndex();
+
+    if (Index &&
+        (m_Flags & Bitwise) != 0)
+    {
+        //
+        // A matching define has all of its bits in the value,
+        // so it is in the list for any of its bits.  Find the
+        // earliest match in each set bit's list and take the
+        // earliest overall, which is the define a scan
+        // in order would find.
+        //
+        
+        ULONG Best = Index->ZeroDefine;
+        
+        for (ULONG64 Bits = Value; Bits; Bits &= Bits - 1)
+        {
+            ULONG Bit = 0;
+
+            while (!((Bits >> Bit) & 1))
+            {
+                Bit++;
+            }
+
+            for (ULONG j = Index->BitStart[Bit];
+                 j < Index->BitStart[Bit + 1];
+                 j++)
+            {
+                ULONG Def = Index->BitDefines[j];
+                
+                if (Def >= Best)
+                {
+                    break;
+                }
+                if ((m_Defines[Def].Value & Value) == m_Defines[Def].Value)
+                {
+                    Best = Def;
+                    break;
+                }
+            }
+        }
+
+        return Best < Index->NumDefines ? &m_Defines[Best] : NULL;
+    }
+    else if (Index)
+    {
+        ULONG Slot = HashDefineValue(Value) & Index->HashMask;
+
+        while (Index->Hash[Slot])
+        {
+            ExtDefine* Define = &m_Defines[Index->Hash[Slot] - 1];
+            if (Define->Value == Value)
+            {
+                return Define;
+            }
+            Slot = (Slot + 1) & Index->HashMask;
+        }
+        return NULL;
+    }
+
+    //
+    // No index, search directly.
+    //
+    
     if ((m_Flags & Bitwise) != 0)
     {
         for (ExtDefine* Define = m_Defines; Define->Name; Define++)
@@ -4985,6 +7875,24 @@ ExtDefineMap::Out(_In_ ULONG64 Value,
     g_Ext->m_LeftIndent = OldIndent;
 }
 
+void WINAPI
+ExtDefineMap::Out(_In_ ULONG Count,
+                  _In_reads_(Count) const ULONG64* Values,
+                  _In_ ULONG Flags,
+                  _In_opt_ PCSTR InvalidStr,
+                  _In_ PCSTR Separator)
+{
+    // Build the index up front rather than on
+    // the first value.
+    GetIndex();
+    
+    for (ULONG i = 0; i < Count; i++)
+    {
+        Out(Values[i], Flags, InvalidStr);
+        g_Ext->OutWrapStr(Separator);
+    }
+}
+
 //----------------------------------------------------------------------------
 //
 // Extension DLL exports.
@@ -4994,19 +7902,54 @@ ExtDefineMap::Out(_In_ ULONG64 Value,
 EXTERN_C BOOL WINAPI
 DllMain(HANDLE Instance, ULONG Reason, PVOID Reserved)
 {
-    switch(Reason)
+    BOOL Ret = TRUE;
+    
+    //
+    // The thread string facility is set up before the
+    // extension's own DllMain runs and torn down after,
+    // so that the extension can format strings in it.
+    //
+    
+    if (Reason == DLL_PROCESS_ATTACH)
     {
-    case DLL_PROCESS_ATTACH:
         ExtExtension::s_Module = (HMODULE)Instance;
-        break;
+        if (!ExtExtension::InitializeThreadStrings())
+        {
+            return FALSE;
+        }
     }
 
     if (g_ExtDllMain)
     {
-        return g_ExtDllMain(Instance, Reason, Reserved);
+        Ret = g_ExtDllMain(Instance, Reason, Reserved);
+    }
+
+    switch(Reason)
+    {
+    case DLL_PROCESS_ATTACH:
+        if (!Ret)
+        {
+            // There will be no detach.
+            ExtExtension::UninitializeThreadStrings();
+        }
+        break;
+    case DLL_THREAD_DETACH:
+    {
+        ExtExtension::StringArena* Arena;
+        
+        Arena = ExtExtension::GetThreadStrings(false);
+        if (Arena)
+        {
+            ExtExtension::FreeThreadStrings(Arena);
+        }
+        break;
+    }
+    case DLL_PROCESS_DETACH:
+        ExtExtension::UninitializeThreadStrings();
+        break;
     }
     
-    return TRUE;
+    return Ret;
 }
 
 EXTERN_C HRESULT CALLBACK
@@ -5040,6 +7983,19 @@ DebugExtensionNotify(_In_ ULONG Notify,
 
     ExtExtension* Inst = g_Ext;
 
+    // Any session change other than becoming accessible
+    // means the target may have run or gone away.
+    if (Notify != DEBUG_NOTIFY_SESSION_ACCESSIBLE)
+    {
+        Inst->FlushReadCache();
+    }
+    // A new session has new modules.
+    if (Notify == DEBUG_NOTIFY_SESSION_ACTIVE ||
+        Notify == DEBUG_NOTIFY_SESSION_INACTIVE)
+    {
+        Inst->FlushTypeCache();
+    }
+
     switch(Notify)
     {
     case DEBUG_NOTIFY_SESSION_ACTIVE:
@@ -987,6 +987,7 @@ public:
     ExtExtension* m_Ext;
     ExtCommandDesc* m_Next;
     PCSTR m_Name;
+    ULONG m_NameHash;
     ExtCommandMethod m_Method;
     PCSTR m_Desc;
     PCSTR m_ArgDescStr;
@@ -1014,6 +1015,10 @@ public:
         ULONG DefaultSilent:1;
         ULONG ExpressionBits;
         ULONG ExpressionRadix;
+        ULONG NameHash;
+        // Index of the parsed value in ExtExtension::m_Args,
+        // valid while Present.
+        ULONG ValIndex;
 
         bool NeedsOptionsOutput(void)
         {
@@ -1039,6 +1044,13 @@ public:
     ULONG m_NumUnnamedArgs;
     ArgDesc* m_Args;
 
+    // Named arguments hashed by name.  Entries are an
+    // index into m_Args plus one, zero for empty.  The
+    // table is twice the argument limit so it is at
+    // most half full.
+    static const ULONG s_ArgTableSize = 128;
+    UCHAR m_ArgTable[s_ArgTableSize];
+
     void WINAPI ClearArgs(void);
     void WINAPI DeleteArgs(void);
     PSTR WINAPI ParseDirective(_In_ PSTR Scan) throw(...);
@@ -1048,9 +1060,15 @@ public:
     ArgDesc* WINAPI FindArg(_In_ PCSTR Name);
     ArgDesc* WINAPI FindUnnamedArg(_In_ ULONG Index);
     
+    static ULONG WINAPI HashName(_In_ PCSTR Name);
+
+    // Hands the registered commands, sorted by name,
+    // to the extension.
     static void WINAPI Transfer(_Out_ ExtCommandDesc** Commands,
                                 _Out_ PULONG LongestName);
 
+    // Descs register themselves during static construction
+    // and are only sorted once, in Transfer.
     static ExtCommandDesc* s_Commands;
     static ULONG s_LongestCommandName;
 };
@@ -1065,6 +1083,11 @@ public:
 //
 // The final array entry should have TypeName == NULL.
 //
+// Type names are looked up through a hash table built
+// from the array, so the array should not change once
+// the extension is initialized.  Names must match
+// exactly, as with a plain strcmp.
+//
 //----------------------------------------------------------------------------
 
 // Data formatting callback for known structs.
@@ -1158,6 +1181,22 @@ public:
 
     ExtKnownStruct* m_KnownStructs;
     ExtProvidedValue* m_ProvidedValues;
+
+    // Expression arguments that are plain numbers, such
+    // as 0x1234 or fffff800`01234567 with MASM syntax, are
+    // converted directly instead of being evaluated by the
+    // engine.  Clear this if a command relies on the engine
+    // evaluating even literal arguments.
+    bool m_FastLiteralArgs;
+
+    // Remote data, typed data and list primitives check
+    // for a user interrupt with PollInterrupt, which only
+    // asks the engine every m_InterruptPollOps calls or
+    // once m_InterruptPollMs milliseconds have passed,
+    // whichever comes first.  Set m_InterruptPollOps to
+    // one to check on every call.
+    ULONG m_InterruptPollOps;
+    ULONG m_InterruptPollMs;
     
     //
     // Interface and callback pointers.  These
@@ -1399,6 +1438,19 @@ public:
     bool m_TestWrap;
     ULONG m_TestWrapChars;
     // m_OutputWidth is also used.
+
+    // If non-zero, wrapped output is collected in a buffer
+    // and sent to the engine in large pieces once this many
+    // characters are pending, instead of with an output
+    // call per fragment.  Pending text is flushed before
+    // any other output or command execution and at the end
+    // of each extension call so output stays in order.
+    // Zero, the default, outputs each fragment directly.
+    ULONG m_OutWrapBufferChars;
+    // Wrapped output is DML.  Markup takes no columns,
+    // entities take one and lines are not broken inside
+    // tags.
+    bool m_OutWrapDml;
     
     // OutWrap takes the given string and displays it
     // wrapped in the appropriate space.  It doesn't
@@ -1411,6 +1463,15 @@ public:
     void WINAPIV OutWrap(_In_ PCSTR Format,
                          ...);
 
+    // Sends any buffered wrapped output to the engine.
+    void FlushOutWrap(void)
+    {
+        if (m_OutWrapBuffer.GetEltsUsed())
+        {
+            FlushOutWrapBuffer();
+        }
+    }
+
     void ClearWrap(void)
     {
         m_LeftIndent = 0;
@@ -1456,8 +1517,18 @@ public:
     }
 
     //
-    // A circular string buffer is available for
-    // handing out multiple static strings.
+    // Each thread has a string arena for handing out
+    // multiple temporary strings of any length.  Strings
+    // stay valid until the engine next calls into the
+    // extension on the same thread.  Worker threads that
+    // are not running a command can call ResetThreadStrings
+    // between items of work to reclaim their strings.
+    //
+    // An arena is bounded.  A call that creates more than
+    // about a megabyte of strings wraps around and reuses
+    // its oldest strings, as the old fixed circle buffer
+    // did, so code that formats strings in a long loop
+    // must not hold on to early results.
     //
 
     PSTR WINAPI RequestCircleString(_In_ ULONG Chars) throw(...);
@@ -1466,6 +1537,7 @@ public:
                              _In_ va_list Args) throw(...);
     PSTR WINAPIV PrintCircleString(_In_ PCSTR Format,
                                    ...) throw(...);
+    void WINAPI ResetThreadStrings(void);
 
     //
     // String buffer with append support.
@@ -1526,6 +1598,81 @@ public:
                              _In_ bool ThrowFailure,
                              _Out_ PULONG64 Cookie);
 
+    //
+    // Automatic type cache.  Type IDs looked up by name
+    // and field offsets and types looked up by
+    // (module, type ID, field path) are remembered for
+    // the session so callers do not need cookies.
+    // ExtRemoteTyped uses the cache for typed Set,
+    // GetFieldOffset and Field.
+    //
+    // The cache keeps an entry in the engine's cached
+    // symbol info, which the engine drops whenever
+    // symbols change.  If that entry is gone the cache
+    // is flushed.  This is checked once per extension call.
+    //
+
+    ULONG WINAPI FindTypeId(_In_ PCSTR Type,
+                            _Out_ PULONG64 ModBase) throw(...);
+    void WINAPI FlushTypeCache(void);
+
+    ULONG64 m_TypeCacheHits;
+    ULONG64 m_TypeCacheMisses;
+
+    //
+    // Optional read-through cache for ExtRemoteData buffer
+    // access.  Reads are satisfied from page-aligned blocks
+    // keyed by address space so that walking many small
+    // structures does not cost one engine request per field,
+    // which matters most over remote kd/dbgsrv links.
+    // Writes go through to the target and invalidate
+    // any overlapping blocks.
+    //
+    // The cache is off by default.  By default it is flushed
+    // at the start of every extension call; KeepAcrossCalls
+    // retains blocks until the session becomes inaccessible
+    // or changes, which is only safe if nothing else edits
+    // target memory between calls.  Execute, CallDebuggee and
+    // ExtCaptureOutput always flush as the target state may
+    // change.
+    //
+    // Virtual blocks belong to the process that was current
+    // when they were read and the cache is flushed when a
+    // call finds a different implicit process.  A command
+    // that switches processes itself through the system
+    // objects interfaces must call FlushReadCache.
+    //
+    // Physical reads bypass the cache unless CachePhysical
+    // is given, as physical memory such as device space
+    // can change without the target running.
+    //
+
+    HRESULT WINAPI EnableReadCache(_In_ bool Enable,
+                                   _In_ bool KeepAcrossCalls = false,
+                                   _In_ bool CachePhysical = false);
+    bool IsReadCacheEnabled(void)
+    {
+        return m_ReadCache != NULL;
+    }
+    void WINAPI FlushReadCache(void);
+    void WINAPI InvalidateReadCache(_In_ bool Physical,
+                                    _In_ ULONG SpaceFlags,
+                                    _In_ ULONG64 Offset,
+                                    _In_ ULONG Bytes);
+    // Reads through the cache if enabled, otherwise
+    // this is a plain ReadVirtual/ReadPhysical2.
+    HRESULT WINAPI ReadCachedBuffer(_In_ bool Physical,
+                                    _In_ ULONG SpaceFlags,
+                                    _In_ ULONG64 Offset,
+                                    _Out_writes_bytes_(Bytes) PVOID Buffer,
+                                    _In_ ULONG Bytes,
+                                    _Out_ PULONG Done);
+
+    // Hits count requests satisfied entirely from the
+    // cache, misses count blocks fetched from the target.
+    ULONG64 m_ReadCacheHits;
+    ULONG64 m_ReadCacheMisses;
+
     //
     // Symbol helpers.
     //
@@ -1605,6 +1752,25 @@ public:
     bool WINAPI ModuleHasGlobalSymbols(_In_ ULONG64 ModBase);
     bool WINAPI ModuleHasTypeInfo(_In_ ULONG64 ModBase);
 
+    //
+    // Command lookup.  Commands are kept in a list sorted
+    // by name for help output and are also indexed by a
+    // hash table built during BaseInitialize, so finding
+    // a command by name does not walk the list.
+    //
+
+    ExtCommandDesc* WINAPI FindCommand(_In_ PCSTR Name);
+    // Runs a command of this extension by name with the
+    // same argument parsing and error handling as when it
+    // is invoked through its export.  This is meant for
+    // plain dbgeng entry points such as a hybrid extension's
+    // own dispatching export; calling it from inside an
+    // EngExtCpp command would replace that command's
+    // parsed arguments.
+    HRESULT WINAPI CallCommandName(_In_ PDEBUG_CLIENT Client,
+                                   _In_ PCSTR Name,
+                                   _In_opt_ PCSTR Args);
+
     //
     // Command execution helpers.
     //
@@ -1617,6 +1783,10 @@ public:
     {
         HRESULT Status;
         PSTR Cmd = PrintCircleStringVa(Format, Args);
+
+        // Commands can run the target or change its memory.
+        FlushReadCache();
+        FlushOutWrap();
         
         if (FAILED(Status = m_Control->
                    Execute(OutCtl, Cmd, ExecFlags)))
@@ -1898,6 +2068,22 @@ public:
             throw ExtInterruptException();
         }
     }
+    // Rate-limited ThrowInterrupt for frequent operations.
+    void PollInterrupt(void) throw(...)
+    {
+        ULONG Tick = GetTickCount();
+        
+        if (m_InterruptPollCountdown > 1 &&
+            Tick - m_InterruptPollTick < m_InterruptPollMs)
+        {
+            m_InterruptPollCountdown--;
+            return;
+        }
+
+        m_InterruptPollCountdown = m_InterruptPollOps;
+        m_InterruptPollTick = Tick;
+        ThrowInterrupt();
+    }
     void DECLSPEC_NORETURN ThrowOutOfMemory(void) throw(...)
     {
         throw ExtStatusException(E_OUTOFMEMORY);
@@ -1969,12 +2155,78 @@ public:
     //
 
     static HMODULE s_Module;
-    static char s_String[2000];
-    static char s_CircleStringBuffer[2000];
-    static char* s_CircleString;
+
+    struct StringBlock
+    {
+        StringBlock* Next;
+        ULONG Chars;
+        // Characters follow.
+    };
+    struct StringArena
+    {
+        StringArena* Next;
+        StringArena* Prev;
+        // Most recent block first.
+        StringBlock* Blocks;
+        PSTR Cur;
+        ULONG Left;
+        // Characters in all blocks.
+        ULONG Chars;
+        // Reusable formatting buffer for output that
+        // is consumed immediately.
+        PSTR Scratch;
+        ULONG ScratchChars;
+    };
+
+    static const ULONG s_StringBlockChars = 4096;
+    // Past this the oldest blocks are recycled.
+    static const ULONG s_StringArenaMaxChars = 256 * s_StringBlockChars;
+    // Arenas are found through TLS and also kept in a list
+    // so that they can be freed when the DLL is unloaded.
+    static DWORD s_StringTls;
+    static StringArena* s_StringArenas;
+    static CRITICAL_SECTION s_StringLock;
+
+    static bool WINAPI InitializeThreadStrings(void);
+    static void WINAPI UninitializeThreadStrings(void);
+    static StringArena* WINAPI GetThreadStrings(_In_ bool Create);
+    static void WINAPI FreeThreadStrings(_In_ StringArena* Arena);
+    static PSTR WINAPI AllocThreadString(_In_ StringArena* Arena,
+                                         _In_ ULONG Chars);
+    static void WINAPI ClearThreadStrings(_In_ StringArena* Arena);
+    // Returns NULL on failure so that it can be used
+    // while building an exception.
+    static PSTR WINAPI FormatThreadStringVa(_In_ PCSTR Format,
+                                            _In_ va_list Args);
+    // The result is only valid until the next call.
+    PSTR WINAPI PrintScratchStringVa(_In_ PCSTR Format,
+                                     _In_ va_list Args) throw(...);
+
+    // Largest piece of buffered wrapped output
+    // handed to the engine in one call.
+    static const ULONG s_OutWrapOutputChars = 8192;
+
+    ExtBuffer<char> m_OutWrapBuffer;
+    ULONG m_OutWrapBufferMask;
+    bool m_OutWrapBufferDml;
+
+    void WINAPI OutWrapText(_In_reads_(Chars) PCSTR Text,
+                            _In_ ULONG Chars);
+    void WINAPI FlushOutWrapBuffer(void);
     
     ExtCommandDesc* m_Commands;
     ULONG m_LongestCommandName;
+    // Open-addressed by name hash, at most half full.
+    ExtCommandDesc** m_CommandTable;
+    ULONG m_CommandTableMask;
+    ULONG m_InterruptPollCountdown;
+    ULONG m_InterruptPollTick;
+    // Open-addressed by type name hash,
+    // at most half full.  Rebuilt if m_KnownStructs
+    // is pointed at a different array.
+    ExtKnownStruct** m_KnownStructTable;
+    ULONG m_KnownStructTableMask;
+    ExtKnownStruct* m_KnownStructTableSource;
     HRESULT m_CallStatus;
     HRESULT m_MacroStatus;
 
@@ -2001,14 +2253,104 @@ public:
     ULONG m_FirstNamedArg;
     // Unnamed args are packed in the front.
     ArgVal m_Args[s_MaxArgs];
+    // Engine radix and expression syntax for literal
+    // arguments, fetched at most once per command.
+    ULONG m_LiteralRadix;
+    ULONG m_LiteralSyntax;
 
     // Register index caches are cleared in QueryMachineInfo.
     ULONG m_ExtRetIndex;
     ULONG m_TempRegIndex[20];
+
+    // Read cache blocks are 4K, which is page-aligned on
+    // all supported targets, and are organized as a small
+    // set-associative table with LRU replacement in each set.
+    static const ULONG s_ReadCacheBlockShift = 12;
+    static const ULONG s_ReadCacheBlockSize = 1 << s_ReadCacheBlockShift;
+    static const ULONG s_ReadCacheSets = 32;
+    static const ULONG s_ReadCacheWays = 4;
+    // Larger requests are not worth caching.
+    static const ULONG s_ReadCacheMaxRequest = 4 * s_ReadCacheBlockSize;
+
+    struct ReadCacheBlock
+    {
+        ULONG64 Base;
+        // High bit marks physical space.
+        ULONG Space;
+        // Zero for an empty block, otherwise the number
+        // of bytes from Base that were readable.
+        ULONG Valid;
+        ULONG LastUse;
+        PUCHAR Data;
+    };
+
+    ReadCacheBlock* m_ReadCache;
+    PUCHAR m_ReadCacheData;
+    // Spare block data that misses are read into so that
+    // a failed read doesn't discard the victim block.
+    PUCHAR m_ReadCacheFill;
+    ULONG m_ReadCacheUse;
+    bool m_ReadCacheKeep;
+    bool m_ReadCachePhysical;
+    bool m_ReadCacheChecked;
+    ULONG64 m_ReadCacheProcess;
+
+    ReadCacheBlock* WINAPI GetReadCacheBlock(_In_ ULONG Space,
+                                             _In_ ULONG64 Base,
+                                             _Out_ HRESULT* Status);
+
+    static const ULONG s_TypeCacheTypeName = 1;
+    static const ULONG s_TypeCacheFieldOffset = 2;
+    static const ULONG s_TypeCacheField = 3;
+    static const ULONG s_TypeCacheInitialSlots = 256;
     
+    struct TypeCacheEntry
+    {
+        // Key.  Type name entries have no module or type.
+        ULONG Kind;
+        ULONG Hash;
+        ULONG64 ModBase;
+        ULONG TypeId;
+        // Type name or field path, NULL for an empty entry.
+        PSTR Name;
+
+        // For type names, the type.  For fields, the
+        // field type and the field offset.
+        ULONG64 ValModBase;
+        ULONG ValTypeId;
+        ULONG ValOffset;
+    };
+
+    // Open-addressed, at most half full.
+    TypeCacheEntry* m_TypeCache;
+    ULONG m_TypeCacheMask;
+    ULONG m_TypeCacheUsed;
+    ULONG64 m_TypeCacheCookie;
+    ULONG64 m_TypeCacheProcess;
+    bool m_TypeCacheChecked;
+
+    // Identifies the process whose address space is
+    // currently visible.  Type IDs can differ between
+    // processes so caches are keyed or flushed by this.
+    ULONG64 WINAPI GetProcessCacheKey(void);
+    void WINAPI CheckTypeCache(void);
+    TypeCacheEntry* WINAPI FindTypeCache(_In_ ULONG Kind,
+                                         _In_ ULONG64 ModBase,
+                                         _In_ ULONG TypeId,
+                                         _In_ PCSTR Name);
+    // Returns NULL if the entry cannot be added,
+    // the cache is optional.
+    TypeCacheEntry* WINAPI AddTypeCache(_In_ ULONG Kind,
+                                        _In_ ULONG64 ModBase,
+                                        _In_ ULONG TypeId,
+                                        _In_ PCSTR Name);
+
     bool m_ExInitialized;
     
     void WINAPI ExInitialize(void) throw(...);
+    HRESULT WINAPI BuildCommandTable(void);
+    HRESULT WINAPI BuildKnownStructTable(void);
+    ExtKnownStruct* WINAPI FindKnownStruct(_In_opt_ PCSTR TypeName);
 
     HRESULT WINAPI QueryMachineInfo(void);
     HRESULT WINAPI Query(_In_ PDEBUG_CLIENT Start);
@@ -2067,6 +2409,10 @@ public:
 
     ArgVal* WINAPI FindArg(_In_ PCSTR Name,
                            _In_ bool Required) throw(...);
+    bool WINAPI ParseLiteralArg(_In_ PCSTR Str,
+                                _In_ ULONG Radix,
+                                _Out_ PCSTR* End,
+                                _Out_ PULONG64 Val) throw(...);
     PCSTR WINAPI SetRawArgVal(_In_ ExtCommandDesc::ArgDesc* Check,
                               _In_opt_ ArgVal* Val,
                               _In_ bool ExplicitVal,
@@ -2771,6 +3117,163 @@ protected:
     void WINAPI Clear(void);
 };
 
+//----------------------------------------------------------------------------
+//
+// ExtRemoteTypedArray reads a run of array elements of a
+// single type with one memory request and gives access to the
+// local copy.  Selected fields can be pulled out of every
+// element without creating a typed object per element,
+// which suits scans of large tables such as handle tables,
+// PFN arrays and hash buckets.
+//
+// Field values are read directly from the element data, so
+// a bitfield is returned as its whole containing integer.
+//
+//----------------------------------------------------------------------------
+
+class ExtRemoteTypedArray
+{
+public:
+    static const ULONG s_MaxFields = 16;
+    // Upper bound on a single read.
+    static const ULONG s_MaxReadBytes = 0x10000000;
+    
+    ExtRemoteTypedArray(void)
+    {
+        m_ModBase = 0;
+        m_TypeId = 0;
+        m_ElementSize = 0;
+        m_Offset = 0;
+        m_Count = 0;
+        m_Physical = false;
+        m_SpaceFlags = 0;
+        m_NumFields = 0;
+    }
+
+    //
+    // Reads Count elements.  The first form reads
+    // from an array or pointer, starting at element
+    // Start, and the second form reads elements of
+    // the given type starting at Offset.
+    //
+    // With AllowPartial, a read that faults part way
+    // keeps the elements that were read completely and
+    // GetCount returns how many there are.  Otherwise
+    // the read must succeed for all elements.
+    //
+    // Selected fields are kept as long as the
+    // element type doesn't change.
+    //
+    
+    void WINAPI Read(_In_ ExtRemoteTyped& Array,
+                     _In_ ULONG64 Start,
+                     _In_ ULONG Count,
+                     _In_ bool AllowPartial = false) throw(...);
+    void WINAPI Read(_In_ PCSTR Type,
+                     _In_ ULONG64 Offset,
+                     _In_ ULONG Count,
+                     _In_ bool AllowPartial = false) throw(...);
+
+    // Selects a field, which may be a path such as
+    // "Entry.Flink", and returns its index for the
+    // field accessors.
+    ULONG WINAPI AddField(_In_ PCSTR Field) throw(...);
+    
+    ULONG GetCount(void)
+    {
+        return m_Count;
+    }
+    ULONG GetElementSize(void)
+    {
+        return m_ElementSize;
+    }
+    ULONG64 GetElementOffset(_In_ ULONG Index) throw(...)
+    {
+        CheckIndex(Index);
+        return m_Offset + (ULONG64)Index * m_ElementSize;
+    }
+    PUCHAR GetElementData(_In_ ULONG Index) throw(...)
+    {
+        CheckIndex(Index);
+        return m_Data.GetBuffer() + (ULONG_PTR)Index * m_ElementSize;
+    }
+    // Creates a full typed object for an element.
+    ExtRemoteTyped WINAPI GetElement(_In_ ULONG Index) throw(...);
+
+    ULONG GetFieldSize(_In_ ULONG Field) throw(...)
+    {
+        CheckField(Field);
+        return m_Fields[Field].Size;
+    }
+    PUCHAR GetFieldData(_In_ ULONG Index,
+                        _In_ ULONG Field) throw(...)
+    {
+        CheckField(Field);
+        return GetElementData(Index) + m_Fields[Field].Offset;
+    }
+    // Fields of 1, 2, 4 or 8 bytes, zero-extended.
+    ULONG64 WINAPI GetField(_In_ ULONG Index,
+                            _In_ ULONG Field) throw(...);
+    // Pointer fields, with automatic sign extension.
+    ULONG64 GetFieldPtr(_In_ ULONG Index,
+                        _In_ ULONG Field) throw(...)
+    {
+        ULONG64 Val = GetField(Index, Field);
+        return m_Fields[Field].Size == 4 ? (ULONG64)(LONG)Val : Val;
+    }
+    // Fills Values with the field from each element.
+    void WINAPI ExtractField(_In_ ULONG Field,
+                             _Out_writes_(m_Count) PULONG64 Values,
+                             _In_ bool Pointer = false) throw(...);
+    
+    ULONG64 m_ModBase;
+    ULONG m_TypeId;
+    ULONG m_ElementSize;
+    ULONG64 m_Offset;
+    ULONG m_Count;
+    bool m_Physical;
+    ULONG m_SpaceFlags;
+    
+protected:
+    struct FieldDesc
+    {
+        ULONG Offset;
+        ULONG Size;
+    };
+
+    void CheckIndex(_In_ ULONG Index) throw(...)
+    {
+        if (Index >= m_Count)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "Array element %u is not in the read range",
+                               Index);
+        }
+    }
+    void CheckField(_In_ ULONG Field) throw(...)
+    {
+        if (Field >= m_NumFields)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "Array field %u has not been added", Field);
+        }
+    }
+    void WINAPI SetType(_In_ ULONG64 ModBase,
+                        _In_ ULONG TypeId,
+                        _In_ ULONG ElementSize);
+    void WINAPI ReadElements(_In_ ULONG Count,
+                             _In_ bool AllowPartial) throw(...);
+
+    ExtBuffer<UCHAR> m_Data;
+    FieldDesc m_Fields[s_MaxFields];
+    ULONG m_NumFields;
+
+private:
+    // The element data is owned so arrays cannot be copied.
+    ExtRemoteTypedArray(_In_ const ExtRemoteTypedArray& Other);
+    ExtRemoteTypedArray& operator=(_In_ const ExtRemoteTypedArray& Other);
+};
+
 //----------------------------------------------------------------------------
 //
 // ExtRemoteList wraps a basic singly- or double-linked list.
@@ -2781,11 +3284,20 @@ protected:
 // When doubly-linked it is assumed that the previous
 // pointer immediately follows the next pointer.
 //
+// Iteration can optionally prefetch, in which case each
+// node's data is read in a single request, the link is
+// taken from that data and a burst of following nodes
+// is read ahead.  m_MaxIter bounds both the walk and
+// the read-ahead.
+//
 //----------------------------------------------------------------------------
 
 class ExtRemoteList
 {
 public:
+    static const ULONG s_DefaultMaxIter = 65536;
+    static const ULONG s_DefaultPrefetchNodes = 16;
+    
     ExtRemoteList(_In_ ULONG64 Head,
                   _In_ ULONG LinkOffset,
                   _In_ bool Double = false)
@@ -2793,7 +3305,10 @@ public:
         m_Head = Head;
         m_LinkOffset = LinkOffset;
         m_Double = Double;
-        m_MaxIter = 65536;
+        m_MaxIter = s_DefaultMaxIter;
+        m_PrefetchNodeBytes = 0;
+        m_PrefetchNodes = 0;
+        ResetPrefetch(0);
     }
     ExtRemoteList(_In_ ExtRemoteData& Head,
                   _In_ ULONG LinkOffset,
@@ -2802,13 +3317,30 @@ public:
         m_Head = Head.m_Offset;
         m_LinkOffset = LinkOffset;
         m_Double = Double;
-        m_MaxIter = 65536;
+        m_MaxIter = s_DefaultMaxIter;
+        m_PrefetchNodeBytes = 0;
+        m_PrefetchNodes = 0;
+        ResetPrefetch(0);
+    }
+    // Prefetched node data is not shared between copies.
+    ExtRemoteList(_In_ const ExtRemoteList& Other)
+    {
+        CopyList(Other);
+    }
+    ExtRemoteList& operator=(_In_ const ExtRemoteList& Other)
+    {
+        if (this != &Other)
+        {
+            CopyList(Other);
+        }
+        return *this;
     }
 
     void StartHead(void)
     {
         m_Node.Set(m_Head, g_Ext->m_PtrSize);
         m_CurIter = 0;
+        ResetPrefetch(0);
     }
     void StartTail(void)
     {
@@ -2820,10 +3352,11 @@ public:
         
         m_Node.Set(m_Head + g_Ext->m_PtrSize, g_Ext->m_PtrSize);
         m_CurIter = 0;
+        ResetPrefetch(g_Ext->m_PtrSize);
     }
     bool HasNode(void)
     {
-        g_Ext->ThrowInterrupt();
+        g_Ext->PollInterrupt();
         ULONG64 NodeOffs = m_Node.GetPtr();
         return NodeOffs != 0 && NodeOffs != m_Head;
     }
@@ -2838,12 +3371,20 @@ public:
             g_Ext->ThrowRemote(E_INVALIDARG,
                                "List iteration count exceeded, loop assumed");
         }
+
+        if (m_PrefetchNodeBytes &&
+            m_PrefetchPtrOffset == 0)
+        {
+            PrefetchStep();
+            return;
+        }
         
         m_Node.Set(m_Node.GetPtr(), g_Ext->m_PtrSize);
+        ResetPrefetch(0);
     }
     void Prev(void)
     {
-        g_Ext->ThrowInterrupt();
+        g_Ext->PollInterrupt();
 
         if (!m_Double)
         {
@@ -2857,8 +3398,31 @@ public:
                                "List iteration count exceeded, loop assumed");
         }
         
+        if (m_PrefetchNodeBytes &&
+            m_PrefetchPtrOffset == g_Ext->m_PtrSize)
+        {
+            PrefetchStep();
+            return;
+        }
+        
         m_Node.Set(m_Node.GetPtr() + g_Ext->m_PtrSize, g_Ext->m_PtrSize);
+        ResetPrefetch(g_Ext->m_PtrSize);
     }
+
+    //
+    // Prefetching iteration.  NodeBytes is the amount of
+    // node data to read, starting at the node base, and
+    // must cover the link.  Zero turns prefetching off.
+    // Reads go through ExtExtension::ReadCachedBuffer so
+    // enabling the read cache lets later reads of the
+    // node data be satisfied without further requests.
+    //
+
+    void WINAPI SetPrefetch(_In_ ULONG NodeBytes,
+                            _In_ ULONG AheadNodes =
+                            s_DefaultPrefetchNodes) throw(...);
+    // Returns the current node's data when prefetching.
+    PUCHAR WINAPI GetNodeData(void) throw(...);
     
     ULONG64 m_Head;
     ULONG m_LinkOffset;
@@ -2866,6 +3430,30 @@ public:
     ULONG m_MaxIter;
     ExtRemoteData m_Node;
     ULONG m_CurIter;
+
+    ULONG m_PrefetchNodeBytes;
+    ULONG m_PrefetchNodes;
+    
+protected:
+    void ResetPrefetch(_In_ ULONG PtrOffset)
+    {
+        m_PrefetchPtrOffset = PtrOffset;
+        m_PrefetchUsed = 0;
+        m_PrefetchCur = 0;
+    }
+    void WINAPI CopyList(_In_ const ExtRemoteList& Other);
+    void WINAPI FillPrefetch(void) throw(...);
+    void WINAPI PrefetchStep(void) throw(...);
+
+    // Ring of read-ahead nodes, with m_PrefetchCur
+    // being the current node when it is less than
+    // m_PrefetchUsed.  Links are the link addresses,
+    // as returned by m_Node.GetPtr().
+    ExtBuffer<UCHAR> m_PrefetchData;
+    ExtBuffer<ULONG64> m_PrefetchLinks;
+    ULONG m_PrefetchPtrOffset;
+    ULONG m_PrefetchUsed;
+    ULONG m_PrefetchCur;
 };
 
 //----------------------------------------------------------------------------
@@ -2971,11 +3559,223 @@ public:
         return Typed;
     }
 
+    // Prefetches whole nodes using the size of the node type.
+    void WINAPI SetTypedPrefetch(_In_ ULONG AheadNodes =
+                                 s_DefaultPrefetchNodes) throw(...);
+
     PCSTR m_Type;
     ULONG64 m_TypeModBase;
     ULONG m_TypeId;
 };
 
+//----------------------------------------------------------------------------
+//
+// ExtRemoteListSnapshot captures the nodes of a list so that
+// they can be decoded in parallel.
+//
+// The engine interfaces can only be used from the engine
+// thread, so the list is walked and each node's data is read
+// there first.  Decoding then runs on a pool of worker threads
+// that see only captured memory.  Each node gets a result
+// slot, and the caller consumes the results in list order
+// afterwards, for example to produce output.
+//
+// Decode functions can follow pointers out of the node with
+// ReadMemory and ReadPointer, which read pages the snapshot
+// has captured.  A read of a page that hasn't been captured
+// yet throws E_PENDING, which normally just propagates out
+// of the decode function.  Once all workers are done the
+// engine thread reads every missing page in one batch and
+// the pending nodes are decoded again from the start, so
+// each level of pointers costs one round.  Deep chains such
+// as a process's thread list are better captured as their
+// own snapshots.  Captured pages are kept until the next
+// Capture, so later decodes of the same snapshot reuse them.
+//
+// Decode functions must not call the engine, g_Ext methods
+// that use the engine or ExtRemote* objects.  Strings from
+// PrintCircleString and friends are per-thread and are freed
+// when a worker exits, so copy anything needed into the
+// result.  Data that only the engine can produce, such as a
+// thread's stack trace, has to be gathered on the engine
+// thread.
+//
+//----------------------------------------------------------------------------
+
+class ExtRemoteListSnapshot;
+
+typedef HRESULT (WINAPI *ExtNodeDecodeFunction)
+    (_In_ ExtRemoteListSnapshot* Snapshot,
+     _In_opt_ PVOID Context,
+     _In_ ULONG Index,
+     _In_ ULONG64 Node,
+     _In_reads_bytes_(NodeBytes) const UCHAR* NodeData,
+     _In_ ULONG NodeBytes,
+     _Out_writes_bytes_(ResultBytes) PVOID Result,
+     _In_ ULONG ResultBytes);
+
+class ExtRemoteListSnapshot
+{
+public:
+    // Workers claim nodes in chunks of this many.
+    static const ULONG s_DecodeChunk = 8;
+    // Memory is captured in pages of this size.
+    static const ULONG s_MemoryPageShift = 12;
+    static const ULONG s_MemoryPageSize = 1 << s_MemoryPageShift;
+    // Nodes still pending after this many rounds
+    // are left with E_PENDING status.
+    static const ULONG s_MaxDecodeRounds = 16;
+    
+    ExtRemoteListSnapshot(void)
+    {
+        m_Count = 0;
+        m_NodeBytes = 0;
+        m_ResultBytes = 0;
+        m_PtrSize = 8;
+        InitializeCriticalSection(&m_MissingLock);
+    }
+    ~ExtRemoteListSnapshot(void)
+    {
+        DeleteCriticalSection(&m_MissingLock);
+    }
+
+    // Walks the list from its head and copies NodeBytes of
+    // each node, starting at the node base.  A zero NodeBytes
+    // uses the list's current prefetch size.  The list is
+    // left prefetching.
+    void WINAPI Capture(_In_ ExtRemoteList& List,
+                        _In_ ULONG NodeBytes = 0) throw(...);
+
+    // Calls Func for every captured node using up to
+    // Threads threads, including the calling thread.  Zero
+    // uses one thread per processor.  Each call gets its
+    // own zeroed ResultBytes result slot and its return
+    // status is kept with the result.  The user can
+    // interrupt the decode, in which case the interrupt
+    // exception is thrown once the workers have stopped.
+    void WINAPI Decode(_In_ ExtNodeDecodeFunction Func,
+                       _In_opt_ PVOID Context,
+                       _In_ ULONG ResultBytes,
+                       _In_ ULONG Threads = 0) throw(...);
+
+    // For decode functions.  Reads captured virtual memory,
+    // throwing E_PENDING if some of it has not been captured
+    // yet and a read fault status if it was unreadable.
+    void WINAPI ReadMemory(_In_ ULONG64 Offset,
+                           _Out_writes_bytes_(Bytes) PVOID Buffer,
+                           _In_ ULONG Bytes) throw(...);
+    // Reads a target pointer, sign-extending 32-bit pointers
+    // as ExtRemoteData::GetPtr does.
+    ULONG64 ReadPointer(_In_ ULONG64 Offset) throw(...)
+    {
+        if (m_PtrSize == 8)
+        {
+            ULONG64 Ptr;
+            ReadMemory(Offset, &Ptr, sizeof(Ptr));
+            return Ptr;
+        }
+        else
+        {
+            LONG Ptr;
+            ReadMemory(Offset, &Ptr, sizeof(Ptr));
+            return (ULONG64)(LONG64)Ptr;
+        }
+    }
+
+    ULONG GetCount(void)
+    {
+        return m_Count;
+    }
+    ULONG GetNodeBytes(void)
+    {
+        return m_NodeBytes;
+    }
+    ULONG64 GetNodeOffset(_In_ ULONG Index) throw(...)
+    {
+        CheckIndex(Index);
+        return m_Nodes.GetBuffer()[Index];
+    }
+    PUCHAR GetNodeData(_In_ ULONG Index) throw(...)
+    {
+        CheckIndex(Index);
+        return m_Data.GetBuffer() + (ULONG_PTR)Index * m_NodeBytes;
+    }
+    PVOID GetResult(_In_ ULONG Index) throw(...)
+    {
+        CheckIndex(Index);
+        return m_Results.GetBuffer() + (ULONG_PTR)Index * m_ResultBytes;
+    }
+    HRESULT GetResultStatus(_In_ ULONG Index) throw(...)
+    {
+        CheckIndex(Index);
+        return m_Status.GetBuffer()[Index];
+    }
+
+protected:
+    struct DecodeState
+    {
+        ExtRemoteListSnapshot* Snapshot;
+        ExtNodeDecodeFunction Func;
+        PVOID Context;
+        // Nodes to decode in this round.
+        PULONG Work;
+        ULONG NumWork;
+        LONG NextChunk;
+        LONG Abort;
+    };
+    struct MemoryPage
+    {
+        ULONG64 Base;
+        // Bytes from Base that were readable.
+        ULONG Valid;
+        ULONG DataOffset;
+    };
+
+    void CheckIndex(_In_ ULONG Index) throw(...)
+    {
+        if (Index >= m_Count)
+        {
+            g_Ext->ThrowRemote(E_INVALIDARG,
+                               "List snapshot has no node %u", Index);
+        }
+    }
+    // Returns false when there is no more work.
+    static bool WINAPI DecodeChunk(_In_ DecodeState* State);
+    static DWORD WINAPI DecodeThread(_In_ LPVOID Param);
+    // Returns true if the user interrupted the round.
+    bool WINAPI DecodeRound(_In_ DecodeState* State,
+                            _In_ ULONG Threads);
+    const MemoryPage* WINAPI FindPage(_In_ ULONG64 Base);
+    void WINAPI AddMissing(_In_ ULONG64 Base);
+    // Reads the missing pages on the engine thread and
+    // returns the number of pages added.
+    ULONG WINAPI CaptureMissing(void) throw(...);
+
+    ULONG m_Count;
+    ULONG m_NodeBytes;
+    ULONG m_ResultBytes;
+    ULONG m_PtrSize;
+    ExtBuffer<ULONG64> m_Nodes;
+    ExtBuffer<UCHAR> m_Data;
+    ExtBuffer<UCHAR> m_Results;
+    ExtBuffer<HRESULT> m_Status;
+
+    // Captured pages, sorted by base.  These only change
+    // on the engine thread between decode rounds, so
+    // workers can search them without locking.
+    ExtBuffer<MemoryPage> m_Pages;
+    ExtBuffer<UCHAR> m_PageData;
+    // Pages workers wanted in the current round.
+    ExtBuffer<ULONG64> m_Missing;
+    CRITICAL_SECTION m_MissingLock;
+
+private:
+    // The snapshot buffers are owned so snapshots
+    // cannot be copied.
+    ExtRemoteListSnapshot(_In_ const ExtRemoteListSnapshot& Other);
+    ExtRemoteListSnapshot& operator=(_In_ const ExtRemoteListSnapshot& Other);
+};
+
 //----------------------------------------------------------------------------
 //
 // Helpers for handling well-known NT data and types.
@@ -3000,6 +3800,13 @@ public:
     static ULONG64 WINAPI GetKernelProcessThreadListHead(_In_ ULONG64 Process);
     static ExtRemoteTypedList WINAPI GetKernelProcessThreadList(_In_ ULONG64 Process);
     static ExtRemoteTyped WINAPI GetKernelThread(_In_ ULONG64 Offset);
+
+    // Capture whole nodes for parallel decoding.
+    static void WINAPI
+        CaptureKernelProcessList(_Out_ ExtRemoteListSnapshot& Snapshot);
+    static void WINAPI
+        CaptureKernelProcessThreadList(_In_ ULONG64 Process,
+                                       _Out_ ExtRemoteListSnapshot& Snapshot);
     
     //
     // User mode.
@@ -3179,7 +3986,15 @@ public:
     {
         m_Defines = Defines;
         m_Flags = Flags;
+        m_Index = NULL;
     };
+    ~ExtDefineMap(void)
+    {
+        if (m_Index != &s_NoIndex)
+        {
+            free(m_Index);
+        }
+    }
 
     static const ULONG Bitwise         = 0x00000001;
     static const ULONG OutValue        = 0x00000002;
@@ -3194,6 +4009,12 @@ public:
     // included in the argument value.  Multi-bit
     // defines should come before single-bit defines
     // so that they take priority for bitwise maps.
+    //
+    // The search uses an index built on first use, a
+    // hash of values for exact maps and a list of
+    // defines per bit for bitwise maps, so the define
+    // array must not change after the map is first used.
+    // Small maps are simply scanned.
     ExtDefine* WINAPI Map(_In_ ULONG64 Value);
     PCSTR WINAPI MapStr(_In_ ULONG64 Value,
                         _In_opt_ PCSTR InvalidStr = NULL);
@@ -3205,21 +4026,84 @@ public:
     void WINAPI Out(_In_ ULONG64 Value,
                     _In_ ULONG Flags = 0,
                     _In_opt_ PCSTR InvalidStr = NULL);
+    // Outputs an array of values, each as Out would,
+    // followed by Separator.
+    void WINAPI Out(_In_ ULONG Count,
+                    _In_reads_(Count) const ULONG64* Values,
+                    _In_ ULONG Flags = 0,
+                    _In_opt_ PCSTR InvalidStr = NULL,
+                    _In_ PCSTR Separator = "\n");
     
     ExtDefine* m_Defines;
     ULONG m_Flags;
+
+protected:
+    struct MapIndex
+    {
+        ULONG NumDefines;
+        // Exact maps: open-addressed table of define
+        // indices plus one, zero for an empty slot.
+        ULONG HashMask;
+        PULONG Hash;
+        // Bitwise maps: BitDefines[BitStart[Bit]] up to
+        // BitDefines[BitStart[Bit + 1]] are the defines
+        // that include the bit, in define order.
+        ULONG BitStart[65];
+        PULONG BitDefines;
+        // First define with no bits, which matches any
+        // value in a bitwise map, or NumDefines.
+        ULONG ZeroDefine;
+    };
+
+    // Maps with fewer defines are not indexed.
+    static const ULONG s_IndexMinDefines = 8;
+    // Marks a map that has been checked and found too
+    // small to index.
+    static MapIndex s_NoIndex;
+
+    MapIndex* WINAPI GetIndex(void);
+    
+    // Built on first use and published atomically
+    // so concurrent first uses are safe.
+    MapIndex* m_Index;
+
+private:
+    // The index is owned so maps cannot be copied.
+    ExtDefineMap(_In_ const ExtDefineMap& Other);
+    ExtDefineMap& operator=(_In_ const ExtDefineMap& Other);
 };
 
 //----------------------------------------------------------------------------
 //
 // Output capture helper class.
 //
+// By default all captured text is accumulated in m_Text.
+// SetStream switches to streaming mode, where text is
+// collected in a fixed-size buffer and handed to a
+// consumer function as the buffer fills, or line by line,
+// so memory use stays bounded however much is output.
+// The consumer must not produce debugger output itself
+// as it is called from within the capture callback.
+// In streaming mode text is only delivered through the
+// consumer and GetTextNonNull returns an empty string.
+//
 //----------------------------------------------------------------------------
 
 template<typename _CharType, typename _BaseClass>
 class ExtCaptureOutput : public _BaseClass
 {
 public:
+    // Receives Chars characters of captured text.
+    // Text is terminated at Chars for convenience.
+    // A failure status stops delivery and is thrown
+    // from Execute.
+    typedef HRESULT (WINAPI *ChunkFunction)
+        (_In_opt_ PVOID Context,
+         _In_reads_(Chars) const _CharType* Text,
+         _In_ ULONG Chars);
+
+    static const ULONG s_DefaultStreamChars = 65536;
+    
     ExtCaptureOutput(void)
     {
         m_Started = false;
@@ -3295,6 +4179,11 @@ public:
             return S_OK;
         }
 
+        if (m_StreamFunc)
+        {
+            return StreamOutput(Text, Chars - 1);
+        }
+        
         if (0xffffffff / CharTypeSize - m_UsedChars < Chars)
         {
             return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
@@ -3332,10 +4221,88 @@ public:
         return S_OK;
     }
 
+    // Switches to streaming mode with a buffer of
+    // BufferChars characters, or back to accumulating
+    // mode if Func is NULL.  If SplitLines is set each
+    // complete line, including its newline, is delivered
+    // separately; lines longer than the buffer are
+    // delivered in pieces.
+    void SetStream(_In_opt_ ChunkFunction Func,
+                   _In_opt_ PVOID Context,
+                   _In_ ULONG BufferChars = s_DefaultStreamChars,
+                   _In_ bool SplitLines = false)
+    {
+        if (m_Started)
+        {
+            g_Ext->ThrowInvalidArg("Capture mode cannot change "
+                                   "while capturing");
+        }
+
+        Delete();
+
+        if (!Func)
+        {
+            return;
+        }
+        
+        if (BufferChars < 1)
+        {
+            BufferChars = 1;
+        }
+        if (BufferChars > 0xffffffff / m_CharTypeSize - 1)
+        {
+            g_Ext->ThrowInvalidArg("Capture buffer too large");
+        }
+
+        // Leave room for a terminator.
+        m_Text = (_CharType*)malloc((BufferChars + 1) * m_CharTypeSize);
+        if (!m_Text)
+        {
+            g_Ext->ThrowOutOfMemory();
+        }
+        m_AllocChars = BufferChars + 1;
+        m_Text[0] = 0;
+        
+        m_StreamFunc = Func;
+        m_StreamContext = Context;
+        m_StreamLines = SplitLines;
+    }
+
+    // Delivers any buffered streaming text.
+    HRESULT FlushStream(void)
+    {
+        if (m_StreamFunc &&
+            m_UsedChars > 0 &&
+            m_StreamStatus == S_OK)
+        {
+            HRESULT Status;
+            
+            m_Text[m_UsedChars] = 0;
+            Status = m_StreamFunc(m_StreamContext, m_Text, m_UsedChars);
+            if (FAILED(Status))
+            {
+                m_StreamStatus = Status;
+            }
+        }
+
+        m_UsedChars = 0;
+        if (m_StreamFunc)
+        {
+            m_Text[0] = 0;
+        }
+        return m_StreamStatus;
+    }
+
     void Start(void)
     {
         HRESULT Status;
 
+        // Earlier output shouldn't be captured.
+        g_Ext->FlushOutWrap();
+        // Captured commands can run the target or change
+        // its memory, as with ExtExtension::Execute.
+        g_Ext->FlushReadCache();
+        
         if (m_CharTypeSize == sizeof(char))
         {
             if ((Status = g_Ext->m_Client->
@@ -3372,6 +4339,7 @@ public:
         }
             
         m_UsedChars = 0;
+        m_StreamStatus = S_OK;
         m_Started = true;
     }
     
@@ -3403,6 +4371,12 @@ public:
         }
 
         m_OldOutCb = NULL;
+
+        // Drop anything read while the capture was active.
+        g_Ext->FlushReadCache();
+
+        // Deliver the tail once the old callbacks are back.
+        FlushStream();
     }
 
     void Delete(void)
@@ -3416,6 +4390,11 @@ public:
         m_Text = NULL;
         m_AllocChars = 0;
         m_UsedChars = 0;
+
+        m_StreamFunc = NULL;
+        m_StreamContext = NULL;
+        m_StreamLines = false;
+        m_StreamStatus = S_OK;
     }
 
     void Execute(_In_ PCSTR Command)
@@ -3432,17 +4411,28 @@ public:
                                   DEBUG_EXECUTE_NO_REPEAT);
 
         Stop();
+
+        if (FAILED(m_StreamStatus))
+        {
+            g_Ext->ThrowStatus(m_StreamStatus,
+                               "Capture consumer failed for '%s'",
+                               Command);
+        }
     }
     
+    // Streamed text has already been handed to the
+    // consumer so there is nothing to return.
     const _CharType* GetTextNonNull(void)
     {
         if (m_CharTypeSize == sizeof(char))
         {
-            return (_CharType*)(m_Text ? (PCSTR)m_Text : "");
+            return (_CharType*)(m_Text && !m_StreamFunc ?
+                                (PCSTR)m_Text : "");
         }
         else
         {
-            return (_CharType*)(m_Text ? (PCWSTR)m_Text : L"");
+            return (_CharType*)(m_Text && !m_StreamFunc ?
+                                (PCWSTR)m_Text : L"");
         }
     }
     
@@ -3452,7 +4442,54 @@ public:
     ULONG m_CharTypeSize;
     _CharType* m_Text;
 
+    ChunkFunction m_StreamFunc;
+    PVOID m_StreamContext;
+    bool m_StreamLines;
+    HRESULT m_StreamStatus;
+    
     _BaseClass* m_OldOutCb;
+
+protected:
+    HRESULT StreamOutput(_In_reads_(Chars) const _CharType* Text,
+                         _In_ ULONG Chars)
+    {
+        while (Chars > 0 &&
+               m_StreamStatus == S_OK)
+        {
+            ULONG Take = m_AllocChars - 1 - m_UsedChars;
+            bool LineEnd = false;
+
+            if (Take > Chars)
+            {
+                Take = Chars;
+            }
+            if (m_StreamLines)
+            {
+                for (ULONG i = 0; i < Take; i++)
+                {
+                    if (Text[i] == '\n')
+                    {
+                        Take = i + 1;
+                        LineEnd = true;
+                        break;
+                    }
+                }
+            }
+
+            memcpy(m_Text + m_UsedChars, Text, Take * m_CharTypeSize);
+            m_UsedChars += Take;
+            Text += Take;
+            Chars -= Take;
+
+            if (LineEnd ||
+                m_UsedChars == m_AllocChars - 1)
+            {
+                FlushStream();
+            }
+        }
+
+        return m_StreamStatus;
+    }
 };
     
 typedef ExtCaptureOutput<char, IDebugOutputCallbacks> ExtCaptureOutputA;
@@ -5,6 +5,9 @@
 // This is not a debugger extension.  It is a tool that can be used to replace
 // the debugger.
 //
+// With -json the stack is written as a single machine-readable
+// record, and -batch processes many dumps in parallel (batch.cpp).
+//
 //
 // Copyright (C) Microsoft Corporation, 2000.
 //
@@ -17,10 +20,19 @@
 #include <dbgeng.h>
 
 #include "out.hpp"
+#include "dumpstk.hpp"
 
 PSTR g_DumpFile;
 PSTR g_ImagePath;
 PSTR g_SymbolPath;
+bool g_Json;
+
+PSTR g_BatchInput;
+PSTR g_BatchOutput;
+ULONG g_BatchWorkers;
+bool g_BatchBench;
+
+double g_OpenMs;
 
 ULONG64 g_TraceFrom[3];
 
@@ -175,6 +187,57 @@ ParseCommandLine(int Argc, _In_reads_(Argc) PSTR* Argv)
                 Exit(1, "-y missing argument\n");
             }
         }
+        else if (!strcmp(Argv[0], "-json"))
+        {
+            g_Json = true;
+        }
+        else if (!strcmp(Argv[0], "-batch"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_BatchInput = Argv[0];
+            }
+            else
+            {
+                Exit(1, "-batch missing argument\n");
+            }
+        }
+        else if (!strcmp(Argv[0], "-bench"))
+        {
+            g_BatchBench = true;
+        }
+        else if (!strcmp(Argv[0], "-j"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                if (sscanf_s(Argv[0], "%u", &g_BatchWorkers) != 1 ||
+                    !g_BatchWorkers)
+                {
+                    Exit(1, "-j illegal argument\n");
+                }
+            }
+            else
+            {
+                Exit(1, "-j missing argument\n");
+            }
+        }
+        else if (!strcmp(Argv[0], "-o"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_BatchOutput = Argv[0];
+            }
+            else
+            {
+                Exit(1, "-o missing argument\n");
+            }
+        }
         else if (!strcmp(Argv[0], "-z"))
         {
             Argv++;
@@ -194,9 +257,21 @@ ParseCommandLine(int Argc, _In_reads_(Argc) PSTR* Argv)
         }
     }
 
-    if (g_DumpFile == NULL)
+    if (g_BatchInput != NULL)
+    {
+        if (g_DumpFile != NULL || g_Json ||
+            g_TraceFrom[0] || g_TraceFrom[1] || g_TraceFrom[2])
+        {
+            Exit(1, "-batch cannot be used with -z, -json, -a32 or -a64\n");
+        }
+    }
+    else if (g_DumpFile == NULL)
     {
-        Exit(1, "No dump file specified, use -z <file>\n");
+        Exit(1, "No dump file specified, use -z <file> or -batch <dir|list>\n");
+    }
+    else if (g_BatchBench || g_BatchWorkers || g_BatchOutput != NULL)
+    {
+        Exit(1, "-bench, -j and -o require -batch\n");
     }
 }
 
@@ -206,8 +281,10 @@ ApplyCommandLineArguments(void)
     HRESULT Status;
 
     // Install output callbacks so we get any output that the
-    // later calls produce.
-    if ((Status = g_Client->SetOutputCallbacks(&g_OutputCb)) != S_OK)
+    // later calls produce.  A JSON record must be the only
+    // thing written so engine output is dropped in that case.
+    if (!g_Json &&
+        (Status = g_Client->SetOutputCallbacks(&g_OutputCb)) != S_OK)
     {
         Exit(1, "SetOutputCallbacks failed, 0x%X\n", Status);
     }
@@ -228,6 +305,7 @@ ApplyCommandLineArguments(void)
     }
 
     // Everything's set up so open the dump file.
+    g_OpenMs = GetTimerMs();
     if ((Status = g_Client->OpenDumpFile(g_DumpFile)) != S_OK)
     {
         Exit(1, "OpenDumpFile failed, 0x%X\n", Status);
@@ -242,6 +320,8 @@ ApplyCommandLineArguments(void)
         Exit(1, "WaitForEvent failed, 0x%X\n", Status);
     }
 
+    g_OpenMs = GetTimerMs() - g_OpenMs;
+
     // Everything is now initialized and we can make any
     // queries we want.
 }
@@ -289,16 +369,96 @@ DumpStack(void)
     delete[] Frames;
 }
 
+void
+DumpStackJson(void)
+{
+    HRESULT Status;
+    DEBUG_STACK_FRAME Frames[50];
+    ULONG Filled;
+    double StackMs;
+
+    StackMs = GetTimerMs();
+
+    if ((Status = g_Control->
+         GetStackTrace(g_TraceFrom[0], g_TraceFrom[1], g_TraceFrom[2],
+                       Frames, _countof(Frames), &Filled)) != S_OK)
+    {
+        Exit(1, "GetStackTrace failed, 0x%X\n", Status);
+    }
+
+    //
+    // Write the whole record on a single line, as
+    // batch mode expects one JSON object per dump.
+    //
+
+    fputs("{\"dump\":", stdout);
+    OutputJsonString(stdout, g_DumpFile);
+    fputs(",\"status\":\"ok\",\"frames\":[", stdout);
+
+    for (ULONG i = 0; i < Filled; i++)
+    {
+        CHAR Name[512];
+        ULONG64 Disp;
+
+        printf("%s{\"n\":%u,\"ip\":\"0x%I64x\",\"ret\":\"0x%I64x\","
+               "\"sp\":\"0x%I64x\",\"sym\":",
+               i ? "," : "", Frames[i].FrameNumber,
+               Frames[i].InstructionOffset, Frames[i].ReturnOffset,
+               Frames[i].StackOffset);
+
+        if (g_Symbols->GetNameByOffset(Frames[i].InstructionOffset,
+                                       Name, sizeof(Name), NULL,
+                                       &Disp) == S_OK)
+        {
+            if (Disp)
+            {
+                size_t Used = strlen(Name);
+
+                _snprintf_s(Name + Used, sizeof(Name) - Used, _TRUNCATE,
+                            "+0x%I64x", Disp);
+            }
+
+            OutputJsonString(stdout, Name);
+        }
+        else
+        {
+            fputs("null", stdout);
+        }
+
+        fputc('}', stdout);
+    }
+
+    StackMs = GetTimerMs() - StackMs;
+
+    printf("],\"open_ms\":%.1f,\"stack_ms\":%.1f}\n",
+           g_OpenMs, StackMs);
+}
+
 void __cdecl
 main(int Argc, _In_reads_(Argc) PSTR* Argv)
 {
-    CreateInterfaces();
-    
     ParseCommandLine(Argc, Argv);
 
+    // Batch mode only drives child processes and
+    // never needs an engine of its own.
+    if (g_BatchInput != NULL)
+    {
+        RunBatch();
+        Exit(0, "");
+    }
+
+    CreateInterfaces();
+
     ApplyCommandLineArguments();
-    
-    DumpStack();
+
+    if (g_Json)
+    {
+        DumpStackJson();
+    }
+    else
+    {
+        DumpStack();
+    }
 
     Exit(0, "");
 }
@@ -0,0 +1,788 @@
+//----------------------------------------------------------------------------
+//
+// Portable memory-mapped minidump reader.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdmpread.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define NO_STREAM 0xffffffff
+
+static int __cdecl
+CompareRanges(_In_ const void* Elt1,
+              _In_ const void* Elt2)
+{
+    const MdmpMemoryRange* Range1 = (const MdmpMemoryRange*)Elt1;
+    const MdmpMemoryRange* Range2 = (const MdmpMemoryRange*)Elt2;
+
+    if (Range1->Start != Range2->Start)
+    {
+        return Range1->Start < Range2->Start ? -1 : 1;
+    }
+    if (Range1->FileOffset != Range2->FileOffset)
+    {
+        return Range1->FileOffset < Range2->FileOffset ? -1 : 1;
+    }
+    return 0;
+}
+
+MdmpReader::MdmpReader(void)
+{
+    m_Base = NULL;
+    m_Size = 0;
+#ifdef _WIN32
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = NULL;
+#else
+    m_File = -1;
+#endif
+    m_DirectoryParsed = false;
+    m_DirectoryStatus = S_OK;
+    m_Directory = NULL;
+    m_NumStreams = 0;
+    m_NumRanges = 0;
+    m_RangeStart = NULL;
+    m_RangeSize = NULL;
+    m_RangeOffset = NULL;
+    m_LastRange = MDMP_NO_RANGE;
+}
+
+MdmpReader::~MdmpReader(void)
+{
+    Close();
+}
+
+HRESULT
+MdmpReader::Open(_In_ PCSTR FileName)
+{
+    HRESULT Status;
+
+    Close();
+
+#ifdef _WIN32
+    LARGE_INTEGER Size;
+
+    m_File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ,
+                         NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+                         NULL);
+    if (m_File == INVALID_HANDLE_VALUE ||
+        !GetFileSizeEx(m_File, &Size))
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        goto Fail;
+    }
+
+    m_Size = (ULONG64)Size.QuadPart;
+    if (m_Size < sizeof(MINIDUMP_HEADER))
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        goto Fail;
+    }
+    if (m_Size > (SIZE_T)-1)
+    {
+        // The whole file must fit in the address space.
+        Status = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        goto Fail;
+    }
+
+    m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_Mapping == NULL)
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        goto Fail;
+    }
+
+    m_Base = (const UCHAR*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_Base == NULL)
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        goto Fail;
+    }
+#else
+    struct stat Stat;
+    void* Base;
+
+    m_File = open(FileName, O_RDONLY);
+    if (m_File < 0 ||
+        fstat(m_File, &Stat) != 0)
+    {
+        Status = HRESULT_FROM_WIN32(errno);
+        goto Fail;
+    }
+
+    m_Size = (ULONG64)Stat.st_size;
+    if (m_Size < sizeof(MINIDUMP_HEADER))
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        goto Fail;
+    }
+    if (m_Size > (size_t)-1)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        goto Fail;
+    }
+
+    Base = mmap(NULL, (size_t)m_Size, PROT_READ, MAP_SHARED, m_File, 0);
+    if (Base == MAP_FAILED)
+    {
+        Status = HRESULT_FROM_WIN32(errno);
+        goto Fail;
+    }
+
+    m_Base = (const UCHAR*)Base;
+
+    // Access is mostly scattered lookups into memory ranges.
+    madvise(Base, (size_t)m_Size, MADV_RANDOM);
+#endif
+
+    if (GetHeader()->Signature != MINIDUMP_SIGNATURE ||
+        (GetHeader()->Version & 0xffff) != MINIDUMP_VERSION)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        goto Fail;
+    }
+
+    if ((Status = BuildRangeIndex()) != S_OK)
+    {
+        goto Fail;
+    }
+
+    return S_OK;
+
+ Fail:
+    Close();
+    return Status;
+}
+
+void
+MdmpReader::Close(void)
+{
+#ifdef _WIN32
+    if (m_Base != NULL)
+    {
+        UnmapViewOfFile(m_Base);
+    }
+    if (m_Mapping != NULL)
+    {
+        CloseHandle(m_Mapping);
+        m_Mapping = NULL;
+    }
+    if (m_File != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_File);
+        m_File = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_Base != NULL)
+    {
+        munmap((void*)m_Base, (size_t)m_Size);
+    }
+    if (m_File >= 0)
+    {
+        close(m_File);
+        m_File = -1;
+    }
+#endif
+
+    m_Base = NULL;
+    m_Size = 0;
+    m_DirectoryParsed = false;
+    m_DirectoryStatus = S_OK;
+    m_Directory = NULL;
+    m_NumStreams = 0;
+
+    FreeRangeIndex();
+}
+
+HRESULT
+MdmpReader::ParseDirectory(void)
+{
+    if (m_DirectoryParsed)
+    {
+        return m_DirectoryStatus;
+    }
+    if (!IsOpen())
+    {
+        return E_INVALIDARG;
+    }
+
+    m_DirectoryParsed = true;
+
+    const MINIDUMP_HEADER* Header = GetHeader();
+
+    m_Directory = (const MINIDUMP_DIRECTORY*)
+        GetFileData(Header->StreamDirectoryRva,
+                    (ULONG64)Header->NumberOfStreams *
+                    sizeof(MINIDUMP_DIRECTORY));
+    if (m_Directory == NULL)
+    {
+        m_DirectoryStatus = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        return m_DirectoryStatus;
+    }
+
+    m_NumStreams = Header->NumberOfStreams;
+
+    for (ULONG32 i = 0; i < s_MaxIndexedStream; i++)
+    {
+        m_StreamIndex[i] = NO_STREAM;
+    }
+
+    // If a stream type occurs more than once the
+    // first occurrence is used, as dbghelp does.
+    for (ULONG32 i = 0; i < m_NumStreams; i++)
+    {
+        ULONG32 Type = m_Directory[i].StreamType;
+
+        if (Type < s_MaxIndexedStream &&
+            m_StreamIndex[Type] == NO_STREAM)
+        {
+            m_StreamIndex[Type] = i;
+        }
+    }
+
+    m_DirectoryStatus = S_OK;
+    return S_OK;
+}
+
+//----------------------------------------------------------------------------
+//
+// Memory range index.
+//
+//----------------------------------------------------------------------------
+
+HRESULT
+MdmpReader::BuildRangeIndex(void)
+{
+    HRESULT Status;
+    MdmpView<MINIDUMP_MEMORY_DESCRIPTOR64> Ranges64;
+    MdmpView<MINIDUMP_MEMORY_DESCRIPTOR> Ranges;
+    ULONG64 Rva;
+    ULONG64 Total;
+    MdmpMemoryRange* Sort;
+    ULONG32 Used;
+    bool Sorted;
+
+    FreeRangeIndex();
+
+    if (FAILED(Status = GetMemory64List(&Ranges64, &Rva)) ||
+        FAILED(Status = GetMemoryList(&Ranges)))
+    {
+        return Status;
+    }
+
+    Total = Ranges64.Count + Ranges.Count;
+    if (Total >= MDMP_NO_RANGE)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+    if (!Total)
+    {
+        return S_OK;
+    }
+
+    Sort = (MdmpMemoryRange*)malloc((size_t)Total * sizeof(*Sort));
+    if (Sort == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    //
+    // Gather the ranges from both lists.  The 64-bit list
+    // data is laid out sequentially starting at BaseRva.
+    // Empty ranges can never satisfy a lookup so drop them.
+    //
+
+    Used = 0;
+    Sorted = true;
+
+    for (ULONG64 i = 0; i < Ranges64.Count; i++)
+    {
+        if (Ranges64[i].DataSize)
+        {
+            Sort[Used].Start = Ranges64[i].StartOfMemoryRange;
+            Sort[Used].Size = Ranges64[i].DataSize;
+            Sort[Used].FileOffset = Rva;
+            Used++;
+        }
+
+        Rva += Ranges64[i].DataSize;
+    }
+    for (ULONG64 i = 0; i < Ranges.Count; i++)
+    {
+        if (Ranges[i].Memory.DataSize)
+        {
+            Sort[Used].Start = Ranges[i].StartOfMemoryRange;
+            Sort[Used].Size = Ranges[i].Memory.DataSize;
+            Sort[Used].FileOffset = Ranges[i].Memory.Rva;
+            Used++;
+        }
+    }
+
+    // Full memory dumps are almost always written in
+    // address order, so only sort when needed.
+    for (ULONG32 i = 1; i < Used; i++)
+    {
+        if (Sort[i].Start < Sort[i - 1].Start)
+        {
+            Sorted = false;
+            break;
+        }
+    }
+    if (!Sorted)
+    {
+        qsort(Sort, Used, sizeof(*Sort), CompareRanges);
+    }
+
+    m_RangeStart = (PULONG64)malloc((size_t)Used * sizeof(ULONG64));
+    m_RangeSize = (PULONG64)malloc((size_t)Used * sizeof(ULONG64));
+    m_RangeOffset = (PULONG64)malloc((size_t)Used * sizeof(ULONG64));
+    if (m_RangeStart == NULL ||
+        m_RangeSize == NULL ||
+        m_RangeOffset == NULL)
+    {
+        free(Sort);
+        FreeRangeIndex();
+        return E_OUTOFMEMORY;
+    }
+
+    for (ULONG32 i = 0; i < Used; i++)
+    {
+        m_RangeStart[i] = Sort[i].Start;
+        m_RangeSize[i] = Sort[i].Size;
+        m_RangeOffset[i] = Sort[i].FileOffset;
+
+        // Lookups find the last range starting at or below
+        // an address, so overlapping ranges are clipped to
+        // keep every range reachable.
+        if (i > 0 &&
+            m_RangeStart[i - 1] + m_RangeSize[i - 1] > m_RangeStart[i])
+        {
+            m_RangeSize[i - 1] = m_RangeStart[i] - m_RangeStart[i - 1];
+        }
+    }
+
+    m_NumRanges = Used;
+    free(Sort);
+    return S_OK;
+}
+
+void
+MdmpReader::FreeRangeIndex(void)
+{
+    free(m_RangeStart);
+    m_RangeStart = NULL;
+    free(m_RangeSize);
+    m_RangeSize = NULL;
+    free(m_RangeOffset);
+    m_RangeOffset = NULL;
+    m_NumRanges = 0;
+    m_LastRange = MDMP_NO_RANGE;
+}
+
+// Returns the last range in [Low, High) that starts
+// at or below Address, or MDMP_NO_RANGE.
+ULONG32
+MdmpReader::SearchRanges(_In_ ULONG64 Address,
+                         _In_ ULONG32 Low,
+                         _In_ ULONG32 High)
+{
+    ULONG32 Found = MDMP_NO_RANGE;
+
+    while (Low < High)
+    {
+        ULONG32 Mid = Low + (High - Low) / 2;
+
+        if (m_RangeStart[Mid] <= Address)
+        {
+            Found = Mid;
+            Low = Mid + 1;
+        }
+        else
+        {
+            High = Mid;
+        }
+    }
+
+    return Found;
+}
+
+ULONG32
+MdmpReader::FindMemoryRangeIndex(_In_ ULONG64 Address)
+{
+    ULONG32 Index = m_LastRange;
+
+    if (Index != MDMP_NO_RANGE &&
+        Address >= m_RangeStart[Index] &&
+        Address - m_RangeStart[Index] < m_RangeSize[Index])
+    {
+        return Index;
+    }
+
+    Index = SearchRanges(Address, 0, m_NumRanges);
+    if (Index == MDMP_NO_RANGE ||
+        Address - m_RangeStart[Index] >= m_RangeSize[Index])
+    {
+        return MDMP_NO_RANGE;
+    }
+
+    m_LastRange = Index;
+    return Index;
+}
+
+ULONG32
+MdmpReader::FindMemoryRanges(_In_ ULONG32 Count,
+                             _In_reads_(Count) const ULONG64* Addresses,
+                             _Out_writes_(Count) PULONG32 Indices)
+{
+    ULONG32 Found = 0;
+    ULONG32 Low = 0;
+    ULONG64 Prev = 0;
+
+    for (ULONG32 i = 0; i < Count; i++)
+    {
+        ULONG64 Address = Addresses[i];
+        ULONG32 High;
+        ULONG32 Step;
+        ULONG32 Index;
+
+        Indices[i] = MDMP_NO_RANGE;
+        if (!m_NumRanges)
+        {
+            continue;
+        }
+
+        // Sorted input lets each search start where the
+        // previous one ended.  Gallop forward to bound
+        // the search so nearby addresses stay cheap.
+        if (Address < Prev)
+        {
+            Low = 0;
+        }
+        Prev = Address;
+
+        Step = 1;
+        High = Low + 1;
+        while (High < m_NumRanges &&
+               m_RangeStart[High] <= Address)
+        {
+            Low = High;
+            Step = Step < m_NumRanges ? Step * 2 : Step;
+            High = m_NumRanges - Low > Step ? Low + Step : m_NumRanges;
+        }
+
+        Index = SearchRanges(Address, Low, High);
+        if (Index == MDMP_NO_RANGE)
+        {
+            continue;
+        }
+
+        Low = Index;
+        if (Address - m_RangeStart[Index] < m_RangeSize[Index])
+        {
+            Indices[i] = Index;
+            Found++;
+        }
+    }
+
+    return Found;
+}
+
+HRESULT
+MdmpReader::GetStream(_In_ ULONG32 StreamType,
+                      _Out_ const UCHAR** Data,
+                      _Out_ PULONG32 Bytes)
+{
+    HRESULT Status;
+    ULONG32 Index = NO_STREAM;
+
+    *Data = NULL;
+    *Bytes = 0;
+
+    if ((Status = ParseDirectory()) != S_OK)
+    {
+        return Status;
+    }
+
+    if (StreamType < s_MaxIndexedStream)
+    {
+        Index = m_StreamIndex[StreamType];
+    }
+    else
+    {
+        for (ULONG32 i = 0; i < m_NumStreams; i++)
+        {
+            if (m_Directory[i].StreamType == StreamType)
+            {
+                Index = i;
+                break;
+            }
+        }
+    }
+    if (Index == NO_STREAM)
+    {
+        return S_FALSE;
+    }
+
+    const MINIDUMP_LOCATION_DESCRIPTOR* Location =
+        &m_Directory[Index].Location;
+
+    *Data = GetLocation(Location);
+    if (*Data == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    *Bytes = Location->DataSize;
+    return S_OK;
+}
+
+HRESULT
+MdmpReader::GetList(_In_ ULONG32 StreamType,
+                    _In_ ULONG32 HeaderBytes,
+                    _In_ ULONG32 EltBytes,
+                    _Out_ const UCHAR** Elts,
+                    _Out_ PULONG64 Count)
+{
+    HRESULT Status;
+    const UCHAR* Data;
+    ULONG32 Bytes;
+
+    *Elts = NULL;
+    *Count = 0;
+
+    if ((Status = GetStream(StreamType, &Data, &Bytes)) != S_OK)
+    {
+        return Status;
+    }
+    if (Bytes < HeaderBytes)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    // All list streams start with their count, which
+    // is 64-bit when the header has room for it.
+    ULONG64 Num = 0;
+
+    memcpy(&Num, Data, HeaderBytes >= sizeof(ULONG64) ?
+           sizeof(ULONG64) : sizeof(ULONG32));
+    if (Num > (Bytes - HeaderBytes) / EltBytes)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    *Elts = Data + HeaderBytes;
+    *Count = Num;
+    return S_OK;
+}
+
+HRESULT
+MdmpReader::GetThreads(_Out_ MdmpView<MINIDUMP_THREAD>* Threads)
+{
+    const UCHAR* Elts;
+    HRESULT Status = GetList(ThreadListStream, sizeof(ULONG32),
+                             sizeof(MINIDUMP_THREAD),
+                             &Elts, &Threads->Count);
+    Threads->Data = (const MINIDUMP_THREAD*)Elts;
+    return Status;
+}
+
+HRESULT
+MdmpReader::GetModules(_Out_ MdmpView<MINIDUMP_MODULE>* Modules)
+{
+    const UCHAR* Elts;
+    HRESULT Status = GetList(ModuleListStream, sizeof(ULONG32),
+                             sizeof(MINIDUMP_MODULE),
+                             &Elts, &Modules->Count);
+    Modules->Data = (const MINIDUMP_MODULE*)Elts;
+    return Status;
+}
+
+HRESULT
+MdmpReader::GetException(_Out_ const MINIDUMP_EXCEPTION_STREAM** Exception)
+{
+    HRESULT Status;
+    const UCHAR* Data;
+    ULONG32 Bytes;
+
+    *Exception = NULL;
+
+    if ((Status = GetStream(ExceptionStream, &Data, &Bytes)) != S_OK)
+    {
+        return Status;
+    }
+    if (Bytes < sizeof(MINIDUMP_EXCEPTION_STREAM))
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    *Exception = (const MINIDUMP_EXCEPTION_STREAM*)Data;
+    return S_OK;
+}
+
+HRESULT
+MdmpReader::GetMemoryList(_Out_ MdmpView<MINIDUMP_MEMORY_DESCRIPTOR>* Ranges)
+{
+    const UCHAR* Elts;
+    HRESULT Status = GetList(MemoryListStream, sizeof(ULONG32),
+                             sizeof(MINIDUMP_MEMORY_DESCRIPTOR),
+                             &Elts, &Ranges->Count);
+    Ranges->Data = (const MINIDUMP_MEMORY_DESCRIPTOR*)Elts;
+    return Status;
+}
+
+HRESULT
+MdmpReader::GetMemory64List(_Out_ MdmpView<MINIDUMP_MEMORY_DESCRIPTOR64>* Ranges,
+                            _Out_ PULONG64 BaseRva)
+{
+    const UCHAR* Elts;
+    HRESULT Status = GetList(Memory64ListStream, 2 * sizeof(ULONG64),
+                             sizeof(MINIDUMP_MEMORY_DESCRIPTOR64),
+                             &Elts, &Ranges->Count);
+    Ranges->Data = (const MINIDUMP_MEMORY_DESCRIPTOR64*)Elts;
+    if (Status == S_OK)
+    {
+        // BaseRva follows NumberOfMemoryRanges.
+        memcpy(BaseRva, Elts - sizeof(ULONG64), sizeof(*BaseRva));
+    }
+    else
+    {
+        *BaseRva = 0;
+    }
+    return Status;
+}
+
+HRESULT
+MdmpReader::GetString(_In_ RVA Rva,
+                      _Out_ const WCHAR** String,
+                      _Out_ PULONG32 Chars)
+{
+    const UCHAR* Data;
+    ULONG32 Bytes;
+
+    *String = NULL;
+    *Chars = 0;
+
+    if ((Data = GetFileData(Rva, sizeof(ULONG32))) == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    memcpy(&Bytes, Data, sizeof(Bytes));
+    if (GetFileData((ULONG64)Rva + sizeof(ULONG32), Bytes) == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    *String = (const WCHAR*)(Data + sizeof(ULONG32));
+    *Chars = Bytes / sizeof(WCHAR);
+    return S_OK;
+}
+
+HRESULT
+MdmpReader::FindMemoryRange(_In_ ULONG64 Address,
+                            _Out_ MdmpMemoryRange* Range)
+{
+    ULONG32 Index = FindMemoryRangeIndex(Address);
+
+    if (Index == MDMP_NO_RANGE)
+    {
+        return S_FALSE;
+    }
+
+    GetMemoryRange(Index, Range);
+    return S_OK;
+}
+
+HRESULT
+MdmpReader::GetVirtualView(_In_ ULONG64 Address,
+                           _In_ ULONG64 Bytes,
+                           _Out_ const UCHAR** Data,
+                           _Out_ PULONG64 Avail)
+{
+    HRESULT Status;
+    MdmpMemoryRange Range;
+
+    *Data = NULL;
+    *Avail = 0;
+
+    if ((Status = FindMemoryRange(Address, &Range)) != S_OK)
+    {
+        return Status;
+    }
+
+    ULONG64 Offs = Address - Range.Start;
+    ULONG64 Left = Range.Size - Offs;
+
+    if (Bytes > Left)
+    {
+        Bytes = Left;
+    }
+
+    *Data = GetFileData(Range.FileOffset + Offs, Bytes);
+    if (*Data == NULL)
+    {
+        // Truncated dumps are common, so hand back
+        // whatever part of the range is present.
+        if (Range.FileOffset + Offs >= m_Size)
+        {
+            return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+        }
+
+        Bytes = m_Size - (Range.FileOffset + Offs);
+        *Data = m_Base + Range.FileOffset + Offs;
+    }
+
+    *Avail = Bytes;
+    return S_OK;
+}
+
+HRESULT
+MdmpReader::ReadVirtual(_In_ ULONG64 Address,
+                        _Out_writes_bytes_(Bytes) PVOID Buffer,
+                        _In_ ULONG32 Bytes,
+                        _Out_opt_ PULONG32 Done)
+{
+    HRESULT Status = S_OK;
+    PUCHAR To = (PUCHAR)Buffer;
+    ULONG32 Left = Bytes;
+
+    while (Left > 0)
+    {
+        const UCHAR* Data;
+        ULONG64 Avail;
+
+        if ((Status = GetVirtualView(Address, Left, &Data, &Avail)) != S_OK)
+        {
+            break;
+        }
+
+        memcpy(To, Data, (size_t)Avail);
+        To += Avail;
+        Address += Avail;
+        Left -= (ULONG32)Avail;
+    }
+
+    if (Done != NULL)
+    {
+        *Done = Bytes - Left;
+    }
+
+    // Partial reads succeed as with ReadVirtual.
+    if (Left < Bytes ||
+        Bytes == 0)
+    {
+        return S_OK;
+    }
+    return Status == S_OK ? HRESULT_FROM_WIN32(ERROR_READ_FAULT) : Status;
+}
@@ -0,0 +1,537 @@
+//----------------------------------------------------------------------------
+//
+// Command-line driver for the portable minidump reader.
+//
+// Displays a summary of a dump's threads, modules and exception,
+// can generate synthetic full-memory dumps and can benchmark
+// virtual address lookups against a dump.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "mdmpread.hpp"
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+PSTR g_DumpFile;
+ULONG64 g_BenchLookups;
+ULONG64 g_SynthRanges;
+
+MdmpReader g_Reader;
+
+void
+Exit(int Code, _In_ PCSTR Format, ...)
+{
+    g_Reader.Close();
+
+    // Output an error message if given.
+    if (Format != NULL)
+    {
+        va_list Args;
+
+        va_start(Args, Format);
+        vfprintf(stderr, Format, Args);
+        va_end(Args);
+    }
+
+    exit(Code);
+}
+
+double
+GetSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER Freq, Now;
+
+    QueryPerformanceFrequency(&Freq);
+    QueryPerformanceCounter(&Now);
+    return (double)Now.QuadPart / (double)Freq.QuadPart;
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (double)Now.tv_sec + (double)Now.tv_nsec / 1e9;
+#endif
+}
+
+// Small deterministic generator so that benchmark
+// runs are repeatable.
+ULONG64
+NextRandom(_Inout_ PULONG64 State)
+{
+    *State = *State * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *State >> 17;
+}
+
+void
+ParseCommandLine(int Argc, _In_reads_(Argc) PSTR* Argv)
+{
+    while (--Argc > 0)
+    {
+        Argv++;
+        if (!strcmp(Argv[0], "-bench"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_BenchLookups = strtoull(Argv[0], NULL, 0);
+            }
+            else
+            {
+                Exit(1, "-bench missing argument\n");
+            }
+        }
+        else if (!strcmp(Argv[0], "-synth"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc > 0)
+            {
+                g_SynthRanges = strtoull(Argv[0], NULL, 0);
+            }
+            else
+            {
+                Exit(1, "-synth missing argument\n");
+            }
+        }
+        else if (Argv[0][0] == '-')
+        {
+            Exit(1, "Unknown command line argument '%s'\n", Argv[0]);
+        }
+        else
+        {
+            g_DumpFile = Argv[0];
+        }
+    }
+
+    if (g_DumpFile == NULL)
+    {
+        Exit(1,
+             "Usage: mdmpread [-synth <ranges>] [-bench <lookups>] <dump>\n"
+             "  -synth writes a synthetic full-memory dump "
+             "with the given number of 4K ranges\n"
+             "  -bench times the given number of "
+             "random virtual address lookups\n");
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Synthetic dumps.
+//
+// The dump has two threads, two modules, an exception stream and
+// a Memory64ListStream of 4K ranges separated by 4K gaps.  Each
+// ULONG64 of saved memory holds its own virtual address so that
+// reads can be checked.
+//
+//----------------------------------------------------------------------------
+
+#define SYNTH_BASE 0x10000000ULL
+#define SYNTH_RANGE_SIZE 0x1000
+#define SYNTH_STREAMS 4
+
+void
+WriteFileData(_In_ FILE* File, _In_reads_bytes_(Bytes) const void* Data,
+              _In_ size_t Bytes)
+{
+    if (fwrite(Data, 1, Bytes, File) != Bytes)
+    {
+        Exit(1, "Unable to write synthetic dump\n");
+    }
+}
+
+void
+WriteSynthDump(void)
+{
+    FILE* File;
+    MINIDUMP_HEADER Header;
+    MINIDUMP_DIRECTORY Dir[SYNTH_STREAMS];
+    MINIDUMP_THREAD Threads[2];
+    MINIDUMP_MODULE Modules[2];
+    MINIDUMP_EXCEPTION_STREAM Exception;
+    static const char* s_ModNames[2] = { "synth.exe", "ntdll.dll" };
+    ULONG32 NameRvas[2];
+    ULONG32 Rva;
+    ULONG32 Count;
+    ULONG64 Count64;
+    ULONG64 DataRva;
+    ULONG64 i;
+
+    if ((File = fopen(g_DumpFile, "wb")) == NULL)
+    {
+        Exit(1, "Unable to create '%s'\n", g_DumpFile);
+    }
+
+    //
+    // Lay out the header, directory, streams, module
+    // names and then the memory data.
+    //
+
+    Rva = sizeof(Header) + sizeof(Dir);
+
+    memset(Dir, 0, sizeof(Dir));
+    Dir[0].StreamType = ThreadListStream;
+    Dir[0].Location.Rva = Rva;
+    Dir[0].Location.DataSize = sizeof(ULONG32) + sizeof(Threads);
+    Rva += Dir[0].Location.DataSize;
+    Dir[1].StreamType = ModuleListStream;
+    Dir[1].Location.Rva = Rva;
+    Dir[1].Location.DataSize = sizeof(ULONG32) + sizeof(Modules);
+    Rva += Dir[1].Location.DataSize;
+    Dir[2].StreamType = ExceptionStream;
+    Dir[2].Location.Rva = Rva;
+    Dir[2].Location.DataSize = sizeof(Exception);
+    Rva += Dir[2].Location.DataSize;
+    Dir[3].StreamType = Memory64ListStream;
+    Dir[3].Location.Rva = Rva;
+    Dir[3].Location.DataSize = (ULONG32)
+        (2 * sizeof(ULONG64) +
+         g_SynthRanges * sizeof(MINIDUMP_MEMORY_DESCRIPTOR64));
+    Rva += Dir[3].Location.DataSize;
+
+    for (i = 0; i < 2; i++)
+    {
+        NameRvas[i] = Rva;
+        Rva += (ULONG32)(sizeof(ULONG32) +
+                         strlen(s_ModNames[i]) * sizeof(WCHAR));
+    }
+
+    DataRva = Rva;
+
+    memset(&Header, 0, sizeof(Header));
+    Header.Signature = MINIDUMP_SIGNATURE;
+    Header.Version = MINIDUMP_VERSION;
+    Header.NumberOfStreams = SYNTH_STREAMS;
+    Header.StreamDirectoryRva = sizeof(Header);
+
+    memset(Threads, 0, sizeof(Threads));
+    for (i = 0; i < 2; i++)
+    {
+        Threads[i].ThreadId = (ULONG32)(0x100 + i);
+        Threads[i].Teb = 0x7ffd0000 + i * 0x1000;
+        Threads[i].Stack.StartOfMemoryRange =
+            SYNTH_BASE + i * 2 * SYNTH_RANGE_SIZE;
+        Threads[i].Stack.Memory.DataSize = SYNTH_RANGE_SIZE;
+    }
+
+    memset(Modules, 0, sizeof(Modules));
+    for (i = 0; i < 2; i++)
+    {
+        Modules[i].BaseOfImage = 0x400000 + i * 0x1000000;
+        Modules[i].SizeOfImage = 0x10000;
+        Modules[i].ModuleNameRva = NameRvas[i];
+    }
+
+    memset(&Exception, 0, sizeof(Exception));
+    Exception.ThreadId = Threads[0].ThreadId;
+    Exception.ExceptionRecord.ExceptionCode = 0xc0000005;
+    Exception.ExceptionRecord.ExceptionAddress = Modules[0].BaseOfImage + 0x1234;
+
+    WriteFileData(File, &Header, sizeof(Header));
+    WriteFileData(File, Dir, sizeof(Dir));
+    Count = 2;
+    WriteFileData(File, &Count, sizeof(Count));
+    WriteFileData(File, Threads, sizeof(Threads));
+    WriteFileData(File, &Count, sizeof(Count));
+    WriteFileData(File, Modules, sizeof(Modules));
+    WriteFileData(File, &Exception, sizeof(Exception));
+
+    Count64 = g_SynthRanges;
+    WriteFileData(File, &Count64, sizeof(Count64));
+    WriteFileData(File, &DataRva, sizeof(DataRva));
+    for (i = 0; i < g_SynthRanges; i++)
+    {
+        MINIDUMP_MEMORY_DESCRIPTOR64 Desc;
+
+        Desc.StartOfMemoryRange = SYNTH_BASE + i * 2 * SYNTH_RANGE_SIZE;
+        Desc.DataSize = SYNTH_RANGE_SIZE;
+        WriteFileData(File, &Desc, sizeof(Desc));
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        ULONG32 Len = (ULONG32)(strlen(s_ModNames[i]) * sizeof(WCHAR));
+
+        WriteFileData(File, &Len, sizeof(Len));
+        for (PCSTR Char = s_ModNames[i]; *Char; Char++)
+        {
+            WCHAR Wide = (WCHAR)*Char;
+            WriteFileData(File, &Wide, sizeof(Wide));
+        }
+    }
+
+    for (i = 0; i < g_SynthRanges; i++)
+    {
+        ULONG64 Page[SYNTH_RANGE_SIZE / sizeof(ULONG64)];
+        ULONG64 Start = SYNTH_BASE + i * 2 * SYNTH_RANGE_SIZE;
+
+        for (ULONG j = 0; j < SYNTH_RANGE_SIZE / sizeof(ULONG64); j++)
+        {
+            Page[j] = Start + j * sizeof(ULONG64);
+        }
+        WriteFileData(File, Page, sizeof(Page));
+    }
+
+    fclose(File);
+
+    printf("Wrote %s with %llu ranges\n", g_DumpFile,
+           (unsigned long long)g_SynthRanges);
+}
+
+//----------------------------------------------------------------------------
+//
+// Dump summary.
+//
+//----------------------------------------------------------------------------
+
+void
+PrintString(_In_ RVA Rva)
+{
+    const WCHAR* Str;
+    ULONG32 Chars;
+
+    if (g_Reader.GetString(Rva, &Str, &Chars) != S_OK)
+    {
+        printf("<bad name>");
+        return;
+    }
+
+    // Names are displayed as ASCII, which is
+    // enough for a summary.
+    for (ULONG32 i = 0; i < Chars; i++)
+    {
+        putchar(Str[i] < 0x80 ? (char)Str[i] : '?');
+    }
+}
+
+void
+DumpSummary(void)
+{
+    HRESULT Status;
+    const MINIDUMP_HEADER* Header = g_Reader.GetHeader();
+    MdmpView<MINIDUMP_THREAD> Threads;
+    MdmpView<MINIDUMP_MODULE> Modules;
+    const MINIDUMP_EXCEPTION_STREAM* Exception;
+    MdmpView<MINIDUMP_MEMORY_DESCRIPTOR> Ranges;
+    MdmpView<MINIDUMP_MEMORY_DESCRIPTOR64> Ranges64;
+    ULONG64 BaseRva;
+
+    printf("%s: %llu bytes, %u streams, flags 0x%llx\n",
+           g_DumpFile, (unsigned long long)g_Reader.GetFileSize(),
+           Header->NumberOfStreams, (unsigned long long)Header->Flags);
+
+    if (FAILED(Status = g_Reader.GetThreads(&Threads)))
+    {
+        Exit(1, "Unable to read thread list, 0x%X\n", Status);
+    }
+    printf("\n%llu threads:\n", (unsigned long long)Threads.Count);
+    for (ULONG64 i = 0; i < Threads.Count; i++)
+    {
+        printf("  %5x  teb %016llx  stack %016llx %x\n",
+               Threads[i].ThreadId,
+               (unsigned long long)Threads[i].Teb,
+               (unsigned long long)Threads[i].Stack.StartOfMemoryRange,
+               Threads[i].Stack.Memory.DataSize);
+    }
+
+    if (FAILED(Status = g_Reader.GetModules(&Modules)))
+    {
+        Exit(1, "Unable to read module list, 0x%X\n", Status);
+    }
+    printf("\n%llu modules:\n", (unsigned long long)Modules.Count);
+    for (ULONG64 i = 0; i < Modules.Count; i++)
+    {
+        printf("  %016llx %08x  ",
+               (unsigned long long)Modules[i].BaseOfImage,
+               Modules[i].SizeOfImage);
+        PrintString(Modules[i].ModuleNameRva);
+        printf("\n");
+    }
+
+    if ((Status = g_Reader.GetException(&Exception)) == S_OK)
+    {
+        printf("\nException %08x at %016llx on thread %x\n",
+               Exception->ExceptionRecord.ExceptionCode,
+               (unsigned long long)Exception->ExceptionRecord.ExceptionAddress,
+               Exception->ThreadId);
+    }
+    else if (FAILED(Status))
+    {
+        Exit(1, "Unable to read exception, 0x%X\n", Status);
+    }
+
+    if (g_Reader.GetMemoryList(&Ranges) == S_OK)
+    {
+        printf("\n%llu memory ranges\n", (unsigned long long)Ranges.Count);
+    }
+    if (g_Reader.GetMemory64List(&Ranges64, &BaseRva) == S_OK)
+    {
+        printf("\n%llu memory64 ranges from %llx\n",
+               (unsigned long long)Ranges64.Count,
+               (unsigned long long)BaseRva);
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Lookup benchmark.
+//
+// Looks up random addresses within the saved ranges and reports
+// the number of bytes of address range resolved per second.
+// Views are not copied so this measures lookup cost alone.
+// The same addresses are then resolved in batches, both in
+// random and in sorted order.
+//
+//----------------------------------------------------------------------------
+
+int __cdecl
+CompareAddresses(_In_ const void* Elt1,
+                 _In_ const void* Elt2)
+{
+    ULONG64 Addr1 = *(const ULONG64*)Elt1;
+    ULONG64 Addr2 = *(const ULONG64*)Elt2;
+
+    return Addr1 < Addr2 ? -1 : (Addr1 > Addr2 ? 1 : 0);
+}
+
+void
+Benchmark(void)
+{
+    HRESULT Status;
+    ULONG32 NumRanges;
+    PULONG64 Addresses;
+    PULONG32 Indices;
+    ULONG64 Random = 1;
+    ULONG64 Resolved = 0;
+    ULONG64 Missed = 0;
+    ULONG32 Found;
+    double Start, Elapsed;
+
+    NumRanges = g_Reader.GetNumMemoryRanges();
+    if (!NumRanges)
+    {
+        Exit(1, "Dump has no memory ranges\n");
+    }
+    if (g_BenchLookups > 0xffffffff)
+    {
+        Exit(1, "Too many lookups\n");
+    }
+
+    Addresses = (PULONG64)malloc((size_t)g_BenchLookups * sizeof(*Addresses));
+    Indices = (PULONG32)malloc((size_t)g_BenchLookups * sizeof(*Indices));
+    if (Addresses == NULL || Indices == NULL)
+    {
+        Exit(1, "Unable to allocate lookup arrays\n");
+    }
+
+    for (ULONG64 i = 0; i < g_BenchLookups; i++)
+    {
+        MdmpMemoryRange Range;
+
+        g_Reader.GetMemoryRange((ULONG32)(NextRandom(&Random) % NumRanges),
+                                &Range);
+        Addresses[i] = Range.Start + NextRandom(&Random) % Range.Size;
+    }
+
+    printf("\n%llu lookups over %u ranges\n",
+           (unsigned long long)g_BenchLookups, NumRanges);
+
+    //
+    // Individual lookups through the view interface.
+    //
+
+    Start = GetSeconds();
+
+    for (ULONG64 i = 0; i < g_BenchLookups; i++)
+    {
+        const UCHAR* Data;
+        ULONG64 Avail;
+
+        Status = g_Reader.GetVirtualView(Addresses[i], 0x1000,
+                                         &Data, &Avail);
+        if (Status == S_OK)
+        {
+            Resolved += Avail;
+        }
+        else
+        {
+            Missed++;
+        }
+    }
+
+    Elapsed = GetSeconds() - Start;
+    if (Elapsed <= 0)
+    {
+        Elapsed = 1e-9;
+    }
+
+    printf("  views:          %.3f s, %.0f lookups/s, %.3f GB/s, "
+           "%llu missed\n",
+           Elapsed, g_BenchLookups / Elapsed, Resolved / Elapsed / 1e9,
+           (unsigned long long)Missed);
+
+    //
+    // Batched lookups, first in random order and then sorted.
+    //
+
+    for (int Pass = 0; Pass < 2; Pass++)
+    {
+        if (Pass)
+        {
+            qsort(Addresses, (size_t)g_BenchLookups, sizeof(*Addresses),
+                  CompareAddresses);
+        }
+
+        Start = GetSeconds();
+        Found = g_Reader.FindMemoryRanges((ULONG32)g_BenchLookups,
+                                          Addresses, Indices);
+        Elapsed = GetSeconds() - Start;
+        if (Elapsed <= 0)
+        {
+            Elapsed = 1e-9;
+        }
+
+        printf("  batch %s: %.3f s, %.0f lookups/s, %llu missed\n",
+               Pass ? "sorted" : "random", Elapsed,
+               g_BenchLookups / Elapsed,
+               (unsigned long long)(g_BenchLookups - Found));
+    }
+
+    free(Addresses);
+    free(Indices);
+}
+
+int __cdecl
+main(int Argc, _In_reads_(Argc) PSTR* Argv)
+{
+    HRESULT Status;
+
+    ParseCommandLine(Argc, Argv);
+
+    if (g_SynthRanges)
+    {
+        WriteSynthDump();
+    }
+
+    if ((Status = g_Reader.Open(g_DumpFile)) != S_OK)
+    {
+        Exit(1, "Unable to open '%s', 0x%X\n", g_DumpFile, Status);
+    }
+
+    DumpSummary();
+
+    if (g_BenchLookups)
+    {
+        Benchmark();
+    }
+
+    Exit(0, NULL);
+    return 0;
+}
@@ -0,0 +1,387 @@
+//----------------------------------------------------------------------------
+//
+// Stack signature bucketing.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bucket.hpp"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+StackBucketer::StackBucketer(void)
+{
+    m_Rules = NULL;
+    m_TopFrames = 0;
+    m_Initialized = false;
+}
+
+StackBucketer::~StackBucketer(void)
+{
+    Clear();
+}
+
+HRESULT
+StackBucketer::Initialize(_In_opt_ TriageRules* Rules,
+                          _In_ ULONG32 TopFrames)
+{
+    if (!TopFrames || TopFrames > BUCKET_MAX_FRAMES)
+    {
+        return E_INVALIDARG;
+    }
+
+    Clear();
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        TrgInitializeLock(&m_Shards[i].Lock);
+        m_Shards[i].Table = NULL;
+        m_Shards[i].TableSize = 0;
+        m_Shards[i].Used = 0;
+        m_Shards[i].Stacks = 0;
+    }
+
+    m_Rules = Rules;
+    m_TopFrames = TopFrames;
+    m_Initialized = true;
+    return S_OK;
+}
+
+void
+StackBucketer::Clear(void)
+{
+    if (!m_Initialized)
+    {
+        return;
+    }
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        BucketShard* Shard = &m_Shards[i];
+
+        for (ULONG32 j = 0; j < Shard->TableSize; j++)
+        {
+            free(Shard->Table[j]);
+        }
+
+        free(Shard->Table);
+        TrgDeleteLock(&Shard->Lock);
+    }
+
+    m_Initialized = false;
+}
+
+ULONG64
+StackBucketer::GetSignature(_In_ ULONG32 NumFrames,
+                            _In_reads_(NumFrames) const PCSTR* Frames,
+                            _Out_writes_z_(BUCKET_MAX_SIGNATURE) PSTR Signature,
+                            _Out_ PULONG32 SignatureChars,
+                            _Out_ PULONG32 SignatureFrames,
+                            _Out_ PULONG32 FollowUpRule)
+{
+    ULONG64 Hash = FNV_OFFSET;
+    ULONG32 Used = 0;
+    ULONG32 Kept = 0;
+
+    *FollowUpRule = TRIAGE_NO_RULE;
+
+    for (ULONG32 i = 0; i < NumFrames && Kept < m_TopFrames; i++)
+    {
+        TriageFrame Frame;
+        ULONG32 Rule = TRIAGE_NO_RULE;
+
+        if (!TriageParseFrame(Frames[i], &Frame))
+        {
+            continue;
+        }
+
+        if (m_Rules != NULL)
+        {
+            Rule = m_Rules->MatchFrame(&Frame);
+            if (Rule != TRIAGE_NO_RULE &&
+                m_Rules->GetRule(Rule)->Ignore)
+            {
+                continue;
+            }
+        }
+
+        if (!Kept)
+        {
+            *FollowUpRule = Rule;
+        }
+
+        // Frames that don't fit are still hashed so
+        // distinct long stacks stay in distinct buckets.
+        if (Kept && Used < BUCKET_MAX_SIGNATURE - 1)
+        {
+            Signature[Used++] = BUCKET_FRAME_SEPARATOR;
+        }
+        Hash = (Hash ^ (UCHAR)BUCKET_FRAME_SEPARATOR) * FNV_PRIME;
+
+        //
+        // Module names are case-insensitive so they are
+        // lowered; symbols are kept as they are.
+        //
+
+        for (ULONG32 j = 0; j < Frame.ModuleChars; j++)
+        {
+            CHAR Ch = Frame.Module[j];
+
+            if (Ch >= 'A' && Ch <= 'Z')
+            {
+                Ch = (CHAR)(Ch - 'A' + 'a');
+            }
+            if (Used < BUCKET_MAX_SIGNATURE - 1)
+            {
+                Signature[Used++] = Ch;
+            }
+            Hash = (Hash ^ (UCHAR)Ch) * FNV_PRIME;
+        }
+        if (Frame.SymbolChars)
+        {
+            if (Used < BUCKET_MAX_SIGNATURE - 1)
+            {
+                Signature[Used++] = '!';
+            }
+            Hash = (Hash ^ (UCHAR)'!') * FNV_PRIME;
+
+            for (ULONG32 j = 0; j < Frame.SymbolChars; j++)
+            {
+                if (Used < BUCKET_MAX_SIGNATURE - 1)
+                {
+                    Signature[Used++] = Frame.Symbol[j];
+                }
+                Hash = (Hash ^ (UCHAR)Frame.Symbol[j]) * FNV_PRIME;
+            }
+        }
+
+        Kept++;
+    }
+
+    Signature[Used] = 0;
+    *SignatureChars = Used;
+    *SignatureFrames = Kept;
+    return Hash;
+}
+
+HRESULT
+StackBucketer::GrowShard(_Inout_ BucketShard* Shard)
+{
+    ULONG32 NewSize = Shard->TableSize ? Shard->TableSize * 2 : 256;
+    StackBucket** NewTable;
+
+    NewTable = (StackBucket**)calloc(NewSize, sizeof(*NewTable));
+    if (NewTable == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    for (ULONG32 i = 0; i < Shard->TableSize; i++)
+    {
+        StackBucket* Bucket = Shard->Table[i];
+        ULONG32 Slot;
+
+        if (Bucket == NULL)
+        {
+            continue;
+        }
+
+        // The low hash bits pick the shard so
+        // slots come from the high bits.
+        Slot = (ULONG32)(Bucket->Hash >> 32) & (NewSize - 1);
+        while (NewTable[Slot] != NULL)
+        {
+            Slot = (Slot + 1) & (NewSize - 1);
+        }
+        NewTable[Slot] = Bucket;
+    }
+
+    free(Shard->Table);
+    Shard->Table = NewTable;
+    Shard->TableSize = NewSize;
+    return S_OK;
+}
+
+HRESULT
+StackBucketer::AddStack(_In_ ULONG32 NumFrames,
+                        _In_reads_(NumFrames) const PCSTR* Frames,
+                        _In_ ULONG64 Count)
+{
+    HRESULT Status = S_OK;
+    CHAR Signature[BUCKET_MAX_SIGNATURE];
+    ULONG32 Chars;
+    ULONG32 SigFrames;
+    ULONG32 FollowUp;
+    ULONG64 Hash;
+    BucketShard* Shard;
+    ULONG32 Slot;
+
+    if (!m_Initialized)
+    {
+        return E_FAIL;
+    }
+
+    // All of the normalization work happens outside
+    // of any lock.
+    Hash = GetSignature(NumFrames, Frames, Signature,
+                        &Chars, &SigFrames, &FollowUp);
+
+    Shard = &m_Shards[Hash & (s_NumShards - 1)];
+
+    TrgAcquireLock(&Shard->Lock);
+
+    if (Shard->Used >= Shard->TableSize / 4 * 3 &&
+        (Status = GrowShard(Shard)) != S_OK)
+    {
+        goto Exit;
+    }
+
+    Slot = (ULONG32)(Hash >> 32) & (Shard->TableSize - 1);
+    for (;;)
+    {
+        StackBucket* Bucket = Shard->Table[Slot];
+
+        if (Bucket == NULL)
+        {
+            Bucket = (StackBucket*)malloc(sizeof(*Bucket) + Chars + 1);
+            if (Bucket == NULL)
+            {
+                Status = E_OUTOFMEMORY;
+                goto Exit;
+            }
+
+            Bucket->Hash = Hash;
+            Bucket->Count = Count;
+            Bucket->FollowUpRule = FollowUp;
+            Bucket->Frames = SigFrames;
+            Bucket->Signature = (PCSTR)(Bucket + 1);
+            memcpy(Bucket + 1, Signature, Chars + 1);
+
+            Shard->Table[Slot] = Bucket;
+            Shard->Used++;
+            break;
+        }
+
+        if (Bucket->Hash == Hash &&
+            !strcmp(Bucket->Signature, Signature))
+        {
+            Bucket->Count += Count;
+            break;
+        }
+
+        Slot = (Slot + 1) & (Shard->TableSize - 1);
+    }
+
+    Shard->Stacks += Count;
+
+ Exit:
+    TrgReleaseLock(&Shard->Lock);
+    return Status;
+}
+
+ULONG64
+StackBucketer::GetNumStacks(void)
+{
+    ULONG64 Stacks = 0;
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        TrgAcquireLock(&m_Shards[i].Lock);
+        Stacks += m_Shards[i].Stacks;
+        TrgReleaseLock(&m_Shards[i].Lock);
+    }
+
+    return Stacks;
+}
+
+ULONG32
+StackBucketer::GetNumBuckets(void)
+{
+    ULONG32 Buckets = 0;
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        TrgAcquireLock(&m_Shards[i].Lock);
+        Buckets += m_Shards[i].Used;
+        TrgReleaseLock(&m_Shards[i].Lock);
+    }
+
+    return Buckets;
+}
+
+static int __cdecl
+CompareBuckets(_In_ const void* Elt1,
+               _In_ const void* Elt2)
+{
+    const StackBucket* Bucket1 = *(const StackBucket* const*)Elt1;
+    const StackBucket* Bucket2 = *(const StackBucket* const*)Elt2;
+
+    if (Bucket1->Count != Bucket2->Count)
+    {
+        return Bucket1->Count > Bucket2->Count ? -1 : 1;
+    }
+
+    // Keep the order stable from run to run.
+    return strcmp(Bucket1->Signature, Bucket2->Signature);
+}
+
+HRESULT
+StackBucketer::GetRankedBuckets(_Out_ StackBucket*** Buckets,
+                                _Out_ PULONG32 NumBuckets)
+{
+    StackBucket** Ranked;
+    ULONG32 Total = 0;
+    ULONG32 Used = 0;
+
+    *Buckets = NULL;
+    *NumBuckets = 0;
+
+    if (!m_Initialized)
+    {
+        return E_FAIL;
+    }
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        TrgAcquireLock(&m_Shards[i].Lock);
+    }
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        Total += m_Shards[i].Used;
+    }
+
+    Ranked = (StackBucket**)malloc((Total ? Total : 1) * sizeof(*Ranked));
+    if (Ranked != NULL)
+    {
+        for (ULONG32 i = 0; i < s_NumShards; i++)
+        {
+            for (ULONG32 j = 0; j < m_Shards[i].TableSize; j++)
+            {
+                if (m_Shards[i].Table[j] != NULL)
+                {
+                    Ranked[Used++] = m_Shards[i].Table[j];
+                }
+            }
+        }
+    }
+
+    for (ULONG32 i = 0; i < s_NumShards; i++)
+    {
+        TrgReleaseLock(&m_Shards[i].Lock);
+    }
+
+    if (Ranked == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    qsort(Ranked, Used, sizeof(*Ranked), CompareBuckets);
+
+    *Buckets = Ranked;
+    *NumBuckets = Used;
+    return S_OK;
+}
@@ -0,0 +1,135 @@
+//----------------------------------------------------------------------------
+//
+// Host support for the portable stack bucketing sample.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+
+#include "trgcompat.h"
+
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#endif
+
+struct TRG_THREAD
+{
+    TRG_THREAD_ROUTINE Routine;
+    PVOID Context;
+    ULONG32 Index;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI
+TrgThreadStart(_In_ LPVOID Param)
+#else
+static void*
+TrgThreadStart(_In_ void* Param)
+#endif
+{
+    TRG_THREAD* Thread = (TRG_THREAD*)Param;
+
+    Thread->Routine(Thread->Context, Thread->Index);
+    return 0;
+}
+
+HRESULT
+TrgRunThreads(_In_ ULONG32 Threads,
+              _In_ TRG_THREAD_ROUTINE Routine,
+              _In_ PVOID Context)
+{
+    HRESULT Status = S_OK;
+    TRG_THREAD* Params;
+    ULONG32 Started;
+
+    if (Threads == 1)
+    {
+        Routine(Context, 0);
+        return S_OK;
+    }
+
+    Params = (TRG_THREAD*)malloc(Threads * sizeof(*Params));
+#ifdef _WIN32
+    HANDLE* Handles = (HANDLE*)malloc(Threads * sizeof(*Handles));
+#else
+    pthread_t* Handles = (pthread_t*)malloc(Threads * sizeof(*Handles));
+#endif
+    if (Params == NULL || Handles == NULL)
+    {
+        free(Params);
+        free(Handles);
+        return E_OUTOFMEMORY;
+    }
+
+    for (Started = 0; Started < Threads; Started++)
+    {
+        Params[Started].Routine = Routine;
+        Params[Started].Context = Context;
+        Params[Started].Index = Started;
+
+#ifdef _WIN32
+        Handles[Started] = CreateThread(NULL, 0, TrgThreadStart,
+                                        &Params[Started], 0, NULL);
+        if (Handles[Started] == NULL)
+        {
+            Status = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+#else
+        if (pthread_create(&Handles[Started], NULL, TrgThreadStart,
+                           &Params[Started]) != 0)
+        {
+            Status = E_FAIL;
+            break;
+        }
+#endif
+    }
+
+    // Wait for whatever was started even on failure.
+    for (ULONG32 i = 0; i < Started; i++)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(Handles[i], INFINITE);
+        CloseHandle(Handles[i]);
+#else
+        pthread_join(Handles[i], NULL);
+#endif
+    }
+
+    free(Params);
+    free(Handles);
+    return Status;
+}
+
+double
+TrgGetSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER Freq, Now;
+
+    QueryPerformanceFrequency(&Freq);
+    QueryPerformanceCounter(&Now);
+    return (double)Now.QuadPart / (double)Freq.QuadPart;
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (double)Now.tv_sec + (double)Now.tv_nsec / 1e9;
+#endif
+}
+
+ULONG32
+TrgGetProcessorCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO SysInfo;
+
+    GetSystemInfo(&SysInfo);
+    return SysInfo.dwNumberOfProcessors;
+#else
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return Count > 0 ? (ULONG32)Count : 1;
+#endif
+}
@@ -0,0 +1,120 @@
+//----------------------------------------------------------------------------
+//
+// Host definitions for the portable stack bucketing sample.
+//
+// On Windows everything comes from windows.h.  Elsewhere this
+// header supplies the few Windows types, status codes and
+// synchronization primitives that the sample uses, so that the
+// sources are the same on every host.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __TRGCOMPAT_H__
+#define __TRGCOMPAT_H__
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+typedef CRITICAL_SECTION TRG_LOCK;
+
+#define TrgInitializeLock(Lock) InitializeCriticalSection(Lock)
+#define TrgDeleteLock(Lock) DeleteCriticalSection(Lock)
+#define TrgAcquireLock(Lock) EnterCriticalSection(Lock)
+#define TrgReleaseLock(Lock) LeaveCriticalSection(Lock)
+
+#if defined(_MSC_VER) && _MSC_VER < 1800
+#define strtoull _strtoui64
+#endif
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define snprintf _snprintf
+#endif
+
+#else // #ifdef _WIN32
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+//
+// SAL annotations have no meaning outside of the Microsoft compiler.
+//
+
+#ifndef _In_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _In_reads_(Size)
+#define _In_reads_bytes_(Size)
+#define _Out_writes_(Size)
+#define _Out_writes_bytes_(Size)
+#define _Out_writes_z_(Size)
+#endif
+
+#define __cdecl
+
+//
+// Basic Windows types with their Windows sizes.
+//
+
+typedef uint8_t UCHAR, *PUCHAR;
+typedef uint16_t USHORT;
+typedef int32_t LONG;
+typedef uint32_t ULONG, *PULONG;
+typedef uint32_t ULONG32, *PULONG32;
+typedef uint32_t DWORD;
+typedef int64_t LONG64;
+typedef uint64_t ULONG64, *PULONG64;
+typedef void* PVOID;
+typedef char CHAR;
+typedef const char* PCSTR;
+typedef char* PSTR;
+typedef int32_t HRESULT;
+
+#define S_OK            ((HRESULT)0)
+#define S_FALSE         ((HRESULT)1)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+
+#define SUCCEEDED(Status) ((HRESULT)(Status) >= 0)
+#define FAILED(Status) ((HRESULT)(Status) < 0)
+
+#define ERROR_OPEN_FAILED       110L
+#define ERROR_BAD_FORMAT        11L
+
+#define HRESULT_FROM_WIN32(Error) \
+    ((HRESULT)(Error) <= 0 ? (HRESULT)(Error) : \
+     (HRESULT)(((Error) & 0x0000FFFF) | 0x80070000))
+
+typedef pthread_mutex_t TRG_LOCK;
+
+#define TrgInitializeLock(Lock) pthread_mutex_init(Lock, NULL)
+#define TrgDeleteLock(Lock) pthread_mutex_destroy(Lock)
+#define TrgAcquireLock(Lock) pthread_mutex_lock(Lock)
+#define TrgReleaseLock(Lock) pthread_mutex_unlock(Lock)
+
+#endif // #ifdef _WIN32
+
+//
+// Runs Routine on Threads threads and waits for all
+// of them to finish.  Each call gets its thread index.
+//
+
+typedef void (*TRG_THREAD_ROUTINE)(_In_ PVOID Context,
+                                   _In_ ULONG32 Index);
+
+HRESULT
+TrgRunThreads(_In_ ULONG32 Threads,
+              _In_ TRG_THREAD_ROUTINE Routine,
+              _In_ PVOID Context);
+
+double
+TrgGetSeconds(void);
+
+ULONG32
+TrgGetProcessorCount(void);
+
+#endif // #ifndef __TRGCOMPAT_H__
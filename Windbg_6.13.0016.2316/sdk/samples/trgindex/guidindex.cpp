@@ -0,0 +1,678 @@
+//----------------------------------------------------------------------------
+//
+// Precompiled GUID name index.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "guidindex.hpp"
+
+#define GUID_MAX_LINE 1024
+
+// GUIDs looked up together by LookupGuids.
+#define GUID_LOOKUP_GROUP 8
+
+static ULONG64
+Mix64(_In_ ULONG64 Value)
+{
+    Value ^= Value >> 33;
+    Value *= 0xff51afd7ed558ccdULL;
+    Value ^= Value >> 33;
+    Value *= 0xc4ceb9fe1a85ec53ULL;
+    Value ^= Value >> 33;
+    return Value;
+}
+
+static ULONG64
+GuidHash(_In_ ULONG64 Low,
+         _In_ ULONG64 High)
+{
+    return Mix64(Low ^ Mix64(High));
+}
+
+static void
+GuidToKey(_In_ const GUID* Guid,
+          _Out_ PULONG64 Low,
+          _Out_ PULONG64 High)
+{
+    *Low = (ULONG64)Guid->Data1 |
+        ((ULONG64)Guid->Data2 << 32) |
+        ((ULONG64)Guid->Data3 << 48);
+    *High = 0;
+    for (ULONG32 i = 0; i < 8; i++)
+    {
+        *High |= (ULONG64)Guid->Data4[i] << (i * 8);
+    }
+}
+
+static PSTR
+TrimString(_Inout_ PSTR Str)
+{
+    PSTR End;
+
+    while (*Str == ' ' || *Str == '\t')
+    {
+        Str++;
+    }
+
+    End = Str + strlen(Str);
+    while (End > Str &&
+           (End[-1] == ' ' || End[-1] == '\t' ||
+            End[-1] == '\r' || End[-1] == '\n'))
+    {
+        *--End = 0;
+    }
+
+    return Str;
+}
+
+static bool
+ParseHex(_In_ PCSTR Text,
+         _In_ ULONG32 Digits,
+         _Out_ PULONG64 Value)
+{
+    *Value = 0;
+
+    for (ULONG32 i = 0; i < Digits; i++)
+    {
+        CHAR Ch = Text[i];
+        ULONG32 Digit;
+
+        if (Ch >= '0' && Ch <= '9')
+        {
+            Digit = Ch - '0';
+        }
+        else if (Ch >= 'a' && Ch <= 'f')
+        {
+            Digit = Ch - 'a' + 10;
+        }
+        else if (Ch >= 'A' && Ch <= 'F')
+        {
+            Digit = Ch - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+
+        *Value = (*Value << 4) | Digit;
+    }
+
+    return true;
+}
+
+ULONG32
+ParseGuid(_In_ PCSTR Text,
+          _Out_ GUID* Guid)
+{
+    PCSTR Start = Text;
+    bool Brace = *Text == '{';
+    ULONG64 Data1, Data2, Data3, Data4a, Data4b;
+
+    memset(Guid, 0, sizeof(*Guid));
+
+    if (Brace)
+    {
+        Text++;
+    }
+
+    // xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+    if (!ParseHex(Text, 8, &Data1) || Text[8] != '-' ||
+        !ParseHex(Text + 9, 4, &Data2) || Text[13] != '-' ||
+        !ParseHex(Text + 14, 4, &Data3) || Text[18] != '-' ||
+        !ParseHex(Text + 19, 4, &Data4a) || Text[23] != '-' ||
+        !ParseHex(Text + 24, 12, &Data4b))
+    {
+        return 0;
+    }
+    Text += 36;
+
+    if (Brace)
+    {
+        if (*Text != '}')
+        {
+            return 0;
+        }
+        Text++;
+    }
+
+    Guid->Data1 = (ULONG32)Data1;
+    Guid->Data2 = (USHORT)Data2;
+    Guid->Data3 = (USHORT)Data3;
+    Guid->Data4[0] = (UCHAR)(Data4a >> 8);
+    Guid->Data4[1] = (UCHAR)Data4a;
+    for (ULONG32 i = 0; i < 6; i++)
+    {
+        Guid->Data4[2 + i] = (UCHAR)(Data4b >> ((5 - i) * 8));
+    }
+
+    return (ULONG32)(Text - Start);
+}
+
+GuidIndex::GuidIndex(void)
+{
+    m_Defs = NULL;
+    m_NumDefs = 0;
+    m_DefSlots = 0;
+    m_CurFile = 0;
+    m_Built = NULL;
+    m_Header = NULL;
+    m_Slots = NULL;
+    m_Strings = NULL;
+}
+
+GuidIndex::~GuidIndex(void)
+{
+    Close();
+    FreeDefs();
+}
+
+//----------------------------------------------------------------------------
+//
+// Building.
+//
+//----------------------------------------------------------------------------
+
+HRESULT
+GuidIndex::AddDef(_In_ ULONG64 Low,
+                  _In_ ULONG64 High,
+                  _In_ ULONG32 Kind,
+                  _In_ PCSTR Name)
+{
+    GuidDef* Def;
+    ULONG32 Slot;
+    PSTR NewName;
+
+    if (!*Name)
+    {
+        return S_FALSE;
+    }
+
+    if (m_NumDefs >= m_DefSlots / 2)
+    {
+        ULONG32 NewSlots = m_DefSlots ? m_DefSlots * 2 : 1024;
+        GuidDef* NewDefs;
+
+        NewDefs = (GuidDef*)calloc(NewSlots, sizeof(*NewDefs));
+        if (NewDefs == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        for (ULONG32 i = 0; i < m_DefSlots; i++)
+        {
+            if (m_Defs[i].Name == NULL)
+            {
+                continue;
+            }
+
+            Slot = (ULONG32)GuidHash(m_Defs[i].Low, m_Defs[i].High) &
+                (NewSlots - 1);
+            while (NewDefs[Slot].Name != NULL)
+            {
+                Slot = (Slot + 1) & (NewSlots - 1);
+            }
+            NewDefs[Slot] = m_Defs[i];
+        }
+
+        free(m_Defs);
+        m_Defs = NewDefs;
+        m_DefSlots = NewSlots;
+    }
+
+    Slot = (ULONG32)GuidHash(Low, High) & (m_DefSlots - 1);
+    for (;;)
+    {
+        Def = &m_Defs[Slot];
+        if (Def->Name == NULL ||
+            (Def->Low == Low && Def->High == High))
+        {
+            break;
+        }
+        Slot = (Slot + 1) & (m_DefSlots - 1);
+    }
+
+    if (Def->Name != NULL && Def->File == m_CurFile)
+    {
+        // Duplicate within one file, keep the first.
+        return S_FALSE;
+    }
+
+    NewName = (PSTR)malloc(strlen(Name) + 1);
+    if (NewName == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+    strcpy(NewName, Name);
+
+    if (Def->Name != NULL)
+    {
+        free(Def->Name);
+    }
+    else
+    {
+        m_NumDefs++;
+    }
+
+    Def->Low = Low;
+    Def->High = High;
+    Def->Kind = Kind;
+    Def->File = m_CurFile;
+    Def->Name = NewName;
+    return S_OK;
+}
+
+void
+GuidIndex::FreeDefs(void)
+{
+    for (ULONG32 i = 0; i < m_DefSlots; i++)
+    {
+        free(m_Defs[i].Name);
+    }
+
+    free(m_Defs);
+    m_Defs = NULL;
+    m_NumDefs = 0;
+    m_DefSlots = 0;
+}
+
+HRESULT
+GuidIndex::AddGuidFile(_In_ PCSTR FileName)
+{
+    HRESULT Status = S_OK;
+    FILE* File;
+    CHAR Line[GUID_MAX_LINE];
+
+    File = fopen(FileName, "r");
+    if (File == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
+    }
+
+    // Each file is its own override level.
+    m_CurFile++;
+
+    while (fgets(Line, sizeof(Line), File) != NULL)
+    {
+        PSTR Text = TrimString(Line);
+        PSTR Name;
+        ULONG32 Kind;
+        ULONG32 Chars;
+        GUID Guid;
+        ULONG64 Low;
+        ULONG64 High;
+
+        if (!*Text || *Text == ';')
+        {
+            continue;
+        }
+
+        if (!strncmp(Text, "interface_map!", 14))
+        {
+            Chars = ParseGuid(Text + 14, &Guid);
+            if (!Chars || Text[14 + Chars] != '=')
+            {
+                continue;
+            }
+            Name = Text + 14 + Chars + 1;
+            Kind = GUID_KIND_INTERFACE;
+        }
+        else if (!strncmp(Text, "interface_type!", 15))
+        {
+            PSTR Equals = strchr(Text + 15, '=');
+
+            if (Equals == NULL || !ParseGuid(Equals + 1, &Guid))
+            {
+                continue;
+            }
+            *Equals = 0;
+            Name = Text + 15;
+            Kind = GUID_KIND_TYPE;
+        }
+        else
+        {
+            // guid.txt lines, anything else is skipped.
+            Chars = ParseGuid(Text, &Guid);
+            if (!Chars || (Text[Chars] != ' ' && Text[Chars] != '\t'))
+            {
+                continue;
+            }
+            Name = Text + Chars;
+            Kind = GUID_KIND_PROVIDER;
+        }
+
+        GuidToKey(&Guid, &Low, &High);
+        if ((Status = AddDef(Low, High, Kind,
+                             TrimString(Name))) == E_OUTOFMEMORY)
+        {
+            break;
+        }
+        Status = S_OK;
+    }
+
+    fclose(File);
+    return Status;
+}
+
+HRESULT
+GuidIndex::AddGuid(_In_ const GUID* Guid,
+                   _In_ ULONG32 Kind,
+                   _In_ PCSTR Name)
+{
+    ULONG64 Low;
+    ULONG64 High;
+
+    GuidToKey(Guid, &Low, &High);
+
+    // Individually added GUIDs override everything before them.
+    m_CurFile++;
+    return AddDef(Low, High, Kind, Name);
+}
+
+HRESULT
+GuidIndex::Build(void)
+{
+    HRESULT Status;
+    UCHAR* Image;
+    ULONG32 NumSlots = 16;
+    ULONG64 StringBytes = 1;
+    ULONG64 TotalBytes;
+    GuidIndexHeader* Header;
+    GuidIndexSlot* Slots;
+    PSTR Strings;
+    ULONG32 StringsUsed;
+
+    // Keep the table at most half full.
+    while (NumSlots < m_NumDefs * 2)
+    {
+        NumSlots *= 2;
+    }
+
+    for (ULONG32 i = 0; i < m_DefSlots; i++)
+    {
+        if (m_Defs[i].Name != NULL)
+        {
+            StringBytes += strlen(m_Defs[i].Name) + 1;
+        }
+    }
+
+    TotalBytes = sizeof(GuidIndexHeader) +
+        (ULONG64)NumSlots * sizeof(GuidIndexSlot) +
+        StringBytes;
+    if (TotalBytes > 0xffffffff)
+    {
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
+
+    Image = (UCHAR*)calloc(1, (size_t)TotalBytes);
+    if (Image == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    Header = (GuidIndexHeader*)Image;
+    Header->Signature = GUID_INDEX_SIGNATURE;
+    Header->Version = GUID_INDEX_VERSION;
+    Header->TotalBytes = (ULONG32)TotalBytes;
+    Header->NumEntries = m_NumDefs;
+    Header->NumSlots = NumSlots;
+    // Slots hold ULONG64s so keep them aligned.
+    Header->SlotsOffset = sizeof(GuidIndexHeader);
+    Header->StringsOffset = Header->SlotsOffset +
+        NumSlots * sizeof(GuidIndexSlot);
+    Header->StringBytes = (ULONG32)StringBytes;
+
+    Slots = (GuidIndexSlot*)(Image + Header->SlotsOffset);
+    Strings = (PSTR)(Image + Header->StringsOffset);
+    // Offset zero is the empty string and marks empty slots.
+    StringsUsed = 1;
+
+    for (ULONG32 i = 0; i < m_DefSlots; i++)
+    {
+        GuidDef* Def = &m_Defs[i];
+        ULONG32 Slot;
+        size_t Len;
+
+        if (Def->Name == NULL)
+        {
+            continue;
+        }
+
+        Slot = (ULONG32)GuidHash(Def->Low, Def->High) & (NumSlots - 1);
+        while (Slots[Slot].Name)
+        {
+            Slot = (Slot + 1) & (NumSlots - 1);
+        }
+
+        Len = strlen(Def->Name);
+        Slots[Slot].Low = Def->Low;
+        Slots[Slot].High = Def->High;
+        Slots[Slot].Kind = Def->Kind;
+        Slots[Slot].Name = StringsUsed;
+        memcpy(Strings + StringsUsed, Def->Name, Len + 1);
+        StringsUsed += (ULONG32)Len + 1;
+    }
+
+    Close();
+    if ((Status = SetImage(Image, TotalBytes)) == S_OK)
+    {
+        m_Built = Image;
+    }
+    else
+    {
+        free(Image);
+    }
+
+    return Status;
+}
+
+HRESULT
+GuidIndex::Save(_In_ PCSTR FileName)
+{
+    if (m_Header == NULL)
+    {
+        return E_FAIL;
+    }
+
+    return WriteWholeFile(FileName, m_Header, m_Header->TotalBytes);
+}
+
+//----------------------------------------------------------------------------
+//
+// Loading.
+//
+//----------------------------------------------------------------------------
+
+HRESULT
+GuidIndex::SetImage(_In_reads_bytes_(Bytes) const UCHAR* Image,
+                    _In_ ULONG64 Bytes)
+{
+    const GuidIndexHeader* Header = (const GuidIndexHeader*)Image;
+    const GuidIndexSlot* Slots;
+    ULONG32 Used = 0;
+
+    if (Bytes < sizeof(*Header) ||
+        Header->Signature != GUID_INDEX_SIGNATURE ||
+        Header->Version != GUID_INDEX_VERSION ||
+        Header->TotalBytes != Bytes ||
+        !Header->NumSlots ||
+        (Header->NumSlots & (Header->NumSlots - 1)) ||
+        Header->SlotsOffset < sizeof(*Header) ||
+        (Header->SlotsOffset & 7) ||
+        (ULONG64)Header->SlotsOffset +
+        (ULONG64)Header->NumSlots * sizeof(GuidIndexSlot) > Bytes ||
+        !Header->StringBytes ||
+        (ULONG64)Header->StringsOffset + Header->StringBytes > Bytes ||
+        Image[Header->StringsOffset + Header->StringBytes - 1] != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+
+    //
+    // Probing stops at an empty slot, so a table with no
+    // empty slot would never end a miss.  Name offsets
+    // are also checked here rather than on every lookup.
+    //
+
+    Slots = (const GuidIndexSlot*)(Image + Header->SlotsOffset);
+    for (ULONG32 i = 0; i < Header->NumSlots; i++)
+    {
+        if (Slots[i].Name >= Header->StringBytes)
+        {
+            return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        }
+        if (Slots[i].Name)
+        {
+            Used++;
+        }
+    }
+    if (Used != Header->NumEntries || Used == Header->NumSlots)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    m_Header = Header;
+    m_Slots = Slots;
+    m_Strings = (PCSTR)(Image + Header->StringsOffset);
+    return S_OK;
+}
+
+HRESULT
+GuidIndex::Open(_In_ PCSTR FileName)
+{
+    HRESULT Status;
+
+    Close();
+
+    if ((Status = m_Mapped.Open(FileName)) != S_OK)
+    {
+        return Status;
+    }
+
+    if ((Status = SetImage(m_Mapped.GetBase(),
+                           m_Mapped.GetSize())) != S_OK)
+    {
+        m_Mapped.Close();
+    }
+
+    return Status;
+}
+
+void
+GuidIndex::Close(void)
+{
+    m_Header = NULL;
+    m_Slots = NULL;
+    m_Strings = NULL;
+    free(m_Built);
+    m_Built = NULL;
+    m_Mapped.Close();
+}
+
+//----------------------------------------------------------------------------
+//
+// Lookups.
+//
+//----------------------------------------------------------------------------
+
+PCSTR
+GuidIndex::Lookup(_In_ const GUID* Guid,
+                  _Out_opt_ PULONG32 Kind)
+{
+    ULONG64 Low;
+    ULONG64 High;
+    ULONG32 Slot;
+
+    if (Kind != NULL)
+    {
+        *Kind = 0;
+    }
+
+    if (m_Header == NULL)
+    {
+        return NULL;
+    }
+
+    GuidToKey(Guid, &Low, &High);
+
+    Slot = (ULONG32)GuidHash(Low, High) & (m_Header->NumSlots - 1);
+    while (m_Slots[Slot].Name)
+    {
+        if (m_Slots[Slot].Low == Low && m_Slots[Slot].High == High)
+        {
+            if (Kind != NULL)
+            {
+                *Kind = m_Slots[Slot].Kind;
+            }
+            return m_Strings + m_Slots[Slot].Name;
+        }
+
+        Slot = (Slot + 1) & (m_Header->NumSlots - 1);
+    }
+
+    return NULL;
+}
+
+ULONG32
+GuidIndex::LookupGuids(_In_ ULONG32 Count,
+                       _In_reads_(Count) const GUID* Guids,
+                       _Out_writes_(Count) PCSTR* Names)
+{
+    ULONG32 Found = 0;
+
+    if (m_Header == NULL)
+    {
+        memset(Names, 0, Count * sizeof(*Names));
+        return 0;
+    }
+
+    for (ULONG32 Base = 0; Base < Count; Base += GUID_LOOKUP_GROUP)
+    {
+        ULONG32 Group = Count - Base < GUID_LOOKUP_GROUP ?
+            Count - Base : GUID_LOOKUP_GROUP;
+        ULONG64 Low[GUID_LOOKUP_GROUP];
+        ULONG64 High[GUID_LOOKUP_GROUP];
+        ULONG32 Slot[GUID_LOOKUP_GROUP];
+        ULONG32 Name[GUID_LOOKUP_GROUP];
+
+        //
+        // Read the first slot of every GUID in the group
+        // before comparing any of them so the cache misses
+        // are taken together rather than one at a time.
+        //
+
+        for (ULONG32 i = 0; i < Group; i++)
+        {
+            GuidToKey(&Guids[Base + i], &Low[i], &High[i]);
+            Slot[i] = (ULONG32)GuidHash(Low[i], High[i]) &
+                (m_Header->NumSlots - 1);
+            Name[i] = m_Slots[Slot[i]].Name;
+        }
+
+        for (ULONG32 i = 0; i < Group; i++)
+        {
+            ULONG32 Cur = Slot[i];
+
+            Names[Base + i] = NULL;
+
+            while (Name[i])
+            {
+                if (m_Slots[Cur].Low == Low[i] &&
+                    m_Slots[Cur].High == High[i])
+                {
+                    Names[Base + i] = m_Strings + Name[i];
+                    Found++;
+                    break;
+                }
+
+                Cur = (Cur + 1) & (m_Header->NumSlots - 1);
+                Name[i] = m_Slots[Cur].Name;
+            }
+        }
+    }
+
+    return Found;
+}
@@ -0,0 +1,177 @@
+//----------------------------------------------------------------------------
+//
+// Read-only file mapping shared by the precompiled indexes.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mapfile.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile(void)
+{
+    m_Base = NULL;
+    m_Size = 0;
+#ifdef _WIN32
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = NULL;
+#else
+    m_File = -1;
+#endif
+}
+
+MappedFile::~MappedFile(void)
+{
+    Close();
+}
+
+HRESULT
+MappedFile::Open(_In_ PCSTR FileName)
+{
+    HRESULT Status;
+
+    Close();
+
+#ifdef _WIN32
+    LARGE_INTEGER Size;
+
+    m_File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ,
+                         NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                         NULL);
+    if (m_File == INVALID_HANDLE_VALUE ||
+        !GetFileSizeEx(m_File, &Size))
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        goto Fail;
+    }
+
+    m_Size = (ULONG64)Size.QuadPart;
+    if (!m_Size)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        goto Fail;
+    }
+    if (m_Size > (SIZE_T)-1)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        goto Fail;
+    }
+
+    m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_Mapping == NULL)
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        goto Fail;
+    }
+
+    m_Base = (const UCHAR*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_Base == NULL)
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        goto Fail;
+    }
+#else
+    struct stat Stat;
+    void* Base;
+
+    m_File = open(FileName, O_RDONLY);
+    if (m_File < 0 ||
+        fstat(m_File, &Stat) != 0)
+    {
+        Status = HRESULT_FROM_WIN32(errno);
+        goto Fail;
+    }
+
+    m_Size = (ULONG64)Stat.st_size;
+    if (!m_Size)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        goto Fail;
+    }
+    if (m_Size > (size_t)-1)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        goto Fail;
+    }
+
+    Base = mmap(NULL, (size_t)m_Size, PROT_READ, MAP_SHARED, m_File, 0);
+    if (Base == MAP_FAILED)
+    {
+        Status = HRESULT_FROM_WIN32(errno);
+        goto Fail;
+    }
+
+    m_Base = (const UCHAR*)Base;
+#endif
+
+    return S_OK;
+
+ Fail:
+    Close();
+    return Status;
+}
+
+void
+MappedFile::Close(void)
+{
+#ifdef _WIN32
+    if (m_Base != NULL)
+    {
+        UnmapViewOfFile(m_Base);
+    }
+    if (m_Mapping != NULL)
+    {
+        CloseHandle(m_Mapping);
+        m_Mapping = NULL;
+    }
+    if (m_File != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_File);
+        m_File = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_Base != NULL)
+    {
+        munmap((void*)m_Base, (size_t)m_Size);
+    }
+    if (m_File >= 0)
+    {
+        close(m_File);
+        m_File = -1;
+    }
+#endif
+
+    m_Base = NULL;
+    m_Size = 0;
+}
+
+HRESULT
+WriteWholeFile(_In_ PCSTR FileName,
+               _In_reads_bytes_(Bytes) const void* Data,
+               _In_ ULONG64 Bytes)
+{
+    FILE* File;
+    bool Written;
+
+    File = fopen(FileName, "wb");
+    if (File == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
+    }
+
+    Written = fwrite(Data, 1, (size_t)Bytes, File) == (size_t)Bytes;
+    if (fclose(File) != 0)
+    {
+        Written = false;
+    }
+
+    return Written ? S_OK : HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+}
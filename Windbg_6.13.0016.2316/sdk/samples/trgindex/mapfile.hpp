@@ -0,0 +1,48 @@
+//----------------------------------------------------------------------------
+//
+// Read-only file mapping shared by the precompiled indexes.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __MAPFILE_HPP__
+#define __MAPFILE_HPP__
+
+#include "trgcompat.h"
+
+class MappedFile
+{
+public:
+    MappedFile(void);
+    ~MappedFile(void);
+
+    HRESULT Open(_In_ PCSTR FileName);
+    void Close(void);
+
+    const UCHAR* GetBase(void)
+    {
+        return m_Base;
+    }
+    ULONG64 GetSize(void)
+    {
+        return m_Size;
+    }
+
+protected:
+    const UCHAR* m_Base;
+    ULONG64 m_Size;
+
+#ifdef _WIN32
+    HANDLE m_File;
+    HANDLE m_Mapping;
+#else
+    int m_File;
+#endif
+};
+
+// Writes a complete file, replacing any existing one.
+HRESULT
+WriteWholeFile(_In_ PCSTR FileName,
+               _In_reads_bytes_(Bytes) const void* Data,
+               _In_ ULONG64 Bytes);
+
+#endif // #ifndef __MAPFILE_HPP__
@@ -0,0 +1,928 @@
+//----------------------------------------------------------------------------
+//
+// Precompiled pool tag index.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tagindex.hpp"
+
+#define TAG_MAX_LINE 1024
+
+// Seeds tried per bucket before the table is grown.
+#define TAG_MAX_SEED 0x10000
+
+static ULONG64
+Mix64(_In_ ULONG64 Value)
+{
+    Value ^= Value >> 33;
+    Value *= 0xff51afd7ed558ccdULL;
+    Value ^= Value >> 33;
+    Value *= 0xc4ceb9fe1a85ec53ULL;
+    Value ^= Value >> 33;
+    return Value;
+}
+
+static ULONG64
+KeyHash(_In_ ULONG32 Key,
+        _In_ ULONG32 Mask)
+{
+    return Mix64(((ULONG64)Mask << 32) | Key);
+}
+
+static ULONG32
+KeySlot(_In_ ULONG64 Hash,
+        _In_ ULONG32 Seed,
+        _In_ ULONG32 NumSlots)
+{
+    return (ULONG32)Mix64(Hash ^ (Seed * 0x9e3779b97f4a7c15ULL)) &
+        (NumSlots - 1);
+}
+
+static ULONG32
+CountBits(_In_ ULONG32 Value)
+{
+    ULONG32 Bits = 0;
+
+    while (Value)
+    {
+        Value &= Value - 1;
+        Bits++;
+    }
+
+    return Bits;
+}
+
+static void
+CopyString(_Out_writes_z_(Size) PSTR Dest,
+           _In_ ULONG32 Size,
+           _In_ PCSTR Src)
+{
+    size_t Len = strlen(Src);
+
+    if (Len >= Size)
+    {
+        Len = Size - 1;
+    }
+    memcpy(Dest, Src, Len);
+    Dest[Len] = 0;
+}
+
+static PSTR
+TrimString(_Inout_ PSTR Str)
+{
+    PSTR End;
+
+    while (*Str == ' ' || *Str == '\t')
+    {
+        Str++;
+    }
+
+    End = Str + strlen(Str);
+    while (End > Str &&
+           (End[-1] == ' ' || End[-1] == '\t' ||
+            End[-1] == '\r' || End[-1] == '\n'))
+    {
+        *--End = 0;
+    }
+
+    return Str;
+}
+
+PoolTagIndex::PoolTagIndex(void)
+{
+    m_Defs = NULL;
+    m_NumDefs = 0;
+    m_DefSlots = 0;
+    m_CurFile = 0;
+    m_Built = NULL;
+    m_Header = NULL;
+    m_Seeds = NULL;
+    m_Slots = NULL;
+    m_Strings = NULL;
+}
+
+PoolTagIndex::~PoolTagIndex(void)
+{
+    Close();
+    FreeDefs();
+}
+
+//----------------------------------------------------------------------------
+//
+// Building.
+//
+//----------------------------------------------------------------------------
+
+HRESULT
+PoolTagIndex::ParseTag(_In_ PCSTR Tag,
+                       _Out_ PULONG32 Key,
+                       _Out_ PULONG32 Mask)
+{
+    ULONG32 Chars = 0;
+
+    *Key = 0;
+    *Mask = 0;
+
+    //
+    // Short tags are padded with spaces as the
+    // kernel does.  A '*' must come last.
+    //
+
+    for (ULONG32 i = 0; i < 4; i++)
+    {
+        CHAR Ch = Tag[Chars] ? Tag[Chars++] : ' ';
+
+        if (Ch == '*')
+        {
+            if (Tag[Chars])
+            {
+                return E_INVALIDARG;
+            }
+            break;
+        }
+        if (Ch != '?')
+        {
+            *Key |= (ULONG32)(UCHAR)Ch << (i * 8);
+            *Mask |= (ULONG32)0xff << (i * 8);
+        }
+    }
+
+    if (Tag[Chars] && !(Tag[Chars] == '*' && !Tag[Chars + 1]))
+    {
+        return E_INVALIDARG;
+    }
+
+    return *Mask ? S_OK : E_INVALIDARG;
+}
+
+HRESULT
+PoolTagIndex::AddDef(_In_ ULONG32 Key,
+                     _In_ ULONG32 Mask,
+                     _In_ PCSTR Binary,
+                     _In_ PCSTR Description)
+{
+    TagDef* Def;
+    ULONG32 Slot;
+    PSTR NewBinary;
+    PSTR NewDesc;
+
+    if (m_NumDefs >= m_DefSlots / 2)
+    {
+        ULONG32 NewSlots = m_DefSlots ? m_DefSlots * 2 : 1024;
+        TagDef* NewDefs;
+
+        NewDefs = (TagDef*)calloc(NewSlots, sizeof(*NewDefs));
+        if (NewDefs == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        for (ULONG32 i = 0; i < m_DefSlots; i++)
+        {
+            if (!m_Defs[i].Mask)
+            {
+                continue;
+            }
+
+            Slot = (ULONG32)KeyHash(m_Defs[i].Key, m_Defs[i].Mask) &
+                (NewSlots - 1);
+            while (NewDefs[Slot].Mask)
+            {
+                Slot = (Slot + 1) & (NewSlots - 1);
+            }
+            NewDefs[Slot] = m_Defs[i];
+        }
+
+        free(m_Defs);
+        m_Defs = NewDefs;
+        m_DefSlots = NewSlots;
+    }
+
+    Slot = (ULONG32)KeyHash(Key, Mask) & (m_DefSlots - 1);
+    for (;;)
+    {
+        Def = &m_Defs[Slot];
+        if (!Def->Mask ||
+            (Def->Key == Key && Def->Mask == Mask))
+        {
+            break;
+        }
+        Slot = (Slot + 1) & (m_DefSlots - 1);
+    }
+
+    if (Def->Mask && Def->File == m_CurFile)
+    {
+        // Duplicate within one file, keep the first.
+        return S_FALSE;
+    }
+
+    NewBinary = (PSTR)malloc(strlen(Binary) + 1);
+    NewDesc = (PSTR)malloc(strlen(Description) + 1);
+    if (NewBinary == NULL || NewDesc == NULL)
+    {
+        free(NewBinary);
+        free(NewDesc);
+        return E_OUTOFMEMORY;
+    }
+    strcpy(NewBinary, Binary);
+    strcpy(NewDesc, Description);
+
+    if (Def->Mask)
+    {
+        free(Def->Binary);
+        free(Def->Description);
+    }
+    else
+    {
+        m_NumDefs++;
+    }
+
+    Def->Key = Key;
+    Def->Mask = Mask;
+    Def->File = m_CurFile;
+    Def->Binary = NewBinary;
+    Def->Description = NewDesc;
+    return S_OK;
+}
+
+void
+PoolTagIndex::FreeDefs(void)
+{
+    for (ULONG32 i = 0; i < m_DefSlots; i++)
+    {
+        if (m_Defs[i].Mask)
+        {
+            free(m_Defs[i].Binary);
+            free(m_Defs[i].Description);
+        }
+    }
+
+    free(m_Defs);
+    m_Defs = NULL;
+    m_NumDefs = 0;
+    m_DefSlots = 0;
+}
+
+HRESULT
+PoolTagIndex::AddTagFile(_In_ PCSTR FileName)
+{
+    HRESULT Status = S_OK;
+    FILE* File;
+    CHAR Line[TAG_MAX_LINE];
+
+    File = fopen(FileName, "r");
+    if (File == NULL)
+    {
+        return HRESULT_FROM_WIN32(ERROR_OPEN_FAILED);
+    }
+
+    // Each file is its own override level.
+    m_CurFile++;
+
+    while (fgets(Line, sizeof(Line), File) != NULL)
+    {
+        PSTR Text = TrimString(Line);
+        PSTR Sep;
+        PSTR Binary;
+        PSTR Desc;
+        ULONG32 Key;
+        ULONG32 Mask;
+
+        if (!*Text ||
+            !strncmp(Text, "//", 2) ||
+            ((Text[0] == 'r' || Text[0] == 'R') &&
+             (Text[1] == 'e' || Text[1] == 'E') &&
+             (Text[2] == 'm' || Text[2] == 'M') &&
+             (!Text[3] || Text[3] == ' ' || Text[3] == '\t')))
+        {
+            continue;
+        }
+
+        //
+        // Lines that don't look like "Tag - text" are
+        // skipped rather than failing the whole file, as
+        // the shipped file has a few stray lines.
+        //
+
+        Sep = strstr(Text, " - ");
+        if (Sep == NULL)
+        {
+            continue;
+        }
+        *Sep = 0;
+        Desc = Sep + 3;
+
+        if (ParseTag(TrimString(Text), &Key, &Mask) != S_OK)
+        {
+            continue;
+        }
+
+        Sep = strstr(Desc, " - ");
+        if (Sep != NULL)
+        {
+            *Sep = 0;
+            Binary = TrimString(Desc);
+            Desc = Sep + 3;
+        }
+        else
+        {
+            Binary = (PSTR)"";
+        }
+
+        if ((Status = AddDef(Key, Mask, Binary,
+                             TrimString(Desc))) == E_OUTOFMEMORY)
+        {
+            break;
+        }
+        Status = S_OK;
+    }
+
+    fclose(File);
+    return Status;
+}
+
+HRESULT
+PoolTagIndex::AddTag(_In_ PCSTR Tag,
+                     _In_ PCSTR Binary,
+                     _In_ PCSTR Description)
+{
+    HRESULT Status;
+    ULONG32 Key;
+    ULONG32 Mask;
+
+    if ((Status = ParseTag(Tag, &Key, &Mask)) != S_OK)
+    {
+        return Status;
+    }
+
+    // Individually added tags override everything before them.
+    m_CurFile++;
+    return AddDef(Key, Mask, Binary, Description);
+}
+
+struct TagBucketOrder
+{
+    ULONG32 Bucket;
+    ULONG32 Count;
+};
+
+static int __cdecl
+CompareBucketOrder(_In_ const void* Elt1,
+                   _In_ const void* Elt2)
+{
+    const TagBucketOrder* Order1 = (const TagBucketOrder*)Elt1;
+    const TagBucketOrder* Order2 = (const TagBucketOrder*)Elt2;
+
+    if (Order1->Count != Order2->Count)
+    {
+        return Order1->Count > Order2->Count ? -1 : 1;
+    }
+    return Order1->Bucket < Order2->Bucket ? -1 :
+        (Order1->Bucket > Order2->Bucket ? 1 : 0);
+}
+
+static int __cdecl
+CompareMasks(_In_ const void* Elt1,
+             _In_ const void* Elt2)
+{
+    ULONG32 Mask1 = *(const ULONG32*)Elt1;
+    ULONG32 Mask2 = *(const ULONG32*)Elt2;
+    ULONG32 Bits1 = CountBits(Mask1);
+    ULONG32 Bits2 = CountBits(Mask2);
+
+    if (Bits1 != Bits2)
+    {
+        return Bits1 > Bits2 ? -1 : 1;
+    }
+    return Mask1 > Mask2 ? -1 : (Mask1 < Mask2 ? 1 : 0);
+}
+
+HRESULT
+PoolTagIndex::Build(void)
+{
+    HRESULT Status;
+    TagDef** Entries = NULL;
+    PULONG32 BucketStart = NULL;
+    TagBucketOrder* Order = NULL;
+    PUCHAR Occupied = NULL;
+    PULONG32 Seeds = NULL;
+    PULONG32 Placed = NULL;
+    PUCHAR Image = NULL;
+    ULONG32 NumEntries = 0;
+    ULONG32 NumSlots;
+    ULONG32 NumBuckets;
+    ULONG32 Masks[TAG_INDEX_MAX_MASKS];
+    ULONG32 NumMasks = 0;
+    ULONG64 StringBytes = 1;
+    ULONG64 TotalBytes;
+    TagIndexHeader* Header;
+    TagIndexSlot* Slots;
+    PSTR Strings;
+    ULONG32 StringsUsed;
+
+    //
+    // Collect the entries and the distinct masks.
+    //
+
+    Entries = (TagDef**)malloc((m_NumDefs ? m_NumDefs : 1) *
+                               sizeof(*Entries));
+    if (Entries == NULL)
+    {
+        Status = E_OUTOFMEMORY;
+        goto Exit;
+    }
+
+    for (ULONG32 i = 0; i < m_DefSlots; i++)
+    {
+        TagDef* Def = &m_Defs[i];
+        ULONG32 j;
+
+        if (!Def->Mask)
+        {
+            continue;
+        }
+
+        Entries[NumEntries++] = Def;
+        StringBytes += strlen(Def->Binary) + strlen(Def->Description) + 2;
+
+        for (j = 0; j < NumMasks; j++)
+        {
+            if (Masks[j] == Def->Mask)
+            {
+                break;
+            }
+        }
+        if (j == NumMasks)
+        {
+            // Masks are whole bytes so there are at most 15.
+            Masks[NumMasks++] = Def->Mask;
+        }
+    }
+
+    qsort(Masks, NumMasks, sizeof(Masks[0]), CompareMasks);
+
+    //
+    // Hash and displace: entries are split into small
+    // buckets and, largest bucket first, each bucket
+    // searches for a seed that puts all of its entries
+    // in free slots.  A lookup then costs one seed read
+    // and one slot probe per mask.
+    //
+
+    NumBuckets = NumEntries / 4 + 1;
+    NumSlots = 1;
+    while (NumSlots < NumEntries + NumEntries / 4 + 1)
+    {
+        NumSlots *= 2;
+    }
+
+    BucketStart = (PULONG32)calloc(NumBuckets + 1, sizeof(*BucketStart));
+    Order = (TagBucketOrder*)malloc(NumBuckets * sizeof(*Order));
+    Placed = (PULONG32)malloc((NumEntries ? NumEntries : 1) *
+                              sizeof(*Placed));
+    if (BucketStart == NULL || Order == NULL || Placed == NULL)
+    {
+        Status = E_OUTOFMEMORY;
+        goto Exit;
+    }
+
+    // Group the entries by bucket.
+    for (ULONG32 i = 0; i < NumEntries; i++)
+    {
+        ULONG64 Hash = KeyHash(Entries[i]->Key, Entries[i]->Mask);
+
+        BucketStart[(ULONG32)(Hash >> 32) % NumBuckets + 1]++;
+    }
+    for (ULONG32 i = 0; i < NumBuckets; i++)
+    {
+        Order[i].Bucket = i;
+        Order[i].Count = BucketStart[i + 1];
+        BucketStart[i + 1] += BucketStart[i];
+    }
+    {
+        PULONG32 Fill = (PULONG32)malloc(NumBuckets * sizeof(*Fill));
+
+        if (Fill == NULL)
+        {
+            Status = E_OUTOFMEMORY;
+            goto Exit;
+        }
+        memcpy(Fill, BucketStart, NumBuckets * sizeof(*Fill));
+        for (ULONG32 i = 0; i < NumEntries; i++)
+        {
+            ULONG64 Hash = KeyHash(Entries[i]->Key, Entries[i]->Mask);
+
+            Placed[Fill[(ULONG32)(Hash >> 32) % NumBuckets]++] = i;
+        }
+        free(Fill);
+    }
+
+    qsort(Order, NumBuckets, sizeof(*Order), CompareBucketOrder);
+
+    for (;;)
+    {
+        bool Failed = false;
+
+        free(Occupied);
+        free(Seeds);
+        Occupied = (PUCHAR)calloc(NumSlots, sizeof(*Occupied));
+        Seeds = (PULONG32)calloc(NumBuckets, sizeof(*Seeds));
+        if (Occupied == NULL || Seeds == NULL)
+        {
+            Status = E_OUTOFMEMORY;
+            goto Exit;
+        }
+
+        for (ULONG32 i = 0; i < NumBuckets && Order[i].Count; i++)
+        {
+            ULONG32 Bucket = Order[i].Bucket;
+            PULONG32 Members = Placed + BucketStart[Bucket];
+            ULONG32 Count = Order[i].Count;
+            ULONG32 SlotList[64];
+            ULONG32 Seed;
+
+            if (Count > sizeof(SlotList) / sizeof(SlotList[0]))
+            {
+                Failed = true;
+                break;
+            }
+
+            for (Seed = 0; Seed < TAG_MAX_SEED; Seed++)
+            {
+                ULONG32 j;
+
+                for (j = 0; j < Count; j++)
+                {
+                    TagDef* Def = Entries[Members[j]];
+                    ULONG32 Slot =
+                        KeySlot(KeyHash(Def->Key, Def->Mask), Seed, NumSlots);
+                    ULONG32 k;
+
+                    if (Occupied[Slot])
+                    {
+                        break;
+                    }
+                    for (k = 0; k < j; k++)
+                    {
+                        if (SlotList[k] == Slot)
+                        {
+                            break;
+                        }
+                    }
+                    if (k < j)
+                    {
+                        break;
+                    }
+                    SlotList[j] = Slot;
+                }
+
+                if (j == Count)
+                {
+                    break;
+                }
+            }
+
+            if (Seed == TAG_MAX_SEED)
+            {
+                Failed = true;
+                break;
+            }
+
+            Seeds[Bucket] = Seed;
+            for (ULONG32 j = 0; j < Count; j++)
+            {
+                Occupied[SlotList[j]] = 1;
+            }
+        }
+
+        if (!Failed)
+        {
+            break;
+        }
+
+        // Rare; a sparser table always settles.
+        NumSlots *= 2;
+        if (NumSlots == 0)
+        {
+            Status = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+            goto Exit;
+        }
+    }
+
+    //
+    // Lay out the image.
+    //
+
+    TotalBytes = sizeof(TagIndexHeader) +
+        (ULONG64)NumBuckets * sizeof(ULONG32) +
+        (ULONG64)NumSlots * sizeof(TagIndexSlot) +
+        StringBytes;
+    if (TotalBytes > 0xffffffff)
+    {
+        Status = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        goto Exit;
+    }
+
+    Image = (PUCHAR)calloc(1, (size_t)TotalBytes);
+    if (Image == NULL)
+    {
+        Status = E_OUTOFMEMORY;
+        goto Exit;
+    }
+
+    Header = (TagIndexHeader*)Image;
+    Header->Signature = TAG_INDEX_SIGNATURE;
+    Header->Version = TAG_INDEX_VERSION;
+    Header->TotalBytes = (ULONG32)TotalBytes;
+    Header->NumEntries = NumEntries;
+    Header->NumSlots = NumSlots;
+    Header->NumBuckets = NumBuckets;
+    Header->NumMasks = NumMasks;
+    Header->SeedsOffset = sizeof(TagIndexHeader);
+    Header->SlotsOffset = Header->SeedsOffset + NumBuckets * sizeof(ULONG32);
+    Header->StringsOffset = Header->SlotsOffset +
+        NumSlots * sizeof(TagIndexSlot);
+    Header->StringBytes = (ULONG32)StringBytes;
+    memcpy(Header->Masks, Masks, NumMasks * sizeof(Masks[0]));
+
+    memcpy(Image + Header->SeedsOffset, Seeds, NumBuckets * sizeof(*Seeds));
+
+    Slots = (TagIndexSlot*)(Image + Header->SlotsOffset);
+    Strings = (PSTR)(Image + Header->StringsOffset);
+    // Offset zero is the empty string.
+    StringsUsed = 1;
+
+    for (ULONG32 i = 0; i < NumEntries; i++)
+    {
+        TagDef* Def = Entries[i];
+        ULONG64 Hash = KeyHash(Def->Key, Def->Mask);
+        ULONG32 Bucket = (ULONG32)(Hash >> 32) % NumBuckets;
+        TagIndexSlot* Slot = &Slots[KeySlot(Hash, Seeds[Bucket], NumSlots)];
+        size_t Len;
+
+        Slot->Key = Def->Key;
+        Slot->Mask = Def->Mask;
+
+        Len = strlen(Def->Binary);
+        if (Len)
+        {
+            Slot->Binary = StringsUsed;
+            memcpy(Strings + StringsUsed, Def->Binary, Len + 1);
+            StringsUsed += (ULONG32)Len + 1;
+        }
+        Len = strlen(Def->Description);
+        if (Len)
+        {
+            Slot->Description = StringsUsed;
+            memcpy(Strings + StringsUsed, Def->Description, Len + 1);
+            StringsUsed += (ULONG32)Len + 1;
+        }
+    }
+
+    Close();
+    if ((Status = SetImage(Image, TotalBytes)) == S_OK)
+    {
+        m_Built = Image;
+        Image = NULL;
+    }
+
+ Exit:
+    free(Entries);
+    free(BucketStart);
+    free(Order);
+    free(Occupied);
+    free(Seeds);
+    free(Placed);
+    free(Image);
+    return Status;
+}
+
+HRESULT
+PoolTagIndex::Save(_In_ PCSTR FileName)
+{
+    if (m_Header == NULL)
+    {
+        return E_FAIL;
+    }
+
+    return WriteWholeFile(FileName, m_Header, m_Header->TotalBytes);
+}
+
+//----------------------------------------------------------------------------
+//
+// Loading.
+//
+//----------------------------------------------------------------------------
+
+HRESULT
+PoolTagIndex::SetImage(_In_reads_bytes_(Bytes) const UCHAR* Image,
+                       _In_ ULONG64 Bytes)
+{
+    const TagIndexHeader* Header = (const TagIndexHeader*)Image;
+
+    //
+    // Saved images may come from anywhere so everything
+    // a lookup relies on is checked once here.
+    //
+
+    if (Bytes < sizeof(*Header) ||
+        Header->Signature != TAG_INDEX_SIGNATURE ||
+        Header->Version != TAG_INDEX_VERSION ||
+        Header->TotalBytes != Bytes ||
+        !Header->NumSlots ||
+        (Header->NumSlots & (Header->NumSlots - 1)) ||
+        !Header->NumBuckets ||
+        Header->NumMasks > TAG_INDEX_MAX_MASKS ||
+        Header->SeedsOffset < sizeof(*Header) ||
+        (Header->SeedsOffset | Header->SlotsOffset) & 3 ||
+        (ULONG64)Header->SeedsOffset +
+        (ULONG64)Header->NumBuckets * sizeof(ULONG32) > Bytes ||
+        (ULONG64)Header->SlotsOffset +
+        (ULONG64)Header->NumSlots * sizeof(TagIndexSlot) > Bytes ||
+        !Header->StringBytes ||
+        (ULONG64)Header->StringsOffset + Header->StringBytes > Bytes ||
+        Image[Header->StringsOffset + Header->StringBytes - 1] != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+
+    m_Header = Header;
+    m_Seeds = (const ULONG32*)(Image + Header->SeedsOffset);
+    m_Slots = (const TagIndexSlot*)(Image + Header->SlotsOffset);
+    m_Strings = (PCSTR)(Image + Header->StringsOffset);
+    return S_OK;
+}
+
+HRESULT
+PoolTagIndex::Open(_In_ PCSTR FileName)
+{
+    HRESULT Status;
+
+    Close();
+
+    if ((Status = m_Mapped.Open(FileName)) != S_OK)
+    {
+        return Status;
+    }
+
+    if ((Status = SetImage(m_Mapped.GetBase(),
+                           m_Mapped.GetSize())) != S_OK)
+    {
+        m_Mapped.Close();
+    }
+
+    return Status;
+}
+
+void
+PoolTagIndex::FreeImage(void)
+{
+    free(m_Built);
+    m_Built = NULL;
+}
+
+void
+PoolTagIndex::Close(void)
+{
+    m_Header = NULL;
+    m_Seeds = NULL;
+    m_Slots = NULL;
+    m_Strings = NULL;
+    FreeImage();
+    m_Mapped.Close();
+}
+
+PCSTR
+PoolTagIndex::GetString(_In_ ULONG32 Offset)
+{
+    return Offset < m_Header->StringBytes ? m_Strings + Offset : "";
+}
+
+//----------------------------------------------------------------------------
+//
+// Lookups.
+//
+//----------------------------------------------------------------------------
+
+bool
+PoolTagIndex::Lookup(_In_ ULONG PoolTag,
+                     _Out_ PCSTR* Binary,
+                     _Out_ PCSTR* Description)
+{
+    ULONG32 Tag = PoolTag & ~POOL_TAG_PROTECTED;
+
+    *Binary = "";
+    *Description = "";
+
+    if (m_Header == NULL)
+    {
+        return false;
+    }
+
+    for (ULONG32 i = 0; i < m_Header->NumMasks; i++)
+    {
+        ULONG32 Mask = m_Header->Masks[i];
+        ULONG32 Key = Tag & Mask;
+        ULONG64 Hash = KeyHash(Key, Mask);
+        const TagIndexSlot* Slot;
+
+        Slot = &m_Slots[KeySlot(Hash,
+                                m_Seeds[(ULONG32)(Hash >> 32) %
+                                        m_Header->NumBuckets],
+                                m_Header->NumSlots)];
+        if (Slot->Mask == Mask && Slot->Key == Key)
+        {
+            *Binary = GetString(Slot->Binary);
+            *Description = GetString(Slot->Description);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+HRESULT
+PoolTagIndex::GetTagDescription(_In_ ULONG PoolTag,
+                                _Out_ PDEBUG_POOLTAG_DESCRIPTION Description)
+{
+    PCSTR Binary;
+    PCSTR Desc;
+
+    if (Description->SizeOfStruct != sizeof(*Description))
+    {
+        return E_INVALIDARG;
+    }
+
+    Description->PoolTag = PoolTag;
+    Description->Owner[0] = 0;
+
+    if (!Lookup(PoolTag, &Binary, &Desc))
+    {
+        Description->Description[0] = 0;
+        Description->Binary[0] = 0;
+        return E_FAIL;
+    }
+
+    CopyString(Description->Description,
+               sizeof(Description->Description), Desc);
+    CopyString(Description->Binary, sizeof(Description->Binary), Binary);
+    return S_OK;
+}
+
+ULONG32
+PoolTagIndex::FillPoolData(_In_ ULONG32 Count,
+                           _Inout_updates_(Count) PDEBUG_POOL_DATA PoolData)
+{
+    ULONG32 Found = 0;
+    ULONG LastTag = 0;
+    bool LastFound = false;
+    PCSTR LastDesc = NULL;
+
+    for (ULONG32 i = 0; i < Count; i++)
+    {
+        PDEBUG_POOL_DATA Data = &PoolData[i];
+        PCSTR Binary;
+        PCSTR Desc;
+
+        if (LastDesc != NULL && Data->PoolTag == LastTag)
+        {
+            memcpy(Data->PoolTagDescription, LastDesc,
+                   sizeof(Data->PoolTagDescription));
+            Found += LastFound ? 1 : 0;
+            continue;
+        }
+
+        LastFound = Lookup(Data->PoolTag, &Binary, &Desc);
+        if (LastFound)
+        {
+            Found++;
+            if (*Binary)
+            {
+                snprintf(Data->PoolTagDescription,
+                         sizeof(Data->PoolTagDescription),
+                         "%s, Binary : %s", Desc, Binary);
+                // Old snprintf does not terminate on truncation.
+                Data->PoolTagDescription[
+                    sizeof(Data->PoolTagDescription) - 1] = 0;
+            }
+            else
+            {
+                CopyString(Data->PoolTagDescription,
+                           sizeof(Data->PoolTagDescription), Desc);
+            }
+        }
+        else
+        {
+            Data->PoolTagDescription[0] = 0;
+        }
+
+        LastTag = Data->PoolTag;
+        LastDesc = Data->PoolTagDescription;
+    }
+
+    return Found;
+}
@@ -0,0 +1,146 @@
+//----------------------------------------------------------------------------
+//
+// Host definitions for the portable triage index sample.
+//
+// On Windows the definitions come from windows.h, dbgeng.h and
+// extsfns.h.  Elsewhere this header supplies the few Windows types
+// and status codes the sample uses, along with copies of the
+// extsfns.h pool structures with the same names and layout, so
+// that the sources are the same on every host.
+//
+//----------------------------------------------------------------------------
+
+#ifndef __TRGCOMPAT_H__
+#define __TRGCOMPAT_H__
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#define KDEXT_64BIT
+#include <wdbgexts.h>
+#include <dbgeng.h>
+
+#pragma warning(disable:4201) // nonstandard extension used : nameless struct
+#include <extsfns.h>
+
+#if defined(_MSC_VER) && _MSC_VER < 1800
+#define strtoull _strtoui64
+#endif
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define snprintf _snprintf
+#endif
+
+#else // #ifdef _WIN32
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+//
+// SAL annotations have no meaning outside of the Microsoft compiler.
+//
+
+#ifndef _In_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _In_reads_(Size)
+#define _In_reads_bytes_(Size)
+#define _Inout_updates_(Size)
+#define _Out_writes_(Size)
+#define _Out_writes_bytes_(Size)
+#define _Out_writes_z_(Size)
+#endif
+
+#define __cdecl
+
+//
+// Basic Windows types with their Windows sizes.
+//
+
+typedef uint8_t UCHAR, *PUCHAR;
+typedef uint16_t USHORT;
+typedef int32_t LONG;
+typedef uint32_t ULONG, *PULONG;
+typedef uint32_t ULONG32, *PULONG32;
+typedef uint32_t DWORD;
+typedef int64_t LONG64;
+typedef uint64_t ULONG64, *PULONG64;
+typedef void* PVOID;
+typedef char CHAR;
+typedef const char* PCSTR;
+typedef char* PSTR;
+typedef int32_t HRESULT;
+
+#define MAX_PATH 260
+
+typedef struct _GUID {
+    ULONG32 Data1;
+    USHORT  Data2;
+    USHORT  Data3;
+    UCHAR   Data4[8];
+} GUID;
+
+#define S_OK            ((HRESULT)0)
+#define S_FALSE         ((HRESULT)1)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+#define E_NOINTERFACE   ((HRESULT)0x80004002)
+
+#define SUCCEEDED(Status) ((HRESULT)(Status) >= 0)
+#define FAILED(Status) ((HRESULT)(Status) < 0)
+
+#define ERROR_OPEN_FAILED       110L
+#define ERROR_BAD_FORMAT        11L
+#define ERROR_FILE_CORRUPT      1392L
+#define ERROR_WRITE_FAULT       29L
+#define ERROR_ARITHMETIC_OVERFLOW 534L
+
+#define HRESULT_FROM_WIN32(Error) \
+    ((HRESULT)(Error) <= 0 ? (HRESULT)(Error) : \
+     (HRESULT)(((Error) & 0x0000FFFF) | 0x80070000))
+
+//
+// Pool structures, as in extsfns.h.
+//
+
+typedef struct _DEBUG_POOL_DATA {
+    ULONG   SizeofStruct;
+    ULONG64 PoolBlock;
+    ULONG64 Pool;
+    ULONG   PreviousSize;
+    ULONG   Size;
+    ULONG   PoolTag;
+    ULONG64 ProcessBilled;
+    union {
+        struct {
+            ULONG   Free:1;
+            ULONG   LargePool:1;
+            ULONG   SpecialPool:1;
+            ULONG   Pageable:1;
+            ULONG   Protected:1;
+            ULONG   Allocated:1;
+            ULONG   Session:1;
+            ULONG   Reserved:25;
+        };
+        ULONG AsUlong;
+    };
+    ULONG64 Reserved2[4];
+    CHAR    PoolTagDescription[64];
+} DEBUG_POOL_DATA, *PDEBUG_POOL_DATA;
+
+typedef struct _DEBUG_POOLTAG_DESCRIPTION {
+    ULONG  SizeOfStruct; // must be == sizeof(DEBUG_POOLTAG_DESCRIPTION)
+    ULONG  PoolTag;
+    CHAR   Description[MAX_PATH];
+    CHAR   Binary[32];
+    CHAR   Owner[32];
+} DEBUG_POOLTAG_DESCRIPTION, *PDEBUG_POOLTAG_DESCRIPTION;
+
+#endif // #ifdef _WIN32
+
+#endif // #ifndef __TRGCOMPAT_H__
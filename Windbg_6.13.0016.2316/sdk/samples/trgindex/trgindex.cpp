@@ -0,0 +1,806 @@
+//----------------------------------------------------------------------------
+//
+// Command-line driver for the precompiled triage indexes.
+//
+// Builds a pool tag index from pooltag.txt and any local tag
+// files and a GUID name index from guids.ini and guid.txt, saves
+// them or opens saved ones, and looks up tags and GUIDs.  Can
+// also benchmark batch lookups in each index against scanning
+// the text file for each lookup.
+//
+//----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "tagindex.hpp"
+#include "guidindex.hpp"
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#define MAX_INDEX_FILES 16
+
+PCSTR g_TagFiles[MAX_INDEX_FILES];
+ULONG32 g_NumTagFiles;
+PCSTR g_IndexFile;
+PCSTR g_SaveFile;
+PCSTR g_GuidFiles[MAX_INDEX_FILES];
+ULONG32 g_NumGuidFiles;
+PCSTR g_GuidIndexFile;
+PCSTR g_GuidSaveFile;
+ULONG32 g_BenchRecords;
+PSTR* g_Tags;
+int g_NumTags;
+
+PoolTagIndex g_TagIndex;
+GuidIndex g_GuidIndex;
+
+void
+Exit(int Code, _In_ PCSTR Format, ...)
+{
+    // Output an error message if given.
+    if (Format != NULL)
+    {
+        va_list Args;
+
+        va_start(Args, Format);
+        vfprintf(stderr, Format, Args);
+        va_end(Args);
+    }
+
+    exit(Code);
+}
+
+double
+GetSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER Freq, Now;
+
+    QueryPerformanceFrequency(&Freq);
+    QueryPerformanceCounter(&Now);
+    return (double)Now.QuadPart / (double)Freq.QuadPart;
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (double)Now.tv_sec + (double)Now.tv_nsec / 1e9;
+#endif
+}
+
+// Small deterministic generator so that benchmark
+// runs are repeatable.
+ULONG64
+NextRandom(_Inout_ PULONG64 State)
+{
+    *State = *State * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *State >> 17;
+}
+
+void
+ParseCommandLine(int Argc, _In_reads_(Argc) PSTR* Argv)
+{
+    while (--Argc > 0)
+    {
+        Argv++;
+        if (!strcmp(Argv[0], "-p"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-p missing argument\n");
+            }
+            if (g_NumTagFiles == MAX_INDEX_FILES)
+            {
+                Exit(1, "Too many tag files\n");
+            }
+            g_TagFiles[g_NumTagFiles++] = Argv[0];
+        }
+        else if (!strcmp(Argv[0], "-g"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-g missing argument\n");
+            }
+            if (g_NumGuidFiles == MAX_INDEX_FILES)
+            {
+                Exit(1, "Too many GUID files\n");
+            }
+            g_GuidFiles[g_NumGuidFiles++] = Argv[0];
+        }
+        else if (!strcmp(Argv[0], "-gi"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-gi missing argument\n");
+            }
+            g_GuidIndexFile = Argv[0];
+        }
+        else if (!strcmp(Argv[0], "-gb"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-gb missing argument\n");
+            }
+            g_GuidSaveFile = Argv[0];
+        }
+        else if (!strcmp(Argv[0], "-i"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-i missing argument\n");
+            }
+            g_IndexFile = Argv[0];
+        }
+        else if (!strcmp(Argv[0], "-b"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-b missing argument\n");
+            }
+            g_SaveFile = Argv[0];
+        }
+        else if (!strcmp(Argv[0], "-bench"))
+        {
+            Argv++;
+            Argc--;
+            if (Argc < 1)
+            {
+                Exit(1, "-bench missing argument\n");
+            }
+            g_BenchRecords = strtoul(Argv[0], NULL, 0);
+        }
+        else if (Argv[0][0] == '-')
+        {
+            Exit(1, "Usage: trgindex [-p pooltag.txt]... [-b out.idx] "
+                 "[-i index.idx]\n"
+                 "                [-g guids.ini]... [-gb out.idx] "
+                 "[-gi index.idx]\n"
+                 "                [-bench records] [tags and GUIDs...]\n");
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (g_NumTagFiles && g_IndexFile != NULL)
+    {
+        Exit(1, "Give either -p tag files or -i index\n");
+    }
+    if (g_NumGuidFiles && g_GuidIndexFile != NULL)
+    {
+        Exit(1, "Give either -g GUID files or -gi index\n");
+    }
+    if (!g_NumTagFiles && g_IndexFile == NULL &&
+        !g_NumGuidFiles && g_GuidIndexFile == NULL)
+    {
+        Exit(1, "No tag or GUID index given\n");
+    }
+
+    g_Tags = Argv;
+    g_NumTags = Argc;
+}
+
+ULONG
+MakeTag(_In_ PCSTR Text)
+{
+    ULONG Tag = 0;
+
+    for (ULONG32 i = 0; i < 4; i++)
+    {
+        CHAR Ch = *Text ? *Text++ : ' ';
+
+        Tag |= (ULONG)(UCHAR)Ch << (i * 8);
+    }
+
+    return Tag;
+}
+
+void
+FormatTag(_In_ ULONG Tag,
+          _Out_writes_z_(5) PSTR Text)
+{
+    for (ULONG32 i = 0; i < 4; i++)
+    {
+        UCHAR Ch = (UCHAR)(Tag >> (i * 8)) & 0x7f;
+
+        Text[i] = Ch >= ' ' ? (CHAR)Ch : '.';
+    }
+    Text[4] = 0;
+}
+
+HRESULT
+LoadIndex(void)
+{
+    HRESULT Status;
+
+    if (g_IndexFile != NULL)
+    {
+        return g_TagIndex.Open(g_IndexFile);
+    }
+    if (!g_NumTagFiles)
+    {
+        return S_OK;
+    }
+
+    for (ULONG32 i = 0; i < g_NumTagFiles; i++)
+    {
+        if ((Status = g_TagIndex.AddTagFile(g_TagFiles[i])) != S_OK)
+        {
+            fprintf(stderr, "Unable to read %s, %08X\n",
+                    g_TagFiles[i], Status);
+            return Status;
+        }
+    }
+
+    return g_TagIndex.Build();
+}
+
+HRESULT
+LoadGuidIndex(void)
+{
+    HRESULT Status;
+
+    if (g_GuidIndexFile != NULL)
+    {
+        return g_GuidIndex.Open(g_GuidIndexFile);
+    }
+    if (!g_NumGuidFiles)
+    {
+        return S_OK;
+    }
+
+    for (ULONG32 i = 0; i < g_NumGuidFiles; i++)
+    {
+        if ((Status = g_GuidIndex.AddGuidFile(g_GuidFiles[i])) != S_OK)
+        {
+            fprintf(stderr, "Unable to read %s, %08X\n",
+                    g_GuidFiles[i], Status);
+            return Status;
+        }
+    }
+
+    return g_GuidIndex.Build();
+}
+
+void
+LookupTags(void)
+{
+    for (int i = 0; i < g_NumTags; i++)
+    {
+        DEBUG_POOLTAG_DESCRIPTION Desc;
+        ULONG Tag;
+        CHAR Name[5];
+        GUID Guid;
+
+        // Arguments that parse as GUIDs go to the GUID index.
+        if (ParseGuid(g_Tags[i], &Guid))
+        {
+            PCSTR GuidName = g_GuidIndex.Lookup(&Guid, NULL);
+
+            printf("%s  %s\n", g_Tags[i],
+                   GuidName != NULL ? GuidName : "<unknown>");
+            continue;
+        }
+
+        Tag = MakeTag(g_Tags[i]);
+        FormatTag(Tag, Name);
+
+        Desc.SizeOfStruct = sizeof(Desc);
+        if (g_TagIndex.GetTagDescription(Tag, &Desc) != S_OK)
+        {
+            printf("%s  <unknown>\n", Name);
+        }
+        else
+        {
+            printf("%s  %-16s %s\n", Name, Desc.Binary, Desc.Description);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Benchmark.
+//
+//----------------------------------------------------------------------------
+
+// Reads a whole text file into a terminated buffer.
+PSTR
+ReadTextFile(_In_ PCSTR FileName)
+{
+    FILE* File;
+    PSTR Text;
+    long Bytes;
+
+    File = fopen(FileName, "rb");
+    if (File == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(File, 0, SEEK_END);
+    Bytes = ftell(File);
+    fseek(File, 0, SEEK_SET);
+
+    Text = (PSTR)malloc(Bytes > 0 ? Bytes + 1 : 1);
+    if (Text != NULL)
+    {
+        Bytes = (long)fread(Text, 1, Bytes > 0 ? Bytes : 0, File);
+        Text[Bytes] = 0;
+    }
+
+    fclose(File);
+    return Text;
+}
+
+//
+// The reference lookup walks the text for every tag, the
+// way a tag is resolved without an index.  The text is
+// already in memory so the comparison is generous to it.
+//
+
+bool
+TextScanLookup(_In_ PCSTR Text,
+               _In_ ULONG PoolTag)
+{
+    ULONG Tag = PoolTag & ~POOL_TAG_PROTECTED;
+
+    while (*Text)
+    {
+        PCSTR Line = Text;
+        ULONG32 i;
+
+        while (*Text && *Text != '\n')
+        {
+            Text++;
+        }
+        if (*Text)
+        {
+            Text++;
+        }
+
+        while (*Line == ' ' || *Line == '\t')
+        {
+            Line++;
+        }
+
+        for (i = 0; i < 4; i++)
+        {
+            CHAR Ch = Line[i];
+            CHAR TagCh = (CHAR)(Tag >> (i * 8));
+
+            if (Ch == '*')
+            {
+                i = 4;
+                break;
+            }
+            if (Ch == ' ' || Ch == '\t' || Ch == '\r' || Ch == '\n')
+            {
+                // Short tags are space-padded.
+                if (TagCh != ' ')
+                {
+                    break;
+                }
+                continue;
+            }
+            if (Ch != '?' && Ch != TagCh)
+            {
+                break;
+            }
+        }
+
+        if (i == 4 && strstr(Line, " - ") != NULL &&
+            strstr(Line, " - ") < Text)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+BenchmarkTags(void)
+{
+    PSTR Text;
+    ULONG* KnownTags;
+    ULONG32 NumKnown = 0;
+    DEBUG_POOL_DATA* Records;
+    ULONG64 Random = 1;
+    ULONG32 Found;
+    ULONG32 Sample;
+    double Start;
+    double IndexTime;
+    double ScanTime;
+
+    Text = ReadTextFile(g_TagFiles[0]);
+    KnownTags = (ULONG*)malloc(strlen(Text != NULL ? Text : "") *
+                               sizeof(*KnownTags) / 8 + 1);
+    Records = (DEBUG_POOL_DATA*)calloc(g_BenchRecords, sizeof(*Records));
+    if (Text == NULL || KnownTags == NULL || Records == NULL)
+    {
+        Exit(1, "Unable to set up benchmark\n");
+    }
+
+    //
+    // Use the exact tags from the text file and
+    // add some unknown ones, then order the records
+    // in runs as a pool summary would have them.
+    //
+
+    for (PCSTR Line = Text; *Line; )
+    {
+        CHAR Tag[5];
+        ULONG32 Chars = 0;
+
+        while (*Line == ' ' || *Line == '\t')
+        {
+            Line++;
+        }
+        while (Chars < 5 && Line[Chars] && Line[Chars] != ' ' &&
+               Line[Chars] != '\t' && Line[Chars] != '\r' &&
+               Line[Chars] != '\n')
+        {
+            Tag[Chars] = Line[Chars];
+            Chars++;
+        }
+        if (Chars > 0 && Chars <= 4 &&
+            !strncmp(Line + Chars, " - ", 3))
+        {
+            Tag[Chars] = 0;
+            if (strchr(Tag, '?') == NULL && strchr(Tag, '*') == NULL)
+            {
+                KnownTags[NumKnown++] = MakeTag(Tag);
+            }
+        }
+
+        while (*Line && *Line++ != '\n')
+        {
+            // Skip to the next line.
+        }
+    }
+
+    if (!NumKnown)
+    {
+        Exit(1, "No tags in %s\n", g_TagFiles[0]);
+    }
+
+    for (ULONG32 i = 0; i < g_BenchRecords; )
+    {
+        ULONG32 Run = (ULONG32)(NextRandom(&Random) % 8) + 1;
+        ULONG Tag;
+
+        if (NextRandom(&Random) % 10 == 0)
+        {
+            Tag = 0x5a5a0000 | (ULONG)(NextRandom(&Random) & 0xffff);
+        }
+        else
+        {
+            Tag = KnownTags[NextRandom(&Random) % NumKnown];
+        }
+
+        for (; Run > 0 && i < g_BenchRecords; Run--, i++)
+        {
+            Records[i].SizeofStruct = sizeof(Records[i]);
+            Records[i].PoolTag = Tag;
+        }
+    }
+
+    printf("%u tags in index, %u bytes\n",
+           g_TagIndex.GetNumTags(), g_TagIndex.GetImageBytes());
+
+    //
+    // Compare building from text with opening a saved index.
+    //
+
+    if (g_SaveFile != NULL)
+    {
+        PoolTagIndex Built;
+        PoolTagIndex Opened;
+        double BuildTime;
+        double OpenTime;
+
+        Start = GetSeconds();
+        for (ULONG32 i = 0; i < g_NumTagFiles; i++)
+        {
+            Built.AddTagFile(g_TagFiles[i]);
+        }
+        Built.Build();
+        BuildTime = GetSeconds() - Start;
+
+        Start = GetSeconds();
+        if (Opened.Open(g_SaveFile) != S_OK)
+        {
+            Exit(1, "Unable to open %s\n", g_SaveFile);
+        }
+        OpenTime = GetSeconds() - Start;
+
+        printf("Load: build from text %.3f ms, open saved index %.3f ms\n",
+               BuildTime * 1000, OpenTime * 1000);
+    }
+
+    Start = GetSeconds();
+    Found = g_TagIndex.FillPoolData(g_BenchRecords, Records);
+    IndexTime = GetSeconds() - Start;
+
+    printf("Index: %u records, %u found, %.3f s, %.0f records/s\n",
+           g_BenchRecords, Found, IndexTime,
+           IndexTime > 0 ? g_BenchRecords / IndexTime : 0);
+
+    // Scanning is slow enough that a sample will do.
+    Sample = g_BenchRecords < 20000 ? g_BenchRecords : 20000;
+    Found = 0;
+
+    Start = GetSeconds();
+    for (ULONG32 i = 0; i < Sample; i++)
+    {
+        Found += TextScanLookup(Text, Records[i].PoolTag) ? 1 : 0;
+    }
+    ScanTime = GetSeconds() - Start;
+
+    printf("Text scan: %u records, %u found, %.3f s, %.0f records/s\n",
+           Sample, Found, ScanTime,
+           ScanTime > 0 ? Sample / ScanTime : 0);
+
+    free(Text);
+    free(KnownTags);
+    free(Records);
+}
+
+// Finds the GUID that a guids.ini or guid.txt line names.
+bool
+ParseGuidLine(_In_ PCSTR Line,
+              _Out_ GUID* Guid)
+{
+    ULONG32 Chars;
+
+    while (*Line == ' ' || *Line == '\t')
+    {
+        Line++;
+    }
+
+    if (!strncmp(Line, "interface_map!", 14))
+    {
+        Chars = ParseGuid(Line + 14, Guid);
+        return Chars && Line[14 + Chars] == '=';
+    }
+    if (!strncmp(Line, "interface_type!", 15))
+    {
+        while (*Line && *Line != '=' && *Line != '\n')
+        {
+            Line++;
+        }
+        return *Line == '=' && ParseGuid(Line + 1, Guid);
+    }
+
+    Chars = ParseGuid(Line, Guid);
+    return Chars && (Line[Chars] == ' ' || Line[Chars] == '\t');
+}
+
+bool
+TextScanGuid(_In_ PCSTR Text,
+             _In_ const GUID* Guid)
+{
+    while (*Text)
+    {
+        GUID LineGuid;
+
+        if (ParseGuidLine(Text, &LineGuid) &&
+            !memcmp(&LineGuid, Guid, sizeof(LineGuid)))
+        {
+            return true;
+        }
+
+        while (*Text && *Text++ != '\n')
+        {
+            // Skip to the next line.
+        }
+    }
+
+    return false;
+}
+
+void
+BenchmarkGuids(void)
+{
+    PSTR Text;
+    GUID* KnownGuids;
+    ULONG32 NumKnown = 0;
+    GUID* Guids;
+    PCSTR* Names;
+    ULONG64 Random = 1;
+    ULONG32 Found;
+    ULONG32 Sample;
+    double Start;
+    double IndexTime;
+    double ScanTime;
+
+    Text = ReadTextFile(g_GuidFiles[0]);
+    KnownGuids = (GUID*)malloc(strlen(Text != NULL ? Text : "") *
+                               sizeof(*KnownGuids) / 36 + 1);
+    Guids = (GUID*)malloc(g_BenchRecords * sizeof(*Guids));
+    Names = (PCSTR*)malloc(g_BenchRecords * sizeof(*Names));
+    if (Text == NULL || KnownGuids == NULL ||
+        Guids == NULL || Names == NULL)
+    {
+        Exit(1, "Unable to set up benchmark\n");
+    }
+
+    for (PCSTR Line = Text; *Line; )
+    {
+        if (ParseGuidLine(Line, &KnownGuids[NumKnown]))
+        {
+            NumKnown++;
+        }
+
+        while (*Line && *Line++ != '\n')
+        {
+            // Skip to the next line.
+        }
+    }
+
+    if (!NumKnown)
+    {
+        Exit(1, "No GUIDs in %s\n", g_GuidFiles[0]);
+    }
+
+    // About one in ten GUIDs is unknown.
+    for (ULONG32 i = 0; i < g_BenchRecords; i++)
+    {
+        if (NextRandom(&Random) % 10 == 0)
+        {
+            ULONG64 Bits = NextRandom(&Random);
+
+            memcpy(&Guids[i], &Bits, sizeof(Bits));
+            Bits = NextRandom(&Random);
+            memcpy((PUCHAR)&Guids[i] + sizeof(Bits), &Bits, sizeof(Bits));
+        }
+        else
+        {
+            Guids[i] = KnownGuids[NextRandom(&Random) % NumKnown];
+        }
+    }
+
+    printf("%u GUIDs in index, %u bytes\n",
+           g_GuidIndex.GetNumGuids(), g_GuidIndex.GetImageBytes());
+
+    if (g_GuidSaveFile != NULL)
+    {
+        GuidIndex Built;
+        GuidIndex Opened;
+        double BuildTime;
+        double OpenTime;
+
+        Start = GetSeconds();
+        for (ULONG32 i = 0; i < g_NumGuidFiles; i++)
+        {
+            Built.AddGuidFile(g_GuidFiles[i]);
+        }
+        Built.Build();
+        BuildTime = GetSeconds() - Start;
+
+        Start = GetSeconds();
+        if (Opened.Open(g_GuidSaveFile) != S_OK)
+        {
+            Exit(1, "Unable to open %s\n", g_GuidSaveFile);
+        }
+        OpenTime = GetSeconds() - Start;
+
+        printf("Load: build from text %.3f ms, open saved index %.3f ms\n",
+               BuildTime * 1000, OpenTime * 1000);
+    }
+
+    Start = GetSeconds();
+    Found = g_GuidIndex.LookupGuids(g_BenchRecords, Guids, Names);
+    IndexTime = GetSeconds() - Start;
+
+    printf("Bulk lookup: %u GUIDs, %u found, %.3f s, %.0f lookups/s\n",
+           g_BenchRecords, Found, IndexTime,
+           IndexTime > 0 ? g_BenchRecords / IndexTime : 0);
+
+    Found = 0;
+    Start = GetSeconds();
+    for (ULONG32 i = 0; i < g_BenchRecords; i++)
+    {
+        Found += g_GuidIndex.Lookup(&Guids[i], NULL) != NULL ? 1 : 0;
+    }
+    IndexTime = GetSeconds() - Start;
+
+    printf("Single lookup: %u GUIDs, %u found, %.3f s, %.0f lookups/s\n",
+           g_BenchRecords, Found, IndexTime,
+           IndexTime > 0 ? g_BenchRecords / IndexTime : 0);
+
+    // Scanning is slow enough that a sample will do.
+    Sample = g_BenchRecords < 20000 ? g_BenchRecords : 20000;
+    Found = 0;
+
+    Start = GetSeconds();
+    for (ULONG32 i = 0; i < Sample; i++)
+    {
+        Found += TextScanGuid(Text, &Guids[i]) ? 1 : 0;
+    }
+    ScanTime = GetSeconds() - Start;
+
+    printf("Text scan: %u GUIDs, %u found, %.3f s, %.0f lookups/s\n",
+           Sample, Found, ScanTime,
+           ScanTime > 0 ? Sample / ScanTime : 0);
+
+    free(Text);
+    free(KnownGuids);
+    free(Guids);
+    free(Names);
+}
+
+int __cdecl
+main(int Argc, _In_reads_(Argc) PSTR* Argv)
+{
+    HRESULT Status;
+
+    ParseCommandLine(Argc, Argv);
+
+    if ((Status = LoadIndex()) != S_OK)
+    {
+        Exit(1, "Unable to load tag index, %08X\n", Status);
+    }
+    if ((Status = LoadGuidIndex()) != S_OK)
+    {
+        Exit(1, "Unable to load GUID index, %08X\n", Status);
+    }
+
+    if (g_SaveFile != NULL)
+    {
+        if ((Status = g_TagIndex.Save(g_SaveFile)) != S_OK)
+        {
+            Exit(1, "Unable to save %s, %08X\n", g_SaveFile, Status);
+        }
+        printf("Saved %u tags to %s, %u bytes\n",
+               g_TagIndex.GetNumTags(), g_SaveFile,
+               g_TagIndex.GetImageBytes());
+    }
+    if (g_GuidSaveFile != NULL)
+    {
+        if ((Status = g_GuidIndex.Save(g_GuidSaveFile)) != S_OK)
+        {
+            Exit(1, "Unable to save %s, %08X\n", g_GuidSaveFile, Status);
+        }
+        printf("Saved %u GUIDs to %s, %u bytes\n",
+               g_GuidIndex.GetNumGuids(), g_GuidSaveFile,
+               g_GuidIndex.GetImageBytes());
+    }
+
+    LookupTags();
+
+    if (g_BenchRecords)
+    {
+        if (!g_NumTagFiles && !g_NumGuidFiles)
+        {
+            Exit(1, "-bench needs -p or -g text files\n");
+        }
+        if (g_NumTagFiles)
+        {
+            BenchmarkTags();
+        }
+        if (g_NumGuidFiles)
+        {
+            BenchmarkGuids();
+        }
+    }
+
+    return 0;
+}